@@ -0,0 +1,158 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <future>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include "client/async_client.cpp"
+
+// drives a server through AsyncClient from several application threads, each keeping up to a window of
+// requests outstanding, once through futures, once through callbacks, and once reading a small hot set of keys
+// through a near-cache while one request in a hundred writes one of them:
+// async_client_bench [host] [port] [requests] [connections] [threads] [window]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double futures(AsyncClient &client, size_t requests, size_t threads, size_t window) {
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::vector<std::future<std::optional<std::string>>> gets;
+            std::vector<std::future<void>> sets;
+            for (size_t i = t; i < requests; i += 2 * window * threads) {
+                for (size_t j = 0; j < window; ++j) {
+                    auto key = "key:" + std::to_string((i + j * threads) % 10000);
+                    sets.push_back(client.set(key, "value"));
+                    gets.push_back(client.get(key));
+                }
+                for (auto &set: sets) {
+                    set.get();
+                }
+                for (auto &get: gets) {
+                    get.get();
+                }
+                sets.clear();
+                gets.clear();
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return elapsed.count();
+}
+
+double callbacks(AsyncClient &client, size_t requests, size_t threads, size_t window) {
+    std::mutex mutex;
+    std::condition_variable room;
+    size_t outstanding = 0, errors = 0;
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = t; i < requests; i += threads) {
+                {
+                    std::unique_lock lock(mutex);
+                    room.wait(lock, [&] { return outstanding < window * threads; });
+                    ++outstanding;
+                }
+                client.command({"INCR", "counter:" + std::to_string(i % 100)}, Reply::Shape::Line, [&](Reply reply) {
+                    std::lock_guard lock(mutex);
+                    errors += reply.error_.has_value();
+                    --outstanding;
+                    room.notify_all();
+                });
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    std::unique_lock lock(mutex);
+    room.wait(lock, [&] { return outstanding == 0; });
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    if (errors) {
+        std::cerr << errors << " INCR replies were errors\n";
+    }
+    return elapsed.count();
+}
+
+double near_cache(AsyncClient &client, size_t requests, size_t threads, size_t window) {
+    constexpr size_t kHotKeys = 1000;
+    for (size_t i = 0; i < kHotKeys; ++i) {
+        client.set("hot:" + std::to_string(i), "value").get();
+    }
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::vector<std::future<std::optional<std::string>>> gets;
+            std::vector<std::future<void>> sets;
+            for (size_t i = t; i < requests; i += window * threads) {
+                for (size_t j = 0; j < window; ++j) {
+                    auto n = i + j * threads;
+                    auto key = "hot:" + std::to_string(n * 7919 % kHotKeys);
+                    if (n % 100 == 0) {
+                        sets.push_back(client.set(key, std::to_string(n)));
+                    } else {
+                        gets.push_back(client.get(key));
+                    }
+                }
+                for (auto &set: sets) {
+                    set.get();
+                }
+                for (auto &get: gets) {
+                    get.get();
+                }
+                sets.clear();
+                gets.clear();
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return elapsed.count();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    std::string port = argc > 2 ? argv[2] : "6379";
+    size_t requests = argc > 3 ? std::stoul(argv[3]) : 1000000;
+    size_t connections = argc > 4 ? std::stoul(argv[4]) : 4;
+    size_t threads = argc > 5 ? std::stoul(argv[5]) : 4;
+    size_t window = argc > 6 ? std::stoul(argv[6]) : 64;
+
+    try {
+        AsyncClient client(host, port, connections);
+        double seconds = futures(client, requests, threads, window);
+        std::cout << "futures:   " << requests << " SET/GET in " << seconds << "s, "
+                  << static_cast<size_t>(requests / seconds) << " ops/s\n";
+        seconds = callbacks(client, requests, threads, window);
+        std::cout << "callbacks: " << requests << " INCR in " << seconds << "s, "
+                  << static_cast<size_t>(requests / seconds) << " ops/s\n";
+
+        AsyncClient::CacheOptions cache;
+        cache.entries_ = 100000;
+        AsyncClient cached(host, port, connections, 1, cache);
+        seconds = near_cache(cached, requests, threads, window);
+        auto [hits, misses] = cached.cache_hits_and_misses();
+        std::cout << "near-cache: " << requests << " GET/SET in " << seconds << "s, "
+                  << static_cast<size_t>(requests / seconds) << " ops/s, "
+                  << (hits + misses ? 100.0 * hits / (hits + misses) : 0.0) << "% of GETs hit\n";
+    } catch (std::exception &e) {
+        std::cerr << "exception: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,520 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "structures/skip_list.cpp"
+#include "structures/data_store.cpp"
+
+// google benchmark microbenchmarks for SkipList and every DataStore type. the size argument is the number of
+// elements in the structure: keys for strings, members of the one key for the other types. run with
+// --benchmark_format=json, or --benchmark_out=file --benchmark_out_format=json, to keep results that
+// google benchmark's tools/compare.py can diff between builds
+
+namespace {
+
+constexpr int64_t kMinSize = 100;
+constexpr int64_t kMaxSize = 10000000;
+// inserts and removes are timed in batches, and undone with the timer paused after each batch
+constexpr int kBatch = 64;
+// the most distinct elements one benchmark touches, so that picking them costs nothing while timed
+constexpr int64_t kMaxProbes = 65536;
+constexpr size_t kFillBatch = 1000;
+
+void sizes(benchmark::internal::Benchmark *b) {
+    b->RangeMultiplier(10)->Range(kMinSize, kMaxSize);
+}
+
+void contended(benchmark::internal::Benchmark *b) {
+    b->ThreadRange(1, 8)->UseRealTime();
+}
+
+// zero-padded so that member order and score order agree, as SkipList::range requires
+std::string member(int64_t i) {
+    char buf[24];
+    std::snprintf(buf, sizeof(buf), "m%010lld", static_cast<long long>(i));
+    return buf;
+}
+
+std::string key(int64_t i) {
+    return "key:" + member(i);
+}
+
+const std::string kValue(16, 'v');
+
+// indices below n in random order: all of them, without repeats, when there are at most kMaxProbes,
+// otherwise kMaxProbes uniform draws
+std::vector<int64_t> probes(int64_t n, uint64_t seed = 42) {
+    std::mt19937_64 rng(seed);
+    std::vector<int64_t> picks;
+    if (n <= kMaxProbes) {
+        picks.resize(n);
+        std::iota(picks.begin(), picks.end(), 0);
+        std::shuffle(picks.begin(), picks.end(), rng);
+    } else {
+        std::uniform_int_distribution<int64_t> dist(0, n - 1);
+        for (int64_t i = 0; i < kMaxProbes; ++i) {
+            picks.push_back(dist(rng));
+        }
+    }
+    return picks;
+}
+
+template <typename F>
+auto map_probes(const std::vector<int64_t> &picks, F &&fn) {
+    std::vector<decltype(fn(int64_t()))> out;
+    out.reserve(picks.size());
+    for (auto i: picks) {
+        out.push_back(fn(i));
+    }
+    return out;
+}
+
+// the structure a benchmark runs against, built on first use. filling one with 10M elements takes seconds,
+// so every size built for a kind is kept until a benchmark asks for another kind. benchmarks that change it
+// put it back as they found it. main empties it before the allocator and Epoch singletons go away
+struct Prepared {
+    std::string kind_;
+    std::map<int64_t, std::shared_ptr<void>> built_;
+};
+
+Prepared cache;
+
+template <typename T, typename F>
+T &prepared(const std::string &kind, int64_t n, F &&fill) {
+    if (cache.kind_ != kind) {
+        cache.built_.clear();
+        cache.kind_ = kind;
+    }
+    auto &slot = cache.built_[n];
+    if (!slot) {
+        auto value = std::make_shared<T>();
+        fill(*value, n);
+        slot = value;
+    }
+    return *static_cast<T *>(slot.get());
+}
+
+// member(2i) at score 2i for every i < n, leaving the odd ones free to insert
+SkipList &skip_list(int64_t n) {
+    return prepared<SkipList>("skiplist", n, [](SkipList &list, int64_t n) {
+        for (int64_t i = 0; i < n; ++i) {
+            list.insert(member(2 * i), 2.0 * i);
+        }
+    });
+}
+
+// fills a store through one of its batch commands, kFillBatch elements a call
+template <typename E, typename F>
+DataStore &store(const std::string &kind, int64_t n, E &&element, F &&add) {
+    return prepared<DataStore>(kind, n, [&](DataStore &store, int64_t n) {
+        std::vector<decltype(element(int64_t()))> batch;
+        for (int64_t i = 0; i < n; ++i) {
+            batch.push_back(element(i));
+            if (batch.size() == kFillBatch || i + 1 == n) {
+                add(store, batch);
+                batch.clear();
+            }
+        }
+    });
+}
+
+DataStore &string_store(int64_t n) {
+    return store("strings", n, [](int64_t i) { return std::make_pair(key(i), kValue); },
+                 [](DataStore &store, const auto &batch) { store.mset(batch); });
+}
+
+DataStore &zset_store(int64_t n) {
+    return store("zset", n, [](int64_t i) { return std::make_pair(2.0 * i, member(2 * i)); },
+                 [](DataStore &store, const auto &batch) { store.zadd("zset", batch); });
+}
+
+DataStore &list_store(int64_t n) {
+    return store("list", n, [](int64_t i) { return member(i); },
+                 [](DataStore &store, const auto &batch) { store.rpush("list", batch); });
+}
+
+// "set" holds n members, and "small" every n/100th of them for SINTER
+DataStore &set_store(int64_t n) {
+    return prepared<DataStore>("set", n, [](DataStore &store, int64_t n) {
+        std::vector<std::string> batch;
+        for (int64_t i = 0; i < n; ++i) {
+            batch.push_back(member(i));
+            if (batch.size() == kFillBatch || i + 1 == n) {
+                store.sadd("set", batch);
+                batch.clear();
+            }
+            if (i % (n / 100) == 0) {
+                store.sadd("small", member(i));
+            }
+        }
+    });
+}
+
+DataStore &hash_store(int64_t n) {
+    return store("hash", n, [](int64_t i) { return std::make_pair(member(i), kValue); },
+                 [](DataStore &store, const auto &batch) { store.hset("hash", batch); });
+}
+
+// SkipList
+
+void BM_SkipListInsert(benchmark::State &state) {
+    auto &list = skip_list(state.range(0));
+    auto odd = map_probes(probes(state.range(0)),
+                          [](int64_t i) { return std::make_pair(member(2 * i + 1), 2.0 * i + 1); });
+    size_t next = 0;
+    for (auto _: state) {
+        size_t start = next;
+        for (int k = 0; k < kBatch; ++k, next = (next + 1) % odd.size()) {
+            benchmark::DoNotOptimize(list.insert(odd[next].first, odd[next].second));
+        }
+        state.PauseTiming();
+        for (int k = 0; k < kBatch; ++k) {
+            list.remove(odd[(start + k) % odd.size()].first);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+BENCHMARK(BM_SkipListInsert)->Apply(sizes);
+
+void BM_SkipListRemove(benchmark::State &state) {
+    auto &list = skip_list(state.range(0));
+    auto even = map_probes(probes(state.range(0)), [](int64_t i) { return std::make_pair(member(2 * i), 2.0 * i); });
+    size_t next = 0;
+    for (auto _: state) {
+        size_t start = next;
+        for (int k = 0; k < kBatch; ++k, next = (next + 1) % even.size()) {
+            benchmark::DoNotOptimize(list.remove(even[next].first));
+        }
+        state.PauseTiming();
+        for (int k = 0; k < kBatch; ++k) {
+            auto &[name, score] = even[(start + k) % even.size()];
+            list.insert(name, score);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+BENCHMARK(BM_SkipListRemove)->Apply(sizes);
+
+void BM_SkipListScore(benchmark::State &state) {
+    auto &list = skip_list(state.range(0));
+    auto names = map_probes(probes(state.range(0)), [](int64_t i) { return member(2 * i); });
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(list.score(names[next]));
+        next = (next + 1) % names.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SkipListScore)->Apply(sizes);
+
+// ten members from a random score on
+void BM_SkipListRange(benchmark::State &state) {
+    auto &list = skip_list(state.range(0));
+    auto picks = probes(state.range(0));
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(list.range(2.0 * picks[next], kMaxSize * 2.0, 0, 10));
+        next = (next + 1) % picks.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SkipListRange)->Apply(sizes);
+
+void BM_SkipListQuery(benchmark::State &state) {
+    auto &list = skip_list(state.range(0));
+    auto bounds = map_probes(probes(state.range(0)), [](int64_t i) { return std::make_pair(2.0 * i, member(2 * i)); });
+    const std::string last = member(2 * kMaxSize);
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(list.query(bounds[next].first, bounds[next].second, kMaxSize * 2.0, last, 0, 10));
+        next = (next + 1) % bounds.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SkipListQuery)->Apply(sizes);
+
+// ten members from a random score on, retired to Epoch as ZREMRANGEBYSCORE does below the lazy-free threshold
+void BM_SkipListRangeDelete(benchmark::State &state) {
+    int64_t n = state.range(0);
+    auto &list = skip_list(n);
+    auto picks = probes(n - 10);
+    size_t next = 0;
+    for (auto _: state) {
+        int64_t from = picks[next];
+        list.range_delete(2.0 * from, kMaxSize * 2.0, 0, 10).retire();
+        state.PauseTiming();
+        for (int64_t i = from; i < from + 10; ++i) {
+            list.insert(member(2 * i), 2.0 * i);
+        }
+        next = (next + 1) % picks.size();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * 10);
+}
+BENCHMARK(BM_SkipListRangeDelete)->Apply(sizes);
+
+// DataStore. adds are timed together with the remove that undoes them, so each pair counts as two items
+
+void BM_StringGet(benchmark::State &state) {
+    auto &store = string_store(state.range(0));
+    auto keys = map_probes(probes(state.range(0)), key);
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.string_get(keys[next]));
+        next = (next + 1) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StringGet)->Apply(sizes);
+
+void BM_StringSet(benchmark::State &state) {
+    auto &store = string_store(state.range(0));
+    auto keys = map_probes(probes(state.range(0)), key);
+    size_t next = 0;
+    for (auto _: state) {
+        store.string_set(keys[next], kValue);
+        next = (next + 1) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StringSet)->Apply(sizes);
+
+void BM_ZAddRem(benchmark::State &state) {
+    auto &store = zset_store(state.range(0));
+    auto odd = map_probes(probes(state.range(0)),
+                          [](int64_t i) { return std::make_pair(member(2 * i + 1), 2.0 * i + 1); });
+    size_t next = 0;
+    for (auto _: state) {
+        store.zadd("zset", odd[next].second, odd[next].first);
+        store.zrem("zset", odd[next].first);
+        next = (next + 1) % odd.size();
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_ZAddRem)->Apply(sizes);
+
+void BM_ZScore(benchmark::State &state) {
+    auto &store = zset_store(state.range(0));
+    auto names = map_probes(probes(state.range(0)), [](int64_t i) { return member(2 * i); });
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.zscore("zset", names[next]));
+        next = (next + 1) % names.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ZScore)->Apply(sizes);
+
+void BM_ZRange(benchmark::State &state) {
+    auto &store = zset_store(state.range(0));
+    auto picks = probes(state.range(0));
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.zrange("zset", 2.0 * picks[next], kMaxSize * 2.0, 0, 10));
+        next = (next + 1) % picks.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ZRange)->Apply(sizes);
+
+void BM_ListPushPop(benchmark::State &state) {
+    auto &store = list_store(state.range(0));
+    const std::string value = member(0);
+    for (auto _: state) {
+        store.lpush("list", value);
+        benchmark::DoNotOptimize(store.rpop("list"));
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_ListPushPop)->Apply(sizes);
+
+void BM_ListIndex(benchmark::State &state) {
+    auto &store = list_store(state.range(0));
+    auto picks = probes(state.range(0));
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.lindex("list", static_cast<int>(picks[next])));
+        next = (next + 1) % picks.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ListIndex)->Apply(sizes);
+
+void BM_ListRange(benchmark::State &state) {
+    auto &store = list_store(state.range(0));
+    auto picks = probes(state.range(0) - 10);
+    size_t next = 0;
+    for (auto _: state) {
+        auto from = static_cast<int>(picks[next]);
+        benchmark::DoNotOptimize(store.lrange("list", from, from + 9));
+        next = (next + 1) % picks.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ListRange)->Apply(sizes);
+
+void BM_SetAddRem(benchmark::State &state) {
+    auto &store = set_store(state.range(0));
+    auto names = map_probes(probes(state.range(0)), [n = state.range(0)](int64_t i) { return member(n + i); });
+    size_t next = 0;
+    for (auto _: state) {
+        store.sadd("set", names[next]);
+        store.srem("set", names[next]);
+        next = (next + 1) % names.size();
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_SetAddRem)->Apply(sizes);
+
+void BM_SetIsMember(benchmark::State &state) {
+    auto &store = set_store(state.range(0));
+    auto names = map_probes(probes(state.range(0)), member);
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.sismember("set", names[next]));
+        next = (next + 1) % names.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SetIsMember)->Apply(sizes);
+
+// a 100 member set against the whole one, which costs 100 lookups whatever the size
+void BM_SetInter(benchmark::State &state) {
+    auto &store = set_store(state.range(0));
+    const std::vector<std::string> keys = {"set", "small"};
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.sinter(keys));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SetInter)->Apply(sizes);
+
+void BM_HashSetDel(benchmark::State &state) {
+    auto &store = hash_store(state.range(0));
+    auto fields = map_probes(probes(state.range(0)), [n = state.range(0)](int64_t i) {
+        return std::vector<std::string>{member(n + i)};
+    });
+    auto pairs = map_probes(probes(state.range(0)), [n = state.range(0)](int64_t i) {
+        return std::vector<std::pair<std::string, std::string>>{{member(n + i), kValue}};
+    });
+    size_t next = 0;
+    for (auto _: state) {
+        store.hset("hash", pairs[next]);
+        store.hdel("hash", fields[next]);
+        next = (next + 1) % fields.size();
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_HashSetDel)->Apply(sizes);
+
+void BM_HashGet(benchmark::State &state) {
+    auto &store = hash_store(state.range(0));
+    auto fields = map_probes(probes(state.range(0)), member);
+    size_t next = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store.hget("hash", fields[next]));
+        next = (next + 1) % fields.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HashGet)->Apply(sizes);
+
+// contention: threads share one store. thread 0 builds it before the timed loop, which every thread starts
+// together
+
+constexpr int64_t kContendedKeys = 100000;
+
+// GET and SET over keys spread across every stripe, with range(0) percent of them SETs
+void BM_ContendedStrings(benchmark::State &state) {
+    static DataStore *store;
+    if (state.thread_index() == 0) {
+        store = &string_store(kContendedKeys);
+    }
+    auto keys = map_probes(probes(kContendedKeys, state.thread_index()), key);
+    std::mt19937 rng(state.thread_index());
+    std::uniform_int_distribution<int> percent(0, 99);
+    size_t next = 0;
+    for (auto _: state) {
+        if (percent(rng) < state.range(0)) {
+            store->string_set(keys[next], kValue);
+        } else {
+            benchmark::DoNotOptimize(store->string_get(keys[next]));
+        }
+        next = (next + 1) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContendedStrings)->Arg(0)->Arg(10)->Arg(50)->Apply(contended);
+
+// every thread adds and removes its own members in one sorted set, whose stripe they all take shared
+void BM_ContendedZAddRem(benchmark::State &state) {
+    static DataStore *store;
+    if (state.thread_index() == 0) {
+        store = &zset_store(kContendedKeys);
+    }
+    auto odd = map_probes(probes(kContendedKeys, state.thread_index()), [&](int64_t i) {
+        return member(2 * (i * state.threads() + state.thread_index()) + 1);
+    });
+    size_t next = 0;
+    for (auto _: state) {
+        store->zadd("zset", 1.0, odd[next]);
+        store->zrem("zset", odd[next]);
+        next = (next + 1) % odd.size();
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_ContendedZAddRem)->Apply(contended);
+
+// one hot counter, whose stripe every INCR takes exclusively
+void BM_ContendedIncr(benchmark::State &state) {
+    static DataStore *store;
+    if (state.thread_index() == 0) {
+        store = &prepared<DataStore>("counter", 0, [](DataStore &, int64_t) {});
+    }
+    for (auto _: state) {
+        benchmark::DoNotOptimize(store->incrby("counter", 1));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContendedIncr)->Apply(contended);
+
+// one list every thread pushes onto the head of and pops off the tail of
+void BM_ContendedListPushPop(benchmark::State &state) {
+    static DataStore *store;
+    if (state.thread_index() == 0) {
+        store = &list_store(kMinSize);
+    }
+    const std::string value = member(state.thread_index());
+    for (auto _: state) {
+        store->lpush("list", value);
+        benchmark::DoNotOptimize(store->rpop("list"));
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_ContendedListPushPop)->Apply(contended);
+
+}
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+#ifdef USE_DEFAULT_ALLOCATOR
+    benchmark::AddCustomContext("allocator", "operator new");
+#else
+    benchmark::AddCustomContext("allocator", "slab");
+#endif
+    benchmark::RunSpecifiedBenchmarks();
+    cache.built_.clear();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "structures/glob.cpp"
+
+// times compiled Glob matching against a character-at-a-time matcher that re-reads the pattern for every
+// key, over a keyspace shaped like an application's: glob_bench [keys]
+
+namespace {
+
+bool naive_class(std::string_view pattern, size_t &p, char c) {
+    bool negated = p < pattern.size() && pattern[p] == '^';
+    if (negated) {
+        ++p;
+    }
+    bool found = false;
+    for (bool first = true; p < pattern.size() && (first || pattern[p] != ']'); first = false) {
+        if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+            ++p;
+        }
+        auto lo = static_cast<unsigned char>(pattern[p]);
+        if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']') {
+            auto hi = static_cast<unsigned char>(pattern[p + 2]);
+            found |= static_cast<unsigned char>(c) >= lo && static_cast<unsigned char>(c) <= hi;
+            p += 3;
+        } else {
+            found |= static_cast<unsigned char>(c) == lo;
+            ++p;
+        }
+    }
+    if (p == pattern.size()) {
+        return false;
+    }
+    ++p;
+    return found != negated;
+}
+
+bool naive_match(std::string_view pattern, std::string_view text) {
+    size_t p = 0, t = 0;
+    size_t star = std::string_view::npos, resume = 0;
+    while (t < text.size()) {
+        if (p < pattern.size()) {
+            char pc = pattern[p];
+            if (pc == '*') {
+                star = ++p;
+                resume = t;
+                continue;
+            }
+            size_t next = p + 1;
+            bool ok;
+            if (pc == '?') {
+                ok = true;
+            } else if (pc == '[') {
+                ok = naive_class(pattern, next, text[t]);
+            } else if (pc == '\\' && p + 1 < pattern.size()) {
+                ok = pattern[p + 1] == text[t];
+                next = p + 2;
+            } else {
+                ok = pc == text[t];
+            }
+            if (ok) {
+                p = next;
+                ++t;
+                continue;
+            }
+        }
+        if (star == std::string_view::npos) {
+            return false;
+        }
+        p = star;
+        t = ++resume;
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+template <typename F>
+std::pair<double, size_t> time_per_key(const std::vector<std::string> &keys, F &&match) {
+    size_t matched = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &key: keys) {
+        matched += match(key);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count() / keys.size(), matched};
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::mt19937_64 rng(42);
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    static const char *kinds[] = {":session", ":profile:email", ":cart:items", ":settings"};
+    for (size_t i = 0; i < count; ++i) {
+        auto id = std::to_string(rng() % 10000000);
+        switch (rng() % 4) {
+            case 0:
+                keys.push_back("user:" + id + kinds[rng() % 4]);
+                break;
+            case 1:
+                keys.push_back("order:" + id + ":items");
+                break;
+            case 2:
+                keys.push_back("cache:page:/catalog/category/" + id + "/products?sort=price&page=" +
+                               std::to_string(rng() % 50));
+                break;
+            default:
+                keys.push_back("session:" + id + ":token:" + std::string(32, static_cast<char>('a' + rng() % 26)));
+                break;
+        }
+    }
+
+    const char *patterns[] = {
+            "user:*:session", "user:1*", "*:items", "*category*products*page=4*", "session:*:token:zzzz*",
+            "user:[0-3]*:session", "order:??????:items", "*[^a-z]:cart:*",
+    };
+    std::cout << std::left << std::setw(30) << "pattern" << std::right << std::setw(10) << "matched"
+              << std::setw(14) << "naive ns" << std::setw(14) << "glob ns" << std::setw(10) << "speedup\n";
+    for (const char *pattern: patterns) {
+        Glob glob(pattern);
+        auto naive = time_per_key(keys, [&](const std::string &key) { return naive_match(pattern, key); });
+        auto compiled = time_per_key(keys, [&](const std::string &key) { return glob.matches(key); });
+        if (naive.second != compiled.second) {
+            std::cerr << "mismatch on " << pattern << ": " << naive.second << " vs " << compiled.second << "\n";
+            return 1;
+        }
+        std::cout << std::left << std::setw(30) << pattern << std::right << std::setw(10) << compiled.second
+                  << std::fixed << std::setprecision(1) << std::setw(14) << naive.first << std::setw(14)
+                  << compiled.first << std::setw(9) << naive.first / compiled.first << "x\n";
+    }
+    return 0;
+}
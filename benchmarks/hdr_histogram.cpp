@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+// a high dynamic range histogram: values from 0 to 2^42 (73 minutes in nanoseconds) counted to three
+// significant digits in fixed memory. values below 2048 get a slot each, and each power of two above
+// that is split into 1024 linear slots, so recording is a shift and an increment and histograms kept by
+// several threads merge by adding their counts
+class HdrHistogram {
+private:
+    static constexpr int kSubBucketBits = 11;
+    static constexpr uint64_t kSubBuckets = uint64_t(1) << kSubBucketBits;
+    static constexpr uint64_t kHalf = kSubBuckets / 2;
+    static constexpr int kMaxBits = 42;
+    static constexpr uint64_t kMaxValue = (uint64_t(1) << kMaxBits) - 1;
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t min_ = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ = 0;
+    double sum_ = 0;
+
+    static size_t index_of(uint64_t value) {
+        if (value < kSubBuckets) {
+            return value;
+        }
+        int magnitude = 63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+        return kSubBuckets + (magnitude - 1) * kHalf + ((value >> magnitude) - kHalf);
+    }
+
+    // the highest value counted in slot i, so percentiles never understate a latency
+    static uint64_t highest_at(size_t i) {
+        if (i < kSubBuckets) {
+            return i;
+        }
+        size_t magnitude = (i - kSubBuckets) / kHalf + 1;
+        uint64_t sub = kHalf + (i - kSubBuckets) % kHalf;
+        return ((sub + 1) << magnitude) - 1;
+    }
+
+public:
+    HdrHistogram() : counts_(kSubBuckets + (kMaxBits - kSubBucketBits) * kHalf) {}
+
+    // values past the range are counted as the largest one
+    void record(uint64_t value) {
+        value = std::min(value, kMaxValue);
+        ++counts_[index_of(value)];
+        ++total_;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        sum_ += static_cast<double>(value);
+    }
+
+    void merge(const HdrHistogram &other) {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    // the value at or below which percentile percent of the recorded values fall
+    uint64_t percentile(double percent) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        auto wanted = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100 * total_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= wanted) {
+                return std::min(highest_at(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const {
+        return total_;
+    }
+
+    uint64_t min() const {
+        return total_ ? min_ : 0;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        return total_ ? sum_ / total_ : 0;
+    }
+
+    // the percentile distribution in HdrHistogram's text format, which its plotting tools read. the steps
+    // halve the distance to 100% every `ticks` lines, and values are divided by scale
+    void print_distribution(std::ostream &out, double scale, int ticks = 5) const {
+        out << std::setw(12) << "Value" << std::setw(15) << "Percentile" << std::setw(11) << "TotalCount"
+            << std::setw(18) << "1/(1-Percentile)" << "\n\n";
+        auto line = [&](uint64_t value, double percent, uint64_t seen) {
+            out << std::fixed << std::setprecision(3) << std::setw(12) << value / scale << std::setprecision(12)
+                << std::setw(15) << percent / 100 << std::setw(11) << seen;
+            if (percent < 100) {
+                out << std::setprecision(2) << std::setw(18) << 1 / (1 - percent / 100);
+            }
+            out << "\n";
+        };
+        uint64_t seen = 0;
+        int step = 0;
+        double level = 0;
+        for (size_t i = 0; i < counts_.size() && total_; ++i) {
+            if (counts_[i] == 0) {
+                continue;
+            }
+            seen += counts_[i];
+            // levels finer than one value in total_ say nothing more
+            while (seen >= level / 100 * total_ && (1 - level / 100) * total_ >= 1) {
+                line(std::min(highest_at(i), max_), level, seen);
+                level = 100 * (1 - std::pow(0.5, static_cast<double>(++step) / ticks));
+            }
+        }
+        line(max_, 100, total_);
+        out << std::setprecision(3) << "#[Mean = " << mean() / scale << ", Max = " << max_ / scale
+            << ", Total count = " << total_ << "]\n";
+    }
+};
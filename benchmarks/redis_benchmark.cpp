@@ -0,0 +1,453 @@
+#include <boost/asio.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include "benchmarks/hdr_histogram.cpp"
+
+// a redis-benchmark style load generator. each thread runs its own io_context with its share of the
+// connections. with --rate the load is open-loop: every connection sends on a fixed schedule whether or
+// not replies have come back, and a latency runs from when its request was due rather than when it went
+// out, so a stalled server is charged for every request it held up (coordinated omission)
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string host_ = "127.0.0.1";
+    std::string port_ = "6379";
+    size_t threads_ = 1;
+    size_t connections_ = 50;
+    size_t requests_ = 100000;
+    // requests per second over all connections; 0 sends as fast as replies allow
+    double rate_ = 0;
+    size_t pipeline_ = 1;
+    uint64_t keyspace_ = 100000;
+    size_t value_size_ = 3;
+    std::string mix_ = "SET,GET";
+    bool histogram_ = false;
+};
+
+// a command the generator can send: how to write one with a random key r, and whether its reply is a count
+// line followed by that many lines and a blank one, as ZQUERY's is, rather than a single line
+struct Command {
+    const char *name_;
+    void (*write_)(std::string &out, uint64_t r, const std::string &value);
+    bool counted_;
+};
+
+const std::vector<Command> &commands() {
+    static const std::vector<Command> table = {
+            {"SET", [](std::string &out, uint64_t r, const std::string &value) {
+                out.append("SET key:").append(std::to_string(r)).append(" ").append(value).append("\n");
+            }, false},
+            {"GET", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("GET key:").append(std::to_string(r)).append("\n");
+            }, false},
+            {"INCR", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("INCR counter:").append(std::to_string(r)).append("\n");
+            }, false},
+            {"LPUSH", [](std::string &out, uint64_t, const std::string &value) {
+                out.append("LPUSH bench:list ").append(value).append("\n");
+            }, false},
+            {"RPUSH", [](std::string &out, uint64_t, const std::string &value) {
+                out.append("RPUSH bench:list ").append(value).append("\n");
+            }, false},
+            {"LPOP", [](std::string &out, uint64_t, const std::string &) { out.append("LPOP bench:list\n"); }, false},
+            {"RPOP", [](std::string &out, uint64_t, const std::string &) { out.append("RPOP bench:list\n"); }, false},
+            {"SADD", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("SADD bench:set member:").append(std::to_string(r)).append("\n");
+            }, false},
+            {"SISMEMBER", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("SISMEMBER bench:set member:").append(std::to_string(r)).append("\n");
+            }, false},
+            {"HSET", [](std::string &out, uint64_t r, const std::string &value) {
+                out.append("HSET bench:hash field:").append(std::to_string(r)).append(" ").append(value).append("\n");
+            }, false},
+            {"HGET", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("HGET bench:hash field:").append(std::to_string(r)).append("\n");
+            }, false},
+            {"ZADD", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("ZADD bench:zset ").append(std::to_string(r)).append(" member:").append(std::to_string(r))
+                        .append("\n");
+            }, false},
+            {"ZSCORE", [](std::string &out, uint64_t r, const std::string &) {
+                out.append("ZSCORE bench:zset member:").append(std::to_string(r)).append("\n");
+            }, false},
+            {"ZQUERY", [](std::string &out, uint64_t r, const std::string &) {
+                // up to 10 members from score r on
+                out.append("ZQUERY bench:zset ").append(std::to_string(r)).append(" a ")
+                        .append(std::to_string(r + 100)).append(" z 0 10\n");
+            }, true},
+    };
+    return table;
+}
+
+// the commands a run sends, and their weights
+struct Mix {
+    std::vector<size_t> commands_;
+    std::vector<uint64_t> cumulative_;
+
+    static Mix parse(const std::string &spec) {
+        Mix mix;
+        std::istringstream iss(spec);
+        std::string item;
+        uint64_t total = 0;
+        while (std::getline(iss, item, ',')) {
+            auto colon = item.find(':');
+            std::string name = item.substr(0, colon);
+            uint64_t weight = colon == std::string::npos ? 1 : std::stoull(item.substr(colon + 1));
+            auto &table = commands();
+            auto it = std::find_if(table.begin(), table.end(), [&](const Command &c) { return name == c.name_; });
+            if (it == table.end()) {
+                throw std::invalid_argument("unknown command in --mix: " + name);
+            }
+            if (weight == 0) {
+                continue;
+            }
+            mix.commands_.push_back(it - table.begin());
+            mix.cumulative_.push_back(total += weight);
+        }
+        if (mix.commands_.empty()) {
+            throw std::invalid_argument("--mix names no command");
+        }
+        return mix;
+    }
+
+    size_t pick(std::mt19937_64 &rng) const {
+        uint64_t r = rng() % cumulative_.back();
+        return commands_[std::upper_bound(cumulative_.begin(), cumulative_.end(), r) - cumulative_.begin()];
+    }
+};
+
+// what one thread saw, per command, merged once every thread is done
+struct Stats {
+    std::vector<HdrHistogram> latencies_;
+    std::vector<uint64_t> errors_;
+
+    Stats() : latencies_(commands().size()), errors_(commands().size()) {}
+
+    void merge(const Stats &other) {
+        for (size_t i = 0; i < latencies_.size(); ++i) {
+            latencies_[i].merge(other.latencies_[i]);
+            errors_[i] += other.errors_[i];
+        }
+    }
+};
+
+class Connection {
+private:
+    struct Pending {
+        size_t command_;
+        Clock::time_point start_;
+    };
+
+    const Options &options_;
+    const Mix &mix_;
+    Stats &stats_;
+    tcp::socket socket_;
+    asio::steady_timer timer_;
+    std::mt19937_64 rng_;
+    std::string value_;
+
+    size_t total_;
+    size_t sent_ = 0;
+    size_t received_ = 0;
+    // between sends when open-loop, zero when closed
+    Clock::duration interval_;
+    Clock::time_point next_due_;
+    bool timer_armed_ = false;
+
+    std::deque<Pending> in_flight_;
+    std::string out_;
+    std::string writing_;
+    bool write_pending_ = false;
+    std::array<char, 65536> buffer_;
+    std::string input_;
+    // lines still to come of a counted reply
+    size_t lines_left_ = 0;
+
+    void flush() {
+        if (write_pending_ || out_.empty()) {
+            return;
+        }
+        write_pending_ = true;
+        writing_.swap(out_);
+        out_.clear();
+        asio::async_write(socket_, asio::buffer(writing_), [this](boost::system::error_code ec, size_t) {
+            write_pending_ = false;
+            if (ec) {
+                throw std::runtime_error("write failed: " + ec.message());
+            }
+            flush();
+        });
+    }
+
+    // sends every request that is due and fits in the pipeline. a request held back by a full pipeline
+    // keeps its due time, so the wait counts against its latency
+    void pump() {
+        bool open_loop = interval_.count() > 0;
+        auto now = Clock::now();
+        while (sent_ < total_ && in_flight_.size() < options_.pipeline_ && (!open_loop || next_due_ <= now)) {
+            size_t command = mix_.pick(rng_);
+            commands()[command].write_(out_, rng_() % options_.keyspace_, value_);
+            in_flight_.push_back({command, open_loop ? next_due_ : now});
+            ++sent_;
+            next_due_ += interval_;
+        }
+        flush();
+        if (open_loop && sent_ < total_ && in_flight_.size() < options_.pipeline_ && !timer_armed_) {
+            timer_armed_ = true;
+            timer_.expires_at(next_due_);
+            timer_.async_wait([this](boost::system::error_code ec) {
+                timer_armed_ = false;
+                if (!ec) {
+                    pump();
+                }
+            });
+        }
+    }
+
+    void complete(bool error) {
+        auto &pending = in_flight_.front();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - pending.start_);
+        stats_.latencies_[pending.command_].record(static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0)));
+        stats_.errors_[pending.command_] += error;
+        in_flight_.pop_front();
+        ++received_;
+    }
+
+    void on_line(std::string_view line) {
+        if (in_flight_.empty()) {
+            throw std::runtime_error("reply without a request: " + std::string(line));
+        }
+        if (lines_left_ > 0) {
+            if (--lines_left_ == 0) {
+                complete(false);
+            }
+            return;
+        }
+        bool error = line.substr(0, 7) == "error: " || line == "unknown command";
+        if (!error && commands()[in_flight_.front().command_].counted_) {
+            lines_left_ = std::stoull(std::string(line)) + 1;
+            return;
+        }
+        complete(error);
+    }
+
+    void read() {
+        socket_.async_read_some(asio::buffer(buffer_), [this](boost::system::error_code ec, size_t n) {
+            if (ec) {
+                throw std::runtime_error("read failed: " + ec.message());
+            }
+            input_.append(buffer_.data(), n);
+            size_t start = 0, end;
+            while ((end = input_.find('\n', start)) != std::string::npos) {
+                on_line(std::string_view(input_.data() + start, end - start));
+                start = end + 1;
+            }
+            input_.erase(0, start);
+            if (received_ == total_) {
+                timer_.cancel();
+                return;
+            }
+            pump();
+            read();
+        });
+    }
+
+public:
+    Connection(asio::io_context &io_context, const tcp::resolver::results_type &endpoints, const Options &options,
+               const Mix &mix, Stats &stats, size_t total, uint64_t seed)
+            : options_(options), mix_(mix), stats_(stats), socket_(io_context), timer_(io_context), rng_(seed),
+              value_(options.value_size_, 'x'), total_(total), interval_(Clock::duration::zero()) {
+        asio::connect(socket_, endpoints);
+        socket_.set_option(tcp::no_delay(true));
+        if (options.rate_ > 0) {
+            interval_ = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.connections_ / options.rate_));
+            interval_ = std::max(interval_, Clock::duration(1));
+        }
+    }
+
+    void start(Clock::time_point at) {
+        next_due_ = at;
+        if (total_ == 0) {
+            return;
+        }
+        asio::post(socket_.get_executor(), [this] { pump(); });
+        read();
+    }
+};
+
+void usage() {
+    std::cerr << "usage: redis_benchmark [--host h] [--port p] [--threads n] [--connections n] [--requests n]\n"
+                 "                       [--rate ops_per_second] [--pipeline n] [--keyspace n] [--value-size bytes]\n"
+                 "                       [--mix CMD[:weight],...] [--histogram]\n"
+                 "commands:";
+    for (const auto &command: commands()) {
+        std::cerr << " " << command.name_;
+    }
+    std::cerr << "\n";
+}
+
+bool parse(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--histogram") {
+            options.histogram_ = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (flag == "--host") {
+            options.host_ = value;
+        } else if (flag == "--port") {
+            options.port_ = value;
+        } else if (flag == "--threads") {
+            options.threads_ = std::stoul(value);
+        } else if (flag == "--connections") {
+            options.connections_ = std::stoul(value);
+        } else if (flag == "--requests") {
+            options.requests_ = std::stoul(value);
+        } else if (flag == "--rate") {
+            options.rate_ = std::stod(value);
+        } else if (flag == "--pipeline") {
+            options.pipeline_ = std::stoul(value);
+        } else if (flag == "--keyspace") {
+            options.keyspace_ = std::stoull(value);
+        } else if (flag == "--value-size") {
+            options.value_size_ = std::stoul(value);
+        } else if (flag == "--mix") {
+            options.mix_ = value;
+        } else {
+            return false;
+        }
+    }
+    return options.threads_ > 0 && options.connections_ > 0 && options.pipeline_ > 0 && options.keyspace_ > 0 &&
+           options.value_size_ > 0 && options.rate_ >= 0;
+}
+
+void report(const Options &options, const Stats &stats, double seconds) {
+    constexpr double kMicros = 1000;
+    HdrHistogram all;
+    uint64_t errors = 0;
+    std::cout << std::left << std::setw(10) << "command" << std::right << std::setw(10) << "requests"
+              << std::setw(8) << "errors" << std::setw(12) << "ops/s" << std::setw(10) << "mean us"
+              << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10)
+              << "p99.9" << std::setw(10) << "max" << "\n";
+    auto row = [&](const std::string &name, const HdrHistogram &latencies, uint64_t failed) {
+        std::cout << std::left << std::setw(10) << name << std::right << std::setw(10) << latencies.count()
+                  << std::setw(8) << failed << std::fixed << std::setprecision(0) << std::setw(12)
+                  << latencies.count() / seconds << std::setprecision(1) << std::setw(10)
+                  << latencies.mean() / kMicros;
+        for (double p: {50.0, 90.0, 99.0, 99.9}) {
+            std::cout << std::setw(10) << latencies.percentile(p) / kMicros;
+        }
+        std::cout << std::setw(10) << latencies.max() / kMicros << "\n";
+    };
+    for (size_t i = 0; i < commands().size(); ++i) {
+        if (stats.latencies_[i].count() == 0) {
+            continue;
+        }
+        row(commands()[i].name_, stats.latencies_[i], stats.errors_[i]);
+        all.merge(stats.latencies_[i]);
+        errors += stats.errors_[i];
+    }
+    row("all", all, errors);
+    std::cout << std::setprecision(3) << "\n" << all.count() << " requests in " << seconds << "s over "
+              << options.connections_ << " connections, " << options.threads_ << " threads, pipeline "
+              << options.pipeline_;
+    if (options.rate_ > 0) {
+        std::cout << ", open-loop at " << options.rate_ << " requests/s";
+    }
+    std::cout << "\n";
+
+    if (options.histogram_) {
+        for (size_t i = 0; i < commands().size(); ++i) {
+            if (stats.latencies_[i].count() > 0) {
+                std::cout << "\n# " << commands()[i].name_ << " latency (us)\n";
+                stats.latencies_[i].print_distribution(std::cout, kMicros);
+            }
+        }
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) {
+            usage();
+            return 1;
+        }
+        auto mix = Mix::parse(options.mix_);
+
+        std::vector<std::unique_ptr<asio::io_context>> contexts;
+        std::vector<Stats> stats(options.threads_);
+        std::vector<std::unique_ptr<Connection>> connections;
+        for (size_t t = 0; t < options.threads_; ++t) {
+            contexts.push_back(std::make_unique<asio::io_context>());
+        }
+        tcp::resolver resolver(*contexts[0]);
+        auto endpoints = resolver.resolve(options.host_, options.port_);
+        for (size_t c = 0; c < options.connections_; ++c) {
+            size_t share = options.requests_ / options.connections_ + (c < options.requests_ % options.connections_);
+            size_t t = c % options.threads_;
+            connections.push_back(
+                    std::make_unique<Connection>(*contexts[t], endpoints, options, mix, stats[t], share, c + 1));
+        }
+
+        auto start = Clock::now();
+        for (auto &connection: connections) {
+            connection->start(start);
+        }
+        // a connection that fails stops its thread; the first failure is reported once every thread is done
+        std::vector<std::exception_ptr> failures(contexts.size());
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < contexts.size(); ++t) {
+            threads.emplace_back([&, t] {
+                try {
+                    contexts[t]->run();
+                } catch (...) {
+                    failures[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        for (auto &failure: failures) {
+            if (failure) {
+                std::rethrow_exception(failure);
+            }
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        for (size_t t = 1; t < stats.size(); ++t) {
+            stats[0].merge(stats[t]);
+        }
+        report(options, stats[0], elapsed.count());
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,738 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include "reply.cpp"
+#include "near_cache.cpp"
+
+// an asynchronous client for applications. it keeps a pool of connections served by its own io threads, and
+// any thread may issue commands: the typed helpers return futures, and command() takes a callback that runs
+// on an io thread, so it must neither block nor throw. commands are spread over the connections in turn, and each
+// connection pipelines: whatever was issued while its previous write was in flight goes out in one write, and
+// replies are matched to requests in order. a connection that fails fails its outstanding requests and
+// reconnects for the next one. MULTI, blocking pops and SUBSCRIBE change the state of the connection they run
+// on, which other callers share, so they are not offered here.
+// with a near-cache, every connection turns on CLIENT TRACKING first thing, and GET, HGET and ZSCORE are
+// answered from the cache while the server has not pushed an invalidation for their key. a connection that
+// fails clears the cache, since the server forgets what it tracked for it
+class AsyncClient {
+public:
+    using Callback = std::function<void(Reply)>;
+
+    // the server answered with an error
+    class ReplyError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // the connection failed before the reply arrived; the command may or may not have run
+    class ConnectionError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // entries_ of 0 means no near-cache. with bcast, the server reports every write under prefixes, or every
+    // write at all without them, instead of remembering what each connection read; only keys under the
+    // prefixes are cached then
+    struct CacheOptions {
+        size_t entries_ = 0;
+        bool bcast_ = false;
+        std::vector<std::string> prefixes_;
+    };
+
+private:
+    using tcp = boost::asio::ip::tcp;
+
+    struct Request {
+        ReplyFramer framer_;
+        Reply reply_;
+        Callback done_;
+    };
+
+    class Connection : public std::enable_shared_from_this<Connection> {
+    private:
+        enum class State { Closed, Connecting, Connected };
+
+        boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+        tcp::socket socket_;
+        const tcp::resolver::results_type &endpoints_;
+        // the near-cache and the CLIENT TRACKING line that has to precede every other request, when caching
+        NearCache *cache_;
+        std::string greeting_;
+
+        // filled by any thread and handed to the strand a batch at a time
+        std::mutex mutex_;
+        std::string queued_text_;
+        std::vector<Request> queued_;
+        bool flush_posted_ = false;
+        bool shut_down_ = false;
+
+        // the rest only on the strand
+        State state_ = State::Closed;
+        // bumped when the connection fails, so that handlers of the old socket leave the new one alone
+        uint64_t generation_ = 0;
+        bool writing_ = false;
+        std::string sending_;
+        std::deque<Request> in_flight_;
+        std::array<char, 65536> incoming_;
+        std::string partial_;
+
+        static void fail_all(std::deque<Request> &requests, const std::string &why, bool lost) {
+            while (!requests.empty()) {
+                auto request = std::move(requests.front());
+                requests.pop_front();
+                request.reply_.error_ = why;
+                request.reply_.lost_ = lost;
+                request.done_(std::move(request.reply_));
+            }
+        }
+
+        std::deque<Request> take_queued() {
+            std::lock_guard lock(mutex_);
+            std::deque<Request> taken(std::make_move_iterator(queued_.begin()), std::make_move_iterator(queued_.end()));
+            queued_.clear();
+            queued_text_.clear();
+            return taken;
+        }
+
+        // the sent requests are lost; the queued ones were never sent and wait for the reconnect
+        void fail(const std::string &why) {
+            ++generation_;
+            state_ = State::Closed;
+            boost::system::error_code ignored;
+            socket_.close(ignored);
+            partial_.clear();
+            if (cache_) {
+                cache_->clear();
+            }
+            fail_all(in_flight_, "connection lost: " + why, true);
+        }
+
+        // queued ahead of whatever waited for the connection, so every read on it is tracked
+        void greet() {
+            if (greeting_.empty()) {
+                return;
+            }
+            std::lock_guard lock(mutex_);
+            queued_text_.insert(0, greeting_ + "\n");
+            queued_.insert(queued_.begin(), Request{ReplyFramer(Reply::Shape::Line), Reply{},
+                                                    [cache = cache_](Reply reply) {
+                                                        if (reply.error_ && !reply.lost_) {
+                                                            cache->disable();
+                                                        }
+                                                    }});
+        }
+
+        // "invalidate <count> <key> ...", or "invalidate 0" once the server was flushed
+        void invalidated(std::string_view line) {
+            if (!cache_) {
+                return;
+            }
+            size_t start = line.find(' ', line.find(' ') + 1);
+            if (start == std::string_view::npos) {
+                cache_->clear();
+                return;
+            }
+            while (start < line.size()) {
+                size_t end = std::min(line.find(' ', start + 1), line.size());
+                cache_->invalidate(std::string(line.substr(start + 1, end - start - 1)));
+                start = end;
+            }
+        }
+
+        void connect() {
+            state_ = State::Connecting;
+            boost::asio::async_connect(socket_, endpoints_, boost::asio::bind_executor(strand_,
+                    [self = shared_from_this()](boost::system::error_code ec, const tcp::endpoint &) {
+                        if (ec) {
+                            self->state_ = State::Closed;
+                            auto queued = self->take_queued();
+                            fail_all(queued, "cannot connect: " + ec.message(), false);
+                            return;
+                        }
+                        self->state_ = State::Connected;
+                        self->socket_.set_option(tcp::no_delay(true));
+                        self->greet();
+                        self->read();
+                        self->flush();
+                    }));
+        }
+
+        void flush() {
+            std::vector<Request> batch;
+            {
+                std::lock_guard lock(mutex_);
+                flush_posted_ = false;
+                if (queued_.empty() || writing_ || state_ == State::Connecting) {
+                    return;
+                }
+                if (state_ == State::Connected) {
+                    sending_.swap(queued_text_);
+                    batch.swap(queued_);
+                }
+            }
+            if (state_ == State::Closed) {
+                connect();
+                return;
+            }
+            // in flight before the first byte goes out, so no reply can arrive ahead of its request
+            for (auto &request: batch) {
+                in_flight_.push_back(std::move(request));
+            }
+            writing_ = true;
+            boost::asio::async_write(socket_, boost::asio::buffer(sending_), boost::asio::bind_executor(strand_,
+                    [self = shared_from_this(), generation = generation_](boost::system::error_code ec, size_t) {
+                        self->writing_ = false;
+                        self->sending_.clear();
+                        if (ec && generation == self->generation_) {
+                            self->fail(ec.message());
+                        }
+                        self->flush();
+                    }));
+        }
+
+        void read() {
+            socket_.async_read_some(boost::asio::buffer(incoming_), boost::asio::bind_executor(strand_,
+                    [self = shared_from_this(), generation = generation_](boost::system::error_code ec, size_t n) {
+                        if (generation != self->generation_) {
+                            return;
+                        }
+                        if (ec) {
+                            self->fail(ec.message());
+                            return;
+                        }
+                        try {
+                            self->consume(n);
+                        } catch (const std::exception &e) {
+                            self->fail(e.what());
+                            return;
+                        }
+                        self->read();
+                    }));
+        }
+
+        void consume(size_t n) {
+            partial_.append(incoming_.data(), n);
+            size_t start = 0, end;
+            while ((end = partial_.find('\n', start)) != std::string::npos) {
+                std::string_view line(partial_.data() + start, end - start);
+                start = end + 1;
+                // a push only ever comes between replies, and no reply's first line starts this way
+                bool between = in_flight_.empty() || !in_flight_.front().framer_.started();
+                if (between && line.substr(0, 11) == "invalidate ") {
+                    invalidated(line);
+                    continue;
+                }
+                if (in_flight_.empty()) {
+                    throw std::runtime_error("reply without a request");
+                }
+                auto &request = in_flight_.front();
+                if (request.framer_.feed(line, request.reply_)) {
+                    auto done = std::move(request.done_);
+                    auto reply = std::move(request.reply_);
+                    in_flight_.pop_front();
+                    done(std::move(reply));
+                }
+            }
+            partial_.erase(0, start);
+        }
+
+    public:
+        Connection(boost::asio::io_context &io_context, const tcp::resolver::results_type &endpoints,
+                   NearCache *cache, std::string greeting)
+                : strand_(boost::asio::make_strand(io_context)), socket_(strand_), endpoints_(endpoints),
+                  cache_(cache), greeting_(std::move(greeting)) {}
+
+        // the first connection is made before the client is handed out, so a wrong address, or a server that
+        // cannot track, shows at once
+        void connect_now() {
+            boost::asio::connect(socket_, endpoints_);
+            socket_.set_option(tcp::no_delay(true));
+            if (!greeting_.empty()) {
+                boost::asio::write(socket_, boost::asio::buffer(greeting_ + "\n"));
+                std::string reply;
+                boost::asio::read_until(socket_, boost::asio::dynamic_buffer(reply), '\n');
+                reply.pop_back();
+                if (reply != "OK") {
+                    throw ReplyError(reply);
+                }
+            }
+            state_ = State::Connected;
+            boost::asio::post(strand_, [self = shared_from_this()] { self->read(); });
+        }
+
+        void submit(const std::string &line, Reply::Shape shape, Callback done) {
+            bool post = false;
+            {
+                std::lock_guard lock(mutex_);
+                if (!shut_down_) {
+                    queued_text_ += line;
+                    queued_text_ += '\n';
+                    queued_.push_back(Request{ReplyFramer(shape), Reply{}, std::move(done)});
+                    post = !flush_posted_;
+                    flush_posted_ = true;
+                    done = nullptr;
+                }
+            }
+            if (post) {
+                boost::asio::post(strand_, [self = shared_from_this()] { self->flush(); });
+            }
+            if (!done) {
+                return;
+            }
+            Reply reply;
+            reply.error_ = "client is shut down";
+            done(std::move(reply));
+        }
+
+        // fails everything outstanding and closes the socket, which ends the handlers waiting on it
+        void shut_down() {
+            boost::asio::post(strand_, [self = shared_from_this()] {
+                {
+                    std::lock_guard lock(self->mutex_);
+                    self->shut_down_ = true;
+                }
+                auto queued = self->take_queued();
+                fail_all(queued, "client is shut down", false);
+                ++self->generation_;
+                self->state_ = State::Closed;
+                boost::system::error_code ignored;
+                self->socket_.close(ignored);
+                fail_all(self->in_flight_, "client is shut down", true);
+            });
+        }
+    };
+
+    boost::asio::io_context io_context_;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+    tcp::resolver::results_type endpoints_;
+    std::unique_ptr<NearCache> cache_;
+    std::vector<std::shared_ptr<Connection>> connections_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_{0};
+
+    // the protocol splits a command line on whitespace, so an argument cannot be empty or hold any
+    static void append(std::string &line, std::string_view arg) {
+        if (arg.empty() || arg.find_first_of(" \t\r\n\v\f") != std::string_view::npos) {
+            throw std::invalid_argument("argument \"" + std::string(arg) + "\" is empty or contains whitespace");
+        }
+        if (!line.empty()) {
+            line += ' ';
+        }
+        line += arg;
+    }
+
+    static std::string join(std::initializer_list<std::string_view> args) {
+        std::string line;
+        for (auto arg: args) {
+            append(line, arg);
+        }
+        return line;
+    }
+
+    // shortest text that reads back as the same double
+    static std::string number(double value) {
+        char buf[32];
+        for (int precision = 15; precision <= 17; ++precision) {
+            std::snprintf(buf, sizeof(buf), "%.*g", precision, value);
+            if (std::strtod(buf, nullptr) == value) {
+                break;
+            }
+        }
+        return buf;
+    }
+
+    static std::optional<std::string> nullable(std::string value) {
+        if (value == "(nil)") {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    static size_t count(const std::string &value) {
+        return std::stoull(value);
+    }
+
+    // the keys a write helper changes, dropped from the near-cache once its reply arrives, so the caller reads
+    // its own write even before the server's push comes in on whichever connection read the key
+    std::vector<std::string> writes(std::vector<std::string> keys) const {
+        return cache_ ? std::move(keys) : std::vector<std::string>();
+    }
+
+    template <typename T, typename Convert>
+    std::future<T> call(std::string line, Reply::Shape shape, Convert convert, std::vector<std::string> written = {}) {
+        auto promise = std::make_shared<std::promise<T>>();
+        auto future = promise->get_future();
+        submit(std::move(line), shape, [promise, convert = std::move(convert), cache = cache_.get(),
+                                        written = std::move(written)](Reply reply) {
+            for (const auto &key: written) {
+                cache->invalidate(key);
+            }
+            try {
+                if (reply.lost_) {
+                    throw ConnectionError(*reply.error_);
+                }
+                if (reply.error_) {
+                    throw ReplyError(*reply.error_);
+                }
+                if constexpr (std::is_void_v<T>) {
+                    convert(reply);
+                    promise->set_value();
+                } else {
+                    promise->set_value(convert(reply));
+                }
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return future;
+    }
+
+    // a read the near-cache may answer, with entry naming it under key. on a miss the reply is cached as it
+    // arrives, on the strand of its connection, so an invalidation following it on the wire finds it there
+    template <typename T, typename Convert>
+    std::future<T> cached(std::string line, const std::string &key, std::string entry, Convert convert) {
+        if (cache_) {
+            if (auto hit = cache_->get(key, entry)) {
+                std::promise<T> promise;
+                promise.set_value(convert(std::move(*hit)));
+                return promise.get_future();
+            }
+        }
+        return call<T>(std::move(line), Reply::Shape::Line,
+                       [cache = cache_.get(), key, entry = std::move(entry), convert](Reply &reply) {
+                           auto value = nullable(std::move(reply.first_));
+                           if (cache) {
+                               cache->put(key, entry, value);
+                           }
+                           return convert(std::move(value));
+                       });
+    }
+
+    static std::optional<std::string> as_string(std::optional<std::string> value) {
+        return value;
+    }
+
+    static std::string greeting(const CacheOptions &options) {
+        std::string line = "CLIENT TRACKING ON";
+        if (options.bcast_) {
+            line += " BCAST";
+        }
+        for (const auto &prefix: options.prefixes_) {
+            append(line, "PREFIX");
+            append(line, prefix);
+        }
+        return line;
+    }
+
+    void submit(std::string line, Reply::Shape shape, Callback done) {
+        auto &connection = connections_[next_.fetch_add(1, std::memory_order_relaxed) % connections_.size()];
+        connection->submit(line, shape, std::move(done));
+    }
+
+public:
+    AsyncClient(const std::string &host, const std::string &port, size_t connections = 4, size_t threads = 1)
+            : AsyncClient(host, port, connections, threads, CacheOptions()) {}
+
+    AsyncClient(const std::string &host, const std::string &port, size_t connections, size_t threads,
+                const CacheOptions &cache)
+            : work_(boost::asio::make_work_guard(io_context_)) {
+        endpoints_ = tcp::resolver(io_context_).resolve(host, port);
+        if (cache.entries_) {
+            cache_ = std::make_unique<NearCache>(cache.entries_,
+                                                 cache.bcast_ ? cache.prefixes_ : std::vector<std::string>());
+        }
+        for (size_t i = 0; i < std::max<size_t>(connections, 1); ++i) {
+            connections_.push_back(std::make_shared<Connection>(io_context_, endpoints_, cache_.get(),
+                                                                cache_ ? greeting(cache) : std::string()));
+            connections_.back()->connect_now();
+        }
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+            threads_.emplace_back([this] { io_context_.run(); });
+        }
+    }
+
+    AsyncClient(const AsyncClient &) = delete;
+    AsyncClient &operator=(const AsyncClient &) = delete;
+
+    // requests still outstanding fail with "client is shut down"
+    ~AsyncClient() {
+        for (auto &connection: connections_) {
+            connection->shut_down();
+        }
+        work_.reset();
+        for (auto &thread: threads_) {
+            thread.join();
+        }
+    }
+
+    // lookups the near-cache answered and lookups that went to the server
+    std::pair<size_t, size_t> cache_hits_and_misses() const {
+        return cache_ ? cache_->hits_and_misses() : std::pair<size_t, size_t>();
+    }
+
+    // any command, with the shape its reply takes; done runs on an io thread. writes sent this way reach the
+    // near-cache through the server's invalidations only
+    void command(const std::vector<std::string> &args, Reply::Shape shape, Callback done) {
+        std::string line;
+        for (const auto &arg: args) {
+            append(line, arg);
+        }
+        submit(std::move(line), shape, std::move(done));
+    }
+
+    std::future<Reply> command(const std::vector<std::string> &args, Reply::Shape shape) {
+        std::string line;
+        for (const auto &arg: args) {
+            append(line, arg);
+        }
+        return call<Reply>(std::move(line), shape, [](Reply &reply) { return std::move(reply); });
+    }
+
+    std::future<std::string> echo(const std::string &message) {
+        return call<std::string>(join({"ECHO", message}), Reply::Shape::Line,
+                                 [](Reply &reply) { return std::move(reply.first_); });
+    }
+
+    // strings
+
+    std::future<void> set(const std::string &key, const std::string &value) {
+        return call<void>(join({"SET", key, value}), Reply::Shape::Line, [](Reply &) {}, writes({key}));
+    }
+
+    std::future<std::optional<std::string>> get(const std::string &key) {
+        return cached<std::optional<std::string>>(join({"GET", key}), key, "", as_string);
+    }
+
+    std::future<void> mset(const std::vector<std::pair<std::string, std::string>> &pairs) {
+        std::string line = "MSET";
+        std::vector<std::string> keys;
+        for (const auto &[key, value]: pairs) {
+            append(line, key);
+            append(line, value);
+            keys.push_back(key);
+        }
+        return call<void>(std::move(line), Reply::Shape::Line, [](Reply &) {}, writes(std::move(keys)));
+    }
+
+    std::future<std::vector<std::optional<std::string>>> mget(const std::vector<std::string> &keys) {
+        std::string line = "MGET";
+        for (const auto &key: keys) {
+            append(line, key);
+        }
+        return call<std::vector<std::optional<std::string>>>(std::move(line), Reply::Shape::Counted,
+                [](Reply &reply) {
+                    std::vector<std::optional<std::string>> values;
+                    for (auto &item: reply.items_) {
+                        values.push_back(nullable(std::move(item)));
+                    }
+                    return values;
+                });
+    }
+
+    std::future<int64_t> incrby(const std::string &key, int64_t amount) {
+        return call<int64_t>(join({"INCRBY", key, std::to_string(amount)}), Reply::Shape::Line,
+                             [](Reply &reply) { return static_cast<int64_t>(std::stoll(reply.first_)); },
+                             writes({key}));
+    }
+
+    std::future<size_t> del(const std::vector<std::string> &keys) {
+        std::string line = "DEL";
+        for (const auto &key: keys) {
+            append(line, key);
+        }
+        return call<size_t>(std::move(line), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); },
+                            writes(keys));
+    }
+
+    // sorted sets
+
+    // whether member was new
+    std::future<bool> zadd(const std::string &key, double score, const std::string &member) {
+        return call<bool>(join({"ZADD", key, number(score), member}), Reply::Shape::Line,
+                          [](Reply &reply) { return reply.first_ == "1"; }, writes({key}));
+    }
+
+    // how many members were new
+    std::future<size_t> zadd(const std::string &key, const std::vector<std::pair<double, std::string>> &members) {
+        std::string line = join({"ZADD", key});
+        for (const auto &[score, member]: members) {
+            append(line, number(score));
+            append(line, member);
+        }
+        return call<size_t>(std::move(line), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); },
+                            writes({key}));
+    }
+
+    std::future<bool> zrem(const std::string &key, const std::string &member) {
+        return call<bool>(join({"ZREM", key, member}), Reply::Shape::Line,
+                          [](Reply &reply) { return reply.first_ == "1"; }, writes({key}));
+    }
+
+    std::future<std::optional<double>> zscore(const std::string &key, const std::string &member) {
+        return cached<std::optional<double>>(join({"ZSCORE", key, member}), key, "z" + member,
+                [](std::optional<std::string> score) -> std::optional<double> {
+                    if (!score) {
+                        return std::nullopt;
+                    }
+                    return std::stod(*score);
+                });
+    }
+
+    std::future<std::vector<std::pair<std::string, double>>>
+    zquery(const std::string &key, double min_score, const std::string &min_member, double max_score,
+           const std::string &max_member, int64_t offset, int64_t count) {
+        auto line = join({"ZQUERY", key, number(min_score), min_member, number(max_score), max_member,
+                          std::to_string(offset), std::to_string(count)});
+        return call<std::vector<std::pair<std::string, double>>>(std::move(line), Reply::Shape::Query,
+                [](Reply &reply) {
+                    std::vector<std::pair<std::string, double>> members;
+                    for (auto &item: reply.items_) {
+                        auto space = item.rfind(' ');
+                        if (space == std::string::npos) {
+                            throw std::runtime_error("malformed ZQUERY item: " + item);
+                        }
+                        members.emplace_back(item.substr(0, space), std::stod(item.substr(space + 1)));
+                    }
+                    return members;
+                });
+    }
+
+    std::future<size_t> zremrangebyscore(const std::string &key, double min_score, double max_score) {
+        return call<size_t>(join({"ZREMRANGEBYSCORE", key, number(min_score), number(max_score)}),
+                            Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); }, writes({key}));
+    }
+
+    // lists
+
+    // the length of the list after the push
+    std::future<size_t> lpush(const std::string &key, const std::vector<std::string> &values) {
+        return push("LPUSH", key, values);
+    }
+
+    std::future<size_t> rpush(const std::string &key, const std::vector<std::string> &values) {
+        return push("RPUSH", key, values);
+    }
+
+    std::future<std::optional<std::string>> lpop(const std::string &key) {
+        return call<std::optional<std::string>>(join({"LPOP", key}), Reply::Shape::Line,
+                                                [](Reply &reply) { return nullable(std::move(reply.first_)); },
+                                                writes({key}));
+    }
+
+    std::future<std::optional<std::string>> rpop(const std::string &key) {
+        return call<std::optional<std::string>>(join({"RPOP", key}), Reply::Shape::Line,
+                                                [](Reply &reply) { return nullable(std::move(reply.first_)); },
+                                                writes({key}));
+    }
+
+    std::future<size_t> llen(const std::string &key) {
+        return call<size_t>(join({"LLEN", key}), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); });
+    }
+
+    std::future<std::vector<std::string>> lrange(const std::string &key, int start, int stop) {
+        return call<std::vector<std::string>>(join({"LRANGE", key, std::to_string(start), std::to_string(stop)}),
+                                              Reply::Shape::Counted,
+                                              [](Reply &reply) { return std::move(reply.items_); });
+    }
+
+    // sets
+
+    // how many members were new
+    std::future<size_t> sadd(const std::string &key, const std::vector<std::string> &members) {
+        std::string line = join({"SADD", key});
+        for (const auto &member: members) {
+            append(line, member);
+        }
+        return call<size_t>(std::move(line), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); },
+                            writes({key}));
+    }
+
+    std::future<bool> srem(const std::string &key, const std::string &member) {
+        return call<bool>(join({"SREM", key, member}), Reply::Shape::Line,
+                          [](Reply &reply) { return reply.first_ == "1"; }, writes({key}));
+    }
+
+    std::future<bool> sismember(const std::string &key, const std::string &member) {
+        return call<bool>(join({"SISMEMBER", key, member}), Reply::Shape::Line,
+                          [](Reply &reply) { return reply.first_ == "1"; });
+    }
+
+    std::future<size_t> scard(const std::string &key) {
+        return call<size_t>(join({"SCARD", key}), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); });
+    }
+
+    std::future<std::vector<std::string>> sinter(const std::vector<std::string> &keys) {
+        std::string line = "SINTER";
+        for (const auto &key: keys) {
+            append(line, key);
+        }
+        return call<std::vector<std::string>>(std::move(line), Reply::Shape::Counted,
+                                              [](Reply &reply) { return std::move(reply.items_); });
+    }
+
+    // hashes
+
+    // how many fields were new
+    std::future<size_t> hset(const std::string &key, const std::vector<std::pair<std::string, std::string>> &fields) {
+        std::string line = join({"HSET", key});
+        for (const auto &[field, value]: fields) {
+            append(line, field);
+            append(line, value);
+        }
+        return call<size_t>(std::move(line), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); },
+                            writes({key}));
+    }
+
+    std::future<std::optional<std::string>> hget(const std::string &key, const std::string &field) {
+        return cached<std::optional<std::string>>(join({"HGET", key, field}), key, "h" + field, as_string);
+    }
+
+    std::future<size_t> hdel(const std::string &key, const std::vector<std::string> &fields) {
+        std::string line = join({"HDEL", key});
+        for (const auto &field: fields) {
+            append(line, field);
+        }
+        return call<size_t>(std::move(line), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); },
+                            writes({key}));
+    }
+
+    std::future<std::vector<std::pair<std::string, std::string>>> hgetall(const std::string &key) {
+        return call<std::vector<std::pair<std::string, std::string>>>(join({"HGETALL", key}), Reply::Shape::Counted,
+                [](Reply &reply) {
+                    std::vector<std::pair<std::string, std::string>> fields;
+                    for (size_t i = 0; i + 1 < reply.items_.size(); i += 2) {
+                        fields.emplace_back(std::move(reply.items_[i]), std::move(reply.items_[i + 1]));
+                    }
+                    return fields;
+                });
+    }
+
+private:
+    std::future<size_t> push(const char *command, const std::string &key, const std::vector<std::string> &values) {
+        std::string line = join({command, key});
+        for (const auto &value: values) {
+            append(line, value);
+        }
+        return call<size_t>(std::move(line), Reply::Shape::Line, [](Reply &reply) { return count(reply.first_); },
+                            writes({key}));
+    }
+};
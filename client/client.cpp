@@ -1,6 +1,14 @@
 #include <boost/asio.hpp>
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
 
 using boost::asio::ip::tcp;
 
@@ -8,7 +16,7 @@ class Client {
 public:
     Client(boost::asio::io_context& io_context,
            const std::string& host, const std::string& port)
-            : socket_(io_context) {
+            : io_context_(io_context), socket_(io_context) {
         try {
             tcp::resolver resolver(io_context);
             endpoints_ = resolver.resolve(host, port);
@@ -41,7 +49,101 @@ public:
         }
     }
 
+    // --pipe: streams input to the server as it is, one command per line, without waiting for replies, and
+    // reads the replies as they arrive. an ECHO of a random token goes last, so its reply marks the end.
+    // returns how many replies were errors
+    size_t pipe(std::istream& input) {
+        auto token = random_token();
+        auto started = std::chrono::steady_clock::now();
+        std::vector<char> chunk(kPipeChunk);
+        std::array<char, 65536> incoming;
+        std::string pending;
+        size_t commands = 0, errors = 0;
+        char last = '\n';
+        bool sent = false, finished = false;
+        std::string tail;
+
+        std::function<void()> write_next = [&] {
+            input.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+            auto n = static_cast<size_t>(input.gcount());
+            if (n == 0) {
+                if (sent) {
+                    return;
+                }
+                sent = true;
+                // a last command without a newline would run into the ECHO
+                tail = (last == '\n' ? "" : "\n") + std::string("ECHO ") + token + "\n";
+                commands += last != '\n';
+                boost::asio::async_write(socket_, boost::asio::buffer(tail),
+                                         [&](boost::system::error_code ec, size_t) {
+                                             if (ec) {
+                                                 throw std::runtime_error("write failed: " + ec.message());
+                                             }
+                                         });
+                return;
+            }
+            commands += std::count(chunk.begin(), chunk.begin() + n, '\n');
+            last = chunk[n - 1];
+            boost::asio::async_write(socket_, boost::asio::buffer(chunk.data(), n),
+                                     [&](boost::system::error_code ec, size_t) {
+                                         if (ec) {
+                                             throw std::runtime_error("write failed: " + ec.message());
+                                         }
+                                         write_next();
+                                     });
+        };
+
+        std::function<void()> read_next = [&] {
+            socket_.async_read_some(boost::asio::buffer(incoming), [&](boost::system::error_code ec, size_t n) {
+                if (ec) {
+                    throw std::runtime_error("read failed: " + ec.message());
+                }
+                pending.append(incoming.data(), n);
+                size_t start = 0, end;
+                while ((end = pending.find('\n', start)) != std::string::npos) {
+                    std::string_view line(pending.data() + start, end - start);
+                    start = end + 1;
+                    if (line == token) {
+                        finished = true;
+                        return;
+                    }
+                    if ((line.substr(0, 7) == "error: " || line == "unknown command") && ++errors <= kPrintedErrors) {
+                        std::cerr << line << std::endl;
+                    }
+                }
+                pending.erase(0, start);
+                read_next();
+            });
+        };
+
+        write_next();
+        read_next();
+        io_context_.run();
+        if (!finished) {
+            throw std::runtime_error("connection closed before every reply arrived");
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        std::cout << "commands: " << commands << ", errors: " << errors << ", " << elapsed.count() << "s ("
+                  << static_cast<size_t>(commands / std::max(elapsed.count(), 1e-9)) << " commands/s)" << std::endl;
+        return errors;
+    }
+
 private:
+    static constexpr size_t kPipeChunk = 1 << 20;
+    // error replies echoed to stderr in pipe mode; the rest are only counted
+    static constexpr size_t kPrintedErrors = 10;
+
+    static std::string random_token() {
+        static constexpr char hex[] = "0123456789abcdef";
+        std::random_device device;
+        std::string token;
+        for (int i = 0; i < 40; ++i) {
+            token += hex[device() & 0xf];
+        }
+        return token;
+    }
+
     void send(const std::string& message) {
         boost::asio::write(socket_, boost::asio::buffer(message + "\n"));
     }
@@ -59,22 +161,36 @@ private:
         return response;
     }
 
+    boost::asio::io_context& io_context_;
     tcp::socket socket_;
     tcp::resolver::results_type endpoints_;
 };
 
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 3) {
-            std::cerr << "usage: client <host> <port>\n";
+        bool pipe = argc >= 4 && std::string(argv[3]) == "--pipe";
+        if (argc != 3 && !(pipe && argc <= 5)) {
+            std::cerr << "usage: client <host> <port> [--pipe [file]]\n";
             return 1;
         }
 
         boost::asio::io_context io_context;
         Client client(io_context, argv[1], argv[2]);
-        client.run();
+        if (!pipe) {
+            client.run();
+        } else if (argc == 5 && std::string(argv[4]) != "-") {
+            std::ifstream file(argv[4], std::ios::binary);
+            if (!file) {
+                std::cerr << "cannot open " << argv[4] << "\n";
+                return 1;
+            }
+            return client.pipe(file) ? 1 : 0;
+        } else {
+            return client.pipe(std::cin) ? 1 : 0;
+        }
     } catch (std::exception& e) {
         std::cerr << "exception: " << e.what() << "\n";
+        return 1;
     }
 
     return 0;
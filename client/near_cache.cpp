@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <optional>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+
+// the client's copy of values it read from a server that tracks them for it, dropped when the server pushes
+// an invalidation. invalidations name keys, so entries sit under their key: a GET as "", an HGET as "h" and
+// the field, a ZSCORE as "z" and the member. a (nil) reply is kept too. striped, so the io threads filling it
+// and the application threads reading it seldom wait on each other
+class NearCache {
+private:
+    static constexpr size_t kStripes = 16;
+
+    using Entries = std::unordered_map<std::string, std::optional<std::string>>;
+
+    struct alignas(64) Stripe {
+        std::mutex mutex_;
+        std::unordered_map<std::string, Entries> keys_;
+        size_t entries_ = 0;
+        size_t hits_ = 0;
+        size_t misses_ = 0;
+    };
+
+    std::array<Stripe, kStripes> stripes_;
+    size_t stripe_capacity_;
+    // in broadcast mode the server only reports writes under these prefixes, so no other key may be cached
+    std::vector<std::string> prefixes_;
+    // cleared when the server refused to track, after which every read goes to it
+    std::atomic<bool> enabled_{true};
+
+    Stripe &stripe(const std::string &key) {
+        return stripes_[std::hash<std::string>{}(key) % kStripes];
+    }
+
+    bool cacheable(const std::string &key) const {
+        if (prefixes_.empty()) {
+            return true;
+        }
+        for (const auto &prefix: prefixes_) {
+            if (key.compare(0, prefix.size(), prefix) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    explicit NearCache(size_t capacity, std::vector<std::string> prefixes = {})
+            : stripe_capacity_(std::max<size_t>(capacity / kStripes, 1)), prefixes_(std::move(prefixes)) {}
+
+    // the cached reply, itself nullopt for (nil), or nullopt on a miss
+    std::optional<std::optional<std::string>> get(const std::string &key, const std::string &entry) {
+        if (!enabled_.load(std::memory_order_relaxed)) {
+            return std::nullopt;
+        }
+        auto &s = stripe(key);
+        std::lock_guard lock(s.mutex_);
+        auto it = s.keys_.find(key);
+        if (it != s.keys_.end()) {
+            auto found = it->second.find(entry);
+            if (found != it->second.end()) {
+                ++s.hits_;
+                return found->second;
+            }
+        }
+        ++s.misses_;
+        return std::nullopt;
+    }
+
+    // a full stripe first drops whichever key its table yields first, which is as good as random here
+    void put(const std::string &key, const std::string &entry, std::optional<std::string> value) {
+        if (!enabled_.load(std::memory_order_relaxed) || !cacheable(key)) {
+            return;
+        }
+        auto &s = stripe(key);
+        std::lock_guard lock(s.mutex_);
+        while (s.entries_ >= stripe_capacity_ && !s.keys_.empty()) {
+            s.entries_ -= s.keys_.begin()->second.size();
+            s.keys_.erase(s.keys_.begin());
+        }
+        auto &entries = s.keys_[key];
+        s.entries_ += entries.insert_or_assign(entry, std::move(value)).second;
+    }
+
+    void invalidate(const std::string &key) {
+        auto &s = stripe(key);
+        std::lock_guard lock(s.mutex_);
+        auto it = s.keys_.find(key);
+        if (it != s.keys_.end()) {
+            s.entries_ -= it->second.size();
+            s.keys_.erase(it);
+        }
+    }
+
+    void clear() {
+        for (auto &s: stripes_) {
+            std::lock_guard lock(s.mutex_);
+            s.keys_.clear();
+            s.entries_ = 0;
+        }
+    }
+
+    void disable() {
+        enabled_ = false;
+        clear();
+    }
+
+    size_t size() {
+        size_t entries = 0;
+        for (auto &s: stripes_) {
+            std::lock_guard lock(s.mutex_);
+            entries += s.entries_;
+        }
+        return entries;
+    }
+
+    // lookups answered from the cache and lookups that went to the server
+    std::pair<size_t, size_t> hits_and_misses() {
+        std::pair<size_t, size_t> counts;
+        for (auto &s: stripes_) {
+            std::lock_guard lock(s.mutex_);
+            counts.first += s.hits_;
+            counts.second += s.misses_;
+        }
+        return counts;
+    }
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <cstddef>
+
+// one reply from the server. the protocol is lines of text, and how many lines make up a reply depends on the
+// command, so the sender says which shape to expect:
+//   Line     one line (SET, GET, INCR, ZADD, ...)
+//   Counted  a count line and that many lines (MGET, LRANGE, SINTER, HMGET, HGETALL, KEYS)
+//   Cursor   a cursor line, then a counted reply (SCAN, SSCAN, HSCAN, ZSCAN)
+//   Query    ZQUERY's count line, that many "member score" lines and a blank line
+// an error is always a single line, whatever the shape
+struct Reply {
+    enum class Shape { Line, Counted, Cursor, Query };
+
+    // the line for Line, the cursor for Cursor, the count otherwise
+    std::string first_;
+    std::vector<std::string> items_;
+    // the server's error line, or why the connection failed before the reply came
+    std::optional<std::string> error_;
+    // the connection failed with the command sent, so it may or may not have run
+    bool lost_ = false;
+
+    static bool is_error(std::string_view line) {
+        return line.substr(0, 7) == "error: " || line == "unknown command";
+    }
+};
+
+// gathers the lines of one reply of a known shape
+class ReplyFramer {
+private:
+    Reply::Shape shape_;
+    bool started_ = false;
+    // lines still to come once the count is known, including ZQUERY's blank line
+    std::optional<size_t> remaining_;
+
+public:
+    explicit ReplyFramer(Reply::Shape shape) : shape_(shape) {}
+
+    bool started() const {
+        return started_;
+    }
+
+    // takes the next line and returns true once reply is complete. a count that is not a number means the
+    // replies are out of step with the requests, and throws
+    bool feed(std::string_view line, Reply &reply) {
+        if (!started_) {
+            started_ = true;
+            if (Reply::is_error(line)) {
+                reply.error_ = std::string(line);
+                return true;
+            }
+            reply.first_ = std::string(line);
+            if (shape_ == Reply::Shape::Line) {
+                return true;
+            }
+            if (shape_ == Reply::Shape::Cursor) {
+                return false;
+            }
+            return counted(line);
+        }
+        if (!remaining_) {
+            return counted(line);
+        }
+        if (shape_ != Reply::Shape::Query || *remaining_ > 1) {
+            reply.items_.emplace_back(line);
+        }
+        return --*remaining_ == 0;
+    }
+
+private:
+    bool counted(std::string_view line) {
+        size_t count = 0;
+        if (line.empty()) {
+            throw std::runtime_error("malformed reply: expected a count");
+        }
+        for (char c: line) {
+            if (c < '0' || c > '9') {
+                throw std::runtime_error("malformed reply: expected a count, got " + std::string(line));
+            }
+            count = count * 10 + (c - '0');
+        }
+        remaining_ = count + (shape_ == Reply::Shape::Query);
+        return *remaining_ == 0;
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+// where each command's keys sit among its arguments, so EXEC can lock them before running a batch and
+// CLIENT TRACKING can remember what a client read
+class CommandKeys {
+public:
+    // keys counted from 1: first_ to last_, step_ apart, with last_ of -1 running to the end. with counted_
+    // the argument just before first_ says how many keys follow instead, as in SINTERCARD numkeys key ...
+    // [LIMIT limit]. all_ marks commands over the whole keyspace. commands missing from the table, such as
+    // blocking pops, SUBSCRIBE and CONFIG, are refused inside MULTI
+    struct KeySpec {
+        int first_;
+        int last_;
+        bool all_;
+        int step_ = 1;
+        bool counted_ = false;
+    };
+
+    static const KeySpec *spec(const std::string &command) {
+        static const std::unordered_map<std::string, KeySpec> specs = {
+                {"ZADD", {1, 1, false}}, {"ZREM", {1, 1, false}}, {"ZSCORE", {1, 1, false}},
+                {"ZQUERY", {1, 1, false}}, {"ZREMRANGEBYSCORE", {1, 1, false}},
+                {"SET", {1, 1, false}}, {"GET", {1, 1, false}}, {"INCRBY", {1, 1, false}},
+                {"INCR", {1, 1, false}}, {"DECR", {1, 1, false}}, {"MGET", {1, -1, false}},
+                {"MSET", {1, -1, false, 2}}, {"MSETNX", {1, -1, false, 2}},
+                {"DEL", {1, -1, false}}, {"UNLINK", {1, -1, false}}, {"FLUSHALL", {0, 0, true}},
+                {"LPUSH", {1, 1, false}}, {"RPUSH", {1, 1, false}}, {"LPOP", {1, 1, false}},
+                {"RPOP", {1, 1, false}}, {"LLEN", {1, 1, false}}, {"LINDEX", {1, 1, false}},
+                {"LRANGE", {1, 1, false}}, {"LTRIM", {1, 1, false}}, {"LMOVE", {1, 2, false}},
+                {"SADD", {1, 1, false}}, {"SREM", {1, 1, false}}, {"SISMEMBER", {1, 1, false}},
+                {"SCARD", {1, 1, false}}, {"SINTER", {1, -1, false}}, {"SUNION", {1, -1, false}},
+                {"SDIFF", {1, -1, false}}, {"SINTERSTORE", {1, -1, false}}, {"SUNIONSTORE", {1, -1, false}},
+                {"SDIFFSTORE", {1, -1, false}}, {"SINTERCARD", {2, -1, false, 1, true}},
+                {"HSET", {1, 1, false}}, {"HGET", {1, 1, false}}, {"HEXISTS", {1, 1, false}},
+                {"HMGET", {1, 1, false}}, {"HDEL", {1, 1, false}}, {"HINCRBY", {1, 1, false}},
+                {"HLEN", {1, 1, false}}, {"HGETALL", {1, 1, false}}, {"HSCAN", {1, 1, false}},
+                {"SSCAN", {1, 1, false}}, {"ZSCAN", {1, 1, false}}, {"SCAN", {0, 0, true}},
+                {"KEYS", {0, 0, true}}, {"PUBLISH", {0, 0, false}},
+                {"ECHO", {0, 0, false}},
+        };
+        auto it = specs.find(command);
+        return it == specs.end() ? nullptr : &it->second;
+    }
+
+    // appends the keys of a tokenized command. a key count that is not a number yields no keys, and the
+    // command itself then fails without touching the store
+    static void keys(const std::vector<std::string> &args, const KeySpec &spec, std::vector<std::string> &out) {
+        if (spec.first_ <= 0) {
+            return;
+        }
+        int end = static_cast<int>(args.size()) - 1;
+        int last = spec.last_ < 0 ? end : std::min(spec.last_, end);
+        if (spec.counted_) {
+            if (spec.first_ - 1 > end) {
+                return;
+            }
+            const auto &count = args[spec.first_ - 1];
+            if (count.empty() || count.size() > 9 || count.find_first_not_of("0123456789") != std::string::npos) {
+                return;
+            }
+            last = std::min(spec.first_ + std::stoi(count) - 1, end);
+        }
+        for (int i = spec.first_; i <= last; i += spec.step_) {
+            out.push_back(args[i]);
+        }
+    }
+
+    // the reads whose keys a default-mode CLIENT TRACKING client is told about when they change
+    static bool tracked_read(const std::string &command) {
+        static const std::unordered_set<std::string> reads = {
+                "GET", "MGET", "ZSCORE", "ZQUERY", "LLEN", "LINDEX", "LRANGE", "SISMEMBER", "SCARD", "SINTER",
+                "SUNION", "SDIFF", "SINTERCARD", "HGET", "HEXISTS", "HMGET", "HLEN", "HGETALL",
+        };
+        return reads.count(command);
+    }
+};
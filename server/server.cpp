@@ -4,16 +4,33 @@
 #include <string>
 #include <unordered_map>
 #include <sstream>
+#include <deque>
+#include <unordered_set>
+#include <chrono>
+#include <optional>
+#include <functional>
+#include <limits>
+#include <iterator>
+#include <iomanip>
 #include "../structures/data_store.cpp"
+#include "../structures/pub_sub.cpp"
+#include "../structures/client_tracking.cpp"
+#include "../structures/scripting.cpp"
+#include "command_keys.cpp"
 
 namespace asio = boost::asio;
 using asio::ip::tcp;
 
-class Session : public std::enable_shared_from_this<Session> {
+class Session : public Subscriber, public std::enable_shared_from_this<Session> {
 
 public:
-    Session(tcp::socket socket, std::shared_ptr<DataStore> store)
-            : socket_(std::move(socket)), store_(store) {
+    Session(tcp::socket socket, std::shared_ptr<DataStore> store, std::shared_ptr<PubSub> pubsub,
+            std::shared_ptr<ScriptEngine> scripts, std::shared_ptr<ClientTracking> tracking,
+            std::shared_ptr<asio::thread_pool> offload)
+            : socket_(std::move(socket)), store_(store), pubsub_(pubsub), scripts_(scripts), tracking_(tracking),
+              offload_(offload),
+              writing_(false),
+              blocked_(false), queue_failed_(false), in_exec_(false) {
         std::cout << "new session created" << std::endl;
     }
 
@@ -22,7 +39,35 @@ public:
         do_read();
     }
 
+    // sessions all run on the io_context thread, so publishers can queue straight into the output queue
+    void deliver(const std::shared_ptr<const std::string> &message) override {
+        write_queue_.push_back(message);
+        if (!writing_) {
+            do_write();
+        }
+    }
+
 private:
+    // takes invalidation pushes on the thread that wrote the keys and posts them to the session's executor
+    class Invalidations : public Subscriber {
+    private:
+        std::weak_ptr<Session> session_;
+        asio::any_io_executor executor_;
+
+    public:
+        Invalidations(std::weak_ptr<Session> session, asio::any_io_executor executor)
+                : session_(std::move(session)), executor_(std::move(executor)) {}
+
+        void deliver(const std::shared_ptr<const std::string> &message) override {
+            asio::post(executor_, [session = session_, message]() {
+                auto self = session.lock();
+                if (self && self->tracking_id_) {
+                    self->deliver(message);
+                }
+            });
+        }
+    };
+
     void do_read() {
         // creates shared ptr to pass into boost functions, the lambda function captures self which keeps session alive even after going out of scope
         auto self(shared_from_this());
@@ -30,44 +75,439 @@ private:
         socket_.async_read_some(boost::asio::buffer(data_, max_length),
                                 [this, self](boost::system::error_code ec, std::size_t length) {
                                     if (!ec) {
-                                        std::string message(data_, length);
-                                        std::cout << "received: " << message << std::endl;
-                                        std::string response = process_message(message);
-                                        std::cout << "sending response: " << response << std::endl;
-                                        do_write(response);
+                                        input_.append(data_, length);
+                                        process_input();
+                                        do_read();
                                     } else {
                                         std::cerr << "read error: " << ec.message() << std::endl;
+                                        close();
                                     }
                                 });
     }
 
-    void do_write(const std::string& message) {
-        // when do_write is called inside do_read, creates another shared ptr to extend lifetime of session object, destroyed when client disconnects or read/write error
+    // runs every complete line in the input buffer; while a blocking command waits, the remaining
+    // commands stay buffered so replies keep their order
+    void process_input() {
+        size_t start = 0, end;
+        while (!blocked_ && (end = input_.find('\n', start)) != std::string::npos) {
+            std::string message = input_.substr(start, end - start);
+            start = end + 1;
+            std::cout << "received: " << message << std::endl;
+            auto response = process_message(message);
+            if (response) {
+                std::cout << "sending response: " << *response << std::endl;
+                deliver(std::make_shared<const std::string>(*response + "\n"));
+            }
+        }
+        input_.erase(0, start);
+    }
+
+    // the store may serve a blocked pop from another session's push, so the reply is posted back
+    // onto this session's executor rather than written from inside the store call
+    DataStore::BlockedCallback unblock_callback(bool with_key) {
         auto self(shared_from_this());
-        boost::asio::async_write(socket_, boost::asio::buffer(message + "\n"),
+        return [self, with_key](std::optional<std::pair<std::string, std::string>> result) {
+            std::string reply = !result ? "(nil)" : with_key ? result->first + " " + result->second : result->second;
+            asio::post(self->socket_.get_executor(), [self, reply]() {
+                self->blocked_ = false;
+                self->waiter_.reset();
+                self->deliver(std::make_shared<const std::string>(reply + "\n"));
+                self->process_input();
+            });
+        };
+    }
+
+    // runs a long command off the io_context thread; like a blocking pop, later commands wait in the
+    // input buffer until its reply has been queued. inside EXEC it runs inline, as the batch holds its keys
+    std::optional<std::string> offload(std::function<std::string()> work) {
+        if (in_exec_) {
+            return work();
+        }
+        auto self(shared_from_this());
+        blocked_ = true;
+        asio::post(*offload_, [self, work = std::move(work)]() {
+            auto reply = work();
+            asio::post(self->socket_.get_executor(), [self, reply]() {
+                self->blocked_ = false;
+                self->deliver(std::make_shared<const std::string>(reply + "\n"));
+                self->process_input();
+            });
+        });
+        return std::nullopt;
+    }
+
+    // CONFIG GET|SET for list-compress-depth, activedefrag, active-defrag-cycle, active-defrag-threshold and
+    // lazyfree-threshold
+    std::string config(std::istringstream &iss) {
+        std::string action, parameter, value;
+        if (!(iss >> action >> parameter) || (action != "GET" && action != "SET")) {
+            return "error: CONFIG requires GET|SET and a parameter";
+        }
+        auto defrag = store_->defrag_config();
+        if (action == "GET") {
+            if (parameter == "list-compress-depth") {
+                return parameter + " " + std::to_string(store_->list_compress_depth());
+            } else if (parameter == "activedefrag") {
+                return parameter + (defrag.enabled_ ? " yes" : " no");
+            } else if (parameter == "active-defrag-cycle") {
+                return parameter + " " + std::to_string(defrag.cycle_percent_);
+            } else if (parameter == "active-defrag-threshold") {
+                return parameter + " " + std::to_string(defrag.threshold_percent_);
+            } else if (parameter == "lazyfree-threshold") {
+                return parameter + " " + std::to_string(store_->lazyfree_threshold());
+            }
+            return "error: unknown CONFIG parameter " + parameter;
+        }
+
+        if (!(iss >> value)) {
+            return "error: CONFIG SET requires a value";
+        }
+        if (parameter == "activedefrag") {
+            if (value != "yes" && value != "no") {
+                return "error: activedefrag must be yes or no";
+            }
+            defrag.enabled_ = value == "yes";
+            store_->set_defrag_config(defrag);
+            return "OK";
+        }
+        if (value.find_first_not_of("0123456789") != std::string::npos) {
+            return "error: " + parameter + " requires a non-negative integer";
+        }
+        auto number = std::stoul(value);
+        if (parameter == "list-compress-depth") {
+            store_->set_list_compress_depth(number);
+        } else if (parameter == "active-defrag-cycle") {
+            if (number < 1 || number > 100) {
+                return "error: active-defrag-cycle must be between 1 and 100";
+            }
+            defrag.cycle_percent_ = number;
+            store_->set_defrag_config(defrag);
+        } else if (parameter == "active-defrag-threshold") {
+            defrag.threshold_percent_ = number;
+            store_->set_defrag_config(defrag);
+        } else if (parameter == "lazyfree-threshold") {
+            store_->set_lazyfree_threshold(number);
+        } else {
+            return "error: unknown CONFIG parameter " + parameter;
+        }
+        return "OK";
+    }
+
+    // CLIENT TRACKING ON [BCAST [PREFIX prefix ...]] | OFF. turning it on again replaces the earlier mode
+    std::string client(std::istringstream &iss) {
+        std::string subcommand, state, option;
+        if (!(iss >> subcommand >> state) || subcommand != "TRACKING" || (state != "ON" && state != "OFF")) {
+            return "error: CLIENT requires TRACKING ON|OFF";
+        }
+        bool bcast = false;
+        std::vector<std::string> prefixes;
+        while (iss >> option) {
+            if (option == "BCAST") {
+                bcast = true;
+            } else if (option == "PREFIX" && iss >> option) {
+                prefixes.push_back(option);
+            } else {
+                return "error: CLIENT TRACKING options are BCAST and PREFIX prefix";
+            }
+        }
+        if (!prefixes.empty() && !bcast) {
+            return "error: PREFIX requires BCAST";
+        }
+        if (state == "OFF" && (bcast || !prefixes.empty())) {
+            return "error: CLIENT TRACKING OFF takes no options";
+        }
+
+        stop_tracking();
+        if (state == "ON") {
+            invalidations_ = std::make_shared<Invalidations>(weak_from_this(), socket_.get_executor());
+            tracking_id_ = tracking_->enable(invalidations_, bcast, std::move(prefixes));
+            tracking_bcast_ = bcast;
+            store_->report_writes(true);
+        }
+        return "OK";
+    }
+
+    void stop_tracking() {
+        if (!tracking_id_) {
+            return;
+        }
+        tracking_->disable(std::exchange(tracking_id_, 0));
+        invalidations_.reset();
+        store_->report_writes(tracking_->clients() > 0);
+    }
+
+    static std::vector<std::string> tokens(const std::string &message) {
+        std::istringstream iss(message);
+        return {std::istream_iterator<std::string>(iss), std::istream_iterator<std::string>()};
+    }
+
+    std::string queue(const std::string &command, const std::string &message) {
+        if (!CommandKeys::spec(command)) {
+            queue_failed_ = true;
+            return "error: " + command + " cannot be queued in MULTI";
+        }
+        queued_->push_back(message);
+        return "QUEUED";
+    }
+
+    // runs the queued commands as one batch under the store's locks. replies with how many ran and then each
+    // reply on its own line, or (nil) when a watched key was written since WATCH
+    std::string exec() {
+        auto commands = std::move(*queued_);
+        queued_.reset();
+        if (std::exchange(queue_failed_, false)) {
+            unwatch_all();
+            return "error: EXECABORT transaction discarded because of previous errors";
+        }
+
+        std::vector<std::string> keys;
+        bool all_keys = false;
+        for (const auto &message: commands) {
+            auto args = tokens(message);
+            const auto &spec = *CommandKeys::spec(args[0]);
+            all_keys |= spec.all_;
+            CommandKeys::keys(args, spec, keys);
+        }
+
+        std::vector<std::string> replies;
+        in_exec_ = true;
+        bool ran = store_->exec(keys, all_keys, watched_, [&] {
+            for (const auto &message: commands) {
+                replies.push_back(process_message(message).value_or(""));
+            }
+        });
+        in_exec_ = false;
+        unwatch_all();
+        if (!ran) {
+            return "(nil)";
+        }
+        std::string reply = std::to_string(replies.size());
+        for (const auto &r: replies) {
+            reply.append("\n").append(r);
+        }
+        return reply;
+    }
+
+    void unwatch_all() {
+        for (const auto &[key, version]: watched_) {
+            store_->unwatch(key);
+        }
+        watched_.clear();
+    }
+
+    // nil and false reply (nil), true replies 1, numbers and strings as their text
+    static std::string script_reply(const ScriptValue &value) {
+        if (value.type_ == ScriptValue::Bool) {
+            return value.truthy() ? "1" : "(nil)";
+        }
+        return value.text().value_or("(nil)");
+    }
+
+    struct ScanOptions {
+        std::string pattern_;
+        size_t count_ = 10;
+        std::string type_;
+    };
+
+    // the MATCH, COUNT and, for SCAN, TYPE options of the scan commands, in any order
+    static bool parse_scan_options(std::istringstream &iss, ScanOptions &options, bool with_type) {
+        static const std::unordered_set<std::string> types = {"string", "list", "set", "zset", "hash"};
+        std::string option;
+        while (iss >> option) {
+            if (option == "MATCH") {
+                if (!(iss >> options.pattern_)) {
+                    return false;
+                }
+            } else if (option == "COUNT") {
+                if (!(iss >> options.count_) || options.count_ == 0) {
+                    return false;
+                }
+            } else if (option == "TYPE" && with_type) {
+                if (!(iss >> options.type_) || !types.count(options.type_)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static std::string to_hex(const std::string &bytes) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(2 * bytes.size());
+        for (unsigned char c: bytes) {
+            hex += digits[c >> 4];
+            hex += digits[c & 0xf];
+        }
+        return hex;
+    }
+
+    static std::optional<std::string> from_hex(const std::string &hex) {
+        auto nibble = [](char c) {
+            return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        };
+        if (hex.size() % 2) {
+            return std::nullopt;
+        }
+        std::string bytes;
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            int hi = nibble(hex[i]), lo = nibble(hex[i + 1]);
+            if (hi < 0 || lo < 0) {
+                return std::nullopt;
+            }
+            bytes += static_cast<char>(hi << 4 | lo);
+        }
+        return bytes;
+    }
+
+    static std::string members_reply(const std::vector<std::string> &members) {
+        std::ostringstream oss;
+        oss << members.size();
+        for (const auto &member: members) {
+            oss << "\n" << member;
+        }
+        return oss.str();
+    }
+
+    // each field and value on its own line, each line preceded by a newline
+    static std::string fields_reply(const std::vector<std::pair<std::string, std::string>> &fields) {
+        std::string reply;
+        for (const auto &[field, value]: fields) {
+            reply.append("\n").append(field).append("\n").append(value);
+        }
+        return reply;
+    }
+
+    // drains everything queued so far in one gather write, so a burst of published messages costs one syscall
+    void do_write() {
+        // creates another shared ptr to extend lifetime of session object while the write is pending
+        auto self(shared_from_this());
+        writing_ = true;
+        in_flight_.assign(write_queue_.begin(), write_queue_.end());
+        write_queue_.clear();
+
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(in_flight_.size());
+        for (const auto &message: in_flight_) {
+            buffers.emplace_back(asio::buffer(*message));
+        }
+
+        boost::asio::async_write(socket_, buffers,
                                  [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                                     if (!ec) {
-                                         std::cout << "response sent, waiting for next command" << std::endl;
-                                         do_read();
-                                     } else {
+                                     in_flight_.clear();
+                                     writing_ = false;
+                                     if (ec) {
                                          std::cerr << "write error: " << ec.message() << std::endl;
+                                         close();
+                                     } else if (!write_queue_.empty()) {
+                                         do_write();
                                      }
                                  });
     }
 
-    std::string process_message(const std::string& message) {
+    void close() {
+        unwatch_all();
+        stop_tracking();
+        if (waiter_) {
+            store_->cancel_blocked(waiter_);
+            waiter_.reset();
+        }
+        for (const auto &channel: channels_) {
+            pubsub_->unsubscribe(this, channel);
+        }
+        for (const auto &pattern: patterns_) {
+            pubsub_->punsubscribe(this, pattern);
+        }
+        channels_.clear();
+        patterns_.clear();
+        write_queue_.clear();
+    }
+
+    std::string subscribe_reply(const std::string &kind, const std::string &name) const {
+        return kind + " " + name + " " + std::to_string(channels_.size() + patterns_.size());
+    }
+
+    static std::optional<std::chrono::milliseconds> parse_timeout(const std::string &token) {
+        try {
+            double seconds = std::stod(token);
+            if (seconds < 0) {
+                return std::nullopt;
+            }
+            return std::chrono::milliseconds(static_cast<int64_t>(seconds * 1000));
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+    }
+
+    // returns nullopt when the reply is deferred until a blocking command is served or times out
+    std::optional<std::string> process_message(const std::string& message) {
         std::istringstream iss(message);
         std::string command;
         iss >> command;
+        if (queued_ && command != "EXEC" && command != "DISCARD" && command != "MULTI" && command != "WATCH") {
+            return queue(command, message);
+        }
+        if (tracking_id_ && !tracking_bcast_ && CommandKeys::tracked_read(command)) {
+            std::vector<std::string> keys;
+            CommandKeys::keys(tokens(message), *CommandKeys::spec(command), keys);
+            tracking_->track(tracking_id_, keys);
+        }
 
         try {
-            if (command == "ZADD") {
+            if (command == "MULTI") {
+                if (queued_) {
+                    return "error: MULTI calls can not be nested";
+                }
+                queued_.emplace();
+                return "OK";
+            } else if (command == "EXEC") {
+                if (!queued_) {
+                    return "error: EXEC without MULTI";
+                }
+                return exec();
+            } else if (command == "DISCARD") {
+                if (!queued_) {
+                    return "error: DISCARD without MULTI";
+                }
+                queued_.reset();
+                queue_failed_ = false;
+                unwatch_all();
+                return "OK";
+            } else if (command == "WATCH") {
+                if (queued_) {
+                    return "error: WATCH inside MULTI is not allowed";
+                }
+                std::string key;
+                size_t watched = watched_.size();
+                while (iss >> key) {
+                    watched_.emplace_back(key, store_->watch(key));
+                }
+                return watched_.size() > watched ? "OK" : "error: WATCH requires at least one key";
+            } else if (command == "UNWATCH") {
+                unwatch_all();
+                return "OK";
+            } else if (command == "ZADD") {
+                // ZADD key score member [score member ...]; replies with how many members were new
                 std::string key, member;
                 double score;
-                if (!(iss >> key >> score >> member)) {
-                    return "error: ZADD requires a key, score, and member";
+                std::vector<std::pair<double, std::string>> members;
+                iss >> key;
+                while (iss >> score) {
+                    if (!(iss >> member)) {
+                        members.clear();
+                        break;
+                    }
+                    members.emplace_back(score, std::move(member));
+                }
+                if (members.empty() || !iss.eof()) {
+                    return "error: ZADD requires a key and score member pairs";
                 }
-                return store_->zadd(key, score, member) ? "1" : "0";
+                if (members.size() == 1) {
+                    return store_->zadd(key, members[0].first, members[0].second) ? "1" : "0";
+                }
+                return std::to_string(store_->zadd(key, members));
             } else if (command == "ZREM") {
                 std::string key, member;
                 if (!(iss >> key >> member)) {
@@ -96,6 +536,470 @@ private:
                     oss << pair.first << " " << pair.second << "\n";
                 }
                 return oss.str();
+            } else if (command == "ZREMRANGEBYSCORE") {
+                std::string key;
+                double min_score, max_score;
+                if (!(iss >> key >> min_score >> max_score)) {
+                    return "error: ZREMRANGEBYSCORE requires a key, min_score, and max_score";
+                }
+                return std::to_string(store_->zrange_del(key, min_score, max_score, 0,
+                                                         std::numeric_limits<int64_t>::max()));
+            } else if (command == "SET") {
+                std::string key, value;
+                if (!(iss >> key >> value)) {
+                    return "error: SET requires a key and value";
+                }
+                store_->string_set(key, value);
+                return "OK";
+            } else if (command == "GET") {
+                std::string key;
+                if (!(iss >> key)) {
+                    return "error: GET requires a key";
+                }
+                auto value = store_->string_get(key);
+                return value ? *value : "(nil)";
+            } else if (command == "MSET" || command == "MSETNX") {
+                std::string key, value;
+                std::vector<std::pair<std::string, std::string>> pairs;
+                while (iss >> key) {
+                    if (!(iss >> value)) {
+                        pairs.clear();
+                        break;
+                    }
+                    pairs.emplace_back(std::move(key), std::move(value));
+                }
+                if (pairs.empty()) {
+                    return "error: " + command + " requires key value pairs";
+                }
+                if (command == "MSETNX") {
+                    return store_->msetnx(pairs) ? "1" : "0";
+                }
+                store_->mset(pairs);
+                return "OK";
+            } else if (command == "MGET") {
+                std::vector<std::string> keys;
+                std::string key;
+                while (iss >> key) {
+                    keys.push_back(key);
+                }
+                if (keys.empty()) {
+                    return "error: MGET requires at least one key";
+                }
+                std::string reply = std::to_string(keys.size());
+                for (const auto &value: store_->mget(keys)) {
+                    reply.append("\n").append(value ? *value : "(nil)");
+                }
+                return reply;
+            } else if (command == "DEL" || command == "UNLINK") {
+                std::vector<std::string> keys;
+                std::string key;
+                while (iss >> key) {
+                    keys.push_back(key);
+                }
+                if (keys.empty()) {
+                    return "error: " + command + " requires at least one key";
+                }
+                return std::to_string(command == "DEL" ? store_->del(keys) : store_->unlink(keys));
+            } else if (command == "FLUSHALL") {
+                std::string mode;
+                iss >> mode;
+                if (!mode.empty() && mode != "ASYNC" && mode != "SYNC") {
+                    return "error: FLUSHALL takes ASYNC or SYNC";
+                }
+                store_->flushall(mode == "ASYNC");
+                return "OK";
+            } else if (command == "INCRBY" || command == "INCR" || command == "DECR") {
+                std::string key;
+                int amount = command == "DECR" ? -1 : 1;
+                if (!(iss >> key) || (command == "INCRBY" && !(iss >> amount))) {
+                    return "error: " + command + " requires a key" + (command == "INCRBY" ? " and integer increment" : "");
+                }
+                auto value = store_->incrby(key, amount);
+                return value ? IntString::render(*value) : "error: value is not an integer or out of range";
+            } else if (command == "LPUSH" || command == "RPUSH") {
+                std::string key, value;
+                std::vector<std::string> values;
+                iss >> key;
+                while (iss >> value) {
+                    values.push_back(std::move(value));
+                }
+                if (values.empty()) {
+                    return "error: " + command + " requires a key and at least one value";
+                }
+                return std::to_string(command == "LPUSH" ? store_->lpush(key, values) : store_->rpush(key, values));
+            } else if (command == "LPOP" || command == "RPOP") {
+                std::string key;
+                if (!(iss >> key)) {
+                    return "error: " + command + " requires a key";
+                }
+                auto value = command == "LPOP" ? store_->lpop(key) : store_->rpop(key);
+                return value ? *value : "(nil)";
+            } else if (command == "LLEN") {
+                std::string key;
+                if (!(iss >> key)) {
+                    return "error: LLEN requires a key";
+                }
+                return std::to_string(store_->llen(key));
+            } else if (command == "LINDEX") {
+                std::string key;
+                int index;
+                if (!(iss >> key >> index)) {
+                    return "error: LINDEX requires a key and index";
+                }
+                auto value = store_->lindex(key, index);
+                return value ? *value : "(nil)";
+            } else if (command == "LRANGE") {
+                std::string key;
+                int start, stop;
+                if (!(iss >> key >> start >> stop)) {
+                    return "error: LRANGE requires a key, start and stop";
+                }
+                auto values = store_->lrange(key, start, stop);
+                std::ostringstream oss;
+                oss << (values ? values->size() : 0);
+                for (const auto &value: values.value_or(std::vector<std::string>{})) {
+                    oss << "\n" << value;
+                }
+                return oss.str();
+            } else if (command == "LTRIM") {
+                std::string key;
+                int start, stop;
+                if (!(iss >> key >> start >> stop)) {
+                    return "error: LTRIM requires a key, start and stop";
+                }
+                return store_->ltrim(key, start, stop) ? "OK" : "(nil)";
+            } else if (command == "LMOVE") {
+                std::string source, destination, from, to;
+                if (!(iss >> source >> destination >> from >> to)) {
+                    return "error: LMOVE requires source, destination, LEFT|RIGHT and LEFT|RIGHT";
+                }
+                auto value = store_->lmove(source, destination, from, to);
+                return value ? *value : "(nil)";
+            } else if (command == "BLPOP" || command == "BRPOP") {
+                std::vector<std::string> args;
+                std::string arg;
+                while (iss >> arg) {
+                    args.push_back(arg);
+                }
+                auto timeout = args.size() >= 2 ? parse_timeout(args.back()) : std::nullopt;
+                if (!timeout) {
+                    return "error: " + command + " requires at least one key and a non-negative timeout";
+                }
+                args.pop_back();
+                blocked_ = true;
+                waiter_ = command == "BLPOP" ? store_->blpop(args, *timeout, unblock_callback(true))
+                                             : store_->brpop(args, *timeout, unblock_callback(true));
+                return std::nullopt;
+            } else if (command == "BLMOVE") {
+                std::string source, destination, from, to, timeout_arg;
+                auto timeout = iss >> source >> destination >> from >> to >> timeout_arg ? parse_timeout(timeout_arg)
+                                                                                        : std::nullopt;
+                if (!timeout || (from != "LEFT" && from != "RIGHT") || (to != "LEFT" && to != "RIGHT")) {
+                    return "error: BLMOVE requires source, destination, LEFT|RIGHT, LEFT|RIGHT and a non-negative timeout";
+                }
+                blocked_ = true;
+                waiter_ = store_->blmove(source, destination, from, to, *timeout, unblock_callback(false));
+                return std::nullopt;
+            } else if (command == "SADD") {
+                std::string key, member;
+                std::vector<std::string> members;
+                iss >> key;
+                while (iss >> member) {
+                    members.push_back(std::move(member));
+                }
+                if (members.empty()) {
+                    return "error: SADD requires a key and at least one member";
+                }
+                return std::to_string(store_->sadd(key, members));
+            } else if (command == "SREM" || command == "SISMEMBER") {
+                std::string key, member;
+                if (!(iss >> key >> member)) {
+                    return "error: " + command + " requires a key and member";
+                }
+                auto result = command == "SREM" ? store_->srem(key, member) : store_->sismember(key, member);
+                return std::to_string(result.value_or(0));
+            } else if (command == "SCARD") {
+                std::string key;
+                if (!(iss >> key)) {
+                    return "error: SCARD requires a key";
+                }
+                return std::to_string(store_->scard(key));
+            } else if (command == "SINTER" || command == "SUNION" || command == "SDIFF") {
+                std::vector<std::string> keys;
+                std::string key;
+                while (iss >> key) {
+                    keys.push_back(key);
+                }
+                if (keys.empty()) {
+                    return "error: " + command + " requires at least one key";
+                }
+                auto store = store_;
+                return offload([store, command, keys]() {
+                    return members_reply(command == "SINTER" ? store->sinter(keys).value_or(std::vector<std::string>{})
+                                         : command == "SUNION" ? store->sunion(keys)
+                                                               : store->sdiff(keys));
+                });
+            } else if (command == "SINTERSTORE" || command == "SUNIONSTORE" || command == "SDIFFSTORE") {
+                std::string dest, key;
+                std::vector<std::string> keys;
+                iss >> dest;
+                while (iss >> key) {
+                    keys.push_back(key);
+                }
+                if (keys.empty()) {
+                    return "error: " + command + " requires a destination and at least one key";
+                }
+                auto store = store_;
+                return offload([store, command, dest, keys]() {
+                    return std::to_string(command == "SINTERSTORE" ? store->sinterstore(dest, keys)
+                                          : command == "SUNIONSTORE" ? store->sunionstore(dest, keys)
+                                                                     : store->sdiffstore(dest, keys));
+                });
+            } else if (command == "SINTERCARD") {
+                // SINTERCARD numkeys key [key ...] [LIMIT limit]
+                std::vector<std::string> args;
+                std::string arg;
+                while (iss >> arg) {
+                    args.push_back(arg);
+                }
+                size_t numkeys = args.empty() || args[0].find_first_not_of("0123456789") != std::string::npos
+                                 ? 0 : std::stoul(args[0]);
+                bool limited = args.size() == numkeys + 3 && args[numkeys + 1] == "LIMIT" &&
+                               args.back().find_first_not_of("0123456789") == std::string::npos;
+                if (numkeys == 0 || (args.size() != numkeys + 1 && !limited)) {
+                    return "error: SINTERCARD requires numkeys, that many keys and an optional LIMIT count";
+                }
+                std::vector<std::string> keys(args.begin() + 1, args.begin() + 1 + numkeys);
+                auto store = store_;
+                auto max = limited ? std::stoul(args.back()) : 0;
+                return offload([store, keys, max]() { return std::to_string(store->sintercard(keys, max)); });
+            } else if (command == "HSET") {
+                std::string key, field, value;
+                std::vector<std::pair<std::string, std::string>> fields;
+                iss >> key;
+                while (iss >> field >> value) {
+                    fields.emplace_back(field, value);
+                }
+                if (fields.empty() || !iss.eof()) {
+                    return "error: HSET requires a key and field value pairs";
+                }
+                return std::to_string(store_->hset(key, fields));
+            } else if (command == "HGET" || command == "HEXISTS") {
+                std::string key, field;
+                if (!(iss >> key >> field)) {
+                    return "error: " + command + " requires a key and field";
+                }
+                if (command == "HEXISTS") {
+                    return store_->hexists(key, field) ? "1" : "0";
+                }
+                auto value = store_->hget(key, field);
+                return value ? *value : "(nil)";
+            } else if (command == "HMGET" || command == "HDEL") {
+                std::string key, field;
+                std::vector<std::string> fields;
+                iss >> key;
+                while (iss >> field) {
+                    fields.push_back(field);
+                }
+                if (fields.empty()) {
+                    return "error: " + command + " requires a key and at least one field";
+                }
+                if (command == "HDEL") {
+                    return std::to_string(store_->hdel(key, fields));
+                }
+                return members_reply(store_->hmget(key, fields).value_or(std::vector<std::string>{}));
+            } else if (command == "HINCRBY") {
+                std::string key, field;
+                int64_t increment;
+                if (!(iss >> key >> field >> increment)) {
+                    return "error: HINCRBY requires a key, field and integer increment";
+                }
+                auto value = store_->hincrby(key, field, increment);
+                return value ? IntString::render(*value) : "(nil)";
+            } else if (command == "HLEN") {
+                std::string key;
+                if (!(iss >> key)) {
+                    return "error: HLEN requires a key";
+                }
+                return std::to_string(store_->hlen(key));
+            } else if (command == "HGETALL") {
+                std::string key;
+                if (!(iss >> key)) {
+                    return "error: HGETALL requires a key";
+                }
+                // one snapshot under a single read, so the reply matches one moment of the hash. only the
+                // rendering is split, into buffers of kReplyBatch fields, so none of them has to grow to the
+                // size of the whole reply
+                auto fields = store_->hgetall(key);
+                size_t items = 2 * fields.size();
+                std::vector<std::shared_ptr<const std::string>> batches;
+                for (size_t i = 0; i < fields.size(); i += kReplyBatch) {
+                    std::string batch;
+                    for (size_t j = i; j < std::min(i + kReplyBatch, fields.size()); ++j) {
+                        batch.append("\n").append(fields[j].first).append("\n").append(fields[j].second);
+                    }
+                    batches.push_back(std::make_shared<const std::string>(std::move(batch)));
+                }
+                if (in_exec_) {
+                    std::string reply = std::to_string(items);
+                    for (const auto &batch: batches) {
+                        reply += *batch;
+                    }
+                    return reply;
+                }
+                deliver(std::make_shared<const std::string>(std::to_string(items)));
+                for (const auto &batch: batches) {
+                    deliver(batch);
+                }
+                return "";
+            } else if (command == "HSCAN" || command == "SSCAN") {
+                // HSCAN|SSCAN key cursor [MATCH pattern] [COUNT count]; replies with the next cursor, then the
+                // count line and items
+                std::string key;
+                uint64_t cursor;
+                ScanOptions options;
+                if (!(iss >> key >> cursor) || !parse_scan_options(iss, options, false)) {
+                    return "error: " + command + " requires a key, a cursor, and optional MATCH and COUNT";
+                }
+                if (command == "SSCAN") {
+                    auto [next, members] = store_->sscan(key, cursor, options.count_, options.pattern_);
+                    return std::to_string(next) + "\n" + members_reply(members);
+                }
+                auto [next, fields] = store_->hscan(key, cursor, options.count_, options.pattern_);
+                return std::to_string(next) + "\n" + std::to_string(2 * fields.size()) + fields_reply(fields);
+            } else if (command == "ZSCAN") {
+                // the cursor is 0 or the hex of the member to resume after
+                std::string key, cursor;
+                ScanOptions options;
+                std::optional<std::string> after;
+                if (!(iss >> key >> cursor) || (cursor != "0" && !(after = from_hex(cursor))) ||
+                    !parse_scan_options(iss, options, false)) {
+                    return "error: ZSCAN requires a key, a cursor, and optional MATCH and COUNT";
+                }
+                auto [next, members] = store_->zscan(key, after, options.count_, options.pattern_);
+                std::ostringstream oss;
+                oss << (next ? to_hex(*next) : "0") << "\n" << 2 * members.size();
+                for (const auto &[member, score]: members) {
+                    oss << "\n" << member << "\n" << score;
+                }
+                return oss.str();
+            } else if (command == "SCAN") {
+                // SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
+                uint64_t cursor;
+                ScanOptions options;
+                if (!(iss >> cursor) || !parse_scan_options(iss, options, true)) {
+                    return "error: SCAN requires a cursor, and optional MATCH, COUNT and TYPE";
+                }
+                auto [next, keys] = store_->scan(cursor, options.count_, options.pattern_, options.type_);
+                return std::to_string(next) + "\n" + members_reply(keys);
+            } else if (command == "KEYS") {
+                // walks the whole keyspace, so it runs off the io thread like the set algebra
+                std::string pattern;
+                if (!(iss >> pattern)) {
+                    return "error: KEYS requires a pattern";
+                }
+                auto store = store_;
+                return offload([store, pattern]() { return members_reply(store->keys(pattern)); });
+            } else if (command == "EVAL" || command == "EVALSHA") {
+                // EVAL script numkeys [key ...] [arg ...]; a script with spaces is sent in double quotes
+                std::string body, arg;
+                size_t numkeys;
+                if (!(iss >> std::quoted(body) >> numkeys)) {
+                    return "error: " + command + " requires a " + (command == "EVAL" ? "script" : "SHA1") +
+                           " and numkeys";
+                }
+                std::vector<std::string> keys, argv;
+                while (iss >> arg) {
+                    (keys.size() < numkeys ? keys : argv).push_back(arg);
+                }
+                if (keys.size() < numkeys) {
+                    return "error: numkeys is greater than the number of arguments";
+                }
+                if (command == "EVAL") {
+                    return script_reply(scripts_->eval(body, keys, argv));
+                }
+                auto result = scripts_->evalsha(body, keys, argv);
+                return result ? script_reply(*result) : "error: NOSCRIPT no script with that SHA1, use EVAL";
+            } else if (command == "SCRIPT") {
+                std::string action, arg;
+                iss >> action;
+                if (action == "LOAD") {
+                    if (!(iss >> std::quoted(arg))) {
+                        return "error: SCRIPT LOAD requires a script";
+                    }
+                    return scripts_->load(arg);
+                } else if (action == "EXISTS") {
+                    std::vector<std::string> found;
+                    while (iss >> arg) {
+                        found.push_back(scripts_->exists(arg) ? "1" : "0");
+                    }
+                    if (found.empty()) {
+                        return "error: SCRIPT EXISTS requires at least one SHA1";
+                    }
+                    return members_reply(found);
+                } else if (action == "FLUSH") {
+                    scripts_->flush();
+                    return "OK";
+                }
+                return "error: SCRIPT requires LOAD, EXISTS or FLUSH";
+            } else if (command == "CLIENT") {
+                return client(iss);
+            } else if (command == "CONFIG") {
+                return config(iss);
+            } else if (command == "ECHO") {
+                // the client's pipe mode sends a random ECHO last and reads replies until it comes back
+                std::string message;
+                if (!(iss >> message)) {
+                    return "error: ECHO requires a message";
+                }
+                return message;
+            } else if (command == "SUBSCRIBE" || command == "PSUBSCRIBE") {
+                bool pattern = command == "PSUBSCRIBE";
+                std::vector<std::string> replies;
+                std::string name;
+                while (iss >> name) {
+                    auto self = std::static_pointer_cast<Subscriber>(shared_from_this());
+                    if (pattern ? patterns_.insert(name).second : channels_.insert(name).second) {
+                        pattern ? pubsub_->psubscribe(self, name) : pubsub_->subscribe(self, name);
+                    }
+                    replies.push_back(subscribe_reply(pattern ? "psubscribe" : "subscribe", name));
+                }
+                if (replies.empty()) {
+                    return "error: " + command + " requires at least one " + (pattern ? "pattern" : "channel");
+                }
+                std::ostringstream oss;
+                for (size_t i = 0; i < replies.size(); ++i) {
+                    oss << (i ? "\n" : "") << replies[i];
+                }
+                return oss.str();
+            } else if (command == "UNSUBSCRIBE" || command == "PUNSUBSCRIBE") {
+                bool pattern = command == "PUNSUBSCRIBE";
+                auto &subscribed = pattern ? patterns_ : channels_;
+                std::vector<std::string> names;
+                std::string name;
+                while (iss >> name) {
+                    names.push_back(name);
+                }
+                if (names.empty()) {
+                    names.assign(subscribed.begin(), subscribed.end());
+                }
+                std::ostringstream oss;
+                for (size_t i = 0; i < names.size(); ++i) {
+                    if (subscribed.erase(names[i])) {
+                        pattern ? pubsub_->punsubscribe(this, names[i]) : pubsub_->unsubscribe(this, names[i]);
+                    }
+                    oss << (i ? "\n" : "") << subscribe_reply(pattern ? "punsubscribe" : "unsubscribe", names[i]);
+                }
+                return names.empty() ? subscribe_reply(pattern ? "punsubscribe" : "unsubscribe", "(nil)") : oss.str();
+            } else if (command == "PUBLISH") {
+                std::string channel, payload;
+                if (!(iss >> channel) || !(iss >> std::ws) || !std::getline(iss, payload)) {
+                    return "error: PUBLISH requires a channel and message";
+                }
+                while (!payload.empty() && (payload.back() == '\n' || payload.back() == '\r')) {
+                    payload.pop_back();
+                }
+                return std::to_string(pubsub_->publish(channel, payload));
             } else {
                 return "unknown command";
             }
@@ -105,8 +1009,34 @@ private:
         }
     }
 
+    // fields rendered per HGETALL buffer
+    static constexpr size_t kReplyBatch = 256;
+
     tcp::socket socket_;
     std::shared_ptr<DataStore> store_;
+    std::shared_ptr<PubSub> pubsub_;
+    std::shared_ptr<ScriptEngine> scripts_;
+    std::shared_ptr<ClientTracking> tracking_;
+    std::shared_ptr<asio::thread_pool> offload_;
+    // CLIENT TRACKING: this client's id while tracking is on, its mode, and where its pushes are posted
+    uint64_t tracking_id_ = 0;
+    bool tracking_bcast_ = false;
+    std::shared_ptr<Subscriber> invalidations_;
+    std::unordered_set<std::string> channels_;
+    std::unordered_set<std::string> patterns_;
+    std::deque<std::shared_ptr<const std::string>> write_queue_;
+    std::vector<std::shared_ptr<const std::string>> in_flight_;
+    bool writing_;
+    std::string input_;
+    bool blocked_;
+    std::shared_ptr<DataStore::ListWaiter> waiter_;
+    // MULTI: the commands queued for EXEC, and whether one was refused so EXEC must abort
+    std::optional<std::vector<std::string>> queued_;
+    bool queue_failed_;
+    // WATCHed keys with the version each had when watched
+    std::vector<std::pair<std::string, uint64_t>> watched_;
+    // set while EXEC runs the queued commands, which then reply inline
+    bool in_exec_;
     enum { max_length = 1024 };
     char data_[max_length];
 };
@@ -115,20 +1045,54 @@ class Server {
 public:
     Server(asio::io_context& io_context, short port)
             : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)),
-              store_(std::make_shared<DataStore>()) {
+              store_(std::make_shared<DataStore>()),
+              pubsub_(std::make_shared<PubSub>()),
+              scripts_(std::make_shared<ScriptEngine>(*store_)),
+              tracking_(std::make_shared<ClientTracking>()),
+              offload_(std::make_shared<asio::thread_pool>(kOffloadThreads)),
+              timer_(io_context) {
+        store_->set_write_listener([tracking = tracking_](std::vector<std::string> keys, bool flushed) {
+            if (flushed) {
+                tracking->invalidate_all();
+            } else {
+                tracking->invalidate(keys);
+            }
+        });
         std::cout << "server created, starting to accept connections" << std::endl;
         do_accept();
+        do_tick();
     }
 
 private:
+    // threads that run long commands such as set algebra away from the io_context thread
+    static constexpr size_t kOffloadThreads = 2;
+
+    // one periodic tick drives every blocked-pop timeout through the store's timer wheel and gives active
+    // defrag its share of the interval
+    void do_tick() {
+        timer_.expires_after(store_->blocked_timeout_resolution());
+        timer_.async_wait([this](boost::system::error_code ec) {
+            if (!ec) {
+                store_->expire_blocked(std::chrono::steady_clock::now());
+                store_->defrag_cycle(store_->blocked_timeout_resolution());
+                do_tick();
+            }
+        });
+    }
+
     void do_accept() {
         std::cout << "waiting for a client to connect..." << std::endl;
         acceptor_.async_accept(
                 [this](boost::system::error_code ec, tcp::socket socket) {
                     if (!ec) {
                         std::cout << "client connected from: " << socket.remote_endpoint() << std::endl;
+                        // replies are already gathered into one write per batch, so holding the last one back
+                        // for the client's delayed ack only stalls pipelined clients waiting on it
+                        boost::system::error_code ignored;
+                        socket.set_option(tcp::no_delay(true), ignored);
                         // original shared ptr to session, goes out of scope
-                        std::make_shared<Session>(std::move(socket), store_)->start();
+                        std::make_shared<Session>(std::move(socket), store_, pubsub_, scripts_, tracking_,
+                                                  offload_)->start();
                     } else {
                         std::cerr << "accept error: " << ec.message() << std::endl;
                     }
@@ -139,6 +1103,11 @@ private:
 
     tcp::acceptor acceptor_;
     std::shared_ptr<DataStore> store_;
+    std::shared_ptr<PubSub> pubsub_;
+    std::shared_ptr<ScriptEngine> scripts_;
+    std::shared_ptr<ClientTracking> tracking_;
+    std::shared_ptr<asio::thread_pool> offload_;
+    asio::steady_timer timer_;
 };
 
 int main(int argc, char* argv[]) {
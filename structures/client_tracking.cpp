@@ -0,0 +1,162 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include "pub_sub.cpp"
+
+// CLIENT TRACKING: which clients cache which keys, and the invalidation pushes sent when those keys are
+// written. a default-mode client is remembered against every key it reads and told once when that key next
+// changes, after which it has to read the key again to be told again. a broadcast client is told of every
+// write to a key starting with one of its prefixes, or to any key without prefixes, whatever it read.
+// pushes are one line, "invalidate <count> <key> ...", and "invalidate 0" once everything was flushed
+class ClientTracking {
+public:
+    // keys remembered for default-mode clients; past this the oldest-looking key is invalidated early, as
+    // the alternative is unbounded memory for keys nobody reads again
+    static constexpr size_t kMaxKeys = 1 << 20;
+
+private:
+    struct Client {
+        std::weak_ptr<Subscriber> subscriber_;
+        bool bcast_;
+        std::vector<std::string> prefixes_;
+    };
+
+    // ids rather than pointers, so a key read by a client that since turned tracking off, or disconnected,
+    // is simply skipped, and a later client at the same address is never told of it
+    std::unordered_map<uint64_t, Client> clients_;
+    std::unordered_map<std::string, std::vector<uint64_t>> keys_;
+    std::vector<uint64_t> bcast_;
+    uint64_t next_id_ = 1;
+    mutable std::mutex mutex_;
+
+    static std::shared_ptr<const std::string> message(const std::vector<const std::string *> &keys) {
+        std::string line = "invalidate " + std::to_string(keys.size());
+        for (auto key: keys) {
+            line.append(" ").append(*key);
+        }
+        return std::make_shared<const std::string>(line + "\n");
+    }
+
+    static bool matches(const Client &client, const std::string &key) {
+        if (client.prefixes_.empty()) {
+            return true;
+        }
+        for (const auto &prefix: client.prefixes_) {
+            if (key.compare(0, prefix.size(), prefix) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // called with mutex_ held; the subscriber is expected to queue the message, not write it
+    void send(uint64_t id, const std::vector<const std::string *> &keys) {
+        auto it = clients_.find(id);
+        if (it == clients_.end()) {
+            return;
+        }
+        if (auto subscriber = it->second.subscriber_.lock()) {
+            subscriber->deliver(message(keys));
+        }
+    }
+
+public:
+    // starts tracking for subscriber and returns its id. deliver is called on whichever thread wrote the
+    // keys, so the subscriber has to hand the push over to its own connection
+    uint64_t enable(const std::shared_ptr<Subscriber> &subscriber, bool bcast, std::vector<std::string> prefixes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto id = next_id_++;
+        clients_.emplace(id, Client{subscriber, bcast, std::move(prefixes)});
+        if (bcast) {
+            bcast_.push_back(id);
+        }
+        return id;
+    }
+
+    // the keys the client read stay behind until they are next written, when the client is skipped
+    void disable(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = clients_.find(id);
+        if (it == clients_.end()) {
+            return;
+        }
+        if (it->second.bcast_) {
+            bcast_.erase(std::find(bcast_.begin(), bcast_.end(), id));
+        }
+        clients_.erase(it);
+    }
+
+    size_t clients() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return clients_.size();
+    }
+
+    size_t tracked_keys() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return keys_.size();
+    }
+
+    // remembers that a default-mode client is about to read keys. called before the read, so a write racing
+    // with it is either seen by the read or invalidates what it returned
+    void track(uint64_t id, const std::vector<std::string> &keys) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &key: keys) {
+            auto it = keys_.find(key);
+            if (it == keys_.end()) {
+                if (keys_.size() >= kMaxKeys) {
+                    auto evicted = keys_.begin();
+                    for (auto client: evicted->second) {
+                        send(client, {&evicted->first});
+                    }
+                    keys_.erase(evicted);
+                }
+                it = keys_.emplace(key, std::vector<uint64_t>()).first;
+            }
+            if (std::find(it->second.begin(), it->second.end(), id) == it->second.end()) {
+                it->second.push_back(id);
+            }
+        }
+    }
+
+    // tells every client tracking any of keys, each in one push, and forgets the default-mode entries
+    void invalidate(const std::vector<std::string> &keys) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unordered_map<uint64_t, std::vector<const std::string *>> pushes;
+        for (const auto &key: keys) {
+            auto it = keys_.find(key);
+            if (it != keys_.end()) {
+                for (auto id: it->second) {
+                    pushes[id].push_back(&key);
+                }
+                keys_.erase(it);
+            }
+            for (auto id: bcast_) {
+                if (matches(clients_.at(id), key)) {
+                    pushes[id].push_back(&key);
+                }
+            }
+        }
+        for (auto &[id, pushed]: pushes) {
+            // a key written twice in one batch is sent once
+            std::sort(pushed.begin(), pushed.end(), [](auto a, auto b) { return *a < *b; });
+            pushed.erase(std::unique(pushed.begin(), pushed.end(), [](auto a, auto b) { return *a == *b; }),
+                         pushed.end());
+            send(id, pushed);
+        }
+    }
+
+    // FLUSHALL: every tracking client drops its whole cache
+    void invalidate_all() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        keys_.clear();
+        for (const auto &[id, client]: clients_) {
+            send(id, {});
+        }
+    }
+};
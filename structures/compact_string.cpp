@@ -0,0 +1,221 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <optional>
+#include "int_string.cpp"
+#include "slab_allocator.cpp"
+
+// binary-safe string in a fixed 48-byte object. up to kInline bytes are stored inside the object next to
+// their length and a kind tag, so a short key or value costs no allocation at all; longer ones live in one
+// heap block laid out as [uint64 length][bytes]. a third kind holds an int64 in place of text for the
+// integer encoding
+class CompactString {
+public:
+    static constexpr size_t kSize = 48;
+    static constexpr size_t kInline = kSize - 2;
+
+private:
+    enum Kind : uint8_t { Inline, Heap, Int };
+    static constexpr size_t kLengthByte = kSize - 2;
+    static constexpr size_t kKindByte = kSize - 1;
+
+    alignas(8) unsigned char bytes_[kSize];
+
+    Kind kind() const {
+        return static_cast<Kind>(bytes_[kKindByte]);
+    }
+
+    char *block() const {
+        char *p;
+        std::memcpy(&p, bytes_, sizeof(p));
+        return p;
+    }
+
+    void assign(std::string_view text) {
+        if (text.size() <= kInline) {
+            std::memcpy(bytes_, text.data(), text.size());
+            bytes_[kLengthByte] = static_cast<unsigned char>(text.size());
+            bytes_[kKindByte] = Inline;
+            return;
+        }
+        uint64_t len = text.size();
+        char *p = KeyspaceAllocator<char>().allocate(sizeof(len) + len);
+        std::memcpy(p, &len, sizeof(len));
+        std::memcpy(p + sizeof(len), text.data(), len);
+        std::memcpy(bytes_, &p, sizeof(p));
+        bytes_[kKindByte] = Heap;
+    }
+
+    void release() {
+        if (kind() == Heap) {
+            char *p = block();
+            uint64_t len;
+            std::memcpy(&len, p, sizeof(len));
+            KeyspaceAllocator<char>().deallocate(p, sizeof(len) + len);
+        }
+        bytes_[kLengthByte] = 0;
+        bytes_[kKindByte] = Inline;
+    }
+
+public:
+    CompactString() {
+        bytes_[kLengthByte] = 0;
+        bytes_[kKindByte] = Inline;
+    }
+
+    // implicit, so maps keyed by CompactString take std::string keys as they are
+    CompactString(const std::string &text) {
+        assign(text);
+    }
+
+    CompactString(std::string_view text) {
+        assign(text);
+    }
+
+    CompactString(const char *text) {
+        assign(text);
+    }
+
+    CompactString(const CompactString &other) {
+        if (other.kind() == Heap) {
+            assign(other.view());
+        } else {
+            std::memcpy(bytes_, other.bytes_, kSize);
+        }
+    }
+
+    CompactString(CompactString &&other) noexcept {
+        std::memcpy(bytes_, other.bytes_, kSize);
+        other.bytes_[kLengthByte] = 0;
+        other.bytes_[kKindByte] = Inline;
+    }
+
+    CompactString &operator=(const CompactString &other) {
+        if (this != &other) {
+            CompactString copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    CompactString &operator=(CompactString &&other) noexcept {
+        if (this != &other) {
+            release();
+            std::memcpy(bytes_, other.bytes_, kSize);
+            other.bytes_[kLengthByte] = 0;
+            other.bytes_[kKindByte] = Inline;
+        }
+        return *this;
+    }
+
+    ~CompactString() {
+        release();
+    }
+
+    static CompactString from_int(int64_t value) {
+        CompactString s;
+        s.set_int(value);
+        return s;
+    }
+
+    bool is_int() const {
+        return kind() == Int;
+    }
+
+    bool is_inline() const {
+        return kind() != Heap;
+    }
+
+    int64_t int_value() const {
+        int64_t value;
+        std::memcpy(&value, bytes_, sizeof(value));
+        return value;
+    }
+
+    void set_int(int64_t value) {
+        release();
+        std::memcpy(bytes_, &value, sizeof(value));
+        bytes_[kKindByte] = Int;
+    }
+
+    // active defrag for values that readers may hold: a copy of the heap block placed in a fuller slab,
+    // leaving this string untouched so it can be retired once readers are done with it
+    std::optional<CompactString> relocated() const {
+#ifndef USE_DEFAULT_ALLOCATOR
+        if (kind() != Heap) {
+            return std::nullopt;
+        }
+        char *p = block();
+        uint64_t len;
+        std::memcpy(&len, p, sizeof(len));
+        void *to = SlabAllocator::instance().relocate(p, sizeof(len) + len);
+        if (!to) {
+            return std::nullopt;
+        }
+        std::memcpy(to, p, sizeof(len) + len);
+        CompactString copy;
+        std::memcpy(copy.bytes_, &to, sizeof(to));
+        copy.bytes_[kKindByte] = Heap;
+        return copy;
+#else
+        return std::nullopt;
+#endif
+    }
+
+    // frees the heap block of a string that relocated() copied straight to its slab, bypassing the thread
+    // cache that would otherwise hand the block out again and refill the sparse slab
+    void release_moved() {
+#ifndef USE_DEFAULT_ALLOCATOR
+        if (kind() == Heap) {
+            char *p = block();
+            uint64_t len;
+            std::memcpy(&len, p, sizeof(len));
+            SlabAllocator::instance().release_moved(p, sizeof(len) + len);
+        }
+#endif
+        bytes_[kLengthByte] = 0;
+        bytes_[kKindByte] = Inline;
+    }
+
+    // the stored text; not available for the integer kind, use str() there
+    std::string_view view() const {
+        if (kind() == Heap) {
+            char *p = block();
+            uint64_t len;
+            std::memcpy(&len, p, sizeof(len));
+            return {p + sizeof(len), static_cast<size_t>(len)};
+        }
+        return {reinterpret_cast<const char *>(bytes_), bytes_[kLengthByte]};
+    }
+
+    std::string str() const {
+        return is_int() ? IntString::render(int_value()) : std::string(view());
+    }
+
+    bool operator==(const CompactString &other) const {
+        if (is_int() || other.is_int()) {
+            return str() == other.str();
+        }
+        return view() == other.view();
+    }
+
+    bool operator!=(const CompactString &other) const {
+        return !(*this == other);
+    }
+
+    struct Hash {
+        size_t operator()(const CompactString &s) const {
+            if (s.is_int()) {
+                char buf[IntString::kMaxLength];
+                return std::hash<std::string_view>{}(std::string_view(buf, IntString::write(s.int_value(), buf)));
+            }
+            return std::hash<std::string_view>{}(s.view());
+        }
+    };
+};
+
+static_assert(sizeof(CompactString) == CompactString::kSize, "CompactString must stay one 48-byte object");
@@ -7,213 +7,1192 @@
 #include <vector>
 #include <limits>
 #include <iostream>
-#include <list>
-#include <set>
 #include <shared_mutex>
+#include <mutex>
+#include <algorithm>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <iterator>
+#include <utility>
+#include <stdexcept>
 #include "skip_list.cpp"
+#include "quick_list.cpp"
+#include "set_object.cpp"
+#include "set_algebra.cpp"
+#include "hash_object.cpp"
+#include "string_value.cpp"
+#include "compact_string.cpp"
+#include "timer_wheel.cpp"
+#include "lazy_free.cpp"
+#include "rcu_map.cpp"
+#include "epoch.cpp"
+#include "glob.cpp"
 
 class DataStore {
+public:
+    // values that take more frees than this to destroy are handed to the lazy freer by UNLINK
+    static constexpr size_t kLazyFreeThreshold = 64;
+
+    // receives the (key, value) a blocked pop was served with, or nullopt when it timed out
+    using BlockedCallback = std::function<void(std::optional<std::pair<std::string, std::string>>)>;
+
+    struct DefragConfig {
+        bool enabled_ = false;
+        // share of each server tick a defrag slice may use
+        size_t cycle_percent_ = 25;
+        // slab bytes above allocated bytes, in percent, before defrag starts
+        size_t threshold_percent_ = 10;
+    };
+
+    struct DefragStats {
+        size_t keys_ = 0;
+        size_t moved_ = 0;
+        // the slice finished a full walk of the keyspace
+        bool pass_done_ = false;
+    };
+
+    struct ListWaiter {
+        std::vector<std::string> keys_;
+        std::string from_;
+        // destination key and side for BLMOVE
+        std::optional<std::pair<std::string, std::string>> to_;
+        BlockedCallback callback_;
+        bool done_ = false;
+    };
+
 private:
-    std::unordered_map<std::string, SkipList> zsets_;
-    std::unordered_map<std::string, std::string> strings_;
-    std::unordered_map<std::string, std::list<std::string>> lists_;
-    std::unordered_map<std::string, std::set<std::string>> sets_;
-    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> hashes_;
-    mutable std::shared_mutex mutex_;
+    using Wakeup = std::pair<BlockedCallback, std::optional<std::pair<std::string, std::string>>>;
+
+    static constexpr size_t kStripeBits = 6;
+    static constexpr size_t kStripes = size_t(1) << kStripeBits;
+    // buckets SCAN may visit per key asked for, bounding a call over a sparse keyspace
+    static constexpr size_t kScanEmptyVisits = 10;
+
+    struct Watch {
+        std::atomic<uint64_t> version_{0};
+        size_t watchers_ = 0;
+    };
+
+    // the keys whose hash selects this stripe, and the lock that guards them. padded to a cache line, so
+    // taking one stripe's lock never invalidates the line holding another's
+    struct alignas(64) Stripe {
+        mutable std::shared_mutex mutex_;
+        // versions of the keys some client WATCHes, bumped by every write to them. entries are added and
+        // removed under the exclusive lock, so writers holding it shared can still look them up
+        std::unordered_map<std::string, Watch> watched_;
+        std::atomic<uint64_t> clock_{0};
+        // looked up without the lock: readers pin an Epoch, writers publish new versions under it
+        RcuMap<SkipList> zsets_;
+        RcuMap<StringValue> strings_;
+        RcuMap<HashObject> hashes_;
+        // edited in place and only read under the lock, but kept in the same maps so SCAN walks one kind of
+        // table
+        RcuMap<QuickList> lists_;
+        RcuMap<SetObject> sets_;
+
+        void swap_keys(Stripe &other) {
+            zsets_.swap(other.zsets_);
+            strings_.swap(other.strings_);
+            hashes_.swap(other.hashes_);
+            lists_.swap(other.lists_);
+            sets_.swap(other.sets_);
+        }
+    };
+
+    // the stripes a multi-key command touches. each is locked once, exclusively when any of its keys is
+    // written, and in stripe order, so commands over overlapping keys can never wait on each other
+    class StripeGuard {
+    private:
+        std::vector<std::pair<std::shared_mutex *, bool>> held_;
+
+    public:
+        StripeGuard(std::array<Stripe, kStripes> &stripes, std::vector<std::pair<size_t, bool>> wanted) {
+            ++written_.depth_;
+            // sorted, so a stripe's exclusive request comes last among its requests
+            std::sort(wanted.begin(), wanted.end());
+            held_.reserve(wanted.size());
+            for (size_t i = 0; i < wanted.size(); ++i) {
+                if (i + 1 < wanted.size() && wanted[i + 1].first == wanted[i].first) {
+                    continue;
+                }
+                auto &mutex = stripes[wanted[i].first].mutex_;
+                if (wanted[i].second) {
+                    mutex.lock();
+                } else {
+                    mutex.lock_shared();
+                }
+                held_.emplace_back(&mutex, wanted[i].second);
+            }
+        }
+
+        StripeGuard(const StripeGuard &) = delete;
+        StripeGuard &operator=(const StripeGuard &) = delete;
+
+        ~StripeGuard() {
+            for (auto it = held_.rbegin(); it != held_.rend(); ++it) {
+                if (it->second) {
+                    it->first->unlock();
+                } else {
+                    it->first->unlock_shared();
+                }
+            }
+            released();
+        }
+    };
+
+    // one stripe's lock for the length of a command, or nothing when the batch running on this thread
+    // already holds the stripe
+    class StripeLock {
+    private:
+        std::shared_mutex *mutex_;
+        bool exclusive_;
+
+    public:
+        StripeLock(std::shared_mutex *mutex, bool exclusive) : mutex_(mutex), exclusive_(exclusive) {
+            ++written_.depth_;
+            if (!mutex_) {
+                return;
+            }
+            if (exclusive_) {
+                mutex_->lock();
+            } else {
+                mutex_->lock_shared();
+            }
+        }
+
+        StripeLock(const StripeLock &) = delete;
+        StripeLock &operator=(const StripeLock &) = delete;
+
+        ~StripeLock() {
+            if (mutex_ && exclusive_) {
+                mutex_->unlock();
+            } else if (mutex_) {
+                mutex_->unlock_shared();
+            }
+            released();
+        }
+    };
+
+    // the EXEC running on this thread: the stripes it holds exclusively, which the commands it runs must not
+    // lock again, and the list keys whose blocked clients are served once it lets go of them
+    struct Batch {
+        const DataStore *store_;
+        std::array<bool, kStripes> held_{};
+        std::vector<std::string> pushed_;
+    };
+
+    static inline thread_local Batch *batch_ = nullptr;
+
+    // the keys this thread wrote under the stripe locks it holds, handed to the write listener once the
+    // outermost of them is released, so the listener never learns of a write before readers can see it
+    struct Written {
+        DataStore *store_ = nullptr;
+        size_t depth_ = 0;
+        std::vector<std::string> keys_;
+        bool flushed_ = false;
+    };
+
+    static inline thread_local Written written_{nullptr, 0, {}, false};
+
+    static void released() {
+        if (--written_.depth_ == 0 && written_.store_) {
+            auto *store = std::exchange(written_.store_, nullptr);
+            auto keys = std::move(written_.keys_);
+            written_.keys_.clear();
+            store->write_listener_(std::move(keys), std::exchange(written_.flushed_, false));
+        }
+    }
+
+    std::array<Stripe, kStripes> stripes_;
+    // clients blocked on each list key, served oldest first. guarded by blocked_mutex_, which is only ever
+    // taken after the stripe locks
+    std::unordered_map<std::string, std::deque<std::shared_ptr<ListWaiter>>> waiters_;
+    TimerWheel<std::shared_ptr<ListWaiter>> blocked_timeouts_;
+    std::mutex blocked_mutex_;
+    // clients currently blocked, so pushes skip blocked_mutex_ when nobody waits
+    std::atomic<size_t> blocked_{0};
+    std::atomic<size_t> list_compress_depth_{0};
+    // guards the defrag config and cursor, and is taken before any stripe
+    mutable std::mutex defrag_mutex_;
+    DefragConfig defrag_config_;
+    // where the next defrag slice resumes: the keyspace being walked, its stripe and bucket, the zset keys of
+    // that bucket still to visit and the member the current zset stopped after
+    int defrag_phase_ = 0;
+    size_t defrag_stripe_ = 0;
+    size_t defrag_bucket_ = 0;
+    std::deque<std::string> defrag_pending_;
+    std::optional<std::string> defrag_member_;
+    size_t defrag_pass_moved_ = 0;
+    // allocated bytes when a full pass last moved nothing; slices are skipped until that changes
+    size_t defrag_idle_at_ = 0;
+    std::atomic<size_t> lazyfree_threshold_{kLazyFreeThreshold};
+    // told of every write while report_writes_ is set, for client tracking
+    std::function<void(std::vector<std::string>, bool)> write_listener_;
+    std::atomic<bool> report_writes_{false};
+    // shared by the set algebra kernels, started on first use
+    std::unique_ptr<ThreadPool> workers_;
+    std::once_flag workers_started_;
+    // frees detached values in the background, started on first use
+    std::unique_ptr<LazyFreer> freer_;
+    std::once_flag freer_started_;
+
+    // the top bits of a multiplicative hash, since the maps inside a stripe index by the low bits and would
+    // otherwise see the same ones for every key
+    static size_t stripe_of(std::string_view key) {
+        uint64_t hash = std::hash<std::string_view>{}(key);
+        return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> (64 - kStripeBits));
+    }
+
+    Stripe &stripe(std::string_view key) {
+        return stripes_[stripe_of(key)];
+    }
+
+    // inside a batch every stripe a command touches was locked up front; taking another one now could
+    // invert the stripe order, so a key EXEC was not given fails the command instead
+    bool held(size_t index) const {
+        if (!batch_ || batch_->store_ != this) {
+            return false;
+        }
+        if (!batch_->held_[index]) {
+            throw std::logic_error("EXEC was not given every key of the batch");
+        }
+        return true;
+    }
+
+    StripeLock lock_key(Stripe &s, bool exclusive) {
+        return StripeLock(held(&s - stripes_.data()) ? nullptr : &s.mutex_, exclusive);
+    }
+
+    StripeGuard lock_keys(const std::vector<std::string> &read, const std::vector<std::string> &written) {
+        std::vector<std::pair<size_t, bool>> wanted;
+        wanted.reserve(read.size() + written.size());
+        for (const auto &key: read) {
+            if (!held(stripe_of(key))) {
+                wanted.emplace_back(stripe_of(key), false);
+            }
+        }
+        for (const auto &key: written) {
+            if (!held(stripe_of(key))) {
+                wanted.emplace_back(stripe_of(key), true);
+            }
+        }
+        return StripeGuard(stripes_, std::move(wanted));
+    }
+
+    StripeGuard lock_all() {
+        std::vector<std::pair<size_t, bool>> wanted;
+        for (size_t i = 0; i < kStripes; ++i) {
+            if (!held(i)) {
+                wanted.emplace_back(i, true);
+            }
+        }
+        return StripeGuard(stripes_, std::move(wanted));
+    }
+
+    // makes a WATCH on key see a write, and queues the key for the write listener. called with the key's
+    // stripe held, shared or exclusive, and only for a write that changed something
+    void touch(Stripe &s, const std::string &key) {
+        if (report_writes_.load(std::memory_order_relaxed)) {
+            written_.store_ = this;
+            written_.keys_.push_back(key);
+        }
+        if (s.watched_.empty()) {
+            return;
+        }
+        auto it = s.watched_.find(key);
+        if (it != s.watched_.end()) {
+            it->second.version_ = ++s.clock_;
+        }
+    }
+
+    ThreadPool *workers() {
+        std::call_once(workers_started_, [this] { workers_ = std::make_unique<ThreadPool>(); });
+        return workers_.get();
+    }
+
+    LazyFreer *freer() {
+        std::call_once(freer_started_, [this] { freer_ = std::make_unique<LazyFreer>(); });
+        return freer_.get();
+    }
+
+    // whether SCAN, DEL and MSETNX see a key. an emptied list, set or zset leaves its map with its last
+    // element, but a zset is only dropped once its stripe is retaken exclusively and can be caught empty
+    template <typename V>
+    static bool holds_data(const V &value) {
+        return !value.empty();
+    }
+
+    static bool holds_data(const StringValue &) {
+        return true;
+    }
+
+    // whether key holds a value of any type
+    static bool exists(const Stripe &s, const std::string &key) {
+        auto holds = [&](const auto &keyspace) {
+            auto value = keyspace.find(key);
+            return value && holds_data(*value);
+        };
+        return holds(s.zsets_) || holds(s.strings_) || holds(s.hashes_) || holds(s.lists_) || holds(s.sets_);
+    }
+
+    // stores every pair, with the stripes of their keys held exclusively. each stripe's string map is sized
+    // for its share of the batch first, so it grows at most once
+    void set_strings(const std::vector<std::pair<std::string, std::string>> &pairs) {
+        std::array<size_t, kStripes> added{};
+        for (const auto &[key, value]: pairs) {
+            ++added[stripe_of(key)];
+        }
+        for (size_t i = 0; i < kStripes; ++i) {
+            if (added[i]) {
+                stripes_[i].strings_.reserve(stripes_[i].strings_.size() + added[i]);
+            }
+        }
+        for (const auto &[key, value]: pairs) {
+            auto &s = stripe(key);
+            touch(s, key);
+            s.strings_.assign(key, StringValue(value));
+        }
+    }
+
+    static std::vector<std::string> keys_of(const std::vector<std::pair<std::string, std::string>> &pairs) {
+        std::vector<std::string> keys;
+        keys.reserve(pairs.size());
+        for (const auto &pair: pairs) {
+            keys.push_back(pair.first);
+        }
+        return keys;
+    }
+
+    // roughly how many deallocations destroying a value takes; packed encodings are a single block
+    static size_t free_effort(const SkipList &zset) {
+        return zset.size();
+    }
+
+    static size_t free_effort(const QuickList &list) {
+        return list.chunk_count();
+    }
+
+    static size_t free_effort(const SetObject &set) {
+        return set.is_intset() ? 1 : set.size();
+    }
+
+    static size_t free_effort(const HashObject &hash) {
+        return hash.is_packed() ? 1 : hash.size();
+    }
+
+    static size_t free_effort(const StringValue &) {
+        return 1;
+    }
+
+    // garbage that lock-free readers may still hold goes through an epoch grace period instead
+    template <typename T>
+    static void free_inline(T &) {}
+
+    template <typename V>
+    static void free_inline(RcuOwned<V> &value) {
+        value.retire();
+    }
+
+    static void free_inline(SkipList::Detached &nodes) {
+        nodes.retire();
+    }
+
+    // takes ownership of garbage and destroys it here, or on the lazy freer when effort is over the threshold
+    template <typename T>
+    void dispose(T garbage, size_t effort) {
+        if (effort > lazyfree_threshold_) {
+            freer()->release(std::move(garbage));
+        } else {
+            free_inline(garbage);
+        }
+    }
+
+    // unlinks the entry in O(1), so only the free itself depends on the size of the value
+    template <typename V>
+    bool remove_key(RcuMap<V> &keyspace, const std::string &key, bool lazy) {
+        auto value = keyspace.extract(key);
+        if (!value) {
+            return false;
+        }
+        bool held = holds_data(*value.get());
+        auto effort = lazy ? free_effort(*value.get()) : 0;
+        dispose(std::move(value), effort);
+        return held;
+    }
+
+    // drops a list, set or zset its last pop or removal emptied. called with the key's stripe held
+    // exclusively
+    template <typename V>
+    static void drop_if_empty(RcuMap<V> &keyspace, const std::string &key) {
+        auto value = keyspace.find(key);
+        if (value && value->empty()) {
+            keyspace.extract(key).retire();
+        }
+    }
+
+    // zsets are edited under the shared lock, so one a removal emptied is dropped after retaking the stripe
+    // exclusively, unless a ZADD refilled it in between
+    void drop_if_empty_zset(Stripe &s, const std::string &key) {
+        auto lock = lock_key(s, true);
+        drop_if_empty(s.zsets_, key);
+    }
+
+    // packed hashes are read without the lock, so a published one is never changed: fn edits a copy that
+    // then replaces it. table-encoded hashes are edited in place and read under the lock. fn returns its
+    // result and whether it changed the hash; only then is the key touched and the copy published. a hash
+    // fn leaves empty is removed. called with the key's stripe held exclusively
+    template <typename F>
+    auto edit_hash(const std::string &key, F &&fn) {
+        auto &hashes = stripe(key).hashes_;
+        auto hash = hashes.find(key);
+        if (hash && !hash->is_packed()) {
+            auto [result, changed] = fn(*hash);
+            if (changed) {
+                touch(stripe(key), key);
+            }
+            if (hash->empty()) {
+                hashes.extract(key).retire();
+            }
+            return result;
+        }
+        HashObject copy = hash ? *hash : HashObject();
+        auto [result, changed] = fn(copy);
+        if (!changed) {
+            return result;
+        }
+        touch(stripe(key), key);
+        if (!copy.empty()) {
+            hashes.assign(key, std::move(copy));
+        } else if (hash) {
+            hashes.extract(key).retire();
+        }
+        return result;
+    }
+
+    // runs fn on the hash at key, or nullptr. a packed hash is read under an epoch pin alone; a table-encoded
+    // one is looked up again under the stripe's shared lock, after the pin is dropped
+    template <typename F>
+    auto read_hash(const std::string &key, F &&fn) {
+        auto &s = stripe(key);
+        {
+            auto guard = Epoch::instance().pin();
+            const HashObject *hash = s.hashes_.find(key);
+            if (!hash || hash->is_packed()) {
+                return fn(hash);
+            }
+        }
+        auto lock = lock_key(s, false);
+        return fn(static_cast<const HashObject *>(s.hashes_.find(key)));
+    }
+
+    size_t remove_keys(const std::vector<std::string> &keys, bool lazy) {
+        auto locks = lock_keys({}, keys);
+        size_t removed = 0;
+        for (const auto &key: keys) {
+            auto &s = stripe(key);
+            bool found = remove_key(s.zsets_, key, lazy);
+            found |= remove_key(s.strings_, key, lazy);
+            found |= remove_key(s.lists_, key, lazy);
+            found |= remove_key(s.sets_, key, lazy);
+            found |= remove_key(s.hashes_, key, lazy);
+            if (found) {
+                touch(s, key);
+            }
+            removed += found;
+        }
+        return removed;
+    }
+
+    // missing keys come back as nullptr
+    std::vector<const SetObject *> find_sets(const std::vector<std::string> &keys) {
+        std::vector<const SetObject *> sets;
+        sets.reserve(keys.size());
+        for (const auto &key: keys) {
+            sets.push_back(stripe(key).sets_.find(key));
+        }
+        return sets;
+    }
+
+    static SetAlgebra::Sets present(std::vector<const SetObject *> sets) {
+        sets.erase(std::remove(sets.begin(), sets.end(), nullptr), sets.end());
+        return sets;
+    }
+
+    size_t store_set(const std::string &dest, const std::vector<std::string> &members) {
+        touch(stripe(dest), dest);
+        auto &sets = stripe(dest).sets_;
+        sets.extract(dest).retire();
+        if (members.empty()) {
+            return 0;
+        }
+        auto set = sets.try_emplace(dest).first;
+        for (const auto &member: members) {
+            set->add(member);
+        }
+        return set->size();
+    }
+
+    size_t push_all(const std::string &key, const std::vector<std::string> &vals, bool front) {
+        size_t size;
+        {
+            auto lock = lock_key(stripe(key), true);
+            touch(stripe(key), key);
+            auto &list = list_at(key);
+            for (const auto &val: vals) {
+                front ? list.push_front(val) : list.push_back(val);
+            }
+            size = list.size();
+        }
+        wake_blocked(key);
+        return size;
+    }
+
+    QuickList &list_at(const std::string &key) {
+        return *stripe(key).lists_.try_emplace(key, list_compress_depth_.load()).first;
+    }
+
+    static std::string pop_side(QuickList &list, const std::string &dir) {
+        return dir == "LEFT" ? *list.pop_front() : *list.pop_back();
+    }
+
+    static void push_side(QuickList &list, const std::string &dir, const std::string &val) {
+        if (dir == "LEFT") {
+            list.push_front(val);
+        } else {
+            list.push_back(val);
+        }
+    }
+
+    // called with blocked_mutex_ held
+    void detach(const std::shared_ptr<ListWaiter> &waiter) {
+        waiter->done_ = true;
+        --blocked_;
+        for (const auto &key: waiter->keys_) {
+            auto it = waiters_.find(key);
+            if (it == waiters_.end()) {
+                continue;
+            }
+            auto &queue = it->second;
+            queue.erase(std::remove(queue.begin(), queue.end(), waiter), queue.end());
+            if (queue.empty()) {
+                waiters_.erase(it);
+            }
+        }
+    }
+
+    std::shared_ptr<ListWaiter> first_waiter(const std::string &key) {
+        auto it = waiters_.find(key);
+        return it == waiters_.end() ? nullptr : it->second.front();
+    }
+
+    // hands elements of key to its waiters in FIFO order; a BLMOVE waiter pushes onto its destination,
+    // which may in turn wake clients blocked there, so keys are processed as a ready queue. called after
+    // the push that filled key released its stripe. each hand-off locks the stripes of key and of the
+    // waiter's destination, so the waiter is picked first and checked again once they are held
+    void serve_blocked(const std::string &key, std::vector<Wakeup> &woken) {
+        std::deque<std::string> ready{key};
+        while (!ready.empty() && blocked_ > 0) {
+            auto current = std::move(ready.front());
+            ready.pop_front();
+
+            while (true) {
+                std::shared_ptr<ListWaiter> waiter;
+                {
+                    std::lock_guard<std::mutex> blocked(blocked_mutex_);
+                    waiter = first_waiter(current);
+                }
+                if (!waiter) {
+                    break;
+                }
+
+                std::vector<std::string> keys{current};
+                if (waiter->to_) {
+                    keys.push_back(waiter->to_->first);
+                }
+                auto locks = lock_keys({}, keys);
+                std::lock_guard<std::mutex> blocked(blocked_mutex_);
+                if (first_waiter(current) != waiter) {
+                    continue;
+                }
+                auto list = stripe(current).lists_.find(current);
+                if (!list || list->empty()) {
+                    break;
+                }
+
+                detach(waiter);
+                auto val = pop_side(*list, waiter->from_);
+                touch(stripe(current), current);
+                if (waiter->to_) {
+                    push_side(list_at(waiter->to_->first), waiter->to_->second, val);
+                    touch(stripe(waiter->to_->first), waiter->to_->first);
+                    ready.push_back(waiter->to_->first);
+                }
+                drop_if_empty(stripe(current).lists_, current);
+                woken.emplace_back(waiter->callback_, std::make_pair(current, std::move(val)));
+            }
+        }
+    }
+
+    // inside an EXEC the key is only noted, and its clients are served once the batch releases its stripes
+    void wake_blocked(const std::string &key) {
+        if (blocked_ == 0) {
+            return;
+        }
+        if (batch_ && batch_->store_ == this) {
+            batch_->pushed_.push_back(key);
+            return;
+        }
+        std::vector<Wakeup> woken;
+        serve_blocked(key, woken);
+        notify(woken);
+    }
+
+    static void notify(std::vector<Wakeup> &woken) {
+        for (auto &[callback, result]: woken) {
+            callback(std::move(result));
+        }
+    }
+
+    // the keys are checked and the waiter queued under their stripes, so a push either finds it queued or
+    // happens before the check and serves it here
+    std::shared_ptr<ListWaiter> block(std::shared_ptr<ListWaiter> waiter, std::chrono::milliseconds timeout) {
+        std::vector<Wakeup> woken;
+        std::optional<std::string> pushed;
+        {
+            auto written = waiter->keys_;
+            if (waiter->to_) {
+                written.push_back(waiter->to_->first);
+            }
+            auto locks = lock_keys({}, written);
+            for (const auto &key: waiter->keys_) {
+                auto list = stripe(key).lists_.find(key);
+                if (!list || list->empty()) {
+                    continue;
+                }
+                auto val = pop_side(*list, waiter->from_);
+                touch(stripe(key), key);
+                if (waiter->to_) {
+                    push_side(list_at(waiter->to_->first), waiter->to_->second, val);
+                    touch(stripe(waiter->to_->first), waiter->to_->first);
+                    pushed = waiter->to_->first;
+                }
+                drop_if_empty(stripe(key).lists_, key);
+                woken.emplace_back(waiter->callback_, std::make_pair(key, std::move(val)));
+                waiter.reset();
+                break;
+            }
+
+            if (waiter) {
+                std::lock_guard<std::mutex> blocked(blocked_mutex_);
+                for (const auto &key: waiter->keys_) {
+                    waiters_[key].push_back(waiter);
+                }
+                ++blocked_;
+                if (timeout.count() > 0) {
+                    blocked_timeouts_.schedule(std::chrono::steady_clock::now() + timeout, waiter);
+                }
+            }
+        }
+        if (pushed) {
+            serve_blocked(*pushed, woken);
+        }
+        notify(woken);
+        return waiter;
+    }
+
+    std::optional<std::string>
+    move_element(const std::string &key1, const std::string &key2, const std::string &dir1, const std::string &dir2) {
+        auto locks = lock_keys({}, {key1, key2});
+        bool left1 = dir1 == "LEFT";
+        bool left2 = dir2 == "LEFT";
+        auto source = stripe(key1).lists_.find(key1);
+        if ((!left1 && dir1 != "RIGHT") || (!left2 && dir2 != "RIGHT") || !source || source->empty()) {
+            return std::nullopt;
+        }
+
+        auto val = *(left1 ? source->pop_front() : source->pop_back());
+        if (left2) {
+            list_at(key2).push_front(val);
+        } else {
+            list_at(key2).push_back(val);
+        }
+        drop_if_empty(stripe(key1).lists_, key1);
+        touch(stripe(key1), key1);
+        touch(stripe(key2), key2);
+        return val;
+    }
 
 public:
+    // zsets are lock-free, so their writers only take the key's stripe shared, which keeps defrag out. it is
+    // taken exclusively just to create a missing key. readers take no lock at all
     bool zadd(const std::string& key, double score, const std::string& member) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        auto& zset = zsets_[key];
-        auto result = zset.insert(member, score);
+        auto &s = stripe(key);
+        {
+            auto lock = lock_key(s, false);
+            if (auto zset = s.zsets_.find(key)) {
+                touch(s, key);
+                return zset->insert(member, score);
+            }
+        }
+        auto lock = lock_key(s, true);
+        touch(s, key);
+        auto zset = s.zsets_.try_emplace(key).first;
+        auto result = zset->insert(member, score);
         return result;
     }
 
+    // ZADD with several members: the key is looked up and its stripe taken once for the whole batch, and
+    // one epoch pin covers every insert, so each skips its own fence. returns how many members were new
+    size_t zadd(const std::string &key, const std::vector<std::pair<double, std::string>> &members) {
+        auto &s = stripe(key);
+        auto insert_all = [&](SkipList &zset) {
+            auto guard = Epoch::instance().pin();
+            touch(s, key);
+            size_t added = 0;
+            for (const auto &[score, member]: members) {
+                added += zset.insert(member, score);
+            }
+            return added;
+        };
+        {
+            auto lock = lock_key(s, false);
+            if (auto zset = s.zsets_.find(key)) {
+                return insert_all(*zset);
+            }
+        }
+        auto lock = lock_key(s, true);
+        return insert_all(*s.zsets_.try_emplace(key).first);
+    }
+
     bool zrem(const std::string &key, const std::string &member) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        std::cout << "ZREM key=" << key << ", member=" << member << std::endl;
-        auto it = zsets_.find(key);
-        if (it == zsets_.end()) {
-            return false;
+        auto &s = stripe(key);
+        bool removed;
+        bool emptied;
+        {
+            auto lock = lock_key(s, false);
+            auto zset = s.zsets_.find(key);
+            if (!zset) {
+                return false;
+            }
+            removed = zset->remove(member);
+            if (removed) {
+                touch(s, key);
+            }
+            emptied = zset->empty();
+        }
+        if (emptied) {
+            drop_if_empty_zset(s, key);
         }
-        return it->second.remove(member);
+        return removed;
     }
 
     std::optional<double> zscore(const std::string &key, const std::string &member) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        std::cout << "ZSCORE key=" << key << ", member=" << member << std::endl;
-        auto it = zsets_.find(key);
-        if (it == zsets_.end()) {
+        auto guard = Epoch::instance().pin();
+        auto zset = stripe(key).zsets_.find(key);
+        if (!zset) {
             return std::nullopt;
         }
-        return it->second.score(member);
+        return zset->score(member);
     }
 
     std::vector<std::pair<std::string, double>> zrange(const std::string &key, double min_score, double max_score, int64_t offset, int64_t count) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto guard = Epoch::instance().pin();
 
-        std::cout << "ZRANGE key=" << key << ", min_score=" << min_score
-                  << ", max_score=" << max_score << ", offset=" << offset << ", count=" << count << std::endl;
-        auto it = zsets_.find(key);
-        if (it == zsets_.end()) {
+        auto zset = stripe(key).zsets_.find(key);
+        if (!zset) {
             return {};
         }
-        return it->second.range(min_score, max_score, offset, count);
+        return zset->range(min_score, max_score, offset, count);
     }
 
     std::vector<std::pair<std::string, double>>
     zquery(const std::string &key, double min_score, const std::string &min_member,
            double max_score, const std::string &max_member,
            int64_t offset, int64_t count) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto guard = Epoch::instance().pin();
 
-        std::cout << "ZQUERY key=" << key << ", min_score=" << min_score << ", min_member=" << min_member
-                  << ", max_score=" << max_score << ", max_member=" << max_member
-                  << ", offset=" << offset << ", count=" << count << std::endl;
-        auto it = zsets_.find(key);
-        if (it == zsets_.end()) {
+        auto zset = stripe(key).zsets_.find(key);
+        if (!zset) {
             return {};
         }
-        return it->second.query(min_score, min_member, max_score, max_member, offset, count);
+        return zset->query(min_score, min_member, max_score, max_member, offset, count);
     }
 
-    void zrange_del(const std::string &key, double min_score, double max_score, int64_t offset, int64_t count) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        std::cout << "ZRANGE_DEL key=" << key << ", min_score=" << min_score
-                  << ", max_score=" << max_score << ", offset=" << offset << ", count=" << count << std::endl;
-        auto it = zsets_.find(key);
-        if (it == zsets_.end()) {
-            return;
+    // the removed nodes are unlinked under the lock and, past the lazy-free threshold, freed in the background
+    size_t zrange_del(const std::string &key, double min_score, double max_score, int64_t offset, int64_t count) {
+        auto &s = stripe(key);
+        size_t n;
+        bool emptied;
+        {
+            auto lock = lock_key(s, false);
+            auto zset = s.zsets_.find(key);
+            if (!zset) {
+                return 0;
+            }
+            auto removed = zset->range_delete(min_score, max_score, offset, count);
+            n = removed.size();
+            if (n > 0) {
+                touch(s, key);
+            }
+            emptied = zset->empty();
+            dispose(std::move(removed), n);
         }
-
-        it->second.range_delete(min_score, max_score, offset, count);
+        if (emptied) {
+            drop_if_empty_zset(s, key);
+        }
+        return n;
     }
 
     void string_set(const std::string &key, const std::string &val) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        strings_[key] = val;
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        touch(s, key);
+        s.strings_.assign(key, StringValue(val));
     }
 
     std::optional<std::string> string_get(const std::string &key) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        auto it = strings_.find(key);
-        if (it == strings_.end()) {
+        auto guard = Epoch::instance().pin();
+        auto value = stripe(key).strings_.find(key);
+        if (!value) {
             return std::nullopt;
-        } else return strings_[key];
+        } else return value->str();
+    }
+
+    // MSET: every stripe involved is locked once, in stripe order, so the pairs land together
+    void mset(const std::vector<std::pair<std::string, std::string>> &pairs) {
+        auto locks = lock_keys({}, keys_of(pairs));
+        set_strings(pairs);
+    }
+
+    // MSETNX: sets nothing, returning false, when any of the keys already holds a value of any type
+    bool msetnx(const std::vector<std::pair<std::string, std::string>> &pairs) {
+        auto locks = lock_keys({}, keys_of(pairs));
+        for (const auto &[key, value]: pairs) {
+            if (exists(stripe(key), key)) {
+                return false;
+            }
+        }
+        set_strings(pairs);
+        return true;
+    }
+
+    // MGET: like GET, under one epoch pin for all the keys
+    std::vector<std::optional<std::string>> mget(const std::vector<std::string> &keys) {
+        auto guard = Epoch::instance().pin();
+        std::vector<std::optional<std::string>> values;
+        values.reserve(keys.size());
+        for (const auto &key: keys) {
+            auto value = stripe(key).strings_.find(key);
+            values.push_back(value ? std::make_optional(value->str()) : std::nullopt);
+        }
+        return values;
     }
 
     bool string_del(const std::string &key) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        auto it = strings_.find(key);
-        if (it == strings_.end()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        if (!remove_key(s.strings_, key, false)) {
             return false;
         }
-        strings_.erase(key);
+        touch(s, key);
         return true;
     }
 
-    std::optional<int64_t> incrby(const std::string &key, int amt) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        auto it = strings_.find(key);
-        if (it == strings_.end()) {
-            strings_[key] = "0";
-            it = strings_.find(key);
+    // removes keys of any type and frees their values inline; returns how many of the keys existed
+    size_t del(const std::vector<std::string> &keys) {
+        return remove_keys(keys, false);
+    }
+
+    // like del, but values over the lazy-free threshold are only detached here and freed in the background
+    size_t unlink(const std::vector<std::string> &keys) {
+        return remove_keys(keys, true);
+    }
+
+    // WATCH: remembers key until the matching unwatch and returns the version exec compares against
+    uint64_t watch(const std::string &key) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        auto &watch = s.watched_[key];
+        if (watch.watchers_++ == 0) {
+            watch.version_ = s.clock_.load();
         }
+        return watch.version_;
+    }
 
-        int64_t val;
-        try {
-            val = std::stoll(it->second);
-        } catch (const std::invalid_argument &e) {
-            return std::nullopt;
-        } catch (const std::out_of_range &e) {
-            return std::nullopt;
+    void unwatch(const std::string &key) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        auto it = s.watched_.find(key);
+        if (it != s.watched_.end() && --it->second.watchers_ == 0) {
+            s.watched_.erase(it);
         }
+    }
 
-        val += amt;
-        it->second = std::to_string(val);
-        return val;
+    // MULTI/EXEC: runs fn with the stripes of keys held exclusively, or every stripe with all_keys, so the
+    // store calls it makes apply as one batch after a single round of locking. the watched keys' stripes are
+    // held too, and fn is skipped, returning false, when any of them was written since its version was taken.
+    // blocked clients woken by the batch are served once it has released its stripes
+    template <typename F>
+    bool exec(const std::vector<std::string> &keys, bool all_keys,
+              const std::vector<std::pair<std::string, uint64_t>> &watched, F &&fn) {
+        assert(!batch_ && "EXEC does not nest");
+        Batch batch{this, {}, {}};
+        {
+            std::vector<std::pair<size_t, bool>> wanted;
+            for (size_t i = 0; all_keys && i < kStripes; ++i) {
+                wanted.emplace_back(i, true);
+            }
+            for (const auto &key: keys) {
+                wanted.emplace_back(stripe_of(key), true);
+            }
+            for (const auto &[key, version]: watched) {
+                wanted.emplace_back(stripe_of(key), true);
+            }
+            StripeGuard locks(stripes_, wanted);
+            for (const auto &[key, version]: watched) {
+                auto &s = stripe(key);
+                auto it = s.watched_.find(key);
+                if (it == s.watched_.end() || it->second.version_ != version) {
+                    return false;
+                }
+            }
+
+            for (const auto &[index, exclusive]: wanted) {
+                batch.held_[index] = true;
+            }
+            struct Running {
+                ~Running() {
+                    batch_ = nullptr;
+                }
+            } running;
+            batch_ = &batch;
+            fn();
+        }
+        for (const auto &key: batch.pushed_) {
+            wake_blocked(key);
+        }
+        return true;
+    }
+
+    // empties every keyspace. the old maps are swapped out whole, with every stripe held so the flush is
+    // atomic, and once no reader can still be on them destroyed here or, with async, by the lazy freer
+    void flushall(bool async) {
+        struct Flushed {
+            std::array<Stripe, kStripes> stripes_;
+
+            ~Flushed() {
+                Epoch::instance().synchronize();
+            }
+        };
+
+        // a defrag slice that was part way through simply finds the flushed keys gone
+        auto flushed = std::make_unique<Flushed>();
+        {
+            auto locks = lock_all();
+            if (report_writes_.load(std::memory_order_relaxed)) {
+                written_.store_ = this;
+                written_.flushed_ = true;
+            }
+            for (size_t i = 0; i < kStripes; ++i) {
+                flushed->stripes_[i].swap_keys(stripes_[i]);
+                for (auto &[key, watch]: stripes_[i].watched_) {
+                    watch.version_ = ++stripes_[i].clock_;
+                }
+            }
+        }
+        if (async) {
+            freer()->release(std::move(flushed));
+        }
+    }
+
+    // listener is called with the keys each write changed, or with flushed set once FLUSHALL emptied the
+    // store, after the locks are released and the new values are visible. set before the store is shared
+    void set_write_listener(std::function<void(std::vector<std::string> keys, bool flushed)> listener) {
+        write_listener_ = std::move(listener);
+    }
+
+    // starting to report waits out the writes in flight, so once it returns any write that went unreported
+    // is already visible to readers
+    void report_writes(bool on) {
+        if (report_writes_.exchange(on) || !on) {
+            return;
+        }
+        auto locks = lock_all();
+    }
+
+    void set_lazyfree_threshold(size_t threshold) {
+        lazyfree_threshold_ = threshold;
+    }
+
+    size_t lazyfree_threshold() const {
+        return lazyfree_threshold_;
+    }
+
+    // blocks until the lazy freer has destroyed everything handed to it so far
+    void lazyfree_drain() {
+        freer()->drain();
+    }
+
+    // values destroyed by the lazy freer so far
+    size_t lazy_freed() {
+        return freer()->freed();
+    }
+
+    // integer values are stored as int64, so a counter never reparses. readers may hold the current version,
+    // so the sum goes into a new 48-byte one that replaces it
+    std::optional<int64_t> incrby(const std::string &key, int amt) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        touch(s, key);
+        auto current = s.strings_.find(key);
+        StringValue next = current ? *current : StringValue::from_int(0);
+        auto result = next.incr(amt);
+        if (result) {
+            s.strings_.assign(key, std::move(next));
+        }
+        return result;
     }
 
     void lpush(const std::string &key, const std::string &val) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        lists_[key].push_front(val);
+        {
+            auto lock = lock_key(stripe(key), true);
+            touch(stripe(key), key);
+            list_at(key).push_front(val);
+        }
+        wake_blocked(key);
     }
 
     void rpush(const std::string &key, const std::string &val) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        lists_[key].push_back(val);
+        {
+            auto lock = lock_key(stripe(key), true);
+            touch(stripe(key), key);
+            list_at(key).push_back(val);
+        }
+        wake_blocked(key);
+    }
+
+    // LPUSH|RPUSH with several values, pushed one after the other under a single lock; blocked clients are
+    // served once the whole batch is in. returns the length of the list after the push
+    size_t lpush(const std::string &key, const std::vector<std::string> &vals) {
+        return push_all(key, vals, true);
+    }
+
+    size_t rpush(const std::string &key, const std::vector<std::string> &vals) {
+        return push_all(key, vals, false);
     }
 
     std::optional<std::string> lpop(const std::string &key) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        if (lists_[key].empty()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        auto list = s.lists_.find(key);
+        if (!list) {
             return std::nullopt;
-        } else {
-            auto val = lists_[key].front();
-            lists_[key].pop_front();
-            return val;
         }
+        auto val = list->pop_front();
+        if (val) {
+            drop_if_empty(s.lists_, key);
+            touch(s, key);
+        }
+        return val;
     }
 
     std::optional<std::string> rpop(const std::string &key) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        if (lists_[key].empty()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        auto list = s.lists_.find(key);
+        if (!list) {
             return std::nullopt;
-        } else {
-            auto val = lists_[key].back();
-            lists_[key].pop_back();
-            return val;
         }
+        auto val = list->pop_back();
+        if (val) {
+            drop_if_empty(s.lists_, key);
+            touch(s, key);
+        }
+        return val;
     }
 
     size_t llen(const std::string &key) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        return lists_[key].size();
+        auto &s = stripe(key);
+        auto lock = lock_key(s, false);
+        auto list = s.lists_.find(key);
+        return list ? list->size() : 0;
     }
 
     std::optional<std::string>
     lmove(const std::string &key1, const std::string &key2, const std::string &dir1, const std::string &dir2) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        if (lists_[key1].empty()) {
-            return std::nullopt;
+        auto result = move_element(key1, key2, dir1, dir2);
+        if (result) {
+            wake_blocked(key2);
         }
+        return result;
+    }
 
-        std::string val;
-        if (dir1 == "LEFT") {
-            val = lists_[key1].front();
-            lists_[key1].pop_front();
-        } else if (dir1 == "RIGHT") {
-            val = lists_[key1].back();
-            lists_[key1].pop_back();
-        } else {
-            return std::nullopt;
+    // blocking pops: served immediately when one of the keys has data (callback runs before returning
+    // nullptr), otherwise the returned waiter stays queued until a push serves it or the timeout fires;
+    // a zero timeout blocks forever
+    std::shared_ptr<ListWaiter>
+    blpop(const std::vector<std::string> &keys, std::chrono::milliseconds timeout, BlockedCallback callback) {
+        return block(std::make_shared<ListWaiter>(ListWaiter{keys, "LEFT", std::nullopt, std::move(callback)}),
+                     timeout);
+    }
+
+    std::shared_ptr<ListWaiter>
+    brpop(const std::vector<std::string> &keys, std::chrono::milliseconds timeout, BlockedCallback callback) {
+        return block(std::make_shared<ListWaiter>(ListWaiter{keys, "RIGHT", std::nullopt, std::move(callback)}),
+                     timeout);
+    }
+
+    std::shared_ptr<ListWaiter>
+    blmove(const std::string &key1, const std::string &key2, const std::string &dir1, const std::string &dir2,
+           std::chrono::milliseconds timeout, BlockedCallback callback) {
+        return block(std::make_shared<ListWaiter>(
+                ListWaiter{{key1}, dir1, std::make_pair(key2, dir2), std::move(callback)}), timeout);
+    }
+
+    // drops a waiter whose client went away; its callback is never invoked
+    void cancel_blocked(const std::shared_ptr<ListWaiter> &waiter) {
+        std::lock_guard<std::mutex> blocked(blocked_mutex_);
+        if (!waiter->done_) {
+            detach(waiter);
         }
+    }
 
-        if (dir2 == "LEFT") {
-            lists_[key2].push_front(val);
-        } else if (dir2 == "RIGHT") {
-            lists_[key2].push_back(val);
-        } else {
-            if (dir1 == "LEFT") {
-                lists_[key1].push_front(val);
-            } else {
-                lists_[key1].push_back(val);
-            }
-            return std::nullopt;
+    // fails every blocked pop whose timeout passed by now; driven by the server's periodic tick
+    size_t expire_blocked(std::chrono::steady_clock::time_point now) {
+        std::vector<BlockedCallback> expired;
+        {
+            std::lock_guard<std::mutex> blocked(blocked_mutex_);
+            blocked_timeouts_.advance(now, [&](const std::shared_ptr<ListWaiter> &waiter) {
+                if (!waiter->done_) {
+                    detach(waiter);
+                    expired.push_back(waiter->callback_);
+                }
+            });
+        }
+        for (auto &callback: expired) {
+            callback(std::nullopt);
         }
+        return expired.size();
+    }
 
-        return val;
+    std::chrono::steady_clock::duration blocked_timeout_resolution() const {
+        return blocked_timeouts_.resolution();
     }
 
+
     std::optional<std::vector<std::string>> lrange(const std::string &key, int start, int stop) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        auto it = lists_.find(key);
-        if (it == lists_.end()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, false);
+        const QuickList *list = s.lists_.find(key);
+        if (!list) {
             return std::nullopt;
         }
 
-        const auto &list = it->second;
-        int size = static_cast<int>(list.size());
+        int size = static_cast<int>(list->size());
 
         if (start < 0) {
             start = std::max(size + start, 0);
@@ -229,26 +1208,162 @@ public:
             return std::vector<std::string>();
         }
 
-        std::vector<std::string> result;
-        auto it_start = list.begin();
-        std::advance(it_start, start);
+        return list->range(start, stop);
+    }
+
+    // chunks kept uncompressed at each end of every list; interior chunks beyond that are LZF-compressed
+    void set_list_compress_depth(size_t depth) {
+        list_compress_depth_ = depth;
+        for (auto &s: stripes_) {
+            std::unique_lock<std::shared_mutex> lock(s.mutex_);
+            s.lists_.for_each([&](std::string_view, QuickList &list) { list.set_compress_depth(depth); });
+        }
+    }
 
-        auto it_stop = list.begin();
-        std::advance(it_stop, stop + 1);
+    size_t list_compress_depth() const {
+        return list_compress_depth_;
+    }
 
-        result.insert(result.end(), it_start, it_stop);
-        return result;
+    void set_defrag_config(const DefragConfig &config) {
+        std::lock_guard<std::mutex> lock(defrag_mutex_);
+        defrag_config_ = config;
+        defrag_idle_at_ = 0;
+    }
+
+    DefragConfig defrag_config() const {
+        std::lock_guard<std::mutex> lock(defrag_mutex_);
+        return defrag_config_;
+    }
+
+    // one bounded slice of active defrag. walks zset nodes and then string values, stripe by stripe, from
+    // where the previous slice stopped, moving objects out of sparse slabs, and returns once the budget is
+    // spent. a stripe is only held while a piece of it is walked, so the budget also bounds how long
+    // commands wait
+    DefragStats defrag_step(std::chrono::microseconds budget) {
+        static constexpr size_t kNodesPerCheck = 64;
+        std::lock_guard<std::mutex> defrag(defrag_mutex_);
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        DefragStats stats;
+
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (defrag_phase_ == 0 && !defrag_pending_.empty()) {
+                auto &s = stripe(defrag_pending_.front());
+                std::unique_lock<std::shared_mutex> lock(s.mutex_);
+                if (auto zset = s.zsets_.find(defrag_pending_.front())) {
+                    defrag_member_ = zset->defrag(defrag_member_, kNodesPerCheck, stats.moved_);
+                } else {
+                    defrag_member_.reset();
+                }
+                if (!defrag_member_) {
+                    defrag_pending_.pop_front();
+                    ++stats.keys_;
+                }
+            } else if (defrag_stripe_ < kStripes) {
+                auto &s = stripes_[defrag_stripe_];
+                std::unique_lock<std::shared_mutex> lock(s.mutex_);
+                if (defrag_phase_ == 0) {
+                    while (defrag_pending_.empty() && defrag_bucket_ < s.zsets_.bucket_count()) {
+                        s.zsets_.for_each_in_bucket(defrag_bucket_, [&](std::string_view key, const SkipList &) {
+                            defrag_pending_.emplace_back(key);
+                        });
+                        ++defrag_bucket_;
+                    }
+                } else {
+                    for (size_t n = 0; n < kNodesPerCheck && defrag_bucket_ < s.strings_.bucket_count();
+                         ++defrag_bucket_, ++n) {
+                        // readers may hold the old version, so a relocated copy replaces it
+                        std::vector<std::pair<std::string, StringValue>> moved;
+                        s.strings_.for_each_in_bucket(defrag_bucket_, [&](std::string_view key,
+                                                                          const StringValue &value) {
+                            if (auto copy = value.relocated()) {
+                                moved.emplace_back(key, std::move(*copy));
+                            }
+                            ++stats.keys_;
+                        });
+                        // the old heap block goes straight back to its sparse slab, as skip-list nodes do
+                        for (auto &[key, value]: moved) {
+                            s.strings_.assign(key, std::move(value), [](void *p) {
+                                static_cast<StringValue *>(p)->release_moved();
+                                keyspace_delete<StringValue>(p);
+                            });
+                        }
+                        stats.moved_ += moved.size();
+                    }
+                }
+                size_t walked = defrag_phase_ == 0 ? s.zsets_.bucket_count() : s.strings_.bucket_count();
+                if (defrag_pending_.empty() && defrag_bucket_ >= walked) {
+                    ++defrag_stripe_;
+                    defrag_bucket_ = 0;
+                }
+            } else if (defrag_phase_ == 0) {
+                defrag_phase_ = 1;
+                defrag_stripe_ = 0;
+            } else {
+                defrag_phase_ = 0;
+                defrag_stripe_ = 0;
+                stats.pass_done_ = true;
+                break;
+            }
+        }
+        return stats;
+    }
+
+    // run from the server tick: when enabled and the slab allocator's overhead is above the threshold,
+    // spends cycle percent of the tick interval on one defrag slice
+    DefragStats defrag_cycle(std::chrono::steady_clock::duration interval) {
+        DefragConfig config;
+        size_t idle_at;
+        {
+            std::lock_guard<std::mutex> lock(defrag_mutex_);
+            config = defrag_config_;
+            idle_at = defrag_idle_at_;
+        }
+        auto memory = SlabAllocator::instance().stats();
+        if (!config.enabled_ || memory.fragmentation() * 100 < 100 + config.threshold_percent_ ||
+            memory.allocated_bytes == idle_at) {
+            return {};
+        }
+
+        auto stats = defrag_step(std::chrono::duration_cast<std::chrono::microseconds>(interval) *
+                                 config.cycle_percent_ / 100);
+        std::lock_guard<std::mutex> lock(defrag_mutex_);
+        defrag_pass_moved_ += stats.moved_;
+        if (stats.pass_done_) {
+            // nothing left to gain at this size; wait for the keyspace to change before walking it again
+            defrag_idle_at_ = defrag_pass_moved_ == 0 ? memory.allocated_bytes : 0;
+            defrag_pass_moved_ = 0;
+        }
+        return stats;
+    }
+
+    std::optional<std::string> lindex(const std::string &key, int index) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, false);
+        const QuickList *list = s.lists_.find(key);
+        if (!list) {
+            return std::nullopt;
+        }
+
+        int size = static_cast<int>(list->size());
+        if (index < 0) {
+            index += size;
+        }
+        if (index < 0 || index >= size) {
+            return std::nullopt;
+        }
+        return list->index(index);
     }
 
     bool ltrim(const std::string &key, int start, int stop) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        auto it = lists_.find(key);
-        if (it == lists_.end()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        auto list = s.lists_.find(key);
+        if (!list) {
             return false;
         }
+        touch(s, key);
 
-        auto &list = it->second;
-        int size = static_cast<int>(list.size());
+        int size = static_cast<int>(list->size());
 
         if (start < 0) start = std::max(size + start, 0);
         if (stop < 0) stop = std::max(size + stop, 0);
@@ -257,159 +1372,371 @@ public:
         stop = std::min(stop, size - 1);
 
         if (start > stop || start >= size) {
-            list.clear();
+            s.lists_.extract(key).retire();
         } else {
-            auto it_start = list.begin();
-            std::advance(it_start, start);
-
-            auto it_stop = list.begin();
-            std::advance(it_stop, stop + 1);
-
-            list.erase(list.begin(), it_start);
-            list.erase(it_stop, list.end());
+            list->trim(start, stop);
         }
 
         return true;
     }
 
-    std::optional<int64_t> sadd(const std::string &key, const std::string member) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        if (sets_[key].find(member) != sets_[key].end()) {
-            return 0;
-        }
+    std::optional<int64_t> sadd(const std::string &key, const std::string &member) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        touch(s, key);
+        return s.sets_.try_emplace(key).first->add(member) ? 1 : 0;
+    }
 
-        sets_[key].insert(member);
-        return 1;
+    // SADD with several members under one lock. a hash-table set is sized for the batch up front, and an
+    // intset the batch converts is sized for the rest of it. returns how many of the members were new
+    size_t sadd(const std::string &key, const std::vector<std::string> &members) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        touch(s, key);
+        auto set = s.sets_.try_emplace(key).first;
+        set->reserve(set->size() + members.size());
+        size_t added = 0;
+        for (size_t i = 0; i < members.size(); ++i) {
+            bool intset = set->is_intset();
+            added += set->add(members[i]);
+            if (intset && !set->is_intset()) {
+                set->reserve(set->size() + members.size() - i - 1);
+            }
+        }
+        return added;
     }
 
     std::optional<int64_t> srem(const std::string &key, const std::string &member) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        if (sets_.find(key) == sets_.end()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        auto set = s.sets_.find(key);
+        if (!set) {
             return std::nullopt;
         }
-
-        if (sets_[key].find(member) == sets_[key].end()) {
+        if (!set->remove(member)) {
             return 0;
         }
-
-        sets_[key].erase(member);
+        drop_if_empty(s.sets_, key);
+        touch(s, key);
         return 1;
     }
 
     std::optional<int64_t> sismember(const std::string &key, const std::string &member) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        if (sets_.find(key) == sets_.end()) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, false);
+        auto set = s.sets_.find(key);
+        if (!set) {
+            return std::nullopt;
+        }
+        return set->contains(member) ? 1 : 0;
+    }
+
+    std::optional<std::vector<std::string>> sinter(const std::vector<std::string> &keys) {
+        auto locks = lock_keys(keys, {});
+        auto sets = find_sets(keys);
+        if (std::find(sets.begin(), sets.end(), nullptr) != sets.end()) {
             return std::nullopt;
         }
-        if (sets_[key].find(member) == sets_[key].end()) {
+        return SetAlgebra::intersect(sets, workers());
+    }
+
+    // stops probing once limit common members are found; 0 counts them all
+    size_t sintercard(const std::vector<std::string> &keys, size_t limit) {
+        auto locks = lock_keys(keys, {});
+        auto sets = find_sets(keys);
+        if (std::find(sets.begin(), sets.end(), nullptr) != sets.end()) {
             return 0;
-        } else {
-            return 1;
         }
+        return SetAlgebra::intersect_card(sets, workers(), limit);
+    }
+
+    // missing keys count as empty sets
+    std::vector<std::string> sunion(const std::vector<std::string> &keys) {
+        auto locks = lock_keys(keys, {});
+        return SetAlgebra::unite(present(find_sets(keys)), workers());
+    }
+
+    std::vector<std::string> sdiff(const std::vector<std::string> &keys) {
+        auto locks = lock_keys(keys, {});
+        auto sets = find_sets(keys);
+        if (sets.empty() || sets[0] == nullptr) {
+            return {};
+        }
+        return SetAlgebra::difference(present(sets), workers());
     }
 
-    std::optional<std::vector<std::string>> sinter(const std::vector<const std::string> keys) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        std::vector<std::string> result;
+    // the STORE variants overwrite dest with the result (removing it when empty) and return its size
+    size_t sinterstore(const std::string &dest, const std::vector<std::string> &keys) {
+        auto locks = lock_keys(keys, {dest});
+        auto sets = find_sets(keys);
+        if (std::find(sets.begin(), sets.end(), nullptr) != sets.end()) {
+            return store_set(dest, {});
+        }
+        return store_set(dest, SetAlgebra::intersect(sets, workers()));
+    }
 
-        auto it = keys.begin();
-        auto prev = it;
-        ++it;
+    size_t sunionstore(const std::string &dest, const std::vector<std::string> &keys) {
+        auto locks = lock_keys(keys, {dest});
+        return store_set(dest, SetAlgebra::unite(present(find_sets(keys)), workers()));
+    }
 
-        while (it != keys.end()) {
-            if (sets_.find(*it) == sets_.end() || sets_.find(*prev) == sets_.end()) {
-                return std::nullopt;
-            }
-            std::set_intersection(sets_[*prev].begin(), sets_[*prev].end(), sets_[*it].begin(), sets_[*it].end(),
-                                  std::inserter(result, result.begin()));
-            prev = it;
-            ++it;
+    size_t sdiffstore(const std::string &dest, const std::vector<std::string> &keys) {
+        auto locks = lock_keys(keys, {dest});
+        auto sets = find_sets(keys);
+        if (sets.empty() || sets[0] == nullptr) {
+            return store_set(dest, {});
         }
-        return result;
+        return store_set(dest, SetAlgebra::difference(present(sets), workers()));
     }
 
     size_t scard(const std::string &key) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        if (sets_.find(key) == sets_.end()) {
-            return 0;
-        }
-        return sets_.find(key)->second.size();
+        auto &s = stripe(key);
+        auto lock = lock_key(s, false);
+        auto set = s.sets_.find(key);
+        return set ? set->size() : 0;
     }
 
     int64_t hset(const std::string &key, const std::vector<std::pair<std::string, std::string>> &fields) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        auto &hash = hashes_[key];
+        auto lock = lock_key(stripe(key), true);
+        return edit_hash(key, [&](HashObject &hash) {
+            int64_t ct = 0;
+            bool changed = false;
+            for (const auto &[field, value]: fields) {
+                if (hash.get(field) == value) {
+                    continue;
+                }
+                changed = true;
+                if (hash.set(field, value)) {
+                    ++ct;
+                }
+            }
+            return std::make_pair(ct, changed);
+        });
+    }
 
-        int64_t ct = 0;
-        for (const auto &[field, value]: fields) {
-            auto [it, inserted] = hash.insert_or_assign(field, value);
-            if (inserted) {
-                ++ct;
+    std::optional<std::string> hget(const std::string &key, const std::string &field) {
+        return read_hash(key, [&](const HashObject *hash) -> std::optional<std::string> {
+            if (!hash) {
+                return std::nullopt;
+            }
+            return hash->get(field);
+        });
+    }
+
+    std::optional<std::vector<std::string>> hmget(const std::string &key, const std::vector<std::string> fields) {
+        return read_hash(key, [&](const HashObject *hash) -> std::optional<std::vector<std::string>> {
+            if (!hash) {
+                return std::nullopt;
             }
-        }
 
-        return ct;
+            std::vector<std::string> result;
+
+            auto it = fields.begin();
+            while (it != fields.end()) {
+                auto value = hash->get(*it);
+                if (value && *value != "") {
+                    result.push_back(*value);
+                }
+                ++it;
+            }
+            return result;
+        });
     }
 
-    std::optional<std::string> hget(const std::string &key, const std::string &field) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        auto hash_it = hashes_.find(key);
-        if (hash_it == hashes_.end()) {
+    std::optional<int64_t> hincrby(const std::string &key, const std::string &field, int64_t increment) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        if (!s.hashes_.find(key)) {
             return std::nullopt;
         }
 
-        auto field_it = hash_it->second.find(field);
-        if (field_it == hash_it->second.end()) {
-            return std::nullopt;
+        return edit_hash(key, [&](HashObject &hash) {
+            auto result = hash.incr(field, increment);
+            return std::make_pair(result, result.has_value());
+        });
+    }
+
+    // removes the key along with its last field
+    int64_t hdel(const std::string &key, const std::vector<std::string> &fields) {
+        auto &s = stripe(key);
+        auto lock = lock_key(s, true);
+        if (!s.hashes_.find(key)) {
+            return 0;
         }
 
-        return field_it->second;
+        return edit_hash(key, [&](HashObject &hash) {
+            int64_t ct = 0;
+            for (const auto &field: fields) {
+                if (hash.remove(field)) {
+                    ++ct;
+                }
+            }
+            return std::make_pair(ct, ct > 0);
+        });
     }
 
-    std::optional<std::vector<std::string>> hmget(const std::string &key, const std::vector<std::string> fields) {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        if (hashes_.find(key) == hashes_.end()) {
-            return std::nullopt;
-        }
+    size_t hlen(const std::string &key) {
+        return read_hash(key, [](const HashObject *hash) -> size_t { return hash ? hash->size() : 0; });
+    }
 
-        std::vector<std::string> result;
+    bool hexists(const std::string &key, const std::string &field) {
+        return read_hash(key, [&](const HashObject *hash) { return hash && hash->contains(field); });
+    }
 
-        auto it = fields.begin();
-        while (it != fields.end()) {
-            if (hashes_[key][*it] != "") {
-                result.push_back(hashes_[key][*it]);
+    std::vector<std::pair<std::string, std::string>> hgetall(const std::string &key) {
+        return read_hash(key, [](const HashObject *hash) {
+            std::vector<std::pair<std::string, std::string>> result;
+            if (hash) {
+                result.reserve(hash->size());
+                hash->for_each([&](const std::string &field, const std::string &value) {
+                    result.emplace_back(field, value);
+                });
             }
-            ++it;
-        }
-        return result;
+            return result;
+        });
     }
 
-    std::optional<int64_t> hincrby(const std::string &key, const std::string &field, int64_t increment) {
-        std::unique_lock<std::shared_mutex> lock(mutex_);
-        auto hash_it = hashes_.find(key);
-        if (hash_it == hashes_.end()) {
-            return std::nullopt;
+    // returns about count fields at or after cursor and the cursor to continue from, 0 when done. fields
+    // present for the whole scan are returned at least once, even if the hash resizes in between. a pattern
+    // keeps only the fields it matches, after the count slots were walked
+    std::pair<uint64_t, std::vector<std::pair<std::string, std::string>>>
+    hscan(const std::string &key, uint64_t cursor, size_t count, const std::string &pattern = "") {
+        Glob glob(pattern.empty() ? "*" : pattern);
+        return read_hash(key, [&](const HashObject *hash) {
+            std::vector<std::pair<std::string, std::string>> fields;
+            if (!hash) {
+                return std::make_pair(uint64_t(0), fields);
+            }
+            uint64_t next = hash->scan(cursor, count, [&](const std::string &field, const std::string &value) {
+                if (glob.matches(field)) {
+                    fields.emplace_back(field, value);
+                }
+            });
+            return std::make_pair(next, fields);
+        });
+    }
+
+    // like hscan, over a set's members
+    std::pair<uint64_t, std::vector<std::string>>
+    sscan(const std::string &key, uint64_t cursor, size_t count, const std::string &pattern = "") {
+        Glob glob(pattern.empty() ? "*" : pattern);
+        auto &s = stripe(key);
+        auto lock = lock_key(s, false);
+        std::vector<std::string> members;
+        const SetObject *set = s.sets_.find(key);
+        if (!set) {
+            return {0, members};
         }
+        uint64_t next = set->scan(cursor, count, [&](const std::string &member) {
+            if (glob.matches(member)) {
+                members.push_back(member);
+            }
+        });
+        return {next, members};
+    }
 
-        auto &hash = hash_it->second;
-        auto field_it = hash.find(field);
+    // up to count members after `after` in member order, and the member to pass as `after` next time, nullopt
+    // once the zset is exhausted. like the other zset reads it takes no lock
+    std::pair<std::optional<std::string>, std::vector<std::pair<std::string, double>>>
+    zscan(const std::string &key, const std::optional<std::string> &after, size_t count,
+          const std::string &pattern = "") {
+        Glob glob(pattern.empty() ? "*" : pattern);
+        auto guard = Epoch::instance().pin();
+        std::vector<std::pair<std::string, double>> members;
+        auto zset = stripe(key).zsets_.find(key);
+        if (!zset) {
+            return {std::nullopt, members};
+        }
+        auto next = zset->scan(after, count, [&](const std::string &member, double score) {
+            if (glob.matches(member)) {
+                members.emplace_back(member, score);
+            }
+        });
+        return {next, members};
+    }
 
-        int64_t curr_value = 0;
-        if (field_it != hash.end()) {
-            try {
-                curr_value = std::stoll(field_it->second);
-            } catch (const std::exception &) {
-                return std::nullopt;
+    // SCAN: the keys in about count buckets from cursor on, and the cursor to continue from, 0 once every key
+    // was seen. the cursor names a stripe, one of its five maps and a bucket cursor within that map, so a
+    // key present for the whole scan is returned at least once however the maps grow in between, and keys
+    // added or removed meanwhile may or may not be. pattern and type (zset, string, hash, list or set) filter
+    // the keys walked, so a call can come back with none and a cursor to go on from. emptied lists, sets and
+    // zsets are left out
+    std::pair<uint64_t, std::vector<std::string>>
+    scan(uint64_t cursor, size_t count, const std::string &pattern = "", const std::string &type = "") {
+        static const char *kinds[] = {"zset", "string", "hash", "list", "set"};
+        count = std::max<size_t>(count, 1);
+        constexpr size_t kKinds = std::size(kinds);
+        constexpr int kBucketBits = 64 - kStripeBits - 3;
+        constexpr uint64_t kBucketMask = (uint64_t(1) << kBucketBits) - 1;
+
+        size_t index = cursor >> (64 - kStripeBits);
+        size_t kind = (cursor >> kBucketBits) & 7;
+        uint64_t bucket = cursor & kBucketMask;
+        Glob glob(pattern.empty() ? "*" : pattern);
+        std::vector<std::string> keys;
+        // buckets visited, and keys walked before filtering, so a sparse table or a selective pattern cannot
+        // turn one call into a full scan
+        size_t visited = 0, walked = 0;
+        auto take = [&](std::string_view key, const auto &value) {
+            ++walked;
+            if (holds_data(value) && glob.matches(key)) {
+                keys.emplace_back(key);
+            }
+        };
+        // a map with no keys, or of another type, is skipped whole without counting as a visit
+        auto walk = [&](const auto &map) {
+            if (map.empty() || (!type.empty() && type != kinds[kind])) {
+                return uint64_t(0);
+            }
+            ++visited;
+            return map.scan(bucket, take);
+        };
+        while (index < kStripes && kind < kKinds && walked < count && visited < count * kScanEmptyVisits) {
+            auto &s = stripes_[index];
+            {
+                auto lock = lock_key(s, false);
+                while (walked < count && visited < count * kScanEmptyVisits) {
+                    switch (kind) {
+                        case 0: bucket = walk(s.zsets_); break;
+                        case 1: bucket = walk(s.strings_); break;
+                        case 2: bucket = walk(s.hashes_); break;
+                        case 3: bucket = walk(s.lists_); break;
+                        default: bucket = walk(s.sets_); break;
+                    }
+                    if (bucket == 0 && ++kind == kKinds) {
+                        break;
+                    }
+                }
+            }
+            if (kind == kKinds) {
+                kind = 0;
+                ++index;
             }
-        } else {
-            hash[field] = "0";
         }
-
-        int64_t new_value = curr_value + increment;
-        hash[field] = std::to_string(new_value);
-
-        return new_value;
+        if (index >= kStripes || kind >= kKinds) {
+            return {0, keys};
+        }
+        return {(uint64_t(index) << (64 - kStripeBits)) | (uint64_t(kind) << kBucketBits) | bucket, keys};
     }
 
-
+    // KEYS: every key matching pattern, one stripe at a time, so writers to the other stripes carry on. a key
+    // written meanwhile may or may not be returned
+    std::vector<std::string> keys(const std::string &pattern) {
+        Glob glob(pattern);
+        std::vector<std::string> keys;
+        auto take = [&](std::string_view key, const auto &value) {
+            if (holds_data(value) && glob.matches(key)) {
+                keys.emplace_back(key);
+            }
+        };
+        for (auto &s: stripes_) {
+            auto lock = lock_key(s, false);
+            s.zsets_.for_each(take);
+            s.strings_.for_each(take);
+            s.hashes_.for_each(take);
+            s.lists_.for_each(take);
+            s.sets_.for_each(take);
+        }
+        return keys;
+    }
 };
\ No newline at end of file
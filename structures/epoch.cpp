@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cassert>
+
+// epoch-based reclamation for the lock-free structures. a thread pins the global epoch for the length of
+// one operation; memory retired while the epoch was e is freed once the epoch reaches e + 2, because the
+// epoch only advances when every pinned thread has seen the current one, so no thread that could still
+// hold a pointer is left by then
+class Epoch {
+private:
+    static constexpr size_t kMaxThreads = 1024;
+    // retired objects a thread collects before it tries to advance the epoch and free its bag
+    static constexpr size_t kCollectEvery = 64;
+
+    // low bit set while pinned, the epoch it pinned in above it
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> state_{0};
+        std::atomic<bool> used_{false};
+    };
+
+    struct Retired {
+        void *p_;
+        void (*deleter_)(void *);
+        uint64_t epoch_;
+    };
+
+    struct Local {
+        Epoch &epoch_;
+        Slot *slot_;
+        size_t depth_ = 0;
+        std::vector<Retired> bag_;
+
+        explicit Local(Epoch &epoch) : epoch_(epoch), slot_(epoch.claim()) {}
+
+        // whatever is still waiting goes to the orphans, freed by whichever thread collects next. nothing is
+        // freed here, since other thread-locals the deleters use may already be gone
+        ~Local() {
+            {
+                std::lock_guard<std::mutex> lock(epoch_.mutex_);
+                epoch_.orphans_.insert(epoch_.orphans_.end(), bag_.begin(), bag_.end());
+            }
+            slot_->state_.store(0);
+            slot_->used_.store(false);
+        }
+    };
+
+    std::atomic<uint64_t> global_{2};
+    std::array<Slot, kMaxThreads> slots_;
+    std::atomic<size_t> high_water_{0};
+    std::mutex mutex_;
+    std::vector<Retired> orphans_;
+
+    Epoch() = default;
+
+    Slot *claim() {
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            bool expected = false;
+            if (!slots_[i].used_.load() && slots_[i].used_.compare_exchange_strong(expected, true)) {
+                size_t high = high_water_.load();
+                while (high < i + 1 && !high_water_.compare_exchange_weak(high, i + 1)) {}
+                return &slots_[i];
+            }
+        }
+        assert(false && "more threads than epoch slots");
+        std::abort();
+    }
+
+    Local &local() {
+        thread_local Local local(*this);
+        return local;
+    }
+
+    // advances the epoch when every pinned thread has seen the current one
+    bool try_advance() {
+        uint64_t now = global_.load();
+        size_t high = high_water_.load();
+        for (size_t i = 0; i < high; ++i) {
+            uint64_t state = slots_[i].state_.load();
+            if ((state & 1) && (state >> 1) != now) {
+                return false;
+            }
+        }
+        return global_.compare_exchange_strong(now, now + 1);
+    }
+
+    static void free_safe(std::vector<Retired> &bag, uint64_t now) {
+        auto keep = bag.begin();
+        for (auto &r: bag) {
+            if (r.epoch_ + 2 <= now) {
+                r.deleter_(r.p_);
+            } else {
+                *keep++ = r;
+            }
+        }
+        bag.erase(keep, bag.end());
+    }
+
+    void collect(Local &local, bool wait_for_orphans = false) {
+        try_advance();
+        uint64_t now = global_.load();
+        if (wait_for_orphans) {
+            mutex_.lock();
+        } else if (!mutex_.try_lock()) {
+            free_safe(local.bag_, now);
+            return;
+        }
+        if (!orphans_.empty()) {
+            free_safe(orphans_, now);
+        }
+        mutex_.unlock();
+        free_safe(local.bag_, now);
+    }
+
+public:
+    // keeps the epoch pinned, and so every object reachable when it was taken alive, until destroyed
+    class Guard {
+    private:
+        Local *local_;
+
+    public:
+        explicit Guard(Local &local) : local_(&local) {}
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        ~Guard() {
+            if (--local_->depth_ == 0) {
+                local_->slot_->state_.store(0);
+            }
+        }
+    };
+
+    // leaked, so threads that exit during static destruction can still hand over their bags
+    static Epoch &instance() {
+        static auto *epoch = new Epoch();
+        return *epoch;
+    }
+
+    // pins nest, only the outermost one publishes the epoch
+    Guard pin() {
+        auto &l = local();
+        if (l.depth_++ == 0) {
+            l.slot_->state_.store((global_.load() << 1) | 1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return Guard(l);
+    }
+
+    // frees p with deleter once no pinned thread can still reach it. p must already be unlinked
+    void retire(void *p, void (*deleter)(void *)) {
+        auto &l = local();
+        l.bag_.push_back({p, deleter, global_.load()});
+        if (l.bag_.size() % kCollectEvery == 0) {
+            collect(l);
+        }
+    }
+
+    template <typename T>
+    void retire(T *p) {
+        retire(p, [](void *q) { delete static_cast<T *>(q); });
+    }
+
+    // waits until every operation pinned before the call has finished, then frees what this thread and
+    // exited threads retired before it. must not be called while pinned
+    void synchronize() {
+        auto &l = local();
+        assert(l.depth_ == 0);
+        uint64_t target = global_.load() + 2;
+        while (global_.load() < target) {
+            if (!try_advance()) {
+                std::this_thread::yield();
+            }
+        }
+        collect(l, true);
+    }
+};
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bitset>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// a glob pattern (*, ?, [abc], [^a-z], \x) compiled once for matching many strings, as SCAN MATCH and KEYS
+// do. most patterns are literal runs joined by stars, like user:*:session: those compare a literal prefix and
+// suffix and find each run in between with a SIMD substring search, leftmost first, which is
+// enough since a star can absorb whatever lies before the next run. patterns with ? or a class check the
+// same prefix and suffix, look for their longest literal run, and only then backtrack over what is left.
+// the tokenizer is shared with GlobTrie, so PSUBSCRIBE patterns parse the same way
+class Glob {
+public:
+    enum class TokenType { Literal, Any, Star, Class };
+
+    struct Token {
+        TokenType type_;
+        char literal_;
+        std::bitset<256> class_;
+    };
+
+    // consecutive stars collapse into one. ranges may be written either way round, and a class that is
+    // never closed matches nothing
+    static std::vector<Token> tokenize(std::string_view pattern) {
+        std::vector<Token> tokens;
+        size_t n = pattern.size();
+
+        for (size_t i = 0; i < n; ++i) {
+            char c = pattern[i];
+            if (c == '*') {
+                if (tokens.empty() || tokens.back().type_ != TokenType::Star) {
+                    tokens.push_back({TokenType::Star, 0, {}});
+                }
+            } else if (c == '?') {
+                tokens.push_back({TokenType::Any, 0, {}});
+            } else if (c == '[') {
+                Token token{TokenType::Class, 0, {}};
+                ++i;
+                bool negate = i < n && pattern[i] == '^';
+                if (negate) {
+                    ++i;
+                }
+                while (i < n && pattern[i] != ']') {
+                    if (pattern[i] == '\\' && i + 1 < n) {
+                        ++i;
+                        token.class_.set(static_cast<unsigned char>(pattern[i]));
+                    } else if (i + 2 < n && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                        auto lo = static_cast<unsigned char>(pattern[i]);
+                        auto hi = static_cast<unsigned char>(pattern[i + 2]);
+                        if (lo > hi) {
+                            std::swap(lo, hi);
+                        }
+                        for (unsigned ch = lo; ch <= hi; ++ch) {
+                            token.class_.set(ch);
+                        }
+                        i += 2;
+                    } else {
+                        token.class_.set(static_cast<unsigned char>(pattern[i]));
+                    }
+                    ++i;
+                }
+                if (i == n) {
+                    token.class_.reset();
+                } else if (negate) {
+                    token.class_.flip();
+                }
+                tokens.push_back(token);
+            } else if (c == '\\' && i + 1 < n) {
+                tokens.push_back({TokenType::Literal, pattern[++i], {}});
+            } else {
+                tokens.push_back({TokenType::Literal, c, {}});
+            }
+        }
+        return tokens;
+    }
+
+    // the first position of needle in text, or npos. two-byte needles and longer compare their first and
+    // last bytes against 16 positions at once and memcmp only the positions where both agree
+    static size_t find(std::string_view text, std::string_view needle) {
+        size_t n = text.size(), k = needle.size();
+        if (k == 0) {
+            return 0;
+        }
+        if (k > n) {
+            return std::string_view::npos;
+        }
+        const char *data = text.data();
+        size_t i = 0;
+        if (k > 1) {
+#if defined(__SSE2__)
+            __m128i first = _mm_set1_epi8(needle[0]);
+            __m128i last = _mm_set1_epi8(needle[k - 1]);
+            for (; i + k - 1 + 16 <= n; i += 16) {
+                __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+                __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + k - 1));
+                auto mask = static_cast<unsigned>(
+                        _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last))));
+                for (; mask; mask &= mask - 1) {
+                    size_t at = i + __builtin_ctz(mask);
+                    if (std::memcmp(data + at + 1, needle.data() + 1, k - 2) == 0) {
+                        return at;
+                    }
+                }
+            }
+#elif defined(__aarch64__)
+            uint8x16_t first = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+            uint8x16_t last = vdupq_n_u8(static_cast<uint8_t>(needle[k - 1]));
+            for (; i + k - 1 + 16 <= n; i += 16) {
+                uint8x16_t head = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i));
+                uint8x16_t tail = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i + k - 1));
+                uint8x16_t eq = vandq_u8(vceqq_u8(head, first), vceqq_u8(tail, last));
+                // narrowed to four bits per position, there being no movemask
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+                for (; mask; mask &= ~(uint64_t(0xf) << (__builtin_ctzll(mask) & ~3))) {
+                    size_t at = i + (__builtin_ctzll(mask) >> 2);
+                    if (std::memcmp(data + at + 1, needle.data() + 1, k - 2) == 0) {
+                        return at;
+                    }
+                }
+            }
+#endif
+        }
+        // the last positions, or every position without SIMD: memchr to each candidate first byte
+        while (i + k <= n) {
+            auto hit = static_cast<const char *>(std::memchr(data + i, needle[0], n - k + 1 - i));
+            if (!hit) {
+                break;
+            }
+            i = hit - data;
+            if (std::memcmp(hit + 1, needle.data() + 1, k - 1) == 0) {
+                return i;
+            }
+            ++i;
+        }
+        return std::string_view::npos;
+    }
+
+private:
+    enum class Plan { Exact, Pieces, General };
+
+    Plan plan_;
+    std::string prefix_;
+    std::string suffix_;
+    // Pieces: the literal runs between stars, in order
+    std::vector<std::string> pieces_;
+    // General: the tokens between prefix_ and suffix_, the longest literal run among them, and whether
+    // they hold a star; without one they match exactly as many characters as there are tokens
+    std::vector<Token> middle_;
+    std::string required_;
+    bool starred_ = false;
+
+    static bool accepts(const Token &token, char c) {
+        switch (token.type_) {
+            case TokenType::Literal:
+                return token.literal_ == c;
+            case TokenType::Class:
+                return token.class_.test(static_cast<unsigned char>(c));
+            default:
+                return true;
+        }
+    }
+
+    // only the latest star is remembered: a mismatch retries from it one character further on, which is
+    // enough for globs and bounds a match by pattern length times text length
+    bool backtrack(std::string_view text) const {
+        size_t p = 0, t = 0;
+        size_t star = std::string_view::npos, resume = 0;
+        while (t < text.size()) {
+            if (p < middle_.size()) {
+                if (middle_[p].type_ == TokenType::Star) {
+                    star = ++p;
+                    resume = t;
+                    continue;
+                }
+                if (accepts(middle_[p], text[t])) {
+                    ++p;
+                    ++t;
+                    continue;
+                }
+            }
+            if (star == std::string_view::npos) {
+                return false;
+            }
+            p = star;
+            t = ++resume;
+        }
+        while (p < middle_.size() && middle_[p].type_ == TokenType::Star) {
+            ++p;
+        }
+        return p == middle_.size();
+    }
+
+public:
+    explicit Glob(std::string_view pattern) {
+        auto tokens = tokenize(pattern);
+        auto literal = [&](size_t i) { return tokens[i].type_ == TokenType::Literal; };
+
+        size_t head = 0;
+        while (head < tokens.size() && literal(head)) {
+            prefix_ += tokens[head++].literal_;
+        }
+        if (head == tokens.size()) {
+            plan_ = Plan::Exact;
+            return;
+        }
+        size_t tail = tokens.size();
+        while (tail > head && literal(tail - 1)) {
+            --tail;
+        }
+        for (size_t i = tail; i < tokens.size(); ++i) {
+            suffix_ += tokens[i].literal_;
+        }
+
+        bool stars_only = std::all_of(tokens.begin() + head, tokens.begin() + tail, [](const Token &token) {
+            return token.type_ == TokenType::Literal || token.type_ == TokenType::Star;
+        });
+        std::string run;
+        for (size_t i = head; i < tail; ++i) {
+            if (literal(i)) {
+                run += tokens[i].literal_;
+                continue;
+            }
+            if (!run.empty()) {
+                if (run.size() > required_.size()) {
+                    required_ = run;
+                }
+                pieces_.push_back(std::move(run));
+                run.clear();
+            }
+        }
+        if (stars_only) {
+            plan_ = Plan::Pieces;
+        } else {
+            plan_ = Plan::General;
+            pieces_.clear();
+            middle_.assign(tokens.begin() + head, tokens.begin() + tail);
+            starred_ = std::any_of(middle_.begin(), middle_.end(),
+                                   [](const Token &token) { return token.type_ == TokenType::Star; });
+        }
+    }
+
+    bool matches(std::string_view text) const {
+        if (plan_ == Plan::Exact) {
+            return text == prefix_;
+        }
+        if (text.size() < prefix_.size() + suffix_.size() || text.substr(0, prefix_.size()) != prefix_ ||
+            text.substr(text.size() - suffix_.size()) != suffix_) {
+            return false;
+        }
+        auto middle = text.substr(prefix_.size(), text.size() - prefix_.size() - suffix_.size());
+        if (plan_ == Plan::Pieces) {
+            for (const auto &piece: pieces_) {
+                size_t at = find(middle, piece);
+                if (at == std::string_view::npos) {
+                    return false;
+                }
+                middle.remove_prefix(at + piece.size());
+            }
+            return true;
+        }
+        if (!starred_ && middle.size() != middle_.size()) {
+            return false;
+        }
+        if (!required_.empty() && find(middle, required_) == std::string_view::npos) {
+            return false;
+        }
+        return backtrack(middle);
+    }
+
+    // for one-off matches; compile a Glob to match many strings against one pattern
+    static bool match(std::string_view pattern, std::string_view text) {
+        return Glob(pattern).matches(text);
+    }
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <bitset>
+#include <unordered_map>
+#include <algorithm>
+#include "glob.cpp"
+
+// glob patterns (*, ?, [abc], [^a-z], \x), tokenized by Glob and compiled into one shared trie, so a single
+// walk over a string finds every matching pattern instead of testing each pattern on its own
+class GlobTrie {
+private:
+    using TokenType = Glob::TokenType;
+    using Token = Glob::Token;
+
+    struct Node {
+        std::unordered_map<char, std::unique_ptr<Node>> literals_;
+        std::unique_ptr<Node> any_;
+        std::unique_ptr<Node> star_;
+        std::vector<std::pair<std::bitset<256>, std::unique_ptr<Node>>> classes_;
+        std::vector<std::string> patterns_;
+        // reached through a '*', so the node can also consume any character and stay put
+        bool looping_ = false;
+
+        bool empty() const {
+            return literals_.empty() && !any_ && !star_ && classes_.empty() && patterns_.empty();
+        }
+    };
+
+    std::unique_ptr<Node> root_;
+    size_t size_;
+
+    static Node *child(Node *node, const Token &token) {
+        switch (token.type_) {
+            case TokenType::Literal: {
+                auto it = node->literals_.find(token.literal_);
+                return it == node->literals_.end() ? nullptr : it->second.get();
+            }
+            case TokenType::Any:
+                return node->any_.get();
+            case TokenType::Star:
+                return node->star_.get();
+            case TokenType::Class:
+                for (auto &[bits, next]: node->classes_) {
+                    if (bits == token.class_) {
+                        return next.get();
+                    }
+                }
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    static Node *add_child(Node *node, const Token &token) {
+        if (auto existing = child(node, token)) {
+            return existing;
+        }
+        auto created = std::make_unique<Node>();
+        auto raw = created.get();
+        switch (token.type_) {
+            case TokenType::Literal:
+                node->literals_.emplace(token.literal_, std::move(created));
+                break;
+            case TokenType::Any:
+                node->any_ = std::move(created);
+                break;
+            case TokenType::Star:
+                raw->looping_ = true;
+                node->star_ = std::move(created);
+                break;
+            case TokenType::Class:
+                node->classes_.emplace_back(token.class_, std::move(created));
+                break;
+        }
+        return raw;
+    }
+
+    static void remove_child(Node *node, const Token &token) {
+        switch (token.type_) {
+            case TokenType::Literal:
+                node->literals_.erase(token.literal_);
+                break;
+            case TokenType::Any:
+                node->any_.reset();
+                break;
+            case TokenType::Star:
+                node->star_.reset();
+                break;
+            case TokenType::Class:
+                node->classes_.erase(std::remove_if(node->classes_.begin(), node->classes_.end(),
+                                                    [&](const auto &entry) { return entry.first == token.class_; }),
+                                     node->classes_.end());
+                break;
+        }
+    }
+
+    // returns true when the node at tokens[idx] became empty and can be pruned by its parent
+    bool erase(Node *node, const std::vector<Token> &tokens, size_t idx, const std::string &pattern) {
+        if (idx == tokens.size()) {
+            auto it = std::find(node->patterns_.begin(), node->patterns_.end(), pattern);
+            if (it == node->patterns_.end()) {
+                return false;
+            }
+            node->patterns_.erase(it);
+            --size_;
+            return node->empty();
+        }
+
+        auto next = child(node, tokens[idx]);
+        if (!next) {
+            return false;
+        }
+        if (erase(next, tokens, idx + 1, pattern)) {
+            remove_child(node, tokens[idx]);
+        }
+        return node->empty();
+    }
+
+    // a star matches the empty string, so entering a node also enters its star child
+    static void enter(const Node *node, std::vector<const Node *> &states) {
+        states.push_back(node);
+        if (node->star_) {
+            states.push_back(node->star_.get());
+        }
+    }
+
+public:
+    GlobTrie() : root_(std::make_unique<Node>()), size_(0) {}
+
+    bool insert(const std::string &pattern) {
+        auto tokens = Glob::tokenize(pattern);
+        Node *node = root_.get();
+        for (const auto &token: tokens) {
+            node = add_child(node, token);
+        }
+        if (std::find(node->patterns_.begin(), node->patterns_.end(), pattern) != node->patterns_.end()) {
+            return false;
+        }
+        node->patterns_.push_back(pattern);
+        ++size_;
+        return true;
+    }
+
+    bool erase(const std::string &pattern) {
+        size_t before = size_;
+        erase(root_.get(), Glob::tokenize(pattern), 0, pattern);
+        return size_ != before;
+    }
+
+    // appends every stored pattern matching str; pointers stay valid until the trie is modified
+    void match(const std::string &str, std::vector<const std::string *> &out) const {
+        std::vector<const Node *> current, next;
+        enter(root_.get(), current);
+
+        for (char c: str) {
+            next.clear();
+            for (auto node: current) {
+                if (node->looping_) {
+                    next.push_back(node);
+                }
+                auto it = node->literals_.find(c);
+                if (it != node->literals_.end()) {
+                    enter(it->second.get(), next);
+                }
+                if (node->any_) {
+                    enter(node->any_.get(), next);
+                }
+                for (const auto &[bits, child]: node->classes_) {
+                    if (bits.test(static_cast<unsigned char>(c))) {
+                        enter(child.get(), next);
+                    }
+                }
+            }
+            std::sort(next.begin(), next.end());
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+            current.swap(next);
+            if (current.empty()) {
+                return;
+            }
+        }
+
+        std::sort(current.begin(), current.end());
+        current.erase(std::unique(current.begin(), current.end()), current.end());
+        for (auto node: current) {
+            for (const auto &pattern: node->patterns_) {
+                out.push_back(&pattern);
+            }
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+};
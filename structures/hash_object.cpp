@@ -0,0 +1,192 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstdint>
+#include "hash_table.cpp"
+#include "string_value.cpp"
+
+// a hash starts packed: fields and values laid back to back in one string as [len][field][len][value]
+// with one-byte lengths, so a small record costs its payload plus two bytes per pair. lookups scan the
+// buffer, which beats hashing at this size. it converts once to a HashTable when it gains too many
+// fields or a field or value too long for the packed form. table values are StringValues, so counters
+// kept in a large hash are stored and incremented as integers
+class HashObject {
+private:
+    static constexpr size_t kMaxPackedEntries = 128;
+    static constexpr size_t kMaxPackedBytes = 64;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    bool packed_;
+    std::string buf_;
+    uint32_t count_;
+    HashTable<StringValue> table_;
+
+    static std::string_view read_at(const std::string &buf, size_t off) {
+        return std::string_view(buf).substr(off + 1, static_cast<uint8_t>(buf[off]));
+    }
+
+    static size_t skip(const std::string &buf, size_t off) {
+        return off + 1 + static_cast<uint8_t>(buf[off]);
+    }
+
+    static void append(std::string &buf, const std::string &s) {
+        buf.push_back(static_cast<char>(s.size()));
+        buf.append(s);
+    }
+
+    // offset of the field's length byte, or npos
+    size_t find_packed(const std::string &field) const {
+        for (size_t off = 0; off < buf_.size(); off = skip(buf_, skip(buf_, off))) {
+            if (read_at(buf_, off) == field) {
+                return off;
+            }
+        }
+        return npos;
+    }
+
+    template <typename F>
+    void for_each_packed(F &&fn) const {
+        for (size_t off = 0; off < buf_.size();) {
+            size_t value_off = skip(buf_, off);
+            fn(std::string(read_at(buf_, off)), std::string(read_at(buf_, value_off)));
+            off = skip(buf_, value_off);
+        }
+    }
+
+    void convert() {
+        table_.reserve(count_ + 1);
+        for_each_packed([&](std::string field, std::string value) {
+            table_.insert_or_assign(field, StringValue(value));
+        });
+        buf_ = std::string();
+        count_ = 0;
+        packed_ = false;
+    }
+
+public:
+    HashObject() : packed_(true), count_(0) {}
+
+    std::optional<std::string> get(const std::string &field) const {
+        if (packed_) {
+            size_t off = find_packed(field);
+            if (off == npos) {
+                return std::nullopt;
+            }
+            return std::string(read_at(buf_, skip(buf_, off)));
+        }
+        auto value = table_.find(field);
+        return value ? std::optional<std::string>(value->str()) : std::nullopt;
+    }
+
+    bool contains(const std::string &field) const {
+        return packed_ ? find_packed(field) != npos : table_.contains(field);
+    }
+
+    // returns true when the field is new
+    bool set(const std::string &field, const std::string &value) {
+        if (packed_) {
+            size_t off = find_packed(field);
+            bool fits = field.size() <= kMaxPackedBytes && value.size() <= kMaxPackedBytes;
+            if (fits && off != npos) {
+                size_t value_off = skip(buf_, off);
+                std::string encoded;
+                append(encoded, value);
+                buf_.replace(value_off, skip(buf_, value_off) - value_off, encoded);
+                return false;
+            }
+            if (fits && count_ < kMaxPackedEntries) {
+                append(buf_, field);
+                append(buf_, value);
+                ++count_;
+                return true;
+            }
+            convert();
+        }
+        return table_.insert_or_assign(field, StringValue(value));
+    }
+
+    // adds by to an integer field, creating it at 0; nullopt when the value is not an integer or the sum
+    // overflows. a packed value is re-rendered into its own slot on the stack, a table value is bumped in place
+    std::optional<int64_t> incr(const std::string &field, int64_t by) {
+        if (packed_) {
+            size_t off = find_packed(field);
+            int64_t current = 0;
+            if (off != npos && !IntString::parse(read_at(buf_, skip(buf_, off)), current)) {
+                return std::nullopt;
+            }
+            int64_t sum;
+            if (!IntString::add(current, by, sum)) {
+                return std::nullopt;
+            }
+
+            char encoded[IntString::kMaxLength + 1];
+            size_t len = IntString::write(sum, encoded + 1);
+            encoded[0] = static_cast<char>(len);
+            if (off != npos) {
+                size_t value_off = skip(buf_, off);
+                buf_.replace(value_off, skip(buf_, value_off) - value_off, encoded, len + 1);
+                return sum;
+            }
+            if (field.size() <= kMaxPackedBytes && count_ < kMaxPackedEntries) {
+                append(buf_, field);
+                buf_.append(encoded, len + 1);
+                ++count_;
+                return sum;
+            }
+            convert();
+        }
+        auto [value, inserted] = table_.try_emplace(field);
+        if (inserted) {
+            *value = StringValue::from_int(0);
+        }
+        return value->incr(by);
+    }
+
+    bool remove(const std::string &field) {
+        if (packed_) {
+            size_t off = find_packed(field);
+            if (off == npos) {
+                return false;
+            }
+            buf_.erase(off, skip(buf_, skip(buf_, off)) - off);
+            --count_;
+            return true;
+        }
+        return table_.erase(field);
+    }
+
+    template <typename F>
+    void for_each(F &&fn) const {
+        if (packed_) {
+            for_each_packed(fn);
+        } else {
+            table_.for_each([&](const std::string &field, const StringValue &value) { fn(field, value.str()); });
+        }
+    }
+
+    // see HashTable::scan; a packed hash is small enough to return whole, ending the scan at once
+    template <typename F>
+    uint64_t scan(uint64_t cursor, size_t count, F &&fn) const {
+        if (packed_) {
+            for_each_packed(fn);
+            return 0;
+        }
+        return table_.scan(cursor, count, [&](const std::string &field, const StringValue &value) {
+            fn(field, value.str());
+        });
+    }
+
+    size_t size() const {
+        return packed_ ? count_ : table_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    bool is_packed() const {
+        return packed_;
+    }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// open-addressing table keyed by string with linear probing. hashes, keys and values live in parallel
+// arrays, so a probe only scans the 8-byte hash array until the stored hash matches. the home slot is
+// taken from the top bits of the hash, which keeps entries ordered by hash across the table: doubling the
+// capacity sends slot s to 2s or 2s+1, and a slot range always corresponds to a hash range
+template <typename V>
+class HashTable {
+private:
+    static constexpr size_t kMinCapacity = 8;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // 0 marks an empty slot
+    std::vector<uint64_t> hashes_;
+    std::vector<std::string> keys_;
+    std::vector<V> values_;
+    size_t size_;
+    int shift_;
+
+    size_t mask() const {
+        return hashes_.size() - 1;
+    }
+
+    size_t find_slot(const std::string &key, uint64_t h) const {
+        if (hashes_.empty()) {
+            return npos;
+        }
+        for (size_t i = home(h);; i = (i + 1) & mask()) {
+            if (hashes_[i] == 0) {
+                return npos;
+            }
+            if (hashes_[i] == h && keys_[i] == key) {
+                return i;
+            }
+        }
+    }
+
+    size_t place(uint64_t h, std::string &&key, V &&value) {
+        size_t i = home(h);
+        while (hashes_[i] != 0) {
+            i = (i + 1) & mask();
+        }
+        hashes_[i] = h;
+        keys_[i] = std::move(key);
+        values_[i] = std::move(value);
+        return i;
+    }
+
+    // visits entries with home slot in [lo, hi) and hash at least min_hash: they sit in [lo, hi) or in the
+    // probe run that spills past hi. entries at the front of the range that spilled in from an earlier
+    // home are skipped
+    template <typename F>
+    void for_each_home_in(size_t lo, size_t hi, uint64_t min_hash, F &&fn) const {
+        for (size_t n = 0; n < hashes_.size(); ++n) {
+            size_t i = (lo + n) & mask();
+            if (hashes_[i] == 0) {
+                if (lo + n >= hi) {
+                    break;
+                }
+                continue;
+            }
+            size_t k = home(hashes_[i]);
+            if (lo <= k && k < hi && hashes_[i] >= min_hash) {
+                fn(keys_[i], values_[i]);
+            }
+        }
+    }
+
+    void rehash(size_t capacity) {
+        auto old_hashes = std::move(hashes_);
+        auto old_keys = std::move(keys_);
+        auto old_values = std::move(values_);
+
+        hashes_.assign(capacity, 0);
+        keys_ = std::vector<std::string>(capacity);
+        values_ = std::vector<V>(capacity);
+        shift_ = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            --shift_;
+        }
+
+        for (size_t i = 0; i < old_hashes.size(); ++i) {
+            if (old_hashes[i] != 0) {
+                place(old_hashes[i], std::move(old_keys[i]), std::move(old_values[i]));
+            }
+        }
+    }
+
+    void grow_for(size_t n) {
+        // keep the load factor at or below 3/4
+        size_t capacity = hashes_.empty() ? kMinCapacity : hashes_.size();
+        while (n * 4 > capacity * 3) {
+            capacity <<= 1;
+        }
+        if (capacity != hashes_.size()) {
+            rehash(capacity);
+        }
+    }
+
+public:
+    HashTable() : size_(0), shift_(64) {}
+
+    static uint64_t hash_of(const std::string &key) {
+        uint64_t h = std::hash<std::string>{}(key) * 0x9E3779B97F4A7C15ull;
+        return h ? h : 1;
+    }
+
+    size_t home(uint64_t h) const {
+        return static_cast<size_t>(h >> shift_);
+    }
+
+    void reserve(size_t n) {
+        grow_for(n);
+    }
+
+    V *find(const std::string &key) {
+        size_t i = find_slot(key, hash_of(key));
+        return i == npos ? nullptr : &values_[i];
+    }
+
+    const V *find(const std::string &key) const {
+        size_t i = find_slot(key, hash_of(key));
+        return i == npos ? nullptr : &values_[i];
+    }
+
+    bool contains(const std::string &key) const {
+        return find_slot(key, hash_of(key)) != npos;
+    }
+
+    // returns the value slot and whether the key was newly inserted
+    std::pair<V *, bool> try_emplace(const std::string &key) {
+        uint64_t h = hash_of(key);
+        size_t i = find_slot(key, h);
+        if (i != npos) {
+            return {&values_[i], false};
+        }
+        grow_for(size_ + 1);
+        ++size_;
+        return {&values_[place(h, std::string(key), V())], true};
+    }
+
+    bool insert_or_assign(const std::string &key, V value) {
+        auto [slot, inserted] = try_emplace(key);
+        *slot = std::move(value);
+        return inserted;
+    }
+
+    // backward-shift deletion: later entries of the probe run slide into the hole, so no tombstones
+    bool erase(const std::string &key) {
+        size_t i = find_slot(key, hash_of(key));
+        if (i == npos) {
+            return false;
+        }
+
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask();
+            if (hashes_[j] == 0) {
+                break;
+            }
+            size_t k = home(hashes_[j]);
+            bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (stays) {
+                continue;
+            }
+            hashes_[i] = hashes_[j];
+            keys_[i] = std::move(keys_[j]);
+            values_[i] = std::move(values_[j]);
+            i = j;
+        }
+        hashes_[i] = 0;
+        keys_[i] = std::string();
+        values_[i] = V();
+        --size_;
+
+        if (hashes_.size() > kMinCapacity && size_ * 8 < hashes_.size()) {
+            size_t capacity = kMinCapacity;
+            while (size_ * 2 > capacity) {
+                capacity <<= 1;
+            }
+            rehash(capacity);
+        }
+        return true;
+    }
+
+    template <typename F>
+    void for_each(F &&fn) const {
+        for (size_t i = 0; i < hashes_.size(); ++i) {
+            if (hashes_[i] != 0) {
+                fn(keys_[i], values_[i]);
+            }
+        }
+    }
+
+    // index of the hash range h falls in when the hash space is cut into parts equal ranges (a power of two)
+    static size_t partition_of(uint64_t h, size_t parts) {
+        int bits = 0;
+        for (size_t p = parts; p > 1; p >>= 1) {
+            ++bits;
+        }
+        return bits == 0 ? 0 : static_cast<size_t>(h >> (64 - bits));
+    }
+
+    // visits only the entries whose hash lies in partition part of parts. because homes are the top bits
+    // of the hash, those entries sit in one contiguous slot range plus whatever its last probe run spilled
+    // past the boundary, so each partition reads about 1/parts of the table
+    template <typename F>
+    void for_each_in_partition(size_t part, size_t parts, F &&fn) const {
+        size_t capacity = hashes_.size();
+        if (capacity < parts) {
+            for (size_t i = 0; i < capacity; ++i) {
+                if (hashes_[i] != 0 && partition_of(hashes_[i], parts) == part) {
+                    fn(keys_[i], values_[i]);
+                }
+            }
+            return;
+        }
+        size_t width = capacity / parts;
+        for_each_home_in(part * width, part * width + width, 0, fn);
+    }
+
+    // cursor-driven iteration for SCAN-style commands: visits the entries hashed at or above cursor in
+    // roughly count slots and returns the cursor to resume from, 0 once the table is exhausted. the cursor
+    // is a hash value rather than a slot, so growing or shrinking between calls neither skips nor repeats
+    // entries that stayed in the table
+    template <typename F>
+    uint64_t scan(uint64_t cursor, size_t count, F &&fn) const {
+        if (hashes_.empty()) {
+            return 0;
+        }
+        size_t lo = home(cursor);
+        size_t hi = std::min(hashes_.size(), lo + std::max<size_t>(count, 1));
+        for_each_home_in(lo, hi, cursor, fn);
+        return hi == hashes_.size() ? 0 : static_cast<uint64_t>(hi) << shift_;
+    }
+
+    void clear() {
+        hashes_.clear();
+        keys_.clear();
+        values_.clear();
+        size_ = 0;
+        shift_ = 64;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    size_t capacity() const {
+        return hashes_.size();
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// sorted, contiguous array of 64-bit members: 8 bytes per member, binary-search lookups
+class IntSet {
+private:
+    static constexpr size_t kBlock = 4;
+
+    std::vector<int64_t> values_;
+
+    static bool block_contains(const int64_t *block, int64_t x) {
+#if defined(__AVX2__)
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi64(values, _mm256_set1_epi64x(x))) != 0;
+#elif defined(__SSE4_1__)
+        __m128i probe = _mm_set1_epi64x(x);
+        __m128i lo = _mm_cmpeq_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block)), probe);
+        __m128i hi = _mm_cmpeq_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 2)), probe);
+        return _mm_movemask_epi8(_mm_or_si128(lo, hi)) != 0;
+#elif defined(__aarch64__)
+        int64x2_t probe = vdupq_n_s64(x);
+        uint64x2_t lo = vceqq_s64(vld1q_s64(block), probe);
+        uint64x2_t hi = vceqq_s64(vld1q_s64(block + 2), probe);
+        return vmaxvq_u32(vreinterpretq_u32_u64(vorrq_u64(lo, hi))) != 0;
+#else
+        return block[0] == x || block[1] == x || block[2] == x || block[3] == x;
+#endif
+    }
+
+    // SIMD galloping: for each probe from the smaller array, gallop over 4-wide blocks of the larger one
+    // until a block's last value reaches the probe, then compare the probe against the whole block at once
+    static void intersect_into(const int64_t *small, size_t small_size, const int64_t *large, size_t large_size,
+                               std::vector<int64_t> &out) {
+        size_t blocks = large_size / kBlock;
+        auto last = [&](size_t b) { return large[b * kBlock + kBlock - 1]; };
+        size_t current = 0;
+
+        for (size_t i = 0; i < small_size; ++i) {
+            int64_t x = small[i];
+
+            if (current < blocks && last(current) < x) {
+                size_t lo = current, step = 1, hi = current + 1;
+                while (hi < blocks && last(hi) < x) {
+                    lo = hi;
+                    step <<= 1;
+                    hi = current + step;
+                }
+                hi = std::min(hi, blocks);
+                // first block in (lo, hi] whose last value is >= x, or blocks when there is none
+                while (lo + 1 < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (last(mid) < x) {
+                        lo = mid;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                current = hi;
+            }
+
+            if (current < blocks) {
+                if (block_contains(large + current * kBlock, x)) {
+                    out.push_back(x);
+                }
+            } else if (std::binary_search(large + blocks * kBlock, large + large_size, x)) {
+                out.push_back(x);
+            }
+        }
+    }
+
+public:
+    bool insert(int64_t value) {
+        auto it = std::lower_bound(values_.begin(), values_.end(), value);
+        if (it != values_.end() && *it == value) {
+            return false;
+        }
+        values_.insert(it, value);
+        return true;
+    }
+
+    bool erase(int64_t value) {
+        auto it = std::lower_bound(values_.begin(), values_.end(), value);
+        if (it == values_.end() || *it != value) {
+            return false;
+        }
+        values_.erase(it);
+        return true;
+    }
+
+    bool contains(int64_t value) const {
+        return std::binary_search(values_.begin(), values_.end(), value);
+    }
+
+    size_t size() const {
+        return values_.size();
+    }
+
+    bool empty() const {
+        return values_.empty();
+    }
+
+    const std::vector<int64_t> &values() const {
+        return values_;
+    }
+
+    static std::vector<int64_t> intersect(const std::vector<int64_t> &a, const std::vector<int64_t> &b) {
+        std::vector<int64_t> out;
+        if (a.size() <= b.size()) {
+            intersect_into(a.data(), a.size(), b.data(), b.size(), out);
+        } else {
+            intersect_into(b.data(), b.size(), a.data(), a.size(), out);
+        }
+        return out;
+    }
+};
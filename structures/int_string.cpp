@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+
+// canonical int64 <-> text conversion shared by the integer encodings. only the canonical spelling
+// parses, so "007" or "+1" stay text and round-trip unchanged
+class IntString {
+public:
+    // longest rendering of an int64, "-9223372036854775808"
+    static constexpr size_t kMaxLength = 20;
+
+    static bool parse(std::string_view text, int64_t &value) {
+        const char *begin = text.data();
+        const char *end = begin + text.size();
+        auto [ptr, ec] = std::from_chars(begin, end, value);
+        if (ec != std::errc() || ptr != end) {
+            return false;
+        }
+        char buf[kMaxLength];
+        auto written = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+        return static_cast<size_t>(written - buf) == text.size();
+    }
+
+    // writes value into buf (at least kMaxLength bytes) without allocating and returns its length
+    static size_t write(int64_t value, char *buf) {
+        return static_cast<size_t>(std::to_chars(buf, buf + kMaxLength, value).ptr - buf);
+    }
+
+    // anything short of 16 characters fits the string's inline buffer, so counters render without allocating
+    static std::string render(int64_t value) {
+        char buf[kMaxLength];
+        return std::string(buf, write(value, buf));
+    }
+
+    // a + b, or false when the sum leaves the int64 range
+    static bool add(int64_t a, int64_t b, int64_t &sum) {
+        return !__builtin_add_overflow(a, b, &sum);
+    }
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
+#include <type_traits>
+
+// one background thread that destroys what it is handed. a large value is detached from the keyspace
+// while its stripe lock is held and its nodes are freed here, so UNLINK or FLUSHALL ASYNC never stalls
+// the other clients behind millions of deallocations
+class LazyFreer {
+private:
+    std::thread thread_;
+    std::deque<std::shared_ptr<void>> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable idle_;
+    size_t pending_;
+    std::atomic<size_t> freed_;
+    bool stop_;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            auto batch = std::move(queue_);
+            queue_.clear();
+            lock.unlock();
+            auto n = batch.size();
+            batch.clear();
+            lock.lock();
+            pending_ -= n;
+            freed_ += n;
+            idle_.notify_all();
+        }
+    }
+
+public:
+    LazyFreer() : pending_(0), freed_(0), stop_(false) {
+        thread_ = std::thread([this] { run(); });
+    }
+
+    // anything still queued is freed before the thread exits
+    ~LazyFreer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    LazyFreer(const LazyFreer &) = delete;
+    LazyFreer &operator=(const LazyFreer &) = delete;
+
+    // takes ownership of object; its destructor runs on the freer thread
+    template <typename T>
+    void release(T &&object) {
+        auto holder = std::make_shared<std::decay_t<T>>(std::forward<T>(object));
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(holder));
+            ++pending_;
+        }
+        cv_.notify_one();
+    }
+
+    // blocks until everything released so far has been freed
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+    size_t pending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_;
+    }
+
+    // objects freed in the background so far
+    size_t freed() const {
+        return freed_;
+    }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <array>
+#include <optional>
+#include <cstdint>
+#include <algorithm>
+
+// byte-oriented LZ77 codec using the LZF stream format: a control byte below 32 starts a run of up to
+// 32 literals, anything else is a back reference of 3..264 bytes up to 8 KB behind the output cursor.
+// there is no entropy stage, so both directions run at memory speed
+class Lzf {
+private:
+    static constexpr size_t kHashBits = 13;
+    static constexpr size_t kMaxOffset = 1 << 13;
+    static constexpr size_t kMaxLiteral = 32;
+    static constexpr size_t kMaxMatch = 264;
+
+    static uint32_t hash(const uint8_t *p) {
+        uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+        return (v * 2654435761u) >> (32 - kHashBits);
+    }
+
+public:
+    // returns nullopt when the input does not shrink, so callers can keep it uncompressed
+    static std::optional<std::string> compress(const std::string &in) {
+        const size_t n = in.size();
+        if (n < 4) {
+            return std::nullopt;
+        }
+
+        auto ip = reinterpret_cast<const uint8_t *>(in.data());
+        std::array<int32_t, 1 << kHashBits> table;
+        table.fill(-1);
+
+        std::string out;
+        out.reserve(n);
+        size_t literal_start = 0;
+
+        auto flush_literals = [&](size_t end) {
+            while (literal_start < end) {
+                size_t run = std::min(kMaxLiteral, end - literal_start);
+                out.push_back(static_cast<char>(run - 1));
+                out.append(in, literal_start, run);
+                literal_start += run;
+            }
+        };
+
+        size_t i = 0;
+        while (i + 2 < n) {
+            uint32_t h = hash(ip + i);
+            int32_t ref = table[h];
+            table[h] = static_cast<int32_t>(i);
+
+            if (ref >= 0 && i - ref <= kMaxOffset &&
+                ip[ref] == ip[i] && ip[ref + 1] == ip[i + 1] && ip[ref + 2] == ip[i + 2]) {
+                size_t max = std::min(kMaxMatch, n - i);
+                size_t len = 3;
+                while (len < max && ip[ref + len] == ip[i + len]) {
+                    ++len;
+                }
+
+                flush_literals(i);
+                size_t off = i - ref - 1;
+                size_t l = len - 2;
+                if (l < 7) {
+                    out.push_back(static_cast<char>((l << 5) | (off >> 8)));
+                } else {
+                    out.push_back(static_cast<char>((7 << 5) | (off >> 8)));
+                    out.push_back(static_cast<char>(l - 7));
+                }
+                out.push_back(static_cast<char>(off & 0xff));
+
+                for (size_t j = i + 1; j < i + len && j + 2 < n; ++j) {
+                    table[hash(ip + j)] = static_cast<int32_t>(j);
+                }
+                i += len;
+                literal_start = i;
+
+                if (out.size() >= n) {
+                    return std::nullopt;
+                }
+            } else {
+                ++i;
+            }
+        }
+
+        flush_literals(n);
+        if (out.size() >= n) {
+            return std::nullopt;
+        }
+        return out;
+    }
+
+    static std::string decompress(const std::string &in, size_t raw_size) {
+        std::string out;
+        out.reserve(raw_size);
+
+        size_t i = 0;
+        while (i < in.size()) {
+            auto ctrl = static_cast<uint8_t>(in[i++]);
+            if (ctrl < kMaxLiteral) {
+                out.append(in, i, ctrl + 1);
+                i += ctrl + 1;
+                continue;
+            }
+
+            size_t len = ctrl >> 5;
+            if (len == 7) {
+                len += static_cast<uint8_t>(in[i++]);
+            }
+            len += 2;
+            size_t ref = out.size() - ((static_cast<size_t>(ctrl & 0x1f) << 8) | static_cast<uint8_t>(in[i++])) - 1;
+            // byte at a time: the reference may overlap the bytes being produced
+            for (size_t k = 0; k < len; ++k) {
+                out.push_back(out[ref + k]);
+            }
+        }
+        return out;
+    }
+};
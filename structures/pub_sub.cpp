@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include "glob_trie.cpp"
+
+class Subscriber {
+public:
+    virtual ~Subscriber() = default;
+
+    // message is already framed for the wire and shared by every receiver of the same publish
+    virtual void deliver(const std::shared_ptr<const std::string> &message) = 0;
+};
+
+class PubSub {
+private:
+    using Subscribers = std::vector<std::shared_ptr<Subscriber>>;
+
+    std::unordered_map<std::string, Subscribers> channels_;
+    std::unordered_map<std::string, Subscribers> patterns_;
+    GlobTrie trie_;
+    mutable std::shared_mutex mutex_;
+
+    static bool add(Subscribers &subscribers, const std::shared_ptr<Subscriber> &subscriber) {
+        if (std::find(subscribers.begin(), subscribers.end(), subscriber) != subscribers.end()) {
+            return false;
+        }
+        subscribers.push_back(subscriber);
+        return true;
+    }
+
+    static bool remove(Subscribers &subscribers, const Subscriber *subscriber) {
+        auto it = std::find_if(subscribers.begin(), subscribers.end(),
+                               [&](const auto &s) { return s.get() == subscriber; });
+        if (it == subscribers.end()) {
+            return false;
+        }
+        // fan-out order is not guaranteed, so swap with the back instead of shifting the tail
+        std::swap(*it, subscribers.back());
+        subscribers.pop_back();
+        return true;
+    }
+
+    static size_t fan_out(const Subscribers &subscribers, const std::shared_ptr<const std::string> &message) {
+        for (const auto &subscriber: subscribers) {
+            subscriber->deliver(message);
+        }
+        return subscribers.size();
+    }
+
+public:
+    bool subscribe(const std::shared_ptr<Subscriber> &subscriber, const std::string &channel) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        return add(channels_[channel], subscriber);
+    }
+
+    bool unsubscribe(const Subscriber *subscriber, const std::string &channel) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = channels_.find(channel);
+        if (it == channels_.end() || !remove(it->second, subscriber)) {
+            return false;
+        }
+        if (it->second.empty()) {
+            channels_.erase(it);
+        }
+        return true;
+    }
+
+    bool psubscribe(const std::shared_ptr<Subscriber> &subscriber, const std::string &pattern) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto &subscribers = patterns_[pattern];
+        if (subscribers.empty()) {
+            trie_.insert(pattern);
+        }
+        return add(subscribers, subscriber);
+    }
+
+    bool punsubscribe(const Subscriber *subscriber, const std::string &pattern) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = patterns_.find(pattern);
+        if (it == patterns_.end() || !remove(it->second, subscriber)) {
+            return false;
+        }
+        if (it->second.empty()) {
+            patterns_.erase(it);
+            trie_.erase(pattern);
+        }
+        return true;
+    }
+
+    // serializes the message once per channel/pattern and hands the same buffer to every subscriber
+    size_t publish(const std::string &channel, const std::string &payload) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        size_t receivers = 0;
+
+        auto it = channels_.find(channel);
+        if (it != channels_.end()) {
+            auto message = std::make_shared<const std::string>("message " + channel + " " + payload + "\n");
+            receivers += fan_out(it->second, message);
+        }
+
+        if (!trie_.empty()) {
+            std::vector<const std::string *> matched;
+            trie_.match(channel, matched);
+            for (auto pattern: matched) {
+                auto message = std::make_shared<const std::string>(
+                        "pmessage " + *pattern + " " + channel + " " + payload + "\n");
+                receivers += fan_out(patterns_.find(*pattern)->second, message);
+            }
+        }
+
+        return receivers;
+    }
+
+    size_t numsub(const std::string &channel) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = channels_.find(channel);
+        return it == channels_.end() ? 0 : it->second.size();
+    }
+
+    size_t numpat() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return patterns_.size();
+    }
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <optional>
+#include <algorithm>
+#include <cstdint>
+#include "lzf.cpp"
+
+// list stored as a deque of chunks, each holding up to kMaxChunkEntries values packed back to back as
+// [varint len][bytes][reversed varint len], so a chunk can be walked from either end without a heap
+// node per element. every chunk records the absolute position of its first entry; pushes and pops only
+// touch the end chunks, so positions stay sorted and a binary search finds the chunk for any index.
+// with a non-zero compress depth, chunks further than that many chunks from either end are stored
+// LZF-compressed and only decoded when a read or write reaches them
+class QuickList {
+private:
+    static constexpr size_t kMaxChunkBytes = 8192;
+    static constexpr uint32_t kMaxChunkEntries = 128;
+    static constexpr size_t kMinCompressBytes = 48;
+
+    struct Chunk {
+        std::string buf_;
+        uint32_t count_ = 0;
+        int64_t start_ = 0;
+        // buf_ holds the LZF stream and raw_size_ the decoded length
+        bool compressed_ = false;
+        uint32_t raw_size_ = 0;
+    };
+
+    std::deque<Chunk> chunks_;
+    // absolute position of element 0; moves down on push_front and up on pop_front
+    int64_t origin_;
+    size_t size_;
+    size_t compress_depth_;
+
+    static size_t varint_size(uint32_t len) {
+        size_t n = 1;
+        while (len >= 0x80) {
+            len >>= 7;
+            ++n;
+        }
+        return n;
+    }
+
+    static std::string encode(const std::string &val) {
+        auto len = static_cast<uint32_t>(val.size());
+        char header[5];
+        size_t n = 0;
+        do {
+            uint8_t byte = len & 0x7f;
+            len >>= 7;
+            header[n++] = static_cast<char>(len ? byte | 0x80 : byte);
+        } while (len);
+
+        std::string entry;
+        entry.reserve(2 * n + val.size());
+        entry.append(header, n);
+        entry.append(val);
+        for (size_t i = n; i > 0; --i) {
+            entry.push_back(header[i - 1]);
+        }
+        return entry;
+    }
+
+    // decodes the length whose first varint byte is at p, stepping by dir (+1 forward, -1 backward)
+    static uint32_t decode(const char *p, int dir) {
+        uint32_t len = 0;
+        int shift = 0;
+        while (true) {
+            auto byte = static_cast<uint8_t>(*p);
+            len |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return len;
+            }
+            shift += 7;
+            p += dir;
+        }
+    }
+
+    static size_t entry_size(uint32_t len) {
+        return 2 * varint_size(len) + len;
+    }
+
+    // byte offset of the k-th entry, walking from whichever end of the chunk is closer
+    static size_t offset_of(const std::string &buf, uint32_t count, uint32_t k) {
+        if (k <= count / 2) {
+            size_t off = 0;
+            for (uint32_t i = 0; i < k; ++i) {
+                off += entry_size(decode(buf.data() + off, 1));
+            }
+            return off;
+        }
+        size_t end = buf.size();
+        for (uint32_t i = count; i > k; --i) {
+            end -= entry_size(decode(buf.data() + end - 1, -1));
+        }
+        return end;
+    }
+
+    static std::string read_at(const std::string &buf, size_t off) {
+        uint32_t len = decode(buf.data() + off, 1);
+        return buf.substr(off + varint_size(len), len);
+    }
+
+    static bool fits(const Chunk &chunk, size_t bytes) {
+        return chunk.count_ < kMaxChunkEntries && chunk.buf_.size() + bytes <= kMaxChunkBytes;
+    }
+
+    static void compress(Chunk &chunk) {
+        if (chunk.compressed_ || chunk.buf_.size() < kMinCompressBytes) {
+            return;
+        }
+        if (auto packed = Lzf::compress(chunk.buf_)) {
+            chunk.raw_size_ = static_cast<uint32_t>(chunk.buf_.size());
+            chunk.buf_ = std::move(*packed);
+            chunk.buf_.shrink_to_fit();
+            chunk.compressed_ = true;
+        }
+    }
+
+    static void decompress(Chunk &chunk) {
+        if (chunk.compressed_) {
+            chunk.buf_ = Lzf::decompress(chunk.buf_, chunk.raw_size_);
+            chunk.compressed_ = false;
+        }
+    }
+
+    // packed entries of a chunk; compressed chunks are decoded into scratch so readers never modify the list
+    static const std::string &raw(const Chunk &chunk, std::string &scratch) {
+        if (!chunk.compressed_) {
+            return chunk.buf_;
+        }
+        scratch = Lzf::decompress(chunk.buf_, chunk.raw_size_);
+        return scratch;
+    }
+
+    // called after a new end chunk is added: the chunk it pushed compress_depth_ deep becomes interior.
+    // chunks that drift back toward an end stay compressed until a write touches them
+    void compress_interior() {
+        if (compress_depth_ == 0 || chunks_.size() <= 2 * compress_depth_) {
+            return;
+        }
+        compress(chunks_[compress_depth_]);
+        compress(chunks_[chunks_.size() - 1 - compress_depth_]);
+    }
+
+    // index of the chunk containing absolute position pos
+    size_t chunk_at(int64_t pos) const {
+        auto it = std::upper_bound(chunks_.begin(), chunks_.end(), pos,
+                                   [](int64_t p, const Chunk &chunk) { return p < chunk.start_; });
+        return static_cast<size_t>(it - chunks_.begin()) - 1;
+    }
+
+    void drop_front_entries(Chunk &chunk, uint32_t n) {
+        decompress(chunk);
+        size_t off = offset_of(chunk.buf_, chunk.count_, n);
+        chunk.buf_.erase(0, off);
+        chunk.count_ -= n;
+        chunk.start_ += n;
+    }
+
+    void drop_back_entries(Chunk &chunk, uint32_t n) {
+        decompress(chunk);
+        size_t off = offset_of(chunk.buf_, chunk.count_, chunk.count_ - n);
+        chunk.buf_.resize(off);
+        chunk.count_ -= n;
+    }
+
+public:
+    explicit QuickList(size_t compress_depth = 0) : origin_(0), size_(0), compress_depth_(compress_depth) {}
+
+    // number of chunks at each end kept uncompressed; 0 disables compression
+    void set_compress_depth(size_t depth) {
+        compress_depth_ = depth;
+    }
+
+    void push_front(const std::string &val) {
+        auto entry = encode(val);
+        if (chunks_.empty() || !fits(chunks_.front(), entry.size())) {
+            if (!chunks_.empty()) {
+                chunks_.front().buf_.shrink_to_fit();
+            }
+            chunks_.emplace_front();
+            chunks_.front().start_ = origin_;
+            compress_interior();
+        }
+        auto &chunk = chunks_.front();
+        decompress(chunk);
+        chunk.buf_.insert(0, entry);
+        ++chunk.count_;
+        --chunk.start_;
+        --origin_;
+        ++size_;
+    }
+
+    void push_back(const std::string &val) {
+        auto entry = encode(val);
+        if (chunks_.empty() || !fits(chunks_.back(), entry.size())) {
+            // the full chunk will not grow again from this end, so give back its spare capacity
+            if (!chunks_.empty()) {
+                chunks_.back().buf_.shrink_to_fit();
+            }
+            int64_t start = chunks_.empty() ? origin_ : chunks_.back().start_ + chunks_.back().count_;
+            chunks_.emplace_back();
+            chunks_.back().start_ = start;
+            compress_interior();
+        }
+        auto &chunk = chunks_.back();
+        decompress(chunk);
+        chunk.buf_.append(entry);
+        ++chunk.count_;
+        ++size_;
+    }
+
+    std::optional<std::string> pop_front() {
+        if (chunks_.empty()) {
+            return std::nullopt;
+        }
+        auto &chunk = chunks_.front();
+        decompress(chunk);
+        auto val = read_at(chunk.buf_, 0);
+        drop_front_entries(chunk, 1);
+        if (chunk.count_ == 0) {
+            chunks_.pop_front();
+        }
+        ++origin_;
+        --size_;
+        return val;
+    }
+
+    std::optional<std::string> pop_back() {
+        if (chunks_.empty()) {
+            return std::nullopt;
+        }
+        auto &chunk = chunks_.back();
+        decompress(chunk);
+        size_t off = offset_of(chunk.buf_, chunk.count_, chunk.count_ - 1);
+        auto val = read_at(chunk.buf_, off);
+        drop_back_entries(chunk, 1);
+        if (chunk.count_ == 0) {
+            chunks_.pop_back();
+        }
+        --size_;
+        return val;
+    }
+
+    std::optional<std::string> front() const {
+        if (chunks_.empty()) {
+            return std::nullopt;
+        }
+        std::string scratch;
+        return read_at(raw(chunks_.front(), scratch), 0);
+    }
+
+    std::optional<std::string> back() const {
+        if (chunks_.empty()) {
+            return std::nullopt;
+        }
+        const auto &chunk = chunks_.back();
+        std::string scratch;
+        const auto &buf = raw(chunk, scratch);
+        return read_at(buf, offset_of(buf, chunk.count_, chunk.count_ - 1));
+    }
+
+    std::optional<std::string> index(size_t i) const {
+        if (i >= size_) {
+            return std::nullopt;
+        }
+        int64_t pos = origin_ + static_cast<int64_t>(i);
+        const auto &chunk = chunks_[chunk_at(pos)];
+        auto k = static_cast<uint32_t>(pos - chunk.start_);
+        std::string scratch;
+        const auto &buf = raw(chunk, scratch);
+        return read_at(buf, offset_of(buf, chunk.count_, k));
+    }
+
+    // values at positions [start, stop], both inclusive and already clamped by the caller
+    std::vector<std::string> range(size_t start, size_t stop) const {
+        std::vector<std::string> result;
+        if (start > stop || start >= size_) {
+            return result;
+        }
+        stop = std::min(stop, size_ - 1);
+        result.reserve(stop - start + 1);
+
+        int64_t pos = origin_ + static_cast<int64_t>(start);
+        size_t c = chunk_at(pos);
+        auto k = static_cast<uint32_t>(pos - chunks_[c].start_);
+        std::string scratch;
+        const std::string *buf = &raw(chunks_[c], scratch);
+        size_t off = offset_of(*buf, chunks_[c].count_, k);
+
+        while (result.size() < stop - start + 1) {
+            if (k == chunks_[c].count_) {
+                ++c;
+                k = 0;
+                off = 0;
+                buf = &raw(chunks_[c], scratch);
+                continue;
+            }
+            uint32_t len = decode(buf->data() + off, 1);
+            result.emplace_back(*buf, off + varint_size(len), len);
+            off += entry_size(len);
+            ++k;
+        }
+        return result;
+    }
+
+    // keeps only positions [start, stop]; whole chunks outside the range are dropped without decoding
+    void trim(size_t start, size_t stop) {
+        if (start > stop || start >= size_) {
+            clear();
+            return;
+        }
+        stop = std::min(stop, size_ - 1);
+
+        int64_t first = origin_ + static_cast<int64_t>(start);
+        int64_t last = origin_ + static_cast<int64_t>(stop);
+
+        while (chunks_.front().start_ + chunks_.front().count_ <= first) {
+            chunks_.pop_front();
+        }
+        while (chunks_.back().start_ > last) {
+            chunks_.pop_back();
+        }
+
+        auto &head = chunks_.front();
+        if (head.start_ < first) {
+            drop_front_entries(head, static_cast<uint32_t>(first - head.start_));
+        }
+        auto &tail = chunks_.back();
+        int64_t tail_end = tail.start_ + tail.count_ - 1;
+        if (tail_end > last) {
+            drop_back_entries(tail, static_cast<uint32_t>(tail_end - last));
+        }
+
+        origin_ = first;
+        size_ = stop - start + 1;
+    }
+
+    void clear() {
+        chunks_.clear();
+        origin_ = 0;
+        size_ = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    size_t chunk_count() const {
+        return chunks_.size();
+    }
+
+    size_t compressed_chunk_count() const {
+        return std::count_if(chunks_.begin(), chunks_.end(), [](const Chunk &chunk) { return chunk.compressed_; });
+    }
+
+    // heap bytes held by the packed chunks
+    size_t bytes() const {
+        size_t total = 0;
+        for (const auto &chunk: chunks_) {
+            total += sizeof(Chunk) + chunk.buf_.capacity();
+        }
+        return total;
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <cstdint>
+#include "compact_string.cpp"
+#include "slab_allocator.cpp"
+#include "epoch.cpp"
+
+template <typename T, typename... Args>
+T *keyspace_new(Args &&...args) {
+    T *p = KeyspaceAllocator<T>().allocate(1);
+    return ::new(p) T(std::forward<Args>(args)...);
+}
+
+// void * so it can be handed to Epoch::retire as a deleter
+template <typename T>
+void keyspace_delete(void *p) {
+    auto *object = static_cast<T *>(p);
+    object->~T();
+    KeyspaceAllocator<T>().deallocate(object, 1);
+}
+
+// a value taken out of an RcuMap. readers that found it before it was unlinked may still be using it, so
+// it is only destroyed after an epoch grace period: retire() defers that to Epoch without blocking, and the
+// destructor waits for the grace period itself, which suits the lazy freer thread
+template <typename V>
+class RcuOwned {
+private:
+    V *value_;
+
+public:
+    explicit RcuOwned(V *value = nullptr) : value_(value) {}
+
+    RcuOwned(RcuOwned &&other) noexcept : value_(other.value_) {
+        other.value_ = nullptr;
+    }
+
+    RcuOwned &operator=(RcuOwned &&) = delete;
+
+    ~RcuOwned() {
+        if (value_) {
+            Epoch::instance().synchronize();
+            keyspace_delete<V>(value_);
+        }
+    }
+
+    void retire() {
+        if (value_) {
+            Epoch::instance().retire(value_, &keyspace_delete<V>);
+            value_ = nullptr;
+        }
+    }
+
+    explicit operator bool() const {
+        return value_ != nullptr;
+    }
+
+    V *get() const {
+        return value_;
+    }
+};
+
+// chained hash map whose lookups run alongside a writer. readers pin an Epoch and only load: every entry,
+// bucket array and value version is published with one atomic store, and whatever a writer unlinks or
+// replaces is retired rather than freed. writers must be serialized by the caller. values live behind a
+// pointer, so a new version is swapped in whole and resizing copies entries without touching values
+template <typename V>
+class RcuMap {
+private:
+    struct Entry {
+        CompactString key_;
+        size_t hash_;
+        std::atomic<V *> value_;
+        std::atomic<Entry *> next_;
+
+        Entry(std::string_view key, size_t hash, V *value, Entry *next)
+                : key_(key), hash_(hash), value_(value), next_(next) {}
+    };
+
+    struct Table {
+        size_t mask_;
+        std::vector<std::atomic<Entry *>> buckets_;
+
+        explicit Table(size_t buckets) : mask_(buckets - 1), buckets_(buckets) {
+            for (auto &bucket: buckets_) {
+                bucket.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    static constexpr size_t kInitialBuckets = 16;
+
+    std::atomic<Table *> table_;
+    size_t size_;
+
+    static size_t hash_of(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    static uint64_t reverse_bits(uint64_t v) {
+        v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+        v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+        v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+        v = ((v >> 8) & 0x00FF00FF00FF00FFull) | ((v & 0x00FF00FF00FF00FFull) << 8);
+        v = ((v >> 16) & 0x0000FFFF0000FFFFull) | ((v & 0x0000FFFF0000FFFFull) << 16);
+        return (v >> 32) | (v << 32);
+    }
+
+    Entry *find_entry(std::string_view key, size_t hash) const {
+        Table *table = table_.load(std::memory_order_acquire);
+        for (Entry *e = table->buckets_[hash & table->mask_].load(std::memory_order_acquire); e;
+             e = e->next_.load(std::memory_order_acquire)) {
+            if (e->hash_ == hash && e->key_.view() == key) {
+                return e;
+            }
+        }
+        return nullptr;
+    }
+
+    // readers may be walking the old table, so its entries are copied rather than relinked, and the old
+    // table and entries are retired together once the new one is published
+    void grow(size_t buckets) {
+        Table *old = table_.load(std::memory_order_relaxed);
+        auto *table = new Table(buckets);
+        std::vector<Entry *> retired;
+        retired.reserve(size_);
+        for (auto &bucket: old->buckets_) {
+            for (Entry *e = bucket.load(std::memory_order_relaxed); e; e = e->next_.load(std::memory_order_relaxed)) {
+                auto &head = table->buckets_[e->hash_ & table->mask_];
+                head.store(keyspace_new<Entry>(e->key_.view(), e->hash_, e->value_.load(std::memory_order_relaxed),
+                                               head.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+                retired.push_back(e);
+            }
+        }
+        table_.store(table, std::memory_order_release);
+
+        auto &epoch = Epoch::instance();
+        for (auto e: retired) {
+            epoch.retire(e, &keyspace_delete<Entry>);
+        }
+        epoch.retire(old, [](void *p) { delete static_cast<Table *>(p); });
+    }
+
+    void destroy_all() {
+        Table *table = table_.load(std::memory_order_relaxed);
+        for (auto &bucket: table->buckets_) {
+            Entry *e = bucket.load(std::memory_order_relaxed);
+            while (e) {
+                Entry *next = e->next_.load(std::memory_order_relaxed);
+                keyspace_delete<V>(e->value_.load(std::memory_order_relaxed));
+                keyspace_delete<Entry>(e);
+                e = next;
+            }
+        }
+        delete table;
+    }
+
+public:
+    RcuMap() : table_(new Table(kInitialBuckets)), size_(0) {}
+
+    // frees everything at once; no reader may still be pinned on the map
+    ~RcuMap() {
+        destroy_all();
+    }
+
+    RcuMap(const RcuMap &) = delete;
+    RcuMap &operator=(const RcuMap &) = delete;
+
+    // safe for pinned readers as well as the writer
+    V *find(std::string_view key) const {
+        Entry *e = find_entry(key, hash_of(key));
+        return e ? e->value_.load(std::memory_order_acquire) : nullptr;
+    }
+
+    // the value at key, constructed from args and published when missing
+    template <typename... Args>
+    std::pair<V *, bool> try_emplace(std::string_view key, Args &&...args) {
+        size_t hash = hash_of(key);
+        if (Entry *e = find_entry(key, hash)) {
+            return {e->value_.load(std::memory_order_relaxed), false};
+        }
+        V *value = keyspace_new<V>(std::forward<Args>(args)...);
+        insert_new(key, hash, value);
+        return {value, true};
+    }
+
+    // publishes value as the new version at key; a replaced version is retired, and destroyed by deleter
+    // once no reader can hold it
+    V *assign(std::string_view key, V &&value, void (*deleter)(void *) = &keyspace_delete<V>) {
+        size_t hash = hash_of(key);
+        V *version = keyspace_new<V>(std::move(value));
+        if (Entry *e = find_entry(key, hash)) {
+            V *old = e->value_.exchange(version, std::memory_order_acq_rel);
+            Epoch::instance().retire(old, deleter);
+        } else {
+            insert_new(key, hash, version);
+        }
+        return version;
+    }
+
+    // unlinks key and hands its value to the caller
+    RcuOwned<V> extract(std::string_view key) {
+        size_t hash = hash_of(key);
+        Table *table = table_.load(std::memory_order_relaxed);
+        auto *link = &table->buckets_[hash & table->mask_];
+        for (Entry *e = link->load(std::memory_order_relaxed); e; e = link->load(std::memory_order_relaxed)) {
+            if (e->hash_ == hash && e->key_.view() == key) {
+                link->store(e->next_.load(std::memory_order_relaxed), std::memory_order_release);
+                --size_;
+                V *value = e->value_.load(std::memory_order_relaxed);
+                Epoch::instance().retire(e, &keyspace_delete<Entry>);
+                return RcuOwned<V>(value);
+            }
+            link = &e->next_;
+        }
+        return RcuOwned<V>();
+    }
+
+    // exchanges contents with a map no reader can see yet, e.g. to flush this one
+    void swap(RcuMap &other) {
+        Table *table = other.table_.load(std::memory_order_relaxed);
+        other.table_.store(table_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        table_.store(table, std::memory_order_release);
+        std::swap(size_, other.size_);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    size_t bucket_count() const {
+        return table_.load(std::memory_order_acquire)->buckets_.size();
+    }
+
+    // sizes the table for n keys in one step, so a bulk insert copies the entries once rather than at
+    // every doubling
+    void reserve(size_t n) {
+        size_t buckets = bucket_count();
+        while (buckets < n) {
+            buckets <<= 1;
+        }
+        if (buckets != bucket_count()) {
+            grow(buckets);
+        }
+    }
+
+    // fn(key, value) for the entries of one bucket, for walks that resume between calls
+    template <typename F>
+    void for_each_in_bucket(size_t bucket, F &&fn) const {
+        Table *table = table_.load(std::memory_order_acquire);
+        if (bucket >= table->buckets_.size()) {
+            return;
+        }
+        for (Entry *e = table->buckets_[bucket].load(std::memory_order_acquire); e;
+             e = e->next_.load(std::memory_order_acquire)) {
+            fn(e->key_.view(), *e->value_.load(std::memory_order_acquire));
+        }
+    }
+
+    template <typename F>
+    void for_each(F &&fn) const {
+        for (size_t b = 0, n = bucket_count(); b < n; ++b) {
+            for_each_in_bucket(b, fn);
+        }
+    }
+
+    // SCAN: fn(key, value) for one bucket, returning the cursor of the next, 0 once every bucket was visited.
+    // the cursor counts up with its bits reversed, so when the table doubles between calls the buckets a
+    // visited one splits into are both behind the cursor and those not yet visited both ahead of it, and an
+    // entry present for the whole scan is visited at least once
+    template <typename F>
+    uint64_t scan(uint64_t cursor, F &&fn) const {
+        Table *table = table_.load(std::memory_order_acquire);
+        for (Entry *e = table->buckets_[cursor & table->mask_].load(std::memory_order_acquire); e;
+             e = e->next_.load(std::memory_order_acquire)) {
+            fn(e->key_.view(), *e->value_.load(std::memory_order_acquire));
+        }
+        cursor |= ~static_cast<uint64_t>(table->mask_);
+        return reverse_bits(reverse_bits(cursor) + 1);
+    }
+
+private:
+    void insert_new(std::string_view key, size_t hash, V *value) {
+        if (size_ + 1 > bucket_count()) {
+            grow(bucket_count() * 2);
+        }
+        Table *table = table_.load(std::memory_order_relaxed);
+        auto &head = table->buckets_[hash & table->mask_];
+        head.store(keyspace_new<Entry>(key, hash, value, head.load(std::memory_order_relaxed)),
+                   std::memory_order_release);
+        ++size_;
+    }
+};
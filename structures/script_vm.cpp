@@ -0,0 +1,843 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <optional>
+#include <utility>
+#include <charconv>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include "int_string.cpp"
+
+class ScriptError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// a script value: nil, a boolean, an int64, a double or a string. strings that spell a number take part in
+// arithmetic as that number, and numbers concatenate as their text
+struct ScriptValue {
+    enum Type : uint8_t { Nil, Bool, Int, Float, Str };
+
+    Type type_ = Nil;
+    // the boolean for Bool
+    int64_t int_ = 0;
+    double float_ = 0;
+    std::string str_;
+
+    static ScriptValue boolean(bool value) {
+        ScriptValue v;
+        v.type_ = Bool;
+        v.int_ = value;
+        return v;
+    }
+
+    static ScriptValue integer(int64_t value) {
+        ScriptValue v;
+        v.type_ = Int;
+        v.int_ = value;
+        return v;
+    }
+
+    static ScriptValue number(double value) {
+        ScriptValue v;
+        v.type_ = Float;
+        v.float_ = value;
+        return v;
+    }
+
+    static ScriptValue string(std::string value) {
+        ScriptValue v;
+        v.type_ = Str;
+        v.str_ = std::move(value);
+        return v;
+    }
+
+    bool truthy() const {
+        return type_ != Nil && (type_ != Bool || int_);
+    }
+
+    bool is_number() const {
+        return type_ == Int || type_ == Float;
+    }
+
+    const char *type_name() const {
+        static const char *names[] = {"nil", "boolean", "integer", "number", "string"};
+        return names[type_];
+    }
+
+    // the text a string or number stands for; nullopt for nil and booleans
+    std::optional<std::string> text() const {
+        switch (type_) {
+            case Str:
+                return str_;
+            case Int:
+                return IntString::render(int_);
+            case Float: {
+                // the shortest of 15 to 17 digits that reads back as the same double, so a score passed
+                // on through call() is the one the script computed
+                char buf[32];
+                for (int precision = 15; precision <= 17; ++precision) {
+                    std::snprintf(buf, sizeof(buf), "%.*g", precision, float_);
+                    if (std::strtod(buf, nullptr) == float_) {
+                        break;
+                    }
+                }
+                return std::string(buf);
+            }
+            default:
+                return std::nullopt;
+        }
+    }
+
+    // the number a number or numeric string stands for; nullopt for anything else
+    std::optional<ScriptValue> to_number() const {
+        if (is_number()) {
+            return *this;
+        }
+        if (type_ != Str || str_.empty()) {
+            return std::nullopt;
+        }
+        int64_t i;
+        auto [end, ec] = std::from_chars(str_.data(), str_.data() + str_.size(), i);
+        if (ec == std::errc() && end == str_.data() + str_.size()) {
+            return integer(i);
+        }
+        // strtod would also take hex, inf and nan
+        if (str_.find_first_of("xXnNiI") != std::string::npos) {
+            return std::nullopt;
+        }
+        char *stop;
+        double d = std::strtod(str_.c_str(), &stop);
+        if (stop == str_.c_str() + str_.size() && !std::isspace(static_cast<unsigned char>(str_[0]))) {
+            return number(d);
+        }
+        return std::nullopt;
+    }
+
+    double as_double() const {
+        return type_ == Int ? static_cast<double>(int_) : float_;
+    }
+};
+
+enum class ScriptOp : uint8_t {
+    Const, Nil, True, False, Load, Store, Pop,
+    Key, Arg, KeyCount, ArgCount,
+    Add, Sub, Mul, Div, Mod, Neg, Concat, Len,
+    Eq, Ne, Lt, Le, Gt, Ge, Not,
+    Jump, JumpIfFalse, AndJump, OrJump,
+    Call, ToNumber, ToString, Return,
+};
+
+struct ScriptInstr {
+    ScriptOp op_;
+    uint32_t arg_;
+};
+
+// a script compiled to bytecode for a small stack machine. the language is a Lua subset: local variables,
+// if/elseif/else, while with break, return, arithmetic, comparison, `..` concatenation, and/or/not, the
+// KEYS and ARGV arrays with `#` for their length, and the functions call, tonumber and tostring. call(...)
+// is handed to the embedder, which runs the command and returns its reply as a value. compiled once, a
+// script can be run any number of times from any thread
+class Script {
+public:
+    // loops may repeat this many times in one run before the script is stopped
+    static constexpr size_t kMaxIterations = 1000000;
+
+    static std::shared_ptr<const Script> compile(std::string_view source);
+
+    template <typename Call>
+    ScriptValue run(const std::vector<std::string> &keys, const std::vector<std::string> &argv, Call &&call) const {
+        std::vector<ScriptValue> stack;
+        stack.reserve(kStackReserve);
+        std::vector<ScriptValue> slots(slots_);
+        size_t iterations = 0;
+        for (size_t pc = 0;;) {
+            const auto &in = code_[pc++];
+            switch (in.op_) {
+                case ScriptOp::Const:
+                    stack.push_back(constants_[in.arg_]);
+                    break;
+                case ScriptOp::Nil:
+                    stack.emplace_back();
+                    break;
+                case ScriptOp::True:
+                case ScriptOp::False:
+                    stack.push_back(ScriptValue::boolean(in.op_ == ScriptOp::True));
+                    break;
+                case ScriptOp::Load:
+                    stack.push_back(slots[in.arg_]);
+                    break;
+                case ScriptOp::Store:
+                    slots[in.arg_] = std::move(stack.back());
+                    stack.pop_back();
+                    break;
+                case ScriptOp::Pop:
+                    stack.pop_back();
+                    break;
+                case ScriptOp::Key:
+                case ScriptOp::Arg: {
+                    const auto &list = in.op_ == ScriptOp::Key ? keys : argv;
+                    auto index = stack.back().to_number();
+                    if (index && index->type_ == ScriptValue::Int && index->int_ >= 1 &&
+                        static_cast<uint64_t>(index->int_) <= list.size()) {
+                        stack.back() = ScriptValue::string(list[index->int_ - 1]);
+                    } else {
+                        stack.back() = ScriptValue();
+                    }
+                    break;
+                }
+                case ScriptOp::KeyCount:
+                    stack.push_back(ScriptValue::integer(static_cast<int64_t>(keys.size())));
+                    break;
+                case ScriptOp::ArgCount:
+                    stack.push_back(ScriptValue::integer(static_cast<int64_t>(argv.size())));
+                    break;
+                case ScriptOp::Add:
+                case ScriptOp::Sub:
+                case ScriptOp::Mul:
+                case ScriptOp::Div:
+                case ScriptOp::Mod: {
+                    auto rhs = std::move(stack.back());
+                    stack.pop_back();
+                    stack.back() = arith(in.op_, stack.back(), rhs);
+                    break;
+                }
+                case ScriptOp::Neg:
+                    stack.back() = arith(ScriptOp::Sub, ScriptValue::integer(0), stack.back());
+                    break;
+                case ScriptOp::Concat: {
+                    auto rhs = std::move(stack.back());
+                    stack.pop_back();
+                    auto left = stack.back().text(), right = rhs.text();
+                    if (!left || !right) {
+                        throw ScriptError(std::string("attempt to concatenate a ") +
+                                          (left ? rhs : stack.back()).type_name() + " value");
+                    }
+                    stack.back() = ScriptValue::string(*left + *right);
+                    break;
+                }
+                case ScriptOp::Len:
+                    if (stack.back().type_ != ScriptValue::Str) {
+                        throw ScriptError(std::string("attempt to get length of a ") + stack.back().type_name() +
+                                          " value");
+                    }
+                    stack.back() = ScriptValue::integer(static_cast<int64_t>(stack.back().str_.size()));
+                    break;
+                case ScriptOp::Eq:
+                case ScriptOp::Ne: {
+                    auto rhs = std::move(stack.back());
+                    stack.pop_back();
+                    bool equal = equals(stack.back(), rhs);
+                    stack.back() = ScriptValue::boolean(in.op_ == ScriptOp::Eq ? equal : !equal);
+                    break;
+                }
+                case ScriptOp::Lt:
+                case ScriptOp::Le:
+                case ScriptOp::Gt:
+                case ScriptOp::Ge: {
+                    auto rhs = std::move(stack.back());
+                    stack.pop_back();
+                    int order = compare(stack.back(), rhs);
+                    bool result = in.op_ == ScriptOp::Lt ? order < 0 : in.op_ == ScriptOp::Le ? order <= 0
+                                                        : in.op_ == ScriptOp::Gt ? order > 0 : order >= 0;
+                    stack.back() = ScriptValue::boolean(result);
+                    break;
+                }
+                case ScriptOp::Not:
+                    stack.back() = ScriptValue::boolean(!stack.back().truthy());
+                    break;
+                case ScriptOp::Jump:
+                    // only a loop jumps backwards
+                    if (in.arg_ < pc && ++iterations > kMaxIterations) {
+                        throw ScriptError("script exceeded " + std::to_string(kMaxIterations) + " loop iterations");
+                    }
+                    pc = in.arg_;
+                    break;
+                case ScriptOp::JumpIfFalse: {
+                    bool taken = !stack.back().truthy();
+                    stack.pop_back();
+                    if (taken) {
+                        pc = in.arg_;
+                    }
+                    break;
+                }
+                case ScriptOp::AndJump:
+                case ScriptOp::OrJump:
+                    // short circuit: the deciding operand stays as the result, otherwise the right one replaces it
+                    if (stack.back().truthy() == (in.op_ == ScriptOp::OrJump)) {
+                        pc = in.arg_;
+                    } else {
+                        stack.pop_back();
+                    }
+                    break;
+                case ScriptOp::Call: {
+                    size_t base = stack.size() - in.arg_;
+                    auto reply = call(stack.data() + base, static_cast<size_t>(in.arg_));
+                    stack.resize(base);
+                    stack.push_back(std::move(reply));
+                    break;
+                }
+                case ScriptOp::ToNumber: {
+                    auto n = stack.back().to_number();
+                    stack.back() = n ? std::move(*n) : ScriptValue();
+                    break;
+                }
+                case ScriptOp::ToString: {
+                    auto &v = stack.back();
+                    auto text = v.text();
+                    v = ScriptValue::string(text ? std::move(*text) : v.type_ == ScriptValue::Nil ? "nil"
+                                                                    : v.truthy() ? "true" : "false");
+                    break;
+                }
+                case ScriptOp::Return:
+                    return std::move(stack.back());
+            }
+        }
+    }
+
+private:
+    friend class ScriptCompiler;
+
+    static constexpr size_t kStackReserve = 16;
+
+    std::vector<ScriptInstr> code_;
+    std::vector<ScriptValue> constants_;
+    size_t slots_ = 0;
+
+    static ScriptValue operand(const ScriptValue &v) {
+        auto n = v.to_number();
+        if (!n) {
+            throw ScriptError(std::string("attempt to perform arithmetic on a ") + v.type_name() + " value");
+        }
+        return std::move(*n);
+    }
+
+    // integers stay integers, with overflow an error, except for `/`, which always divides as doubles
+    static ScriptValue arith(ScriptOp op, const ScriptValue &lhs, const ScriptValue &rhs) {
+        auto a = operand(lhs), b = operand(rhs);
+        if (a.type_ == ScriptValue::Int && b.type_ == ScriptValue::Int && op != ScriptOp::Div) {
+            int64_t result;
+            bool overflow = false;
+            switch (op) {
+                case ScriptOp::Add:
+                    overflow = __builtin_add_overflow(a.int_, b.int_, &result);
+                    break;
+                case ScriptOp::Sub:
+                    overflow = __builtin_sub_overflow(a.int_, b.int_, &result);
+                    break;
+                case ScriptOp::Mul:
+                    overflow = __builtin_mul_overflow(a.int_, b.int_, &result);
+                    break;
+                default:
+                    if (b.int_ == 0) {
+                        throw ScriptError("attempt to perform 'n%0'");
+                    }
+                    // floored, so the result takes the divisor's sign
+                    result = b.int_ == -1 ? 0 : a.int_ % b.int_;
+                    if (result != 0 && (result < 0) != (b.int_ < 0)) {
+                        result += b.int_;
+                    }
+                    break;
+            }
+            if (overflow) {
+                throw ScriptError("integer overflow");
+            }
+            return ScriptValue::integer(result);
+        }
+        double x = a.as_double(), y = b.as_double();
+        switch (op) {
+            case ScriptOp::Add:
+                return ScriptValue::number(x + y);
+            case ScriptOp::Sub:
+                return ScriptValue::number(x - y);
+            case ScriptOp::Mul:
+                return ScriptValue::number(x * y);
+            case ScriptOp::Div:
+                return ScriptValue::number(x / y);
+            default:
+                return ScriptValue::number(x - std::floor(x / y) * y);
+        }
+    }
+
+    // values of different types are never equal, except an integer and a double of the same value
+    static bool equals(const ScriptValue &a, const ScriptValue &b) {
+        if (a.is_number() && b.is_number()) {
+            return a.type_ == b.type_ && a.type_ == ScriptValue::Int ? a.int_ == b.int_
+                                                                     : a.as_double() == b.as_double();
+        }
+        if (a.type_ != b.type_) {
+            return false;
+        }
+        return a.type_ == ScriptValue::Str ? a.str_ == b.str_ : a.int_ == b.int_;
+    }
+
+    // numbers order numerically and strings bytewise; anything else is an error
+    static int compare(const ScriptValue &a, const ScriptValue &b) {
+        if (a.type_ == ScriptValue::Int && b.type_ == ScriptValue::Int) {
+            return a.int_ < b.int_ ? -1 : a.int_ > b.int_;
+        }
+        if (a.is_number() && b.is_number()) {
+            double x = a.as_double(), y = b.as_double();
+            return x < y ? -1 : x > y;
+        }
+        if (a.type_ == ScriptValue::Str && b.type_ == ScriptValue::Str) {
+            int order = a.str_.compare(b.str_);
+            return order < 0 ? -1 : order > 0;
+        }
+        throw ScriptError(std::string("attempt to compare ") + a.type_name() + " with " + b.type_name());
+    }
+};
+
+// one pass from source to bytecode: the tokens are read up front and a recursive descent parser emits
+// instructions as it goes, patching forward jumps once their target is known. locals live in numbered
+// slots resolved here, so the interpreter never looks a name up
+class ScriptCompiler {
+private:
+    struct Token {
+        enum Kind { End, Name, Number, String, Symbol };
+        Kind kind_;
+        std::string text_;
+        ScriptValue value_;
+    };
+
+    Script &script_;
+    std::vector<Token> tokens_;
+    size_t pos_ = 0;
+    // the locals in scope, innermost last; a local's slot is its index here
+    std::vector<std::string> locals_;
+    // forward jumps out of each enclosing while loop, patched at its end
+    std::vector<std::vector<size_t>> breaks_;
+    // how deep the parser has recursed, bounded so a hostile script fails instead of overflowing the stack
+    // of the thread compiling it
+    static constexpr size_t kMaxDepth = 200;
+    size_t depth_ = 0;
+
+    // held by each rule that can recurse into itself: blocks, expressions, unary operators and ..
+    class Nested {
+    private:
+        size_t &depth_;
+
+    public:
+        explicit Nested(size_t &depth) : depth_(depth) {
+            if (++depth_ > kMaxDepth) {
+                --depth_;
+                fail("expression nested too deeply");
+            }
+        }
+
+        Nested(const Nested &) = delete;
+        Nested &operator=(const Nested &) = delete;
+
+        ~Nested() {
+            --depth_;
+        }
+    };
+
+    [[noreturn]] static void fail(const std::string &message) {
+        throw ScriptError("script compile error: " + message);
+    }
+
+    static bool is_keyword(std::string_view name) {
+        static constexpr std::string_view keywords[] = {"and", "break", "do", "else", "elseif", "end", "false",
+                                                        "if", "local", "nil", "not", "or", "return", "then",
+                                                        "true", "while"};
+        for (auto keyword: keywords) {
+            if (name == keyword) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void tokenize(std::string_view src) {
+        size_t i = 0;
+        while (true) {
+            while (i < src.size() && std::isspace(static_cast<unsigned char>(src[i]))) {
+                ++i;
+            }
+            if (src.substr(i, 2) == "--") {
+                while (i < src.size() && src[i] != '\n') {
+                    ++i;
+                }
+                continue;
+            }
+            if (i == src.size()) {
+                tokens_.push_back({Token::End, "<eof>", {}});
+                return;
+            }
+            char c = src[i];
+            size_t start = i;
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                while (i < src.size() && (std::isalnum(static_cast<unsigned char>(src[i])) || src[i] == '_')) {
+                    ++i;
+                }
+                tokens_.push_back({Token::Name, std::string(src.substr(start, i - start)), {}});
+            } else if (std::isdigit(static_cast<unsigned char>(c))) {
+                auto digits = [&] {
+                    while (i < src.size() && std::isdigit(static_cast<unsigned char>(src[i]))) {
+                        ++i;
+                    }
+                };
+                digits();
+                if (i + 1 < src.size() && src[i] == '.' && std::isdigit(static_cast<unsigned char>(src[i + 1]))) {
+                    ++i;
+                    digits();
+                }
+                if (i < src.size() && (src[i] == 'e' || src[i] == 'E')) {
+                    ++i;
+                    if (i < src.size() && (src[i] == '+' || src[i] == '-')) {
+                        ++i;
+                    }
+                    digits();
+                }
+                auto text = std::string(src.substr(start, i - start));
+                auto value = ScriptValue::string(text).to_number();
+                if (!value || (i < src.size() && std::isalpha(static_cast<unsigned char>(src[i])))) {
+                    fail("malformed number near '" + text + "'");
+                }
+                tokens_.push_back({Token::Number, text, std::move(*value)});
+            } else if (c == '"' || c == '\'') {
+                std::string text;
+                for (++i; i < src.size() && src[i] != c; ++i) {
+                    if (src[i] == '\\' && i + 1 < src.size()) {
+                        char e = src[++i];
+                        text += e == 'n' ? '\n' : e == 't' ? '\t' : e == 'r' ? '\r' : e;
+                    } else {
+                        text += src[i];
+                    }
+                }
+                if (i == src.size()) {
+                    fail("unfinished string");
+                }
+                ++i;
+                tokens_.push_back({Token::String, text, ScriptValue::string(text)});
+            } else {
+                static constexpr std::string_view pairs[] = {"==", "~=", "<=", ">=", ".."};
+                bool paired = false;
+                for (auto pair: pairs) {
+                    paired = paired || src.substr(i, 2) == pair;
+                }
+                if (!paired && std::string_view("+-*/%#()[],;=<>").find(c) == std::string_view::npos) {
+                    fail(std::string("unexpected character '") + c + "'");
+                }
+                i += paired ? 2 : 1;
+                tokens_.push_back({Token::Symbol, std::string(src.substr(start, i - start)), {}});
+            }
+        }
+    }
+
+    const Token &peek(size_t ahead = 0) const {
+        return tokens_[std::min(pos_ + ahead, tokens_.size() - 1)];
+    }
+
+    bool check(std::string_view text, size_t ahead = 0) const {
+        const auto &t = peek(ahead);
+        return (t.kind_ == Token::Name || t.kind_ == Token::Symbol) && t.text_ == text;
+    }
+
+    bool accept(std::string_view text) {
+        if (check(text)) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(std::string_view text) {
+        if (!accept(text)) {
+            fail("'" + std::string(text) + "' expected near '" + peek().text_ + "'");
+        }
+    }
+
+    std::string name() {
+        const auto &t = peek();
+        if (t.kind_ != Token::Name || is_keyword(t.text_) || t.text_ == "KEYS" || t.text_ == "ARGV") {
+            fail("name expected near '" + t.text_ + "'");
+        }
+        ++pos_;
+        return t.text_;
+    }
+
+    std::optional<uint32_t> resolve(const std::string &name) const {
+        for (size_t i = locals_.size(); i-- > 0;) {
+            if (locals_[i] == name) {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        return std::nullopt;
+    }
+
+    size_t emit(ScriptOp op, uint32_t arg = 0) {
+        script_.code_.push_back({op, arg});
+        return script_.code_.size() - 1;
+    }
+
+    void patch(size_t jump) {
+        script_.code_[jump].arg_ = static_cast<uint32_t>(script_.code_.size());
+    }
+
+    bool block_ends() const {
+        return peek().kind_ == Token::End || check("end") || check("else") || check("elseif");
+    }
+
+    void block() {
+        Nested nested(depth_);
+        size_t scope = locals_.size();
+        while (!block_ends()) {
+            statement();
+            accept(";");
+        }
+        locals_.resize(scope);
+    }
+
+    void statement() {
+        if (accept("local")) {
+            auto local = name();
+            if (accept("=")) {
+                expression();
+            } else {
+                emit(ScriptOp::Nil);
+            }
+            // declared after its initializer, so `local x = x` reads the outer x
+            locals_.push_back(local);
+            script_.slots_ = std::max(script_.slots_, locals_.size());
+            emit(ScriptOp::Store, static_cast<uint32_t>(locals_.size() - 1));
+        } else if (accept("if")) {
+            expression();
+            expect("then");
+            std::optional<size_t> skip = emit(ScriptOp::JumpIfFalse);
+            block();
+            std::vector<size_t> exits;
+            while (check("elseif") || check("else")) {
+                exits.push_back(emit(ScriptOp::Jump));
+                patch(*skip);
+                skip.reset();
+                if (accept("else")) {
+                    block();
+                    break;
+                }
+                expect("elseif");
+                expression();
+                expect("then");
+                skip = emit(ScriptOp::JumpIfFalse);
+                block();
+            }
+            if (skip) {
+                patch(*skip);
+            }
+            expect("end");
+            for (auto exit: exits) {
+                patch(exit);
+            }
+        } else if (accept("while")) {
+            auto top = static_cast<uint32_t>(script_.code_.size());
+            expression();
+            expect("do");
+            auto exit = emit(ScriptOp::JumpIfFalse);
+            breaks_.emplace_back();
+            block();
+            expect("end");
+            emit(ScriptOp::Jump, top);
+            patch(exit);
+            for (auto jump: breaks_.back()) {
+                patch(jump);
+            }
+            breaks_.pop_back();
+        } else if (accept("break")) {
+            if (breaks_.empty()) {
+                fail("break outside a loop");
+            }
+            breaks_.back().push_back(emit(ScriptOp::Jump));
+        } else if (accept("return")) {
+            if (block_ends() || check(";")) {
+                emit(ScriptOp::Nil);
+            } else {
+                expression();
+            }
+            emit(ScriptOp::Return);
+        } else if (peek().kind_ == Token::Name && check("=", 1)) {
+            auto target = name();
+            auto slot = resolve(target);
+            if (!slot) {
+                fail("assignment to undeclared local '" + target + "'");
+            }
+            expect("=");
+            expression();
+            emit(ScriptOp::Store, *slot);
+        } else if (peek().kind_ == Token::Name && check("(", 1)) {
+            expression();
+            emit(ScriptOp::Pop);
+        } else {
+            fail("unexpected '" + peek().text_ + "'");
+        }
+    }
+
+    // precedence from loosest to tightest: or, and, comparison, .. (right associative), + -, * / %, unary
+    void expression() {
+        Nested nested(depth_);
+        conjunction();
+        while (accept("or")) {
+            auto jump = emit(ScriptOp::OrJump);
+            conjunction();
+            patch(jump);
+        }
+    }
+
+    void conjunction() {
+        comparison();
+        while (accept("and")) {
+            auto jump = emit(ScriptOp::AndJump);
+            comparison();
+            patch(jump);
+        }
+    }
+
+    void comparison() {
+        concatenation();
+        static const std::pair<std::string_view, ScriptOp> ops[] = {
+                {"==", ScriptOp::Eq}, {"~=", ScriptOp::Ne}, {"<", ScriptOp::Lt},
+                {"<=", ScriptOp::Le}, {">", ScriptOp::Gt}, {">=", ScriptOp::Ge}};
+        for (bool matched = true; matched;) {
+            matched = false;
+            for (const auto &[text, op]: ops) {
+                if (accept(text)) {
+                    concatenation();
+                    emit(op);
+                    matched = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    void concatenation() {
+        Nested nested(depth_);
+        additive();
+        if (accept("..")) {
+            concatenation();
+            emit(ScriptOp::Concat);
+        }
+    }
+
+    void additive() {
+        multiplicative();
+        while (check("+") || check("-")) {
+            auto op = accept("+") ? ScriptOp::Add : (expect("-"), ScriptOp::Sub);
+            multiplicative();
+            emit(op);
+        }
+    }
+
+    void multiplicative() {
+        unary();
+        while (check("*") || check("/") || check("%")) {
+            auto op = accept("*") ? ScriptOp::Mul : accept("/") ? ScriptOp::Div : (expect("%"), ScriptOp::Mod);
+            unary();
+            emit(op);
+        }
+    }
+
+    void unary() {
+        Nested nested(depth_);
+        if (accept("not")) {
+            unary();
+            emit(ScriptOp::Not);
+        } else if (accept("-")) {
+            unary();
+            emit(ScriptOp::Neg);
+        } else if (accept("#")) {
+            if ((check("KEYS") || check("ARGV")) && !check("[", 1)) {
+                emit(accept("KEYS") ? ScriptOp::KeyCount : (expect("ARGV"), ScriptOp::ArgCount));
+            } else {
+                unary();
+                emit(ScriptOp::Len);
+            }
+        } else {
+            primary();
+        }
+    }
+
+    void primary() {
+        const auto &t = peek();
+        if (t.kind_ == Token::Number || t.kind_ == Token::String) {
+            script_.constants_.push_back(t.value_);
+            ++pos_;
+            emit(ScriptOp::Const, static_cast<uint32_t>(script_.constants_.size() - 1));
+        } else if (accept("nil")) {
+            emit(ScriptOp::Nil);
+        } else if (accept("true")) {
+            emit(ScriptOp::True);
+        } else if (accept("false")) {
+            emit(ScriptOp::False);
+        } else if (accept("(")) {
+            expression();
+            expect(")");
+        } else if (check("KEYS") || check("ARGV")) {
+            auto op = accept("KEYS") ? ScriptOp::Key : (expect("ARGV"), ScriptOp::Arg);
+            expect("[");
+            expression();
+            expect("]");
+            emit(op);
+        } else if (t.kind_ == Token::Name && check("(", 1)) {
+            auto function = name();
+            expect("(");
+            uint32_t argc = 0;
+            if (!accept(")")) {
+                do {
+                    expression();
+                    ++argc;
+                } while (accept(","));
+                expect(")");
+            }
+            if (function == "call") {
+                if (argc == 0) {
+                    fail("call needs a command name");
+                }
+                emit(ScriptOp::Call, argc);
+            } else if (function == "tonumber" || function == "tostring") {
+                if (argc != 1) {
+                    fail(function + " takes one argument");
+                }
+                emit(function == "tonumber" ? ScriptOp::ToNumber : ScriptOp::ToString);
+            } else {
+                fail("unknown function '" + function + "'");
+            }
+        } else if (t.kind_ == Token::Name && !is_keyword(t.text_)) {
+            auto slot = resolve(t.text_);
+            if (!slot) {
+                fail("undeclared local '" + t.text_ + "'");
+            }
+            ++pos_;
+            emit(ScriptOp::Load, *slot);
+        } else {
+            fail("unexpected '" + t.text_ + "'");
+        }
+    }
+
+public:
+    ScriptCompiler(std::string_view source, Script &script) : script_(script) {
+        tokenize(source);
+    }
+
+    void compile() {
+        block();
+        if (peek().kind_ != Token::End) {
+            fail("unexpected '" + peek().text_ + "'");
+        }
+        emit(ScriptOp::Nil);
+        emit(ScriptOp::Return);
+    }
+};
+
+inline std::shared_ptr<const Script> Script::compile(std::string_view source) {
+    auto script = std::make_shared<Script>();
+    ScriptCompiler(source, *script).compile();
+    return script;
+}
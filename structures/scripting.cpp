@@ -0,0 +1,268 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <optional>
+#include <exception>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <openssl/sha.h>
+#include "data_store.cpp"
+#include "script_vm.cpp"
+#include "int_string.cpp"
+
+// EVAL, EVALSHA and SCRIPT for one store. scripts are compiled once and cached under the SHA1 of their
+// source. a run holds the stripes of its declared keys for its whole length, the way EXEC holds a batch's,
+// so nothing interleaves with it, and the commands it calls may only touch those keys
+class ScriptEngine {
+private:
+    // a command scripts can call: its argument count after the name, max_args_ of 0 meaning no limit, and
+    // which arguments are keys, counted from 1 with last_key_ of 0 running to the end
+    struct Binding {
+        size_t min_args_;
+        size_t max_args_;
+        size_t first_key_;
+        size_t last_key_;
+        ScriptValue (*run_)(DataStore &, const std::vector<std::string> &);
+    };
+
+    DataStore &store_;
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const Script>> scripts_;
+
+    static int64_t integer_arg(const std::string &arg) {
+        int64_t value;
+        if (!IntString::parse(arg, value)) {
+            throw ScriptError("value is not an integer or out of range");
+        }
+        return value;
+    }
+
+    static int int_arg(const std::string &arg) {
+        auto value = integer_arg(arg);
+        if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+            throw ScriptError("value is not an integer or out of range");
+        }
+        return static_cast<int>(value);
+    }
+
+    static double score_arg(const std::string &arg) {
+        auto value = ScriptValue::string(arg).to_number();
+        if (!value) {
+            throw ScriptError("value is not a valid float");
+        }
+        return value->as_double();
+    }
+
+    static const std::string &side_arg(const std::string &arg) {
+        if (arg != "LEFT" && arg != "RIGHT") {
+            throw ScriptError("side must be LEFT or RIGHT");
+        }
+        return arg;
+    }
+
+    static ScriptValue optional_string(const std::optional<std::string> &value) {
+        return value ? ScriptValue::string(*value) : ScriptValue();
+    }
+
+    static ScriptValue count(size_t n) {
+        return ScriptValue::integer(static_cast<int64_t>(n));
+    }
+
+    static const std::unordered_map<std::string, Binding> &bindings() {
+        using Args = const std::vector<std::string> &;
+        static const std::unordered_map<std::string, Binding> table = {
+                {"GET", {1, 1, 1, 1, [](DataStore &s, Args a) { return optional_string(s.string_get(a[0])); }}},
+                {"SET", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    s.string_set(a[0], a[1]);
+                    return ScriptValue::string("OK");
+                }}},
+                {"INCR", {1, 1, 1, 1, [](DataStore &s, Args a) { return incrby(s, a[0], 1); }}},
+                {"DECR", {1, 1, 1, 1, [](DataStore &s, Args a) { return incrby(s, a[0], -1); }}},
+                {"INCRBY", {2, 2, 1, 1, [](DataStore &s, Args a) { return incrby(s, a[0], int_arg(a[1])); }}},
+                {"DEL", {1, 0, 1, 0, [](DataStore &s, Args a) { return count(s.del(a)); }}},
+                {"ZADD", {3, 3, 1, 1, [](DataStore &s, Args a) {
+                    return count(s.zadd(a[0], score_arg(a[1]), a[2]));
+                }}},
+                {"ZREM", {2, 2, 1, 1, [](DataStore &s, Args a) { return count(s.zrem(a[0], a[1])); }}},
+                {"ZSCORE", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    auto score = s.zscore(a[0], a[1]);
+                    return score ? ScriptValue::number(*score) : ScriptValue();
+                }}},
+                {"LPUSH", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    s.lpush(a[0], a[1]);
+                    return count(s.llen(a[0]));
+                }}},
+                {"RPUSH", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    s.rpush(a[0], a[1]);
+                    return count(s.llen(a[0]));
+                }}},
+                {"LPOP", {1, 1, 1, 1, [](DataStore &s, Args a) { return optional_string(s.lpop(a[0])); }}},
+                {"RPOP", {1, 1, 1, 1, [](DataStore &s, Args a) { return optional_string(s.rpop(a[0])); }}},
+                {"LLEN", {1, 1, 1, 1, [](DataStore &s, Args a) { return count(s.llen(a[0])); }}},
+                {"LINDEX", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    return optional_string(s.lindex(a[0], int_arg(a[1])));
+                }}},
+                {"LMOVE", {4, 4, 1, 2, [](DataStore &s, Args a) {
+                    return optional_string(s.lmove(a[0], a[1], side_arg(a[2]), side_arg(a[3])));
+                }}},
+                {"SADD", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    return ScriptValue::integer(s.sadd(a[0], a[1]).value_or(0));
+                }}},
+                {"SREM", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    return ScriptValue::integer(s.srem(a[0], a[1]).value_or(0));
+                }}},
+                {"SISMEMBER", {2, 2, 1, 1, [](DataStore &s, Args a) {
+                    return ScriptValue::integer(s.sismember(a[0], a[1]).value_or(0));
+                }}},
+                {"SCARD", {1, 1, 1, 1, [](DataStore &s, Args a) { return count(s.scard(a[0])); }}},
+                {"HSET", {3, 0, 1, 1, [](DataStore &s, Args a) {
+                    if (a.size() % 2 == 0) {
+                        throw ScriptError("HSET requires a key and field value pairs");
+                    }
+                    std::vector<std::pair<std::string, std::string>> fields;
+                    for (size_t i = 1; i + 1 < a.size(); i += 2) {
+                        fields.emplace_back(a[i], a[i + 1]);
+                    }
+                    return ScriptValue::integer(s.hset(a[0], fields));
+                }}},
+                {"HGET", {2, 2, 1, 1, [](DataStore &s, Args a) { return optional_string(s.hget(a[0], a[1])); }}},
+                {"HEXISTS", {2, 2, 1, 1, [](DataStore &s, Args a) { return count(s.hexists(a[0], a[1])); }}},
+                {"HINCRBY", {3, 3, 1, 1, [](DataStore &s, Args a) {
+                    auto value = s.hincrby(a[0], a[1], integer_arg(a[2]));
+                    return value ? ScriptValue::integer(*value) : ScriptValue();
+                }}},
+                {"HDEL", {2, 0, 1, 1, [](DataStore &s, Args a) {
+                    return ScriptValue::integer(s.hdel(a[0], std::vector<std::string>(a.begin() + 1, a.end())));
+                }}},
+                {"HLEN", {1, 1, 1, 1, [](DataStore &s, Args a) { return count(s.hlen(a[0])); }}},
+        };
+        return table;
+    }
+
+    static ScriptValue incrby(DataStore &store, const std::string &key, int amount) {
+        auto value = store.incrby(key, amount);
+        if (!value) {
+            throw ScriptError("value is not an integer or out of range");
+        }
+        return ScriptValue::integer(*value);
+    }
+
+    // call(name, ...) from a script. a key the script did not declare may sit in a stripe the run does not
+    // hold, so using one is an error rather than a lock taken out of order
+    ScriptValue dispatch(const std::vector<std::string> &keys, const ScriptValue *args, size_t n) {
+        auto name = args[0].text();
+        auto it = name ? bindings().find(*name) : bindings().end();
+        if (it == bindings().end()) {
+            throw ScriptError("unknown command '" + name.value_or(args[0].type_name()) + "' called from script");
+        }
+        const auto &binding = it->second;
+        size_t argc = n - 1;
+        if (argc < binding.min_args_ || (binding.max_args_ && argc > binding.max_args_)) {
+            throw ScriptError("wrong number of arguments for '" + *name + "' called from script");
+        }
+        std::vector<std::string> strings;
+        strings.reserve(argc);
+        for (size_t i = 1; i < n; ++i) {
+            auto text = args[i].text();
+            if (!text) {
+                throw ScriptError("command arguments must be strings or numbers");
+            }
+            strings.push_back(std::move(*text));
+        }
+        size_t last = binding.last_key_ ? std::min(binding.last_key_, argc) : argc;
+        for (size_t i = binding.first_key_; i <= last; ++i) {
+            if (std::find(keys.begin(), keys.end(), strings[i - 1]) == keys.end()) {
+                throw ScriptError("script accessed key '" + strings[i - 1] + "' not declared in KEYS");
+            }
+        }
+        return binding.run_(store_, strings);
+    }
+
+    static std::string sha1_hex(std::string_view source) {
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char *>(source.data()), source.size(), digest);
+        static constexpr char hex[] = "0123456789abcdef";
+        std::string sha;
+        sha.reserve(2 * SHA_DIGEST_LENGTH);
+        for (auto byte: digest) {
+            sha += hex[byte >> 4];
+            sha += hex[byte & 0xf];
+        }
+        return sha;
+    }
+
+    std::shared_ptr<const Script> find(const std::string &sha) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = scripts_.find(sha);
+        return it == scripts_.end() ? nullptr : it->second;
+    }
+
+    std::pair<std::string, std::shared_ptr<const Script>> compile(std::string_view source) {
+        auto sha = sha1_hex(source);
+        if (auto script = find(sha)) {
+            return {sha, script};
+        }
+        auto script = Script::compile(source);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        return {sha, scripts_.emplace(sha, script).first->second};
+    }
+
+    // a failing script keeps the writes it made before the error. the error is only rethrown once exec has
+    // returned, so clients blocked on lists the script pushed to are still served
+    ScriptValue run(const Script &script, const std::vector<std::string> &keys, const std::vector<std::string> &argv) {
+        ScriptValue result;
+        std::exception_ptr failed;
+        store_.exec(keys, false, {}, [&] {
+            try {
+                result = script.run(keys, argv, [&](const ScriptValue *args, size_t n) {
+                    return dispatch(keys, args, n);
+                });
+            } catch (...) {
+                failed = std::current_exception();
+            }
+        });
+        if (failed) {
+            std::rethrow_exception(failed);
+        }
+        return result;
+    }
+
+public:
+    explicit ScriptEngine(DataStore &store) : store_(store) {}
+
+    // SCRIPT LOAD: compiles and caches source, returning its SHA1; throws ScriptError when it does not compile
+    std::string load(std::string_view source) {
+        return compile(source).first;
+    }
+
+    ScriptValue eval(std::string_view source, const std::vector<std::string> &keys,
+                     const std::vector<std::string> &argv) {
+        return run(*compile(source).second, keys, argv);
+    }
+
+    // nullopt when no script with that SHA1 has been loaded
+    std::optional<ScriptValue> evalsha(const std::string &sha, const std::vector<std::string> &keys,
+                                       const std::vector<std::string> &argv) {
+        auto script = find(sha);
+        if (!script) {
+            return std::nullopt;
+        }
+        return run(*script, keys, argv);
+    }
+
+    bool exists(const std::string &sha) const {
+        return find(sha) != nullptr;
+    }
+
+    void flush() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        scripts_.clear();
+    }
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include "set_object.cpp"
+#include "thread_pool.cpp"
+
+// multi-set kernels behind SINTER/SUNION/SDIFF and their STORE variants. every kernel walks its input by
+// hash partition: a member hashes to the same partition in every set, so partitions are independent and
+// can be handed to a ThreadPool, with each worker producing its own slice of the result
+class SetAlgebra {
+public:
+    using Sets = std::vector<const SetObject *>;
+
+    // below this much probing work a parallel split costs more than it saves
+    static constexpr size_t kParallelThreshold = 1 << 16;
+
+private:
+    // partitions scanned serially, so SINTERCARD LIMIT can stop between them
+    static constexpr size_t kSerialParts = 64;
+
+    static size_t parts_for(ThreadPool *pool, size_t work) {
+        if (pool == nullptr || work < kParallelThreshold) {
+            return 1;
+        }
+        // a few partitions per thread so an uneven hash split still keeps everyone busy
+        size_t parts = 1;
+        while (parts < (pool->size() + 1) * 4) {
+            parts <<= 1;
+        }
+        return parts;
+    }
+
+    template <typename F>
+    static std::vector<std::string> gather(ThreadPool *pool, size_t parts, F &&kernel) {
+        if (parts == 1) {
+            std::vector<std::string> out;
+            kernel(0, 1, out);
+            return out;
+        }
+
+        std::vector<std::vector<std::string>> slices(parts);
+        pool->parallel_for(parts, [&](size_t part) { kernel(part, parts, slices[part]); });
+
+        size_t total = 0;
+        for (const auto &slice: slices) {
+            total += slice.size();
+        }
+        std::vector<std::string> out;
+        out.reserve(total);
+        for (auto &slice: slices) {
+            std::move(slice.begin(), slice.end(), std::back_inserter(out));
+        }
+        return out;
+    }
+
+    static bool in_all(const Sets &sets, const std::string &member) {
+        for (size_t i = 1; i < sets.size(); ++i) {
+            if (!sets[i]->contains(member)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // walks the smallest set once and probes the others, so the cost is O(smallest * sets) whatever the
+    // order of the inputs; when every set is an intset the sorted arrays are intersected directly
+    static std::vector<std::string> intersect(Sets sets, ThreadPool *pool) {
+        if (sets.empty()) {
+            return {};
+        }
+        std::sort(sets.begin(), sets.end(), [](auto a, auto b) { return a->size() < b->size(); });
+        if (sets[0]->empty()) {
+            return {};
+        }
+
+        bool all_ints = std::all_of(sets.begin(), sets.end(), [](auto set) { return set->is_intset(); });
+        if (all_ints) {
+            auto common = sets[0]->ints().values();
+            for (size_t i = 1; i < sets.size() && !common.empty(); ++i) {
+                common = IntSet::intersect(common, sets[i]->ints().values());
+            }
+            std::vector<std::string> out;
+            out.reserve(common.size());
+            for (auto value: common) {
+                out.push_back(IntString::render(value));
+            }
+            return out;
+        }
+
+        size_t parts = parts_for(pool, sets[0]->size() * sets.size());
+        return gather(pool, parts, [&](size_t part, size_t n, std::vector<std::string> &out) {
+            sets[0]->for_each_in_partition(part, n, [&](const std::string &member) {
+                if (in_all(sets, member)) {
+                    out.push_back(member);
+                }
+            });
+        });
+    }
+
+    // size of the intersection, stopping once limit members are found (0 means no limit)
+    static size_t intersect_card(Sets sets, ThreadPool *pool, size_t limit) {
+        if (sets.empty()) {
+            return 0;
+        }
+        std::sort(sets.begin(), sets.end(), [](auto a, auto b) { return a->size() < b->size(); });
+        if (limit == 0) {
+            limit = sets[0]->size();
+        }
+
+        std::atomic<size_t> found(0);
+        auto count = [&](size_t part, size_t n) {
+            if (found.load(std::memory_order_relaxed) >= limit) {
+                return;
+            }
+            sets[0]->for_each_in_partition(part, n, [&](const std::string &member) {
+                if (found.load(std::memory_order_relaxed) < limit && in_all(sets, member)) {
+                    found.fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+        };
+
+        size_t parts = parts_for(pool, sets[0]->size() * sets.size());
+        if (parts == 1) {
+            // an intset would re-render every member per partition, so it is walked in one go
+            size_t serial = sets[0]->is_intset() ? 1 : kSerialParts;
+            for (size_t part = 0; part < serial && found < limit; ++part) {
+                count(part, serial);
+            }
+        } else {
+            pool->parallel_for(parts, [&](size_t part) { count(part, parts); });
+        }
+        return std::min(found.load(), limit);
+    }
+
+    static std::vector<std::string> unite(const Sets &sets, ThreadPool *pool) {
+        size_t total = 0;
+        for (auto set: sets) {
+            total += set->size();
+        }
+
+        size_t parts = parts_for(pool, total);
+        return gather(pool, parts, [&](size_t part, size_t n, std::vector<std::string> &out) {
+            HashTable<SetObject::Empty> seen;
+            seen.reserve(total / n);
+            for (auto set: sets) {
+                set->for_each_in_partition(part, n, [&](const std::string &member) {
+                    if (seen.try_emplace(member).second) {
+                        out.push_back(member);
+                    }
+                });
+            }
+        });
+    }
+
+    // members of the first set that are in none of the others
+    static std::vector<std::string> difference(const Sets &sets, ThreadPool *pool) {
+        if (sets.empty()) {
+            return {};
+        }
+
+        size_t parts = parts_for(pool, sets[0]->size() * sets.size());
+        return gather(pool, parts, [&](size_t part, size_t n, std::vector<std::string> &out) {
+            sets[0]->for_each_in_partition(part, n, [&](const std::string &member) {
+                for (size_t i = 1; i < sets.size(); ++i) {
+                    if (sets[i]->contains(member)) {
+                        return;
+                    }
+                }
+                out.push_back(member);
+            });
+        });
+    }
+};
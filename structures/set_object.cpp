@@ -0,0 +1,142 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "hash_table.cpp"
+#include "int_set.cpp"
+#include "int_string.cpp"
+
+// a set starts as a sorted IntSet while every member is a canonical int64 and the set stays small, and
+// converts once to an open-addressing HashTable when a non-integer member arrives or it outgrows the limit
+class SetObject {
+public:
+    struct Empty {};
+
+private:
+    static constexpr size_t kMaxIntSetEntries = 512;
+
+    bool intset_;
+    IntSet ints_;
+    HashTable<Empty> table_;
+
+    void convert() {
+        table_.reserve(ints_.size() + 1);
+        for (auto value: ints_.values()) {
+            table_.try_emplace(IntString::render(value));
+        }
+        ints_ = IntSet();
+        intset_ = false;
+    }
+
+public:
+    SetObject() : intset_(true) {}
+
+    static bool parse_int(const std::string &member, int64_t &value) {
+        return IntString::parse(member, value);
+    }
+
+    bool add(const std::string &member) {
+        if (intset_) {
+            int64_t value;
+            if (parse_int(member, value)) {
+                if (ints_.contains(value)) {
+                    return false;
+                }
+                if (ints_.size() < kMaxIntSetEntries) {
+                    return ints_.insert(value);
+                }
+            }
+            convert();
+        }
+        return table_.try_emplace(member).second;
+    }
+
+    // makes room for n members once the set is a hash table; an intset is left alone, as a batch of
+    // integers may still fit it
+    void reserve(size_t n) {
+        if (!intset_) {
+            table_.reserve(n);
+        }
+    }
+
+    bool remove(const std::string &member) {
+        if (intset_) {
+            int64_t value;
+            return parse_int(member, value) && ints_.erase(value);
+        }
+        return table_.erase(member);
+    }
+
+    bool contains(const std::string &member) const {
+        if (intset_) {
+            int64_t value;
+            return parse_int(member, value) && ints_.contains(value);
+        }
+        return table_.contains(member);
+    }
+
+    template <typename F>
+    void for_each(F &&fn) const {
+        if (intset_) {
+            for (auto value: ints_.values()) {
+                fn(IntString::render(value));
+            }
+        } else {
+            table_.for_each([&](const std::string &member, const Empty &) { fn(member); });
+        }
+    }
+
+    // members whose hash falls in partition part of parts, see HashTable::for_each_in_partition. every
+    // encoding partitions by the same hash, so a member lands in the same partition whichever set holds it
+    template <typename F>
+    void for_each_in_partition(size_t part, size_t parts, F &&fn) const {
+        if (intset_) {
+            for (auto value: ints_.values()) {
+                auto member = IntString::render(value);
+                if (HashTable<Empty>::partition_of(HashTable<Empty>::hash_of(member), parts) == part) {
+                    fn(member);
+                }
+            }
+        } else {
+            table_.for_each_in_partition(part, parts, [&](const std::string &member, const Empty &) { fn(member); });
+        }
+    }
+
+    // see HashTable::scan; an intset is small enough to return whole, ending the scan at once
+    template <typename F>
+    uint64_t scan(uint64_t cursor, size_t count, F &&fn) const {
+        if (intset_) {
+            for_each(fn);
+            return 0;
+        }
+        return table_.scan(cursor, count, [&](const std::string &member, const Empty &) { fn(member); });
+    }
+
+    std::vector<std::string> members() const {
+        std::vector<std::string> result;
+        result.reserve(size());
+        for_each([&](const std::string &member) { result.push_back(member); });
+        return result;
+    }
+
+    size_t size() const {
+        return intset_ ? ints_.size() : table_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    bool is_intset() const {
+        return intset_;
+    }
+
+    const IntSet &ints() const {
+        return ints_;
+    }
+
+    const HashTable<Empty> &table() const {
+        return table_;
+    }
+};
@@ -9,142 +9,342 @@
 #include <limits>
 #include <iostream>
 #include <optional>
-
+#include <atomic>
+#include <cstdint>
+#include "slab_allocator.cpp"
+#include "epoch.cpp"
+
+// lock-free skip list. every level of a node's tower is linked with compare-and-swap, and the low bit of a
+// next pointer marks the node that owns it as deleted: a remover marks the tower top-down, the thread whose
+// mark lands on level 0 owns the removal, and any traversal that meets a marked node snips it out. readers
+// never block, and unlinked nodes are reclaimed through Epoch once no pinned operation can still see them
 class SkipList {
 private:
+    using Link = std::atomic<uintptr_t>;
+
     struct Node {
+        // set while the inserter is still linking the upper levels, and once the node has been removed
+        static constexpr uint8_t kInserting = 1;
+        static constexpr uint8_t kRemoved = 2;
+
         std::string member_;
-        double score_;
-        std::vector<Node *> forward_;
+        std::atomic<double> score_;
+        std::atomic<uint8_t> state_;
+        std::vector<Link, KeyspaceAllocator<Link>> forward_;
 
         Node(const std::string &m, double s, int level)
-                : member_(m), score_(s), forward_(level, nullptr) {}
+                : member_(m), score_(s), state_(kInserting), forward_(level) {
+            for (auto &link: forward_) {
+                link.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // nodes and their forward arrays come from the keyspace size classes
+        static void *operator new(size_t) {
+            return KeyspaceAllocator<Node>().allocate(1);
+        }
+
+        static void operator delete(void *p) {
+            KeyspaceAllocator<Node>().deallocate(static_cast<Node *>(p), 1);
+        }
+
+        int level() const {
+            return static_cast<int>(forward_.size());
+        }
+
+        Node *next(int i) const {
+            return pointer(forward_[i].load());
+        }
+
+        bool deleted() const {
+            return marked(forward_[0].load());
+        }
     };
 
     static constexpr int MAX_LEVEL_ = 32;
     static constexpr float P_ = 0.5;
 
     Node *head_;
-    int level_;
-    std::mt19937 gen_;
-    std::uniform_real_distribution<> dis_;
-    mutable std::mutex mutex_;
+    // highest level any node has reached; readers start their descent there
+    std::atomic<int> level_;
+    std::atomic<size_t> length_;
 
-    int randomLevel() {
+    static Node *pointer(uintptr_t link) {
+        return reinterpret_cast<Node *>(link & ~uintptr_t(1));
+    }
+
+    static bool marked(uintptr_t link) {
+        return link & 1;
+    }
+
+    static uintptr_t link_to(Node *node) {
+        return reinterpret_cast<uintptr_t>(node);
+    }
+
+    static int randomLevel() {
+        thread_local std::mt19937 gen(std::random_device{}());
+        std::uniform_real_distribution<> dis(0.0, 1.0);
         int lvl = 1;
-        while (dis_(gen_) < P_ && lvl < MAX_LEVEL_) {
+        while (dis(gen) < P_ && lvl < MAX_LEVEL_) {
             ++lvl;
         }
         return lvl;
     }
 
+    // first live node after x at level 0
+    static Node *live_next(Node *x) {
+        x = x->next(0);
+        while (x && x->deleted()) {
+            x = x->next(0);
+        }
+        return x;
+    }
+
+    // fills preds and succs with the nodes around member at every level, snipping out marked nodes on the
+    // way, and reports whether a live node holds member. restarts when a snip loses a race
+    bool find(const std::string &member, Node **preds, Node **succs) {
+    retry:
+        Node *pred = head_;
+        for (int i = MAX_LEVEL_ - 1; i >= 0; --i) {
+            Node *curr = pred->next(i);
+            while (curr) {
+                uintptr_t succ = curr->forward_[i].load();
+                while (marked(succ)) {
+                    uintptr_t expected = link_to(curr);
+                    if (!pred->forward_[i].compare_exchange_strong(expected, succ & ~uintptr_t(1))) {
+                        goto retry;
+                    }
+                    curr = pointer(succ);
+                    if (!curr) {
+                        break;
+                    }
+                    succ = curr->forward_[i].load();
+                }
+                if (curr && curr->member_ < member) {
+                    pred = curr;
+                    curr = pointer(succ);
+                } else {
+                    break;
+                }
+            }
+            preds[i] = pred;
+            succs[i] = curr;
+        }
+        return succs[0] && succs[0]->member_ == member;
+    }
+
+    // marks every level of x, top-down; true for the one caller whose mark lands on level 0
+    static bool mark(Node *x) {
+        for (int i = x->level() - 1; i >= 1; --i) {
+            uintptr_t link = x->forward_[i].load();
+            while (!marked(link) && !x->forward_[i].compare_exchange_weak(link, link | 1)) {}
+        }
+        uintptr_t link = x->forward_[0].load();
+        while (!marked(link)) {
+            if (x->forward_[0].compare_exchange_weak(link, link | 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // called by the owner of a removal once x is unlinked. a node whose inserter is still linking towers
+    // may be relinked at an upper level, so in that case the inserter retires it when it finishes
+    static bool owns_unlinked(Node *x) {
+        return !(x->state_.fetch_or(Node::kRemoved) & Node::kInserting);
+    }
+
+    // active defrag: a copy of x in a fuller slab, or x itself when moving would not help. pinned readers may
+    // still be on x, so it keeps its links and is only released after a grace period
+    static Node *defrag_copy(Node *x) {
+#ifndef USE_DEFAULT_ALLOCATOR
+        void *to = SlabAllocator::instance().relocate(x, sizeof(Node));
+        if (!to) {
+            return x;
+        }
+        auto y = ::new(to) Node(x->member_, x->score_, x->level());
+        y->state_ = x->state_.load();
+        for (int i = 0; i < x->level(); ++i) {
+            y->forward_[i].store(x->forward_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        Epoch::instance().retire(x, [](void *p) {
+            static_cast<Node *>(p)->~Node();
+            SlabAllocator::instance().release_moved(p, sizeof(Node));
+        });
+        return y;
+#else
+        return x;
+#endif
+    }
+
     void printDebug(const std::string& operation, const std::string& member, double score) const {
         std::cout << operation << ": member=" << member << ", score=" << score << std::endl;
         for (int i = 0; i < level_; ++i) {
             std::cout << "Level " << i << ": ";
-            Node* node = head_->forward_[i];
+            Node* node = head_->next(i);
             while (node) {
                 std::cout << "(" << node->member_ << "," << node->score_ << ") ";
-                node = node->forward_[i];
+                node = node->next(i);
             }
             std::cout << std::endl;
         }
     }
 
 public:
-    SkipList() : level_(1), gen_(std::random_device{}()), dis_(0.0, 1.0) {
+    // nodes unlinked by range_delete. other threads may still be reading them, so they are freed after an
+    // epoch grace period when this is destroyed, which the store may leave to the lazy freer thread
+    class Detached {
+    private:
+        std::vector<Node *> nodes_;
+
+        friend class SkipList;
+
+    public:
+        Detached() = default;
+        Detached(Detached &&other) noexcept = default;
+        Detached &operator=(Detached &&) = delete;
+
+        ~Detached() {
+            if (nodes_.empty()) {
+                return;
+            }
+            Epoch::instance().synchronize();
+            for (auto x: nodes_) {
+                delete x;
+            }
+        }
+
+        // hands the nodes to Epoch instead of waiting for the grace period here
+        void retire() {
+            for (auto x: nodes_) {
+                Epoch::instance().retire(x);
+            }
+            nodes_.clear();
+        }
+
+        size_t size() const {
+            return nodes_.size();
+        }
+    };
+
+    SkipList() : level_(1), length_(0) {
         head_ = new Node("", std::numeric_limits<double>::lowest(), MAX_LEVEL_);
+        head_->state_ = 0;
     }
 
+    // only runs once no other thread can reach the list. marked nodes belong to a remover that retires them
     ~SkipList() {
-        Node *current = head_;
+        Node *current = head_->next(0);
+        delete head_;
         while (current != nullptr) {
-            Node *next = current->forward_[0];
-            delete current;
+            Node *next = current->next(0);
+            if (!current->deleted()) {
+                delete current;
+            }
             current = next;
         }
     }
-    bool insert(const std::string &member, double score) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::vector<Node *> update(MAX_LEVEL_);
-        Node *x = head_;
 
-        for (int i = level_ - 1; i >= 0; --i) {
-            while (x->forward_[i] && x->forward_[i]->member_ < member) {
-                x = x->forward_[i];
+    bool insert(const std::string &member, double score) {
+        auto guard = Epoch::instance().pin();
+        Node *preds[MAX_LEVEL_];
+        Node *succs[MAX_LEVEL_];
+        Node *x = nullptr;
+
+        while (true) {
+            if (find(member, preds, succs)) {
+                succs[0]->score_ = score;
+                delete x;
+                return false;
+            }
+            if (!x) {
+                x = new Node(member, score, randomLevel());
+            }
+            for (int i = 0; i < x->level(); ++i) {
+                x->forward_[i].store(link_to(succs[i]), std::memory_order_relaxed);
+            }
+            uintptr_t expected = link_to(succs[0]);
+            if (preds[0]->forward_[0].compare_exchange_strong(expected, link_to(x))) {
+                break;
             }
-            update[i] = x;
         }
-        x = x->forward_[0];
 
-        if (x && x->member_ == member) {
-            x->score_ = score;
-            return false;
-        }
+        ++length_;
+        int top = x->level();
+        int level = level_.load();
+        while (level < top && !level_.compare_exchange_weak(level, top)) {}
 
-        int new_level = randomLevel();
-        if (new_level > level_) {
-            for (int i = level_; i < new_level; ++i) {
-                update[i] = head_;
+        for (int i = 1; i < top; ++i) {
+            bool linked = false;
+            while (!linked) {
+                uintptr_t link = x->forward_[i].load();
+                if (marked(link)) {
+                    break;
+                }
+                if (pointer(link) != succs[i] && !x->forward_[i].compare_exchange_strong(link, link_to(succs[i]))) {
+                    continue;
+                }
+                uintptr_t expected = link_to(succs[i]);
+                linked = preds[i]->forward_[i].compare_exchange_strong(expected, link_to(x));
+                if (!linked && (!find(member, preds, succs) || succs[0] != x)) {
+                    break;
+                }
+            }
+            if (!linked) {
+                break;
             }
-            level_ = new_level;
         }
 
-        x = new Node(member, score, new_level);
-        for (int i = 0; i < new_level; ++i) {
-            x->forward_[i] = update[i]->forward_[i];
-            update[i]->forward_[i] = x;
+        // a remover that ran meanwhile left the retire to us; snip whatever we linked after it unlinked
+        if (x->state_.fetch_and(static_cast<uint8_t>(~Node::kInserting)) & Node::kRemoved) {
+            find(member, preds, succs);
+            Epoch::instance().retire(x);
         }
-
         return true;
     }
 
     bool remove(const std::string &member) {
-        std::lock_guard<std::mutex> lock(mutex_);
-
-        std::vector<Node *> update(MAX_LEVEL_);
-        auto x = head_;
+        auto guard = Epoch::instance().pin();
+        Node *preds[MAX_LEVEL_];
+        Node *succs[MAX_LEVEL_];
 
-        for (int i = level_ - 1; i >= 0; --i) {
-            while (x->forward_[i] && x->forward_[i]->member_ < member) {
-                x = x->forward_[i];
-            }
-            update[i] = x;
+        if (!find(member, preds, succs)) {
+            return false;
         }
-        x = x->forward_[0];
-
-        if (!x || x->member_ != member) {
+        Node *x = succs[0];
+        if (!mark(x)) {
             return false;
         }
-
-        for (int i = 0; i < level_; ++i) {
-            if (update[i]->forward_[i] != x) {
-                break;
-            }
-            update[i]->forward_[i] = x->forward_[i];
+        --length_;
+        bool owner = owns_unlinked(x);
+        find(member, preds, succs);
+        if (owner) {
+            Epoch::instance().retire(x);
         }
+        return true;
+    }
 
-        delete x;
-
-        while (level_ > 1 && head_->forward_[level_ - 1] == nullptr) {
-            --level_;
-        }
+    size_t size() const {
+        return length_;
+    }
 
-        return true;
+    bool empty() const {
+        return length_ == 0;
     }
 
     std::optional<double> score(const std::string &member) {
+        auto guard = Epoch::instance().pin();
         auto x = head_;
 
         for (int i = level_ - 1; i >= 0; --i) {
-            while (x->forward_[i] && x->forward_[i]->member_ < member) {
-                x = x->forward_[i];
+            while (x->next(i) && x->next(i)->member_ < member) {
+                x = x->next(i);
             }
         }
-        x = x->forward_[0];
+        x = live_next(x);
 
         if (x && x->member_ == member) {
-            return x->score_;
+            return x->score_.load();
         }
 
         return std::nullopt;
@@ -152,97 +352,173 @@ public:
 
     std::vector<std::pair<std::string, double>>
     range(double min_score, double max_score, int64_t offset, int64_t count) {
-        std::lock_guard<std::mutex> lock(mutex_);
+        auto guard = Epoch::instance().pin();
 
         std::vector<std::pair<std::string, double>> result;
         auto x = head_;
 
         for (int i = level_ - 1; i >= 0; --i) {
-            while (x->forward_[i] && x->forward_[i]->score_ < min_score) {
-                x = x->forward_[i];
+            while (x->next(i) && x->next(i)->score_ < min_score) {
+                x = x->next(i);
             }
         }
-        x = x->forward_[0];
+        x = live_next(x);
 
         while (x && offset > 0) {
-            x = x->forward_[0];
+            x = live_next(x);
             --offset;
         }
 
-        while (x && x->score_ <= max_score && count > 0) {
-            result.emplace_back(x->member_, x->score_);
-            x = x->forward_[0];
+        while (x && count > 0) {
+            double score = x->score_;
+            if (score > max_score) {
+                break;
+            }
+            result.emplace_back(x->member_, score);
+            x = live_next(x);
             --count;
         }
 
         return result;
     }
 
-    void range_delete(double min_score, double max_score, int64_t offset, int64_t count) {
-        std::lock_guard<std::mutex> lock(mutex_);
-
-        std::vector<Node *> update(MAX_LEVEL_);
-        auto x = head_;
-        for (int i = level_ - 1; i >= 0; --i) {
-            while (x->forward_[i] && x->forward_[i]->score_ < min_score) {
-                x = x->forward_[i];
+    // marks the matching nodes and unlinks them, handing them back detached rather than freeing them here
+    Detached range_delete(double min_score, double max_score, int64_t offset, int64_t count) {
+        Detached removed;
+        std::vector<Node *> unlinked;
+        {
+            auto guard = Epoch::instance().pin();
+            auto x = head_;
+            for (int i = level_ - 1; i >= 0; --i) {
+                while (x->next(i) && x->next(i)->score_ < min_score) {
+                    x = x->next(i);
+                }
             }
-            update[i] = x;
-        }
-        x = x->forward_[0];
+            x = live_next(x);
 
-        while (x && offset > 0) {
-            x = x->forward_[0];
-            --offset;
-        }
+            while (x && offset > 0) {
+                x = live_next(x);
+                --offset;
+            }
 
-        while (x && x->score_ <= max_score && count > 0) {
-            auto next = x->forward_[0];
-            for (int i = 0; i < level_; ++i) {
-                if (update[i]->forward_[i] != x) {
-                    break;
+            while (x && x->score_ <= max_score && count > 0) {
+                auto next = live_next(x);
+                if (mark(x)) {
+                    unlinked.push_back(x);
+                    --count;
                 }
-                update[i]->forward_[i] = x->forward_[i];
+                x = next;
             }
-            delete x;
-            --count;
-            while (level_ > 1 && head_->forward_[level_ - 1] == nullptr) {
-                --level_;
+            length_ -= unlinked.size();
+
+            Node *preds[MAX_LEVEL_];
+            Node *succs[MAX_LEVEL_];
+            for (auto node: unlinked) {
+                bool owner = owns_unlinked(node);
+                find(node->member_, preds, succs);
+                if (owner) {
+                    removed.nodes_.push_back(node);
+                }
             }
-            x = next;
         }
+        return removed;
     }
 
     std::vector<std::pair<std::string, double>> query(double min_score, const std::string &min_member,
                                                       double max_score, const std::string &max_member,
                                                       int64_t offset, int64_t count) {
-        std::lock_guard<std::mutex> lock(mutex_);
+        auto guard = Epoch::instance().pin();
 
         std::vector<std::pair<std::string, double>> result;
         auto x = head_;
 
         for (int i = level_ - 1; i >= 0; --i) {
-            while (x->forward_[i] && (x->forward_[i]->score_ < min_score ||
-                                      (x->forward_[i]->score_ == min_score && x->forward_[i]->member_ < min_member))) {
-                x = x->forward_[i];
+            Node *next;
+            while ((next = x->next(i)) && (next->score_ < min_score ||
+                                           (next->score_ == min_score && next->member_ < min_member))) {
+                x = next;
             }
         }
-        x = x->forward_[0];
+        x = live_next(x);
 
         while (x && offset > 0) {
-            x = x->forward_[0];
+            x = live_next(x);
             --offset;
         }
 
-        while (x && count > 0 && (x->score_ < max_score ||
-                                  (x->score_ == max_score && x->member_ <= max_member))) {
-            result.emplace_back(x->member_, x->score_);
-            x = x->forward_[0];
+        while (x && count > 0) {
+            double score = x->score_;
+            if (score > max_score || (score == max_score && x->member_ > max_member)) {
+                break;
+            }
+            result.emplace_back(x->member_, score);
+            x = live_next(x);
             --count;
         }
 
         return result;
     }
 
+    // ZSCAN: fn(member, score) for up to count members after `after` in member order, from the start when it
+    // is nullopt. returns the member to resume after, or nullopt once the end is reached. the cursor is a
+    // member rather than a position, so members present for the whole scan are returned exactly once however
+    // the list changes between calls
+    template <typename F>
+    std::optional<std::string> scan(const std::optional<std::string> &after, size_t count, F &&fn) {
+        auto guard = Epoch::instance().pin();
+        auto x = head_;
+        if (after) {
+            for (int i = level_ - 1; i >= 0; --i) {
+                while (x->next(i) && x->next(i)->member_ <= *after) {
+                    x = x->next(i);
+                }
+            }
+        }
+        size_t visited = 0;
+        for (x = live_next(x); x; x = live_next(x)) {
+            fn(x->member_, x->score_.load());
+            if (++visited >= count && live_next(x)) {
+                return x->member_;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // active defrag: visits up to max_nodes nodes with members after the cursor (from the start when it is
+    // nullopt), copies those in sparse slabs with defrag_copy and relinks their predecessors at every
+    // level. returns the member to resume after, or nullopt once the end is reached. readers may run
+    // alongside, but the caller must keep every other writer off the list
+    std::optional<std::string> defrag(const std::optional<std::string> &after, size_t max_nodes, size_t &moved) {
+        // last[i] is the node whose forward_[i] points at the current node, whatever its height
+        std::vector<Node *> last(MAX_LEVEL_, head_);
+        auto x = head_;
+        if (after) {
+            for (int i = level_ - 1; i >= 0; --i) {
+                while (x->next(i) && x->next(i)->member_ <= *after) {
+                    x = x->next(i);
+                }
+                last[i] = x;
+            }
+        }
+        x = last[0]->next(0);
+
+        for (size_t visited = 0; x && visited < max_nodes; ++visited) {
+            auto level = x->level();
+            // a marked node still belongs to its remover, so it stays where it is
+            Node *y = x->deleted() ? x : defrag_copy(x);
+            if (y != x) {
+                for (int i = 0; i < level; ++i) {
+                    auto mark_bit = last[i]->forward_[i].load(std::memory_order_relaxed) & 1;
+                    last[i]->forward_[i].store(link_to(y) | mark_bit, std::memory_order_release);
+                }
+                ++moved;
+            }
+            for (int i = 0; i < level; ++i) {
+                last[i] = y;
+            }
+            x = y->next(0);
+        }
 
-};
\ No newline at end of file
+        return x ? std::optional<std::string>(last[0]->member_) : std::nullopt;
+    }
+};
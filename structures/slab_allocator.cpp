@@ -0,0 +1,389 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+
+// size-class allocator for keyspace objects. memory comes in 64 KB slabs aligned to their size, each
+// carved into objects of one size class, so the owning slab (and through it the arena) of any object is
+// found by masking its address. a slab keeps its own free list and is returned to the system as soon as
+// its last object is freed, which is what keeps RSS near the live data after heavy churn. threads take
+// objects from a small per-class cache that is refilled from and flushed to an arena in batches, and
+// threads are spread over kShards arenas so they rarely contend on the same arena lock
+class SlabAllocator {
+public:
+    static constexpr size_t kSlabBytes = 64 * 1024;
+    static constexpr size_t kMaxSmall = 512;
+    static constexpr size_t kShards = 8;
+
+    struct Stats {
+        // bytes handed out in small objects, rounded up to their size class
+        size_t allocated_bytes = 0;
+        // bytes held in slabs, including free objects in slabs and thread caches
+        size_t slab_bytes = 0;
+        size_t slabs = 0;
+        // requests above kMaxSmall, passed through to operator new
+        size_t large_bytes = 0;
+
+        // slab memory per allocated byte; 1.0 means no waste
+        double fragmentation() const {
+            return allocated_bytes == 0 ? 0.0 : static_cast<double>(slab_bytes) / static_cast<double>(allocated_bytes);
+        }
+    };
+
+private:
+    static constexpr std::array<uint32_t, 13> kClasses = {16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512};
+    static constexpr size_t kClassCount = kClasses.size();
+    // objects moved between a thread cache and an arena at a time
+    static constexpr size_t kBatch = 32;
+    static constexpr size_t kCacheLimit = 2 * kBatch;
+
+    struct Arena;
+
+    struct Slab {
+        Arena *arena_;
+        uint32_t class_;
+        uint32_t live_;
+        uint32_t capacity_;
+        uint32_t carved_;
+        void *free_;
+        Slab *prev_;
+        Slab *next_;
+        bool listed_;
+    };
+
+    static constexpr size_t kHeaderBytes = (sizeof(Slab) + 15) & ~size_t(15);
+
+    struct Arena {
+        std::mutex mutex_;
+        // slabs of each class that still have room
+        std::array<Slab *, kClassCount> partial_{};
+        std::array<size_t, kClassCount> partial_count_{};
+        // per class totals, to compare a slab against the class average
+        std::array<size_t, kClassCount> class_slabs_{};
+        std::array<size_t, kClassCount> class_live_{};
+        std::atomic<size_t> slabs_{0};
+        std::atomic<size_t> allocated_{0};
+    };
+
+    struct ThreadCache {
+        std::array<std::vector<void *>, kClassCount> free_;
+        Arena *arena_;
+
+        explicit ThreadCache(Arena *arena) : arena_(arena) {}
+
+        ~ThreadCache() {
+            for (auto &objects: free_) {
+                instance().give_back(objects.data(), objects.size());
+            }
+        }
+    };
+
+    std::array<Arena, kShards> arenas_;
+    std::atomic<size_t> next_arena_{0};
+    std::atomic<size_t> large_bytes_{0};
+
+    static size_t class_of(size_t size) {
+        static const auto table = [] {
+            std::array<uint8_t, kMaxSmall / 16 + 1> t{};
+            size_t cls = 0;
+            for (size_t i = 0; i < t.size(); ++i) {
+                while (kClasses[cls] < i * 16) {
+                    ++cls;
+                }
+                t[i] = static_cast<uint8_t>(cls);
+            }
+            return t;
+        }();
+        return table[(size + 15) / 16];
+    }
+
+    static Slab *slab_of(void *p) {
+        return reinterpret_cast<Slab *>(reinterpret_cast<uintptr_t>(p) & ~(kSlabBytes - 1));
+    }
+
+    ThreadCache &cache() {
+        thread_local ThreadCache cache(&arenas_[next_arena_++ % kShards]);
+        return cache;
+    }
+
+    static void link(Arena &arena, Slab *slab) {
+        size_t cls = slab->class_;
+        slab->prev_ = nullptr;
+        slab->next_ = arena.partial_[cls];
+        if (slab->next_) {
+            slab->next_->prev_ = slab;
+        }
+        arena.partial_[cls] = slab;
+        ++arena.partial_count_[cls];
+        slab->listed_ = true;
+    }
+
+    static void unlink(Arena &arena, Slab *slab) {
+        size_t cls = slab->class_;
+        if (slab->prev_) {
+            slab->prev_->next_ = slab->next_;
+        } else {
+            arena.partial_[cls] = slab->next_;
+        }
+        if (slab->next_) {
+            slab->next_->prev_ = slab->prev_;
+        }
+        --arena.partial_count_[cls];
+        slab->listed_ = false;
+    }
+
+    static Slab *new_slab(Arena &arena, size_t cls) {
+        void *block = std::aligned_alloc(kSlabBytes, kSlabBytes);
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        auto slab = new(block) Slab{&arena, static_cast<uint32_t>(cls), 0,
+                                    static_cast<uint32_t>((kSlabBytes - kHeaderBytes) / kClasses[cls]), 0,
+                                    nullptr, nullptr, nullptr, false};
+        ++arena.slabs_;
+        ++arena.class_slabs_[cls];
+        link(arena, slab);
+        return slab;
+    }
+
+    // moves up to kBatch objects of class cls from the arena into out
+    static void refill(Arena &arena, size_t cls, std::vector<void *> &out) {
+        std::lock_guard<std::mutex> lock(arena.mutex_);
+        while (out.size() < kBatch) {
+            Slab *slab = arena.partial_[cls] ? arena.partial_[cls] : new_slab(arena, cls);
+            while (out.size() < kBatch && slab->live_ < slab->capacity_) {
+                void *p;
+                if (slab->free_) {
+                    p = slab->free_;
+                    slab->free_ = *static_cast<void **>(p);
+                } else {
+                    // objects are carved lazily, so a fresh slab only touches the pages it hands out
+                    p = reinterpret_cast<char *>(slab) + kHeaderBytes + size_t(slab->carved_++) * kClasses[cls];
+                }
+                ++slab->live_;
+                ++arena.class_live_[cls];
+                out.push_back(p);
+            }
+            if (slab->live_ == slab->capacity_) {
+                unlink(arena, slab);
+            }
+        }
+    }
+
+    // returns objects to their slabs, locking each owning arena once per run of objects from it
+    void give_back(void *const *objects, size_t n) {
+        std::unique_lock<std::mutex> lock;
+        Arena *locked = nullptr;
+        for (size_t i = 0; i < n; ++i) {
+            Slab *slab = slab_of(objects[i]);
+            Arena &arena = *slab->arena_;
+            // one arena lock at a time; assigning a new lock over the old one would briefly hold both
+            if (&arena != locked) {
+                if (lock) {
+                    lock.unlock();
+                }
+                lock = std::unique_lock<std::mutex>(arena.mutex_);
+                locked = &arena;
+            }
+
+            release_locked(arena, slab, objects[i]);
+        }
+    }
+
+    static void release_locked(Arena &arena, Slab *slab, void *p) {
+        *static_cast<void **>(p) = slab->free_;
+        slab->free_ = p;
+        --slab->live_;
+        --arena.class_live_[slab->class_];
+        if (!slab->listed_) {
+            link(arena, slab);
+        }
+        // keep one empty slab per class as a spare, release the rest
+        if (slab->live_ == 0 && arena.partial_count_[slab->class_] > 1) {
+            unlink(arena, slab);
+            --arena.slabs_;
+            --arena.class_slabs_[slab->class_];
+            slab->~Slab();
+            std::free(slab);
+        }
+    }
+
+    // how many partial slabs relocate looks at when choosing a destination
+    static constexpr size_t kRelocateCandidates = 32;
+
+    SlabAllocator() = default;
+
+public:
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    // never destroyed, so thread caches can flush into it during thread and process exit
+    static SlabAllocator &instance() {
+        static auto *allocator = new SlabAllocator();
+        return *allocator;
+    }
+
+    void *allocate(size_t size) {
+        if (size > kMaxSmall) {
+            large_bytes_.fetch_add(size, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+        size_t cls = class_of(size);
+        auto &tc = cache();
+        auto &objects = tc.free_[cls];
+        if (objects.empty()) {
+            refill(*tc.arena_, cls, objects);
+        }
+        void *p = objects.back();
+        objects.pop_back();
+        slab_of(p)->arena_->allocated_.fetch_add(kClasses[cls], std::memory_order_relaxed);
+        return p;
+    }
+
+    void deallocate(void *p, size_t size) {
+        if (size > kMaxSmall) {
+            large_bytes_.fetch_sub(size, std::memory_order_relaxed);
+            ::operator delete(p);
+            return;
+        }
+        size_t cls = class_of(size);
+        slab_of(p)->arena_->allocated_.fetch_sub(kClasses[cls], std::memory_order_relaxed);
+        auto &objects = cache().free_[cls];
+        objects.push_back(p);
+        if (objects.size() > kCacheLimit) {
+            give_back(objects.data() + kBatch, objects.size() - kBatch);
+            objects.resize(kBatch);
+        }
+    }
+
+    // active defrag: when p sits in a slab less utilized than the average for its class, returns a free
+    // object of the same class in a fuller slab of the same arena, or nullptr when moving would not help.
+    // the caller moves the object there and frees the old address with release_moved, which bypasses the
+    // thread cache so the sparse slab can drain
+    void *relocate(void *p, size_t size) {
+        if (size > kMaxSmall) {
+            return nullptr;
+        }
+        Slab *source = slab_of(p);
+        Arena &arena = *source->arena_;
+        size_t cls = source->class_;
+        std::lock_guard<std::mutex> lock(arena.mutex_);
+
+        size_t capacity = source->capacity_;
+        if (arena.partial_count_[cls] < 2 ||
+            source->live_ * arena.class_slabs_[cls] >= arena.class_live_[cls]) {
+            return nullptr;
+        }
+
+        Slab *target = nullptr;
+        size_t seen = 0;
+        for (Slab *slab = arena.partial_[cls]; slab && seen < kRelocateCandidates; slab = slab->next_, ++seen) {
+            if (slab != source && slab->live_ < capacity && (!target || slab->live_ > target->live_)) {
+                target = slab;
+            }
+        }
+        if (!target || target->live_ <= source->live_) {
+            return nullptr;
+        }
+
+        void *to;
+        if (target->free_) {
+            to = target->free_;
+            target->free_ = *static_cast<void **>(to);
+        } else {
+            to = reinterpret_cast<char *>(target) + kHeaderBytes + size_t(target->carved_++) * kClasses[cls];
+        }
+        ++target->live_;
+        ++arena.class_live_[cls];
+        if (target->live_ == target->capacity_) {
+            unlink(arena, target);
+        }
+        arena.allocated_.fetch_add(kClasses[cls], std::memory_order_relaxed);
+        return to;
+    }
+
+    void release_moved(void *p, size_t size) {
+        Slab *slab = slab_of(p);
+        Arena &arena = *slab->arena_;
+        arena.allocated_.fetch_sub(kClasses[class_of(size)], std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(arena.mutex_);
+        release_locked(arena, slab, p);
+    }
+
+    // hands the calling thread's cached objects back to their slabs
+    void flush_thread_cache() {
+        for (auto &objects: cache().free_) {
+            give_back(objects.data(), objects.size());
+            objects.clear();
+        }
+    }
+
+    Stats arena_stats(size_t shard) const {
+        const Arena &arena = arenas_[shard];
+        Stats stats;
+        stats.allocated_bytes = arena.allocated_.load(std::memory_order_relaxed);
+        stats.slabs = arena.slabs_.load(std::memory_order_relaxed);
+        stats.slab_bytes = stats.slabs * kSlabBytes;
+        return stats;
+    }
+
+    Stats stats() const {
+        Stats total;
+        for (size_t shard = 0; shard < kShards; ++shard) {
+            auto stats = arena_stats(shard);
+            total.allocated_bytes += stats.allocated_bytes;
+            total.slab_bytes += stats.slab_bytes;
+            total.slabs += stats.slabs;
+        }
+        total.large_bytes = large_bytes_.load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
+// std-compatible allocator over SlabAllocator, for containers and nodes in the keyspace
+template <typename T>
+class SlabStdAllocator {
+public:
+    using value_type = T;
+
+    SlabStdAllocator() noexcept = default;
+
+    template <typename U>
+    SlabStdAllocator(const SlabStdAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(SlabAllocator::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        SlabAllocator::instance().deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const SlabStdAllocator<U> &) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const SlabStdAllocator<U> &) const noexcept {
+        return false;
+    }
+};
+
+// building with -DUSE_DEFAULT_ALLOCATOR=ON routes the keyspace back through operator new, for comparison
+#ifdef USE_DEFAULT_ALLOCATOR
+template <typename T>
+using KeyspaceAllocator = std::allocator<T>;
+#else
+template <typename T>
+using KeyspaceAllocator = SlabStdAllocator<T>;
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <optional>
+#include <cstdint>
+#include "compact_string.cpp"
+#include "int_string.cpp"
+
+// a string value that holds a canonical int64 as the number itself. counters are incremented in place
+// and only turned into text when a reply needs it. text up to CompactString::kInline bytes is stored
+// inside the 48-byte object
+class StringValue {
+private:
+    CompactString data_;
+
+public:
+    StringValue() = default;
+
+    explicit StringValue(const std::string &text) {
+        int64_t value;
+        if (IntString::parse(text, value)) {
+            data_.set_int(value);
+        } else {
+            data_ = CompactString(text);
+        }
+    }
+
+    static StringValue from_int(int64_t value) {
+        StringValue v;
+        v.data_.set_int(value);
+        return v;
+    }
+
+    bool is_int() const {
+        return data_.is_int();
+    }
+
+    bool is_inline() const {
+        return data_.is_inline();
+    }
+
+    // adds by to an integer value in place; nullopt when the value is text or the sum would overflow
+    std::optional<int64_t> incr(int64_t by) {
+        int64_t sum;
+        if (!is_int() || !IntString::add(data_.int_value(), by, sum)) {
+            return std::nullopt;
+        }
+        data_.set_int(sum);
+        return sum;
+    }
+
+    // a copy whose heap block sits in a fuller slab, see CompactString::relocated
+    std::optional<StringValue> relocated() const {
+        auto data = data_.relocated();
+        if (!data) {
+            return std::nullopt;
+        }
+        StringValue v;
+        v.data_ = std::move(*data);
+        return v;
+    }
+
+    // the original of a relocated() copy, once no reader holds it
+    void release_moved() {
+        data_.release_moved();
+    }
+
+    std::string str() const {
+        return data_.str();
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                if (stop_ && tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads = std::max(1u, std::thread::hardware_concurrency())) : stop_(false) {
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &worker: workers_) {
+            worker.join();
+        }
+    }
+
+    template <typename F>
+    auto submit(F &&fn) -> std::future<decltype(fn())> {
+        auto task = std::make_shared<std::packaged_task<decltype(fn())()>>(std::forward<F>(fn));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace_back([task] { (*task)(); });
+        }
+        cv_.notify_one();
+        return future;
+    }
+
+    // runs fn(i) for every i in [0, n) on the workers and the calling thread, returning once all are done
+    template <typename F>
+    void parallel_for(size_t n, F &&fn) {
+        auto next = std::make_shared<std::atomic<size_t>>(0);
+        auto drain = [next, n, &fn] {
+            for (size_t i = (*next)++; i < n; i = (*next)++) {
+                fn(i);
+            }
+        };
+
+        std::vector<std::future<void>> pending;
+        size_t helpers = std::min(workers_.size(), n > 0 ? n - 1 : 0);
+        for (size_t i = 0; i < helpers; ++i) {
+            pending.push_back(submit(drain));
+        }
+        drain();
+        for (auto &future: pending) {
+            future.get();
+        }
+    }
+
+    size_t size() const {
+        return workers_.size();
+    }
+};
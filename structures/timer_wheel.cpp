@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// hashed timing wheel: scheduling is O(1) and each advance only scans the slots for the ticks that
+// elapsed, so thousands of pending timeouts cost one periodic tick instead of one timer apiece
+template <typename T>
+class TimerWheel {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        uint64_t expiry_tick_;
+        T value_;
+    };
+
+    std::vector<std::vector<Entry>> slots_;
+    Clock::duration resolution_;
+    Clock::time_point start_;
+    uint64_t current_tick_;
+    size_t size_;
+
+    uint64_t ticks_until(Clock::time_point t, bool round_up) const {
+        if (t <= start_) {
+            return 0;
+        }
+        auto elapsed = t - start_;
+        uint64_t ticks = elapsed / resolution_;
+        if (round_up && elapsed % resolution_ != Clock::duration::zero()) {
+            ++ticks;
+        }
+        return ticks;
+    }
+
+public:
+    explicit TimerWheel(Clock::duration resolution = std::chrono::milliseconds(10), size_t slots = 512)
+            : slots_(slots), resolution_(resolution), start_(Clock::now()), current_tick_(0), size_(0) {}
+
+    void schedule(Clock::time_point deadline, T value) {
+        // never fire early: round the deadline up, and anything already due goes in the next tick
+        uint64_t tick = std::max(ticks_until(deadline, true), current_tick_ + 1);
+        slots_[tick % slots_.size()].push_back({tick, std::move(value)});
+        ++size_;
+    }
+
+    // calls expire(value) for every entry whose deadline is at or before now
+    template <typename F>
+    size_t advance(Clock::time_point now, F &&expire) {
+        uint64_t now_tick = ticks_until(now, false);
+        if (now_tick <= current_tick_) {
+            return 0;
+        }
+
+        size_t fired = 0;
+        uint64_t steps = std::min<uint64_t>(now_tick - current_tick_, slots_.size());
+        for (uint64_t i = 1; i <= steps; ++i) {
+            auto &slot = slots_[(current_tick_ + i) % slots_.size()];
+            size_t kept = 0;
+            for (size_t j = 0; j < slot.size(); ++j) {
+                if (slot[j].expiry_tick_ <= now_tick) {
+                    expire(slot[j].value_);
+                    ++fired;
+                } else {
+                    if (kept != j) {
+                        slot[kept] = std::move(slot[j]);
+                    }
+                    ++kept;
+                }
+            }
+            slot.erase(slot.begin() + kept, slot.end());
+        }
+
+        current_tick_ = now_tick;
+        size_ -= fired;
+        return fired;
+    }
+
+    Clock::duration resolution() const {
+        return resolution_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+};
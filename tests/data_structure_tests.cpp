@@ -2,7 +2,17 @@
 #include <thread>
 #include <vector>
 #include <atomic>
+#include <set>
+#include <unordered_set>
+#include <random>
+#include <cstring>
 #include "../structures/data_store.cpp"
+#include "../structures/pub_sub.cpp"
+#include "../structures/client_tracking.cpp"
+#include "../structures/scripting.cpp"
+#include "../server/command_keys.cpp"
+#include "../client/reply.cpp"
+#include "../client/near_cache.cpp"
 
 class SkipListTest : public ::testing::Test {
 protected:
@@ -69,7 +79,9 @@ list.insert("b", 2.0);
 list.insert("c", 3.0);
 list.insert("d", 4.0);
 
-list.range_delete(1.5, 3.5, 0, 10);
+auto removed = list.range_delete(1.5, 3.5, 0, 10);
+EXPECT_EQ(removed.size(), 2);
+EXPECT_EQ(list.size(), 2);
 
 EXPECT_TRUE(list.score("a").has_value());
 EXPECT_FALSE(list.score("b").has_value());
@@ -94,6 +106,601 @@ EXPECT_EQ(result[0].first, "b");
 EXPECT_EQ(result[1].first, "c");
 }
 
+TEST_F(SkipListTest, ConcurrentWritersAndReaders) {
+    constexpr int kWriters = 4;
+    constexpr int kPerWriter = 2000;
+    // members are zero-padded so member order matches score order, and every score is its member's number
+    auto member = [](int i) {
+        auto digits = std::to_string(i);
+        return "m" + std::string(6 - digits.size(), '0') + digits;
+    };
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::vector<std::thread> threads;
+    for (int w = 0; w < kWriters; ++w) {
+        threads.emplace_back([&, w] {
+            for (int i = w; i < kWriters * kPerWriter; i += kWriters) {
+                list.insert(member(i), i);
+            }
+            for (int i = w; i < kWriters * kPerWriter; i += kWriters) {
+                if (i % 2 == 0) {
+                    EXPECT_TRUE(list.remove(member(i)));
+                }
+            }
+            // sorts and scores after every other member, outside the readers' query
+            for (int i = 0; i < 1000; ++i) {
+                list.insert("zhot", kWriters * kPerWriter + 1 + w);
+            }
+        });
+    }
+    for (int r = 0; r < 2; ++r) {
+        threads.emplace_back([&] {
+            while (!done) {
+                auto result = list.query(0, "", kWriters * kPerWriter, "m999999", 0, 500);
+                for (size_t i = 0; i < result.size(); ++i) {
+                    if (result[i].first != member(static_cast<int>(result[i].second)) ||
+                        (i > 0 && result[i].second <= result[i - 1].second)) {
+                        ++torn;
+                    }
+                }
+                auto hot = list.score("zhot");
+                if (hot && (*hot <= kWriters * kPerWriter || *hot > kWriters * (kPerWriter + 1))) {
+                    ++torn;
+                }
+            }
+        });
+    }
+    for (int w = 0; w < kWriters; ++w) {
+        threads[w].join();
+    }
+    done = true;
+    for (size_t t = kWriters; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+
+    EXPECT_EQ(torn, 0);
+    EXPECT_EQ(list.size(), kWriters * kPerWriter / 2 + 1);
+    auto all = list.query(0, "", kWriters * kPerWriter, "m999999", 0, kWriters * kPerWriter);
+    ASSERT_EQ(all.size(), static_cast<size_t>(kWriters * kPerWriter / 2));
+    for (size_t i = 0; i < all.size(); ++i) {
+        EXPECT_EQ(all[i].second, 2 * i + 1);
+    }
+
+    // the writers have exited, so this frees every node they retired
+    Epoch::instance().synchronize();
+}
+
+class QuickListTest : public ::testing::Test {
+protected:
+    QuickList list;
+    std::deque<std::string> expected;
+
+    void push_front(const std::string &val) {
+        list.push_front(val);
+        expected.push_front(val);
+    }
+
+    void push_back(const std::string &val) {
+        list.push_back(val);
+        expected.push_back(val);
+    }
+};
+
+TEST_F(QuickListTest, PushPopBothEnds) {
+    for (int i = 0; i < 1000; ++i) {
+        i % 3 ? push_back("v" + std::to_string(i)) : push_front(std::string(i % 200, 'x'));
+    }
+    EXPECT_EQ(list.size(), 1000);
+    EXPECT_GT(list.chunk_count(), 1);
+
+    for (int i = 0; i < 300; ++i) {
+        EXPECT_EQ(*list.pop_front(), expected.front());
+        expected.pop_front();
+        EXPECT_EQ(*list.pop_back(), expected.back());
+        expected.pop_back();
+    }
+    EXPECT_EQ(list.size(), expected.size());
+    EXPECT_EQ(list.range(0, list.size() - 1), std::vector<std::string>(expected.begin(), expected.end()));
+}
+
+TEST_F(QuickListTest, IndexAndRangeAcrossChunks) {
+    for (int i = 0; i < 5000; ++i) {
+        i % 2 ? push_back(std::to_string(i)) : push_front(std::to_string(i));
+    }
+
+    for (size_t i = 0; i < expected.size(); i += 37) {
+        EXPECT_EQ(*list.index(i), expected[i]);
+    }
+    EXPECT_EQ(*list.index(expected.size() - 1), expected.back());
+    EXPECT_FALSE(list.index(expected.size()).has_value());
+
+    auto range = list.range(1200, 1500);
+    EXPECT_EQ(range, std::vector<std::string>(expected.begin() + 1200, expected.begin() + 1501));
+    EXPECT_TRUE(list.range(10, 5).empty());
+}
+
+TEST_F(QuickListTest, Trim) {
+    for (int i = 0; i < 2000; ++i) {
+        push_back(std::to_string(i));
+    }
+    list.trim(500, 1499);
+    expected = std::deque<std::string>(expected.begin() + 500, expected.begin() + 1500);
+
+    EXPECT_EQ(list.size(), 1000);
+    EXPECT_EQ(*list.index(0), "500");
+    EXPECT_EQ(list.range(0, 999), std::vector<std::string>(expected.begin(), expected.end()));
+
+    push_front("new");
+    EXPECT_EQ(*list.index(0), "new");
+    EXPECT_EQ(*list.index(1), "500");
+
+    list.trim(5, 2);
+    EXPECT_TRUE(list.empty());
+}
+
+TEST_F(QuickListTest, PackedSmallerThanNodeList) {
+    for (int i = 0; i < 10000; ++i) {
+        list.push_back("item:" + std::to_string(i));
+    }
+    // a std::list node is two pointers plus a std::string before any allocator overhead
+    size_t node_list_bytes = 10000 * (2 * sizeof(void *) + sizeof(std::string));
+    EXPECT_LT(list.bytes() * 3, node_list_bytes);
+}
+
+TEST_F(QuickListTest, CompressedInteriorChunks) {
+    QuickList plain;
+    list.set_compress_depth(1);
+    for (int i = 0; i < 20000; ++i) {
+        auto val = "history:event:" + std::to_string(i % 500) + ":status=ok";
+        push_back(val);
+        plain.push_back(val);
+    }
+    EXPECT_GT(list.compressed_chunk_count(), list.chunk_count() / 2);
+    EXPECT_EQ(plain.compressed_chunk_count(), 0);
+    EXPECT_LT(list.bytes() * 2, plain.bytes());
+
+    for (size_t i = 0; i < expected.size(); i += 911) {
+        EXPECT_EQ(*list.index(i), expected[i]);
+    }
+    EXPECT_EQ(list.range(9000, 9300), std::vector<std::string>(expected.begin() + 9000, expected.begin() + 9301));
+
+    list.trim(100, 19899);
+    expected = std::deque<std::string>(expected.begin() + 100, expected.begin() + 19900);
+    while (!expected.empty()) {
+        ASSERT_EQ(*list.pop_front(), expected.front());
+        expected.pop_front();
+        if (!expected.empty()) {
+            ASSERT_EQ(*list.pop_back(), expected.back());
+            expected.pop_back();
+        }
+    }
+    EXPECT_TRUE(list.empty());
+}
+
+TEST(LzfTest, RoundTrip) {
+    std::string repetitive;
+    for (int i = 0; i < 1000; ++i) {
+        repetitive += "key:" + std::to_string(i % 37) + ";";
+    }
+    auto packed = Lzf::compress(repetitive);
+    ASSERT_TRUE(packed.has_value());
+    EXPECT_LT(packed->size(), repetitive.size() / 3);
+    EXPECT_EQ(Lzf::decompress(*packed, repetitive.size()), repetitive);
+
+    std::string runs(10000, 'a');
+    packed = Lzf::compress(runs);
+    ASSERT_TRUE(packed.has_value());
+    EXPECT_EQ(Lzf::decompress(*packed, runs.size()), runs);
+
+    std::mt19937 gen(42);
+    std::string noise;
+    for (int i = 0; i < 4096; ++i) {
+        noise.push_back(static_cast<char>(gen()));
+    }
+    EXPECT_FALSE(Lzf::compress(noise).has_value());
+}
+
+TEST(HashTableTest, MatchesReferenceSet) {
+    HashTable<int> table;
+    std::unordered_map<std::string, int> reference;
+    std::mt19937 gen(7);
+
+    for (int i = 0; i < 20000; ++i) {
+        auto key = "k" + std::to_string(gen() % 3000);
+        if (gen() % 3 == 0) {
+            EXPECT_EQ(table.erase(key), reference.erase(key) == 1);
+        } else {
+            EXPECT_EQ(table.insert_or_assign(key, i), reference.insert_or_assign(key, i).second);
+        }
+    }
+
+    EXPECT_EQ(table.size(), reference.size());
+    for (const auto &[key, value] : reference) {
+        auto found = table.find(key);
+        ASSERT_NE(found, nullptr);
+        EXPECT_EQ(*found, value);
+    }
+    size_t visited = 0;
+    table.for_each([&](const std::string &key, int value) {
+        EXPECT_EQ(reference.at(key), value);
+        ++visited;
+    });
+    EXPECT_EQ(visited, reference.size());
+
+    for (const auto &entry : reference) {
+        EXPECT_TRUE(table.erase(entry.first));
+    }
+    EXPECT_TRUE(table.empty());
+    EXPECT_FALSE(table.contains("k1"));
+}
+
+TEST(IntSetTest, GallopingIntersection) {
+    std::mt19937 gen(11);
+    IntSet small, large;
+    std::set<int64_t> small_ref, large_ref;
+    for (int i = 0; i < 300; ++i) {
+        int64_t v = gen() % 100000;
+        small.insert(v);
+        small_ref.insert(v);
+    }
+    for (int i = 0; i < 50000; ++i) {
+        int64_t v = gen() % 100000;
+        large.insert(v);
+        large_ref.insert(v);
+    }
+
+    std::vector<int64_t> expected;
+    std::set_intersection(small_ref.begin(), small_ref.end(), large_ref.begin(), large_ref.end(),
+                          std::back_inserter(expected));
+    EXPECT_EQ(IntSet::intersect(small.values(), large.values()), expected);
+    EXPECT_EQ(IntSet::intersect(large.values(), small.values()), expected);
+    EXPECT_EQ(IntSet::intersect(large.values(), large.values()), large.values());
+    EXPECT_TRUE(IntSet::intersect({}, large.values()).empty());
+}
+
+TEST(SetObjectTest, IntSetConvertsToHashTable) {
+    SetObject set;
+    EXPECT_TRUE(set.add("3"));
+    EXPECT_TRUE(set.add("-12"));
+    EXPECT_FALSE(set.add("3"));
+    EXPECT_TRUE(set.is_intset());
+    EXPECT_TRUE(set.contains("-12"));
+    EXPECT_FALSE(set.contains("012"));
+
+    EXPECT_TRUE(set.add("007"));
+    EXPECT_FALSE(set.is_intset());
+    EXPECT_TRUE(set.contains("3"));
+    EXPECT_TRUE(set.contains("007"));
+    EXPECT_FALSE(set.contains("7"));
+    EXPECT_EQ(set.size(), 3);
+
+    SetObject big;
+    for (int i = 0; i < 1000; ++i) {
+        big.add(std::to_string(i));
+    }
+    EXPECT_FALSE(big.is_intset());
+    EXPECT_EQ(big.size(), 1000);
+    EXPECT_TRUE(big.remove("999"));
+    EXPECT_FALSE(big.contains("999"));
+}
+
+TEST(HashTableTest, PartitionsCoverEveryEntryOnce) {
+    HashTable<int> table;
+    for (int i = 0; i < 5000; ++i) {
+        table.insert_or_assign("k" + std::to_string(i), i);
+    }
+
+    for (size_t parts: {1, 4, 64, 16384}) {
+        std::multiset<int> seen;
+        for (size_t part = 0; part < parts; ++part) {
+            table.for_each_in_partition(part, parts, [&](const std::string &key, int value) {
+                EXPECT_EQ(HashTable<int>::partition_of(HashTable<int>::hash_of(key), parts), part);
+                seen.insert(value);
+            });
+        }
+        ASSERT_EQ(seen.size(), 5000u);
+        EXPECT_EQ(std::set<int>(seen.begin(), seen.end()).size(), 5000u);
+    }
+}
+
+TEST(SetAlgebraTest, ParallelMatchesSerial) {
+    SetObject a, b, c;
+    for (int i = 0; i < 100000; ++i) {
+        a.add("m" + std::to_string(i));
+    }
+    for (int i = 0; i < 100000; i += 2) {
+        b.add("m" + std::to_string(i));
+    }
+    for (int i = 0; i < 300; ++i) {
+        c.add(std::to_string(i * 5));
+        c.add("m" + std::to_string(i * 3));
+    }
+
+    ThreadPool pool(4);
+    auto sorted = [](std::vector<std::string> v) {
+        std::sort(v.begin(), v.end());
+        return v;
+    };
+    SetAlgebra::Sets sets = {&a, &b, &c};
+
+    auto inter = sorted(SetAlgebra::intersect(sets, nullptr));
+    EXPECT_EQ(inter.size(), 150u);
+    EXPECT_EQ(sorted(SetAlgebra::intersect(sets, &pool)), inter);
+
+    auto uni = sorted(SetAlgebra::unite(sets, nullptr));
+    EXPECT_EQ(uni.size(), 100300u);
+    EXPECT_EQ(sorted(SetAlgebra::unite(sets, &pool)), uni);
+
+    auto diff = sorted(SetAlgebra::difference({&a, &b, &c}, nullptr));
+    EXPECT_EQ(diff.size(), 50000u - 150u);
+    EXPECT_EQ(sorted(SetAlgebra::difference({&a, &b, &c}, &pool)), diff);
+
+    EXPECT_EQ(SetAlgebra::intersect_card({&a, &b}, &pool, 0), 50000u);
+    EXPECT_EQ(SetAlgebra::intersect_card({&a, &b}, &pool, 10), 10u);
+    EXPECT_EQ(SetAlgebra::intersect_card({&a, &b}, nullptr, 10), 10u);
+}
+
+TEST(HashTableTest, ScanSurvivesResize) {
+    HashTable<int> table;
+    for (int i = 0; i < 1000; ++i) {
+        table.insert_or_assign("k" + std::to_string(i), i);
+    }
+
+    std::set<int> seen;
+    uint64_t cursor = 0;
+    int round = 0;
+    do {
+        cursor = table.scan(cursor, 16, [&](const std::string &, int value) { seen.insert(value); });
+        // grow and then shrink the table mid-scan; the original keys must all still be returned
+        if (++round == 5) {
+            for (int i = 1000; i < 5000; ++i) {
+                table.insert_or_assign("k" + std::to_string(i), i);
+            }
+        } else if (round == 10) {
+            for (int i = 1000; i < 5000; ++i) {
+                table.erase("k" + std::to_string(i));
+            }
+        }
+    } while (cursor != 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(seen.count(i)) << i;
+    }
+}
+
+TEST(HashObjectTest, PackedPromotesToTable) {
+    HashObject hash;
+    EXPECT_TRUE(hash.set("name", "ada"));
+    EXPECT_TRUE(hash.set("age", "36"));
+    EXPECT_FALSE(hash.set("name", "grace"));
+    EXPECT_TRUE(hash.is_packed());
+    EXPECT_EQ(hash.get("name"), "grace");
+    EXPECT_EQ(hash.get("age"), "36");
+    EXPECT_FALSE(hash.get("missing").has_value());
+    EXPECT_TRUE(hash.remove("age"));
+    EXPECT_FALSE(hash.contains("age"));
+    EXPECT_EQ(hash.size(), 1u);
+
+    // a long value promotes the whole hash
+    EXPECT_TRUE(hash.set("bio", std::string(100, 'x')));
+    EXPECT_FALSE(hash.is_packed());
+    EXPECT_EQ(hash.get("name"), "grace");
+    EXPECT_EQ(hash.get("bio"), std::string(100, 'x'));
+
+    HashObject wide;
+    for (int i = 0; i < 200; ++i) {
+        wide.set("f" + std::to_string(i), std::to_string(i));
+    }
+    EXPECT_FALSE(wide.is_packed());
+    EXPECT_EQ(wide.size(), 200u);
+    EXPECT_EQ(wide.get("f150"), "150");
+}
+
+TEST(IntStringTest, CanonicalParseAndRender) {
+    int64_t value;
+    EXPECT_TRUE(IntString::parse("-42", value));
+    EXPECT_EQ(value, -42);
+    EXPECT_TRUE(IntString::parse("9223372036854775807", value));
+    EXPECT_FALSE(IntString::parse("9223372036854775808", value));
+    EXPECT_FALSE(IntString::parse("007", value));
+    EXPECT_FALSE(IntString::parse("+1", value));
+    EXPECT_FALSE(IntString::parse("", value));
+
+    EXPECT_EQ(IntString::render(0), "0");
+    EXPECT_EQ(IntString::render(9999), "9999");
+    EXPECT_EQ(IntString::render(-9223372036854775807 - 1), "-9223372036854775808");
+}
+
+TEST(CompactStringTest, InlineHeapAndBinarySafe) {
+    EXPECT_EQ(sizeof(CompactString), 48u);
+
+    std::string edge(CompactString::kInline, 'k');
+    CompactString inline_key(edge);
+    EXPECT_TRUE(inline_key.is_inline());
+    EXPECT_EQ(inline_key.view(), edge);
+
+    CompactString heap_key(edge + "!");
+    EXPECT_FALSE(heap_key.is_inline());
+    EXPECT_EQ(heap_key.str(), edge + "!");
+
+    std::string binary("a\0b\0", 4);
+    CompactString raw(binary);
+    EXPECT_EQ(raw.view().size(), 4u);
+    EXPECT_EQ(raw.str(), binary);
+
+    CompactString copy(heap_key);
+    CompactString moved(std::move(heap_key));
+    EXPECT_EQ(copy, moved);
+    copy = inline_key;
+    EXPECT_EQ(copy, inline_key);
+    moved = CompactString("short");
+    EXPECT_TRUE(moved.is_inline());
+    EXPECT_EQ(moved.view(), "short");
+
+    // the integer kind compares and hashes like its text
+    EXPECT_EQ(CompactString::from_int(123), CompactString("123"));
+    EXPECT_EQ(CompactString::Hash{}(CompactString::from_int(123)), CompactString::Hash{}(CompactString("123")));
+
+    std::unordered_map<CompactString, int, CompactString::Hash> map;
+    map[std::string("user:1000")] = 1;
+    map[std::string(100, 'x')] = 2;
+    EXPECT_EQ(map.at(std::string("user:1000")), 1);
+    EXPECT_EQ(map.at(std::string(100, 'x')), 2);
+}
+
+TEST(StringValueTest, IntegersIncrementInPlace) {
+    StringValue counter("41");
+    EXPECT_TRUE(counter.is_int());
+    EXPECT_EQ(counter.incr(1), 42);
+    EXPECT_EQ(counter.str(), "42");
+
+    StringValue text("0042");
+    EXPECT_FALSE(text.is_int());
+    EXPECT_FALSE(text.incr(1).has_value());
+    EXPECT_EQ(text.str(), "0042");
+
+    EXPECT_TRUE(StringValue(std::string(CompactString::kInline, 'v')).is_inline());
+    EXPECT_FALSE(StringValue(std::string(CompactString::kInline + 1, 'v')).is_inline());
+
+    auto max = StringValue::from_int(std::numeric_limits<int64_t>::max());
+    EXPECT_FALSE(max.incr(1).has_value());
+    EXPECT_EQ(max.str(), "9223372036854775807");
+}
+
+TEST(HashObjectTest, IncrementBothEncodings) {
+    HashObject hash;
+    EXPECT_EQ(hash.incr("hits", 5), 5);
+    EXPECT_EQ(hash.incr("hits", 995), 1000);
+    EXPECT_EQ(hash.incr("hits", -1001), -1);
+    EXPECT_EQ(hash.get("hits"), "-1");
+    hash.set("name", "ada");
+    EXPECT_FALSE(hash.incr("name", 1).has_value());
+    EXPECT_TRUE(hash.is_packed());
+
+    hash.set("bio", std::string(100, 'x'));
+    EXPECT_FALSE(hash.is_packed());
+    EXPECT_EQ(hash.incr("hits", 2), 1);
+    EXPECT_EQ(hash.incr("new", 7), 7);
+    EXPECT_EQ(hash.get("hits"), "1");
+    EXPECT_FALSE(hash.incr("bio", 1).has_value());
+}
+
+TEST(SlabAllocatorTest, ChurnReturnsEmptySlabs) {
+    auto &allocator = SlabAllocator::instance();
+    allocator.flush_thread_cache();
+    auto before = allocator.stats();
+
+    std::vector<void *> objects;
+    for (int i = 0; i < 100000; ++i) {
+        objects.push_back(allocator.allocate(40));
+        std::memset(objects.back(), i & 0xff, 40);
+    }
+    auto full = allocator.stats();
+    EXPECT_EQ(full.allocated_bytes - before.allocated_bytes, 100000u * 48);
+    // measured over this churn alone, since earlier tests leave spare slabs in other arenas
+    EXPECT_LT(static_cast<double>(full.slab_bytes - before.slab_bytes) / (full.allocated_bytes - before.allocated_bytes), 1.2);
+
+    // free them in a scattered order, leaving every slab empty
+    std::mt19937 gen(7);
+    std::shuffle(objects.begin(), objects.end(), gen);
+    for (size_t i = 0; i < objects.size(); ++i) {
+        allocator.deallocate(objects[i], 40);
+    }
+    allocator.flush_thread_cache();
+    auto after = allocator.stats();
+    EXPECT_EQ(after.allocated_bytes, before.allocated_bytes);
+    // only the spare slab per class survives
+    EXPECT_LE(after.slabs, before.slabs + 1);
+
+    void *large = allocator.allocate(4096);
+    EXPECT_EQ(allocator.stats().large_bytes, before.large_bytes + 4096);
+    allocator.deallocate(large, 4096);
+}
+
+TEST(SlabAllocatorTest, ThreadsShareSlabsSafely) {
+    auto &allocator = SlabAllocator::instance();
+    std::vector<std::thread> threads;
+    std::vector<std::vector<void *>> handed(4);
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 20000; ++i) {
+                handed[t].push_back(allocator.allocate(16 + (i % 8) * 16));
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    // free every object on a different thread than the one that allocated it
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            auto &objects = handed[(t + 1) % 4];
+            for (size_t i = 0; i < objects.size(); ++i) {
+                allocator.deallocate(objects[i], 16 + (i % 8) * 16);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    std::set<void *> unique;
+    for (auto &objects: handed) {
+        unique.insert(objects.begin(), objects.end());
+    }
+    EXPECT_EQ(unique.size(), 80000u);
+}
+
+TEST(SlabAllocatorTest, DefragEmptiesSparseSlabs) {
+#ifdef USE_DEFAULT_ALLOCATOR
+    GTEST_SKIP() << "keyspace objects are not slab allocated";
+#endif
+    auto &allocator = SlabAllocator::instance();
+    SkipList list;
+    for (int i = 0; i < 20000; ++i) {
+        list.insert("member" + std::to_string(i), i);
+    }
+    // leave every slab about a tenth full
+    for (int i = 0; i < 20000; ++i) {
+        if (i % 10 != 0) {
+            list.remove("member" + std::to_string(i));
+        }
+    }
+    // removed and moved nodes are released after an epoch grace period
+    Epoch::instance().synchronize();
+    allocator.flush_thread_cache();
+    auto sparse = allocator.stats();
+
+    size_t moved = 0;
+    std::optional<std::string> cursor;
+    size_t slices = 0;
+    do {
+        cursor = list.defrag(cursor, 100, moved);
+        ++slices;
+    } while (cursor);
+    Epoch::instance().synchronize();
+    allocator.flush_thread_cache();
+    auto packed = allocator.stats();
+
+    EXPECT_GT(moved, 0u);
+    EXPECT_GT(slices, 1u);
+    EXPECT_LT(packed.slabs, sparse.slabs);
+    EXPECT_EQ(packed.allocated_bytes, sparse.allocated_bytes);
+    for (int i = 0; i < 20000; ++i) {
+        auto score = list.score("member" + std::to_string(i));
+        if (i % 10 == 0) {
+            ASSERT_TRUE(score.has_value()) << i;
+            EXPECT_EQ(*score, i);
+        } else {
+            EXPECT_FALSE(score.has_value());
+        }
+    }
+    EXPECT_TRUE(list.insert("after-defrag", 1));
+    EXPECT_TRUE(list.remove("member0"));
+}
+
 class DataStoreTest : public ::testing::Test {
 protected:
     DataStore store;
@@ -313,6 +920,103 @@ TEST_F(DataStoreTest, LTrim) {
     EXPECT_FALSE(store.ltrim("nonexistent", 0, 1));
 }
 
+TEST_F(DataStoreTest, LIndex) {
+    store.rpush("mylist", "a");
+    store.rpush("mylist", "b");
+    store.rpush("mylist", "c");
+
+    EXPECT_EQ(store.lindex("mylist", 0), "a");
+    EXPECT_EQ(store.lindex("mylist", -1), "c");
+    EXPECT_EQ(store.lindex("mylist", 1), "b");
+    EXPECT_FALSE(store.lindex("mylist", 3).has_value());
+    EXPECT_FALSE(store.lindex("mylist", -4).has_value());
+    EXPECT_FALSE(store.lindex("nonexistent", 0).has_value());
+}
+
+TEST_F(DataStoreTest, BLPopServedImmediately) {
+    store.rpush("list2", "x");
+
+    std::optional<std::pair<std::string, std::string>> served;
+    auto waiter = store.blpop({"list1", "list2"}, std::chrono::milliseconds(0), [&](auto result) { served = result; });
+    EXPECT_EQ(waiter, nullptr);
+    ASSERT_TRUE(served.has_value());
+    EXPECT_EQ(served->first, "list2");
+    EXPECT_EQ(served->second, "x");
+    EXPECT_EQ(store.llen("list2"), 0);
+}
+
+TEST_F(DataStoreTest, BlockedPopsWokenInFifoOrder) {
+    std::vector<std::string> order;
+    auto first = store.blpop({"queue"}, std::chrono::milliseconds(0), [&](auto result) { order.push_back("first:" + result->second); });
+    auto second = store.brpop({"other", "queue"}, std::chrono::milliseconds(0), [&](auto result) { order.push_back("second:" + result->second); });
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    EXPECT_TRUE(order.empty());
+
+    store.rpush("queue", "a");
+    EXPECT_EQ(order, (std::vector<std::string>{"first:a"}));
+    EXPECT_EQ(store.llen("queue"), 0);
+
+    store.lpush("queue", "b");
+    EXPECT_EQ(order, (std::vector<std::string>{"first:a", "second:b"}));
+
+    store.rpush("queue", "c");
+    EXPECT_EQ(order.size(), 2);
+    EXPECT_EQ(store.llen("queue"), 1);
+}
+
+TEST_F(DataStoreTest, BLMoveWakesDestinationWaiters) {
+    std::optional<std::pair<std::string, std::string>> moved, popped;
+    store.blmove("jobs", "processing", "LEFT", "RIGHT", std::chrono::milliseconds(0), [&](auto result) { moved = result; });
+    store.blpop({"processing"}, std::chrono::milliseconds(0), [&](auto result) { popped = result; });
+
+    store.rpush("jobs", "job1");
+    ASSERT_TRUE(moved.has_value());
+    EXPECT_EQ(moved->second, "job1");
+    ASSERT_TRUE(popped.has_value());
+    EXPECT_EQ(popped->first, "processing");
+    EXPECT_EQ(popped->second, "job1");
+    EXPECT_EQ(store.llen("jobs"), 0);
+    EXPECT_EQ(store.llen("processing"), 0);
+}
+
+TEST_F(DataStoreTest, BlockedPopTimeoutAndCancel) {
+    int timeouts = 0;
+    int served = 0;
+    store.blpop({"timed"}, std::chrono::milliseconds(50), [&](auto result) { result ? ++served : ++timeouts; });
+    auto cancelled = store.blpop({"timed"}, std::chrono::milliseconds(0), [&](auto) { ++served; });
+
+    EXPECT_EQ(store.expire_blocked(std::chrono::steady_clock::now()), 0);
+    EXPECT_EQ(store.expire_blocked(std::chrono::steady_clock::now() + std::chrono::seconds(1)), 1);
+    EXPECT_EQ(timeouts, 1);
+
+    store.cancel_blocked(cancelled);
+    store.rpush("timed", "kept");
+    EXPECT_EQ(served, 0);
+    EXPECT_EQ(store.llen("timed"), 1);
+}
+
+TEST(TimerWheelTest, FiresOnlyExpiredEntries) {
+    TimerWheel<int> wheel(std::chrono::milliseconds(10), 8);
+    auto now = std::chrono::steady_clock::now();
+    wheel.schedule(now + std::chrono::milliseconds(25), 1);
+    wheel.schedule(now + std::chrono::milliseconds(200), 2);
+    wheel.schedule(now - std::chrono::milliseconds(5), 3);
+
+    std::vector<int> fired;
+    auto collect = [&](int value) { fired.push_back(value); };
+    wheel.advance(now + std::chrono::milliseconds(15), collect);
+    EXPECT_EQ(fired, (std::vector<int>{3}));
+
+    wheel.advance(now + std::chrono::milliseconds(60), collect);
+    EXPECT_EQ(fired, (std::vector<int>{3, 1}));
+    EXPECT_EQ(wheel.size(), 1);
+
+    wheel.advance(now + std::chrono::seconds(1), collect);
+    EXPECT_EQ(fired, (std::vector<int>{3, 1, 2}));
+    EXPECT_EQ(wheel.size(), 0);
+}
+
 TEST_F(DataStoreTest, SAdd) {
     auto result = store.sadd("myset", "a");
     EXPECT_TRUE(result.has_value());
@@ -377,6 +1081,64 @@ TEST_F(DataStoreTest, SInter) {
     EXPECT_FALSE(result.has_value());
 }
 
+TEST_F(DataStoreTest, SInterAcrossEncodings) {
+    for (int i = 0; i < 2000; ++i) {
+        store.sadd("big", std::to_string(i));
+    }
+    for (int i = 0; i < 100; i += 3) {
+        store.sadd("ints", std::to_string(i));
+    }
+    for (int i = 0; i < 100; i += 2) {
+        store.sadd("evens", std::to_string(i));
+    }
+    store.sadd("mixed", "6");
+    store.sadd("mixed", "12");
+    store.sadd("mixed", "13");
+    store.sadd("mixed", "name");
+
+    auto result = store.sinter({"big", "ints", "evens"});
+    ASSERT_TRUE(result.has_value());
+    std::set<std::string> actual(result->begin(), result->end());
+    std::set<std::string> expected;
+    for (int i = 0; i < 100; i += 6) {
+        expected.insert(std::to_string(i));
+    }
+    EXPECT_EQ(actual, expected);
+
+    result = store.sinter({"ints", "evens"});
+    EXPECT_EQ(std::set<std::string>(result->begin(), result->end()), expected);
+
+    result = store.sinter({"big", "mixed", "evens"});
+    EXPECT_EQ(std::set<std::string>(result->begin(), result->end()), (std::set<std::string>{"6", "12"}));
+}
+
+TEST_F(DataStoreTest, SetAlgebraCommands) {
+    for (const auto &member: {"a", "b", "c", "d"}) {
+        store.sadd("s1", member);
+    }
+    for (const auto &member: {"c", "d", "e"}) {
+        store.sadd("s2", member);
+    }
+    auto as_set = [](const std::vector<std::string> &v) { return std::set<std::string>(v.begin(), v.end()); };
+
+    EXPECT_EQ(as_set(store.sunion({"s1", "s2", "missing"})), (std::set<std::string>{"a", "b", "c", "d", "e"}));
+    EXPECT_EQ(as_set(store.sdiff({"s1", "s2", "missing"})), (std::set<std::string>{"a", "b"}));
+    EXPECT_TRUE(store.sdiff({"missing", "s1"}).empty());
+
+    EXPECT_EQ(store.sintercard({"s1", "s2"}, 0), 2u);
+    EXPECT_EQ(store.sintercard({"s1", "s2"}, 1), 1u);
+    EXPECT_EQ(store.sintercard({"s1", "missing"}, 0), 0u);
+
+    EXPECT_EQ(store.sinterstore("dest", {"s1", "s2"}), 2u);
+    EXPECT_EQ(as_set(*store.sinter({"dest"})), (std::set<std::string>{"c", "d"}));
+    // the destination may also be an input
+    EXPECT_EQ(store.sunionstore("dest", {"dest", "s1"}), 4u);
+    EXPECT_EQ(store.sdiffstore("dest", {"s2", "s1"}), 1u);
+    EXPECT_EQ(store.scard("dest"), 1u);
+    EXPECT_EQ(store.sinterstore("dest", {"s1", "missing"}), 0u);
+    EXPECT_FALSE(store.sinter({"dest"}).has_value());
+}
+
 TEST_F(DataStoreTest, SCard) {
     store.sadd("myset", "a");
     store.sadd("myset", "b");
@@ -443,6 +1205,523 @@ TEST_F(DataStoreTest, HIncrBy) {
     EXPECT_FALSE(result.has_value());
 }
 
+TEST_F(DataStoreTest, HashFieldCommands) {
+    store.hset("user", {{"name", "ada"}, {"lang", "c++"}, {"age", "36"}});
+
+    EXPECT_EQ(store.hlen("user"), 3u);
+    EXPECT_TRUE(store.hexists("user", "lang"));
+    EXPECT_FALSE(store.hexists("user", "email"));
+    EXPECT_EQ(store.hdel("user", {"lang", "email"}), 1);
+    EXPECT_EQ(store.hlen("user"), 2u);
+
+    auto all = store.hgetall("user");
+    std::set<std::pair<std::string, std::string>> fields(all.begin(), all.end());
+    EXPECT_EQ(fields, (std::set<std::pair<std::string, std::string>>{{"name", "ada"}, {"age", "36"}}));
+
+    EXPECT_EQ(store.hdel("user", {"name", "age"}), 2);
+    EXPECT_EQ(store.hlen("user"), 0u);
+    EXPECT_FALSE(store.hget("user", "name").has_value());
+}
+
+TEST_F(DataStoreTest, HScan) {
+    std::vector<std::pair<std::string, std::string>> fields;
+    for (int i = 0; i < 1000; ++i) {
+        fields.emplace_back("f" + std::to_string(i), std::to_string(i));
+    }
+    store.hset("big", fields);
+
+    std::set<std::string> seen;
+    uint64_t cursor = 0;
+    size_t calls = 0;
+    do {
+        auto [next, batch] = store.hscan("big", cursor, 100);
+        for (const auto &[field, value]: batch) {
+            EXPECT_EQ(field, "f" + value);
+            seen.insert(field);
+        }
+        cursor = next;
+        ++calls;
+    } while (cursor != 0);
+    EXPECT_EQ(seen.size(), 1000u);
+    EXPECT_GT(calls, 1u);
+
+    store.hset("small", {{"a", "1"}});
+    auto [next, batch] = store.hscan("small", 0, 10);
+    EXPECT_EQ(next, 0u);
+    EXPECT_EQ(batch.size(), 1u);
+}
+
+TEST_F(DataStoreTest, ScanVisitsEveryKeyAcrossGrowth) {
+    std::set<std::string> expected;
+    for (int i = 0; i < 200; ++i) {
+        auto n = std::to_string(i);
+        store.string_set("s" + n, n);
+        store.rpush("l" + n, n);
+        store.sadd("t" + n, n);
+        store.zadd("z" + n, i, n);
+        store.hset("h" + n, {{"f", n}});
+        for (auto prefix: {"s", "l", "t", "z", "h"}) {
+            expected.insert(prefix + n);
+        }
+    }
+
+    std::multiset<std::string> seen;
+    uint64_t cursor = 0;
+    size_t calls = 0;
+    do {
+        auto [next, keys] = store.scan(cursor, 20);
+        EXPECT_LE(keys.size(), 40u);
+        seen.insert(keys.begin(), keys.end());
+        cursor = next;
+        // the maps double several times while the scan is under way
+        if (++calls == 5) {
+            for (int i = 0; i < 5000; ++i) {
+                store.string_set("grown" + std::to_string(i), "x");
+            }
+        }
+    } while (cursor != 0);
+    for (const auto &key: expected) {
+        EXPECT_GE(seen.count(key), 1u) << key;
+    }
+    EXPECT_GT(calls, 5u);
+
+    // an emptied list is not reported
+    store.lpop("l0");
+    std::set<std::string> lists;
+    cursor = 0;
+    do {
+        auto [next, keys] = store.scan(cursor, 50, "", "list");
+        lists.insert(keys.begin(), keys.end());
+        cursor = next;
+    } while (cursor != 0);
+    EXPECT_EQ(lists.size(), 199u);
+    EXPECT_FALSE(lists.count("l0"));
+    EXPECT_TRUE(lists.count("l1"));
+}
+
+TEST_F(DataStoreTest, ScanMatchFiltersKeys) {
+    for (int i = 0; i < 100; ++i) {
+        store.string_set("user:" + std::to_string(i) + ":session", "x");
+        store.string_set("other:" + std::to_string(i), "x");
+    }
+    std::set<std::string> matched;
+    uint64_t cursor = 0;
+    do {
+        auto [next, keys] = store.scan(cursor, 10, "user:*:session");
+        matched.insert(keys.begin(), keys.end());
+        cursor = next;
+    } while (cursor != 0);
+    EXPECT_EQ(matched.size(), 100u);
+    EXPECT_TRUE(matched.count("user:7:session"));
+}
+
+TEST_F(DataStoreTest, MSetMGetAndMSetNX) {
+    std::vector<std::pair<std::string, std::string>> pairs;
+    for (int i = 0; i < 10000; ++i) {
+        pairs.emplace_back("k" + std::to_string(i), "v" + std::to_string(i));
+    }
+    store.mset(pairs);
+    EXPECT_EQ(store.string_get("k0"), "v0");
+    EXPECT_EQ(store.string_get("k9999"), "v9999");
+    EXPECT_EQ(store.mget({"k1", "missing", "k2"}),
+              (std::vector<std::optional<std::string>>{"v1", std::nullopt, "v2"}));
+
+    EXPECT_FALSE(store.msetnx({{"fresh", "x"}, {"k5", "y"}}));
+    EXPECT_FALSE(store.string_get("fresh").has_value());
+    EXPECT_EQ(store.string_get("k5"), "v5");
+    store.sadd("a_set", "m");
+    EXPECT_FALSE(store.msetnx({{"fresh", "x"}, {"a_set", "y"}}));
+    EXPECT_TRUE(store.msetnx({{"fresh", "x"}, {"fresh2", "y"}}));
+    EXPECT_EQ(store.mget({"fresh", "fresh2"}), (std::vector<std::optional<std::string>>{"x", "y"}));
+}
+
+TEST_F(DataStoreTest, BatchAddsCountNewMembers) {
+    EXPECT_EQ(store.zadd("board", std::vector<std::pair<double, std::string>>{{1, "a"}, {2, "b"}, {3, "a"}}), 2u);
+    EXPECT_EQ(store.zscore("board", "a"), 3);
+    EXPECT_EQ(store.zadd("board", std::vector<std::pair<double, std::string>>{{4, "c"}}), 1u);
+
+    // integers fill the intset until a string member converts it part way through the batch
+    std::vector<std::string> members;
+    for (int i = 0; i < 100; ++i) {
+        members.push_back(std::to_string(i));
+    }
+    members.push_back("word");
+    for (int i = 0; i < 1000; ++i) {
+        members.push_back("m" + std::to_string(i));
+    }
+    members.push_back("5");
+    EXPECT_EQ(store.sadd("set", members), 1101u);
+    EXPECT_EQ(store.scard("set"), 1101u);
+    EXPECT_EQ(store.sismember("set", "m999"), 1);
+    EXPECT_EQ(store.sadd("set", std::vector<std::string>{"m1", "new"}), 1u);
+
+    EXPECT_EQ(store.rpush("list", std::vector<std::string>{"b", "c"}), 2u);
+    EXPECT_EQ(store.lpush("list", std::vector<std::string>{"a", "z"}), 4u);
+    EXPECT_EQ(store.lrange("list", 0, -1), (std::vector<std::string>{"z", "a", "b", "c"}));
+}
+
+TEST_F(DataStoreTest, BatchPushServesBlockedClients) {
+    std::vector<std::string> served;
+    for (int i = 0; i < 2; ++i) {
+        store.blpop({"jobs"}, std::chrono::milliseconds(0), [&](auto result) { served.push_back(result->second); });
+    }
+    EXPECT_EQ(store.rpush("jobs", std::vector<std::string>{"a", "b", "c"}), 3u);
+    EXPECT_EQ(served, (std::vector<std::string>{"a", "b"}));
+    EXPECT_EQ(store.lrange("jobs", 0, -1), std::vector<std::string>{"c"});
+}
+
+TEST_F(DataStoreTest, KeysMatchesEveryType) {
+    store.string_set("user:1:name", "ann");
+    store.hset("user:1:profile", {{"age", "30"}});
+    store.rpush("user:1:queue", "job");
+    store.sadd("user:1:tags", "a");
+    store.zadd("user:1:scores", 1, "a");
+    store.string_set("order:1", "x");
+    store.sadd("user:2:tags", "b");
+    store.srem("user:2:tags", "b");
+
+    auto keys = store.keys("user:1:*");
+    EXPECT_EQ(std::set<std::string>(keys.begin(), keys.end()),
+              (std::set<std::string>{"user:1:name", "user:1:profile", "user:1:queue", "user:1:tags", "user:1:scores"}));
+    EXPECT_EQ(store.keys("*").size(), 6u);
+    EXPECT_EQ(store.keys("order:1"), std::vector<std::string>{"order:1"});
+    EXPECT_TRUE(store.keys("nothing*").empty());
+}
+
+TEST_F(DataStoreTest, SScanAndZScanWalkInChunks) {
+    for (int i = 0; i < 1000; ++i) {
+        store.sadd("big", "m" + std::to_string(i));
+        store.zadd("board", i, "m" + std::to_string(i));
+    }
+    std::set<std::string> members;
+    uint64_t cursor = 0;
+    size_t calls = 0;
+    do {
+        auto [next, batch] = store.sscan("big", cursor, 100, "m1*");
+        members.insert(batch.begin(), batch.end());
+        cursor = next;
+        ++calls;
+    } while (cursor != 0);
+    EXPECT_EQ(members.size(), 111u);
+    EXPECT_GT(calls, 1u);
+
+    auto [end, small] = store.sscan("none", 0, 10);
+    EXPECT_EQ(end, 0u);
+    EXPECT_TRUE(small.empty());
+
+    // members present throughout come back exactly once, even with removals between calls
+    std::multiset<std::string> ranked;
+    std::optional<std::string> after;
+    calls = 0;
+    do {
+        auto [next, batch] = store.zscan("board", after, 100);
+        EXPECT_LE(batch.size(), 100u);
+        for (const auto &[member, score]: batch) {
+            EXPECT_EQ(member, "m" + std::to_string(static_cast<int>(score)));
+            ranked.insert(member);
+        }
+        after = next;
+        if (++calls == 3) {
+            store.zrem("board", "m999");
+            store.zrem("board", "m0");
+        }
+    } while (after);
+    EXPECT_EQ(ranked.size(), 999u);
+    EXPECT_EQ(ranked.count("m500"), 1u);
+    EXPECT_EQ(ranked.count("m999"), 0u);
+}
+
+TEST_F(DataStoreTest, UnlinkFreesLargeValuesLazily) {
+    for (int i = 0; i < 1000; ++i) {
+        store.zadd("big", i, "member" + std::to_string(i));
+        store.sadd("members", "m" + std::to_string(i));
+    }
+    store.zadd("small", 1, "a");
+    store.string_set("str", "value");
+    store.lpush("list", "x");
+
+    // small values are freed inline, large ones go to the freer thread
+    EXPECT_EQ(store.unlink({"small", "str", "missing"}), 2u);
+    store.lazyfree_drain();
+    EXPECT_EQ(store.lazy_freed(), 0u);
+    EXPECT_EQ(store.unlink({"big", "members"}), 2u);
+    EXPECT_EQ(store.zscore("big", "member1"), std::nullopt);
+    EXPECT_EQ(store.scard("members"), 0u);
+    store.lazyfree_drain();
+    EXPECT_EQ(store.lazy_freed(), 2u);
+
+    // a key written again after an unlink starts empty
+    store.zadd("big", 5, "new");
+    EXPECT_EQ(store.zrange("big", 0, 10, 0, 10).size(), 1u);
+    EXPECT_EQ(store.del({"big", "list"}), 2u);
+    EXPECT_FALSE(store.lpop("list").has_value());
+
+    // the list is ordered by member, so pad them to keep member and score order the same
+    for (int i = 0; i < 500; ++i) {
+        store.zadd("range", i, "member" + std::string(3 - std::to_string(i).size(), '0') + std::to_string(i));
+    }
+    EXPECT_EQ(store.zrange_del("range", 100, 399, 0, 1000), 300u);
+    EXPECT_EQ(store.zrange("range", 0, 1000, 0, 1000).size(), 200u);
+    store.lazyfree_drain();
+    EXPECT_EQ(store.lazy_freed(), 3u);
+
+    store.set_lazyfree_threshold(0);
+    store.string_set("str", "value");
+    store.flushall(true);
+    EXPECT_FALSE(store.string_get("str").has_value());
+    EXPECT_TRUE(store.zrange("range", 0, 1000, 0, 1000).empty());
+    store.lazyfree_drain();
+    EXPECT_EQ(store.lazy_freed(), 4u);
+}
+
+TEST_F(DataStoreTest, ExecRunsBatchUnderHeldStripes) {
+    store.string_set("counter", "1");
+    bool ran = store.exec({"counter", "list", "other", "set", "union"}, false, {}, [&] {
+        store.incrby("counter", 41);
+        store.rpush("list", "a");
+        store.lmove("list", "other", "LEFT", "RIGHT");
+        store.sadd("set", "m");
+        store.sunionstore("union", {"set"});
+    });
+    EXPECT_TRUE(ran);
+    EXPECT_EQ(store.string_get("counter"), "42");
+    EXPECT_EQ(store.llen("other"), 1u);
+    EXPECT_EQ(store.scard("union"), 1u);
+
+    EXPECT_TRUE(store.exec({}, true, {}, [&] { store.flushall(false); }));
+    EXPECT_FALSE(store.string_get("counter").has_value());
+}
+
+TEST_F(DataStoreTest, ExecRefusesKeysItWasNotGiven) {
+    // of 100 keys some fall outside the one stripe held, and the first of them fails its command
+    size_t written = 0;
+    EXPECT_THROW(store.exec({"held"}, false, {}, [&] {
+        for (int i = 0; i < 100; ++i) {
+            store.string_set("key" + std::to_string(i), "x");
+            ++written;
+        }
+    }), std::logic_error);
+    EXPECT_LT(written, 100u);
+
+    // nothing was left locked or marked as running
+    store.string_set("key99", "y");
+    EXPECT_TRUE(store.exec({"key99"}, false, {}, [&] { store.string_set("key99", "z"); }));
+    EXPECT_EQ(store.string_get("key99"), "z");
+}
+
+TEST_F(DataStoreTest, WatchAbortsExecOnlyWhenWatchedKeyChanges) {
+    auto version = store.watch("watched");
+    store.string_set("unrelated", "x");
+    bool ran = false;
+    EXPECT_TRUE(store.exec({"watched"}, false, {{"watched", version}}, [&] { ran = true; }));
+    EXPECT_TRUE(ran);
+
+    store.hset("watched", {{"field", "value"}});
+    ran = false;
+    EXPECT_FALSE(store.exec({"watched"}, false, {{"watched", version}}, [&] { ran = true; }));
+    EXPECT_FALSE(ran);
+    store.unwatch("watched");
+
+    // a flush counts as a write to every watched key
+    version = store.watch("watched");
+    store.flushall(false);
+    EXPECT_FALSE(store.exec({}, false, {{"watched", version}}, [] {}));
+    store.unwatch("watched");
+}
+
+TEST_F(DataStoreTest, EmptiedValuesLeaveTheKeyspace) {
+    EXPECT_FALSE(store.lpop("ghost").has_value());
+    EXPECT_FALSE(store.rpop("ghost").has_value());
+    EXPECT_FALSE(store.lmove("ghost", "dst", "LEFT", "LEFT").has_value());
+
+    store.rpush("list", "a");
+    store.rpush("moved", "b");
+    store.sadd("set", "m");
+    store.zadd("zset", 1.0, "m");
+    store.zadd("range", 1.0, "m");
+    store.rpush("trimmed", "c");
+    EXPECT_EQ(store.lpop("list"), "a");
+    EXPECT_EQ(store.lmove("moved", "dst", "LEFT", "LEFT"), "b");
+    EXPECT_EQ(store.srem("set", "m"), 1);
+    EXPECT_TRUE(store.zrem("zset", "m"));
+    EXPECT_EQ(store.zrange_del("range", 0, 2, 0, 10), 1u);
+    EXPECT_TRUE(store.ltrim("trimmed", 5, 10));
+
+    EXPECT_EQ(store.keys("*"), std::vector<std::string>{"dst"});
+    EXPECT_EQ(store.del({"ghost", "list", "moved", "set", "zset", "range", "trimmed"}), 0u);
+    EXPECT_EQ(store.unlink({"ghost", "dst"}), 1u);
+}
+
+TEST_F(DataStoreTest, FailedPopsAndMovesLeaveWatchesAlone) {
+    auto empty = store.watch("empty");
+    auto dest = store.watch("dest");
+    EXPECT_FALSE(store.lpop("empty").has_value());
+    EXPECT_FALSE(store.rpop("empty").has_value());
+    store.rpush("src", "a");
+    EXPECT_FALSE(store.lmove("src", "dest", "LEFT", "UP").has_value());
+    EXPECT_FALSE(store.lmove("src", "dest", "DOWN", "LEFT").has_value());
+    EXPECT_FALSE(store.lmove("empty", "dest", "LEFT", "LEFT").has_value());
+    EXPECT_EQ(store.llen("src"), 1u);
+    EXPECT_TRUE(store.exec({"empty", "dest"}, false, {{"empty", empty}, {"dest", dest}}, [] {}));
+
+    EXPECT_EQ(store.lmove("src", "dest", "RIGHT", "LEFT"), "a");
+    EXPECT_FALSE(store.exec({"dest"}, false, {{"dest", dest}}, [] {}));
+    store.unwatch("empty");
+    store.unwatch("dest");
+}
+
+TEST_F(DataStoreTest, NoOpRemovalsAndHashEditsLeaveWatchesAlone) {
+    store.hset("hash", {{"f", "1"}});
+    store.sadd("set", "m");
+    store.zadd("zset", 1.0, "m");
+    std::vector<std::pair<std::string, uint64_t>> watched;
+    for (const auto &key: {"missing", "hash", "set", "zset"}) {
+        watched.emplace_back(key, store.watch(key));
+    }
+    std::vector<std::string> keys = {"missing", "hash", "set", "zset"};
+
+    EXPECT_FALSE(store.string_del("missing"));
+    EXPECT_EQ(store.hdel("hash", {"other"}), 0);
+    EXPECT_EQ(store.hset("hash", {{"f", "1"}}), 0);
+    EXPECT_FALSE(store.hincrby("hash", "f", std::numeric_limits<int64_t>::max()).has_value());
+    EXPECT_EQ(store.srem("set", "other"), 0);
+    EXPECT_FALSE(store.zrem("zset", "other"));
+    EXPECT_EQ(store.zrange_del("zset", 5, 10, 0, 10), 0u);
+    EXPECT_TRUE(store.exec(keys, false, watched, [] {}));
+
+    EXPECT_EQ(store.hset("hash", {{"f", "2"}}), 0);
+    EXPECT_FALSE(store.exec(keys, false, watched, [] {}));
+    for (const auto &key: keys) {
+        store.unwatch(key);
+    }
+}
+
+TEST_F(DataStoreTest, ExecServesBlockedClientsAfterRelease) {
+    std::optional<std::pair<std::string, std::string>> served;
+    auto waiter = store.blpop({"queue"}, std::chrono::milliseconds(0), [&](auto result) { served = result; });
+    ASSERT_NE(waiter, nullptr);
+
+    EXPECT_TRUE(store.exec({"queue"}, false, {}, [&] {
+        store.rpush("queue", "job");
+        EXPECT_FALSE(served.has_value());
+    }));
+    ASSERT_TRUE(served.has_value());
+    EXPECT_EQ(served->second, "job");
+}
+
+TEST_F(DataStoreTest, WatchedIncrementsRetryToExactCount) {
+    constexpr int kThreads = 4;
+    constexpr int kIncrements = 200;
+    store.string_set("count", "0");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < kIncrements; ++i) {
+                // read, then write only if nobody else wrote in between
+                while (true) {
+                    auto version = store.watch("count");
+                    auto current = std::stoll(*store.string_get("count"));
+                    bool ran = store.exec({"count"}, false, {{"count", version}}, [&] {
+                        store.string_set("count", std::to_string(current + 1));
+                    });
+                    store.unwatch("count");
+                    if (ran) {
+                        break;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    EXPECT_EQ(store.string_get("count"), std::to_string(kThreads * kIncrements));
+}
+
+TEST_F(DataStoreTest, ActiveDefragSlices) {
+#ifdef USE_DEFAULT_ALLOCATOR
+    GTEST_SKIP() << "keyspace objects are not slab allocated";
+#endif
+    std::string long_value(200, 'v');
+    for (int i = 0; i < 5000; ++i) {
+        store.zadd("zset", i, "member" + std::to_string(i));
+        store.string_set("key" + std::to_string(i), long_value + std::to_string(i));
+    }
+    for (int i = 0; i < 5000; ++i) {
+        if (i % 8 != 0) {
+            store.zrem("zset", "member" + std::to_string(i));
+            store.string_del("key" + std::to_string(i));
+        }
+    }
+
+    // disabled by default, so the tick does nothing
+    EXPECT_EQ(store.defrag_cycle(std::chrono::milliseconds(10)).keys_, 0u);
+
+    DataStore::DefragStats total;
+    for (int slice = 0; slice < 10000 && !total.pass_done_; ++slice) {
+        auto stats = store.defrag_step(std::chrono::microseconds(200));
+        total.keys_ += stats.keys_;
+        total.moved_ += stats.moved_;
+        total.pass_done_ = stats.pass_done_;
+    }
+    EXPECT_TRUE(total.pass_done_);
+    EXPECT_GT(total.moved_, 0u);
+    EXPECT_GE(total.keys_, 626u);
+
+    for (int i = 0; i < 5000; i += 8) {
+        EXPECT_EQ(store.zscore("zset", "member" + std::to_string(i)), i);
+        EXPECT_EQ(store.string_get("key" + std::to_string(i)), long_value + std::to_string(i));
+    }
+
+    DataStore::DefragConfig config;
+    config.enabled_ = true;
+    config.cycle_percent_ = 50;
+    store.set_defrag_config(config);
+    EXPECT_TRUE(store.defrag_config().enabled_);
+    EXPECT_EQ(store.defrag_config().cycle_percent_, 50u);
+}
+
+TEST_F(DataStoreTest, ActiveDefragEmptiesSparseStringSlabs) {
+#ifdef USE_DEFAULT_ALLOCATOR
+    GTEST_SKIP() << "keyspace objects are not slab allocated";
+#endif
+    auto &allocator = SlabAllocator::instance();
+    std::string long_value(300, 's');
+    for (int i = 0; i < 20000; ++i) {
+        store.string_set("key" + std::to_string(i), long_value + std::to_string(i));
+    }
+    // leave every slab of the values' class about a tenth full
+    for (int i = 0; i < 20000; ++i) {
+        if (i % 10 != 0) {
+            store.string_del("key" + std::to_string(i));
+        }
+    }
+    Epoch::instance().synchronize();
+    allocator.flush_thread_cache();
+    auto sparse = allocator.stats();
+
+    DataStore::DefragStats total;
+    for (int slice = 0; slice < 100000 && !total.pass_done_; ++slice) {
+        auto stats = store.defrag_step(std::chrono::microseconds(200));
+        total.moved_ += stats.moved_;
+        total.pass_done_ = stats.pass_done_;
+    }
+    // the replaced versions are freed after the grace period, and their blocks go straight back to their
+    // slabs: none is left in this thread's cache to be handed out again
+    Epoch::instance().synchronize();
+    auto drained = allocator.stats();
+    allocator.flush_thread_cache();
+    auto flushed = allocator.stats();
+
+    EXPECT_TRUE(total.pass_done_);
+    EXPECT_GT(total.moved_, 0u);
+    EXPECT_LT(drained.slabs, sparse.slabs);
+    EXPECT_EQ(drained.slabs, flushed.slabs);
+    for (int i = 0; i < 20000; i += 10) {
+        EXPECT_EQ(store.string_get("key" + std::to_string(i)), long_value + std::to_string(i));
+    }
+}
+
 class DataStoreThreadTest : public ::testing::Test {
 protected:
     DataStore store;
@@ -475,6 +1754,122 @@ TEST_F(DataStoreThreadTest, ConcurrentReads) {
     EXPECT_EQ(successful_reads, 10000);
 }
 
+TEST_F(DataStoreThreadTest, LockFreeReadsDuringWrites) {
+    std::string padding(100, 'x');
+    store.string_set("str", padding + "0");
+    store.hset("hash", {{"field", "0"}});
+    store.zadd("zset", 0, "member");
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([&] {
+            while (!done) {
+                auto str = store.string_get("str");
+                if (str && str->compare(0, padding.size(), padding) != 0) {
+                    ++torn;
+                }
+                auto field = store.hget("hash", "field");
+                if (field && field->empty()) {
+                    ++torn;
+                }
+                auto score = store.zscore("zset", "member");
+                if (score && *score < 0) {
+                    ++torn;
+                }
+            }
+        });
+    }
+
+    // every write replaces or removes a version a reader may be holding
+    for (int i = 1; i <= 5000; ++i) {
+        store.string_set("str", padding + std::to_string(i));
+        store.hset("hash", {{"field", std::to_string(i)}});
+        store.zadd("zset", i, "member");
+        if (i % 100 == 0) {
+            store.string_del("str");
+            store.hdel("hash", {"field"});
+        }
+    }
+    done = true;
+    for (auto &t: readers) {
+        t.join();
+    }
+    Epoch::instance().synchronize();
+
+    EXPECT_EQ(torn, 0);
+    EXPECT_FALSE(store.string_get("str").has_value());
+    EXPECT_EQ(store.zscore("zset", "member"), 5000);
+}
+
+TEST_F(DataStoreThreadTest, MultiKeyOpsAcrossStripes) {
+    constexpr int kItems = 200;
+    for (int i = 0; i < kItems; ++i) {
+        store.rpush("list_a", std::to_string(i));
+        store.sadd("set_a", std::to_string(i));
+        store.sadd("set_b", std::to_string(i * 2));
+    }
+
+    // opposite key orders in each pair of threads, which deadlocks unless stripes are taken in one order
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 2000; ++i) {
+                if (t % 2 == 0) {
+                    store.lmove("list_a", "list_b", "LEFT", "RIGHT");
+                    store.sinterstore("set_c", {"set_a", "set_b"});
+                } else {
+                    store.lmove("list_b", "list_a", "LEFT", "RIGHT");
+                    store.sunionstore("set_d", {"set_b", "set_a"});
+                }
+                store.del({"tmp_" + std::to_string(t), "list_x", "set_x"});
+            }
+        });
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(store.llen("list_a") + store.llen("list_b"), static_cast<size_t>(kItems));
+    EXPECT_EQ(store.scard("set_c"), static_cast<size_t>(kItems / 2));
+    EXPECT_EQ(store.scard("set_d"), static_cast<size_t>(kItems + kItems / 2));
+}
+
+TEST_F(DataStoreThreadTest, BlockedPopServedAcrossStripes) {
+    std::atomic<int> served{0};
+    std::vector<std::shared_ptr<DataStore::ListWaiter>> waiters;
+    for (int i = 0; i < 50; ++i) {
+        waiters.push_back(store.blmove("src" + std::to_string(i), "dst", "LEFT", "RIGHT",
+                                       std::chrono::milliseconds(0), [&](auto result) {
+                                           if (result) {
+                                               ++served;
+                                           }
+                                       }));
+    }
+    waiters.push_back(store.blpop({"dst"}, std::chrono::milliseconds(0), [&](auto result) {
+        if (result) {
+            ++served;
+        }
+    }));
+
+    std::vector<std::thread> pushers;
+    for (int t = 0; t < 5; ++t) {
+        pushers.emplace_back([&, t] {
+            for (int i = t; i < 50; i += 5) {
+                store.lpush("src" + std::to_string(i), "v" + std::to_string(i));
+            }
+        });
+    }
+    for (auto &t: pushers) {
+        t.join();
+    }
+
+    // the first value moved onto dst also serves the client blocked there
+    EXPECT_EQ(served, 51);
+    EXPECT_EQ(store.llen("dst"), 49u);
+}
+
 TEST_F(DataStoreThreadTest, ConcurrentWrites) {
     std::atomic<int> successful_writes(0);
     std::atomic<int> total_attempts(0);
@@ -609,6 +2004,520 @@ TEST_F(DataStoreThreadTest, ConcurrentRangeOperations) {
     EXPECT_GE(successful_ops, 8);
 }
 
+class ScriptTest : public ::testing::Test {
+protected:
+    DataStore store;
+    ScriptEngine scripts{store};
+
+    static ScriptValue run(const std::string &source, const std::vector<std::string> &argv = {}) {
+        return Script::compile(source)->run({"k"}, argv, [](const ScriptValue *, size_t) { return ScriptValue(); });
+    }
+};
+
+TEST_F(ScriptTest, LanguageBasics) {
+    EXPECT_EQ(run("return 1 + 2 * 3 - 4 % 3").int_, 6);
+    EXPECT_DOUBLE_EQ(run("return 7 / 2").float_, 3.5);
+    EXPECT_EQ(run("return -7 % 3").int_, 2);
+    EXPECT_EQ(run("return 'a' .. 1 .. KEYS[1] .. #ARGV", {"x", "y"}).str_, "a1k2");
+    EXPECT_EQ(run("return ARGV[1] + ARGV[2]", {"40", "2"}).int_, 42);
+    EXPECT_EQ(run("return ARGV[3]", {"a"}).type_, ScriptValue::Nil);
+    EXPECT_EQ(run("local s = 0 local i = 1 while true do if i > 10 then break end s = s + i i = i + 1 end return s").int_,
+              55);
+    EXPECT_EQ(run("local x = 5 if x < 3 then return 'low' elseif x < 7 then return 'mid' else return 'high' end").str_,
+              "mid");
+    EXPECT_EQ(run("local x = 1 if true then local x = 2 end return x").int_, 1);
+    EXPECT_EQ(run("return nil or false or 'x'").str_, "x");
+    EXPECT_FALSE(run("return 1 and nil").truthy());
+    EXPECT_TRUE(run("return not nil and 1 == 1.0 and 'a' < 'b' and 2 ~= '2'").truthy());
+    EXPECT_EQ(run("return tonumber('12') + 1").int_, 13);
+    EXPECT_EQ(run("return tostring(nil) .. tostring(true)").str_, "niltrue");
+    EXPECT_EQ(run("-- comment\nreturn").type_, ScriptValue::Nil);
+}
+
+TEST_F(ScriptTest, CompileAndRuntimeErrors) {
+    for (const auto &source: {"return x", "if true then", "local = 1", "foo()", "x = 1", "break", "return 1 +",
+                              "return 'open", "return 1.2.3", "call()"}) {
+        EXPECT_THROW(Script::compile(source), ScriptError) << source;
+    }
+    EXPECT_THROW(run("return 1 + 'a'"), ScriptError);
+    EXPECT_THROW(run("return 1 < 'a'"), ScriptError);
+    EXPECT_THROW(run("return 'a' .. nil"), ScriptError);
+    EXPECT_THROW(run("return 9223372036854775807 + 1"), ScriptError);
+    EXPECT_THROW(run("return 1 % 0"), ScriptError);
+    EXPECT_THROW(run("while true do end"), ScriptError);
+
+    // deep nesting fails to compile instead of exhausting the stack
+    auto repeat = [](const std::string &text, size_t times) {
+        std::string out;
+        for (size_t i = 0; i < times; ++i) {
+            out += text;
+        }
+        return out;
+    };
+    for (const auto &source: {"return " + repeat("(", 100000) + "1" + repeat(")", 100000),
+                              "return " + repeat("not ", 100000) + "true", "return " + repeat("- ", 100000) + "1",
+                              "return " + repeat("'a' .. ", 100000) + "'b'",
+                              repeat("if true then ", 100000) + repeat(" end", 100000)}) {
+        EXPECT_THROW(Script::compile(source), ScriptError);
+    }
+    EXPECT_NO_THROW(Script::compile("return " + repeat("(", 50) + "1" + repeat(")", 50)));
+}
+
+TEST_F(ScriptTest, ReadModifyWriteInOneCall) {
+    // the score is only set once, and the counter only moves when it was
+    const std::string source = "local s = call('ZSCORE', KEYS[1], ARGV[1]) "
+                               "if s then return s end "
+                               "call('ZADD', KEYS[1], ARGV[2], ARGV[1]) "
+                               "return call('INCR', KEYS[2])";
+    EXPECT_EQ(scripts.eval(source, {"board", "added"}, {"alice", "10"}).int_, 1);
+    EXPECT_EQ(scripts.eval(source, {"board", "added"}, {"bob", "2.5"}).int_, 2);
+    auto score = scripts.eval(source, {"board", "added"}, {"alice", "99"});
+    EXPECT_EQ(score.type_, ScriptValue::Float);
+    EXPECT_DOUBLE_EQ(score.float_, 10);
+    EXPECT_EQ(store.zscore("board", "bob"), 2.5);
+    EXPECT_EQ(store.string_get("added"), "2");
+
+    EXPECT_EQ(scripts.eval("call('HSET', KEYS[1], 'f', 1, 'g', 2) return call('HINCRBY', KEYS[1], 'g', 40)",
+                           {"h"}, {}).int_, 42);
+    EXPECT_EQ(scripts.eval("call('RPUSH', KEYS[1], 'a') return call('LMOVE', KEYS[1], KEYS[2], 'LEFT', 'RIGHT')",
+                           {"from", "to"}, {}).str_, "a");
+    EXPECT_EQ(store.llen("to"), 1u);
+}
+
+TEST_F(ScriptTest, FloatsRenderToTheShortestRoundTrip) {
+    EXPECT_EQ(run("return tostring(5 / 2)").str_, "2.5");
+    EXPECT_EQ(run("return tostring(0.0000001)").str_, "1e-07");
+    EXPECT_EQ(run("return 0.1 .. ''").str_, "0.1");
+    EXPECT_EQ(std::stod(run("return tostring(1 / 3)").str_), 1.0 / 3);
+
+    // the score call() passes on is the double the script computed
+    scripts.eval("call('ZADD', KEYS[1], 1 / 3, 'm')", {"z"}, {});
+    EXPECT_EQ(store.zscore("z", "m"), 1.0 / 3);
+}
+
+TEST_F(ScriptTest, EvalShaUsesTheCache) {
+    auto sha = scripts.load("return 1");
+    EXPECT_EQ(sha, "e0e1f9fabfc9d4800c877a703b823ac0578ff8db");
+    EXPECT_TRUE(scripts.exists(sha));
+    auto result = scripts.evalsha(sha, {}, {});
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->int_, 1);
+
+    // EVAL caches what it compiles too
+    scripts.eval("return ARGV[1]", {}, {"x"});
+    EXPECT_EQ(scripts.evalsha(scripts.load("return ARGV[1]"), {}, {"y"})->str_, "y");
+
+    scripts.flush();
+    EXPECT_FALSE(scripts.exists(sha));
+    EXPECT_FALSE(scripts.evalsha(sha, {}, {}).has_value());
+    EXPECT_THROW(scripts.load("return +"), ScriptError);
+}
+
+TEST_F(ScriptTest, CallsAreCheckedAndFailuresKeepEarlierWrites) {
+    EXPECT_THROW(scripts.eval("return call('GET', 'other')", {"mine"}, {}), ScriptError);
+    EXPECT_THROW(scripts.eval("return call('GET', KEYS[1], 'extra')", {"mine"}, {}), ScriptError);
+    EXPECT_THROW(scripts.eval("return call('NOPE', KEYS[1])", {"mine"}, {}), ScriptError);
+    EXPECT_THROW(scripts.eval("return call('SET', KEYS[1], nil)", {"mine"}, {}), ScriptError);
+    EXPECT_THROW(scripts.eval("call('SET', KEYS[1], 'text') return call('INCR', KEYS[1])", {"mine"}, {}),
+                 ScriptError);
+    EXPECT_EQ(store.string_get("mine"), "text");
+
+    // a blocked client woken by a failing script is still served
+    std::optional<std::pair<std::string, std::string>> served;
+    store.blpop({"queue"}, std::chrono::milliseconds(0), [&](auto result) { served = result; });
+    EXPECT_THROW(scripts.eval("call('RPUSH', KEYS[1], 'job') return 1 + nil", {"queue"}, {}), ScriptError);
+    ASSERT_TRUE(served.has_value());
+    EXPECT_EQ(served->second, "job");
+}
+
+TEST_F(ScriptTest, ScriptsRunAtomically) {
+    constexpr int kThreads = 4;
+    constexpr int kRuns = 500;
+    // GET then SET would lose updates if another client could run in between
+    auto sha = scripts.load("local n = call('GET', KEYS[1]) or 0 call('SET', KEYS[1], n + 1) return n + 1");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < kRuns; ++i) {
+                scripts.evalsha(sha, {"count"}, {});
+            }
+        });
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    EXPECT_EQ(store.string_get("count"), std::to_string(kThreads * kRuns));
+}
+
+class GlobTrieTest : public ::testing::Test {
+protected:
+    GlobTrie trie;
+
+    std::set<std::string> match(const std::string &str) {
+        std::vector<const std::string *> matched;
+        trie.match(str, matched);
+        std::set<std::string> result;
+        for (auto pattern : matched) {
+            result.insert(*pattern);
+        }
+        return result;
+    }
+};
+
+TEST_F(GlobTrieTest, MatchesAllPatternKinds) {
+    trie.insert("news.*");
+    trie.insert("news.sp?rts");
+    trie.insert("news.[a-c]*");
+    trie.insert("news.[^a-c]*");
+    trie.insert("*.weather");
+    trie.insert("exact");
+    trie.insert("star\\*");
+
+    EXPECT_EQ(match("news.sports"), (std::set<std::string>{"news.*", "news.sp?rts", "news.[^a-c]*"}));
+    EXPECT_EQ(match("news.art"), (std::set<std::string>{"news.*", "news.[a-c]*"}));
+    EXPECT_EQ(match("news.weather"), (std::set<std::string>{"news.*", "news.[^a-c]*", "*.weather"}));
+    EXPECT_EQ(match("exact"), (std::set<std::string>{"exact"}));
+    EXPECT_EQ(match("star*"), (std::set<std::string>{"star\\*"}));
+    EXPECT_TRUE(match("starx").empty());
+    EXPECT_TRUE(match("exactly").empty());
+}
+
+TEST_F(GlobTrieTest, Erase) {
+    EXPECT_TRUE(trie.insert("a*"));
+    EXPECT_FALSE(trie.insert("a*"));
+    EXPECT_TRUE(trie.insert("a*b"));
+    EXPECT_EQ(trie.size(), 2);
+
+    EXPECT_TRUE(trie.erase("a*"));
+    EXPECT_FALSE(trie.erase("a*"));
+    EXPECT_EQ(match("axb"), (std::set<std::string>{"a*b"}));
+    EXPECT_TRUE(match("ax").empty());
+
+    EXPECT_TRUE(trie.erase("a*b"));
+    EXPECT_TRUE(trie.empty());
+}
+
+class RecordingSubscriber : public Subscriber {
+public:
+    std::vector<std::shared_ptr<const std::string>> messages;
+
+    void deliver(const std::shared_ptr<const std::string> &message) override {
+        messages.push_back(message);
+    }
+};
+
+TEST(GlobTest, MatchesAllPatternKinds) {
+    EXPECT_TRUE(Glob::match("user:*:session", "user:42:session"));
+    EXPECT_TRUE(Glob::match("user:*:session", "user::session"));
+    EXPECT_FALSE(Glob::match("user:*:session", "user:42:sessions"));
+    EXPECT_TRUE(Glob::match("*", ""));
+    EXPECT_TRUE(Glob::match("a*b*c", "axxbyybzc"));
+    EXPECT_FALSE(Glob::match("a*b*c", "axxbyyb"));
+    EXPECT_TRUE(Glob::match("h?llo", "hello"));
+    EXPECT_FALSE(Glob::match("h?llo", "hllo"));
+    EXPECT_TRUE(Glob::match("h[ae]llo", "hallo"));
+    EXPECT_FALSE(Glob::match("h[ae]llo", "hillo"));
+    EXPECT_TRUE(Glob::match("h[^e]llo", "hallo"));
+    EXPECT_FALSE(Glob::match("h[^e]llo", "hello"));
+    EXPECT_TRUE(Glob::match("h[a-c]llo", "hbllo"));
+    EXPECT_TRUE(Glob::match("a\\*b", "a*b"));
+    EXPECT_FALSE(Glob::match("a\\*b", "axb"));
+    EXPECT_FALSE(Glob::match("a[bc", "ab"));
+    EXPECT_TRUE(Glob::match("[c-a]", "b"));
+    EXPECT_TRUE(Glob::match("", ""));
+    EXPECT_FALSE(Glob::match("", "a"));
+}
+
+TEST(GlobTest, FindsNeedlesAtEveryOffset) {
+    std::string text(100, 'a');
+    // decoys share the needle's first and last bytes
+    for (size_t i = 0; i + 3 <= text.size(); i += 7) {
+        text.replace(i, 3, "xaz");
+    }
+    EXPECT_EQ(Glob::find(text, "xyz"), std::string_view::npos);
+    for (size_t at = 0; at + 3 <= text.size(); ++at) {
+        std::string haystack = text;
+        haystack.replace(at, 3, "xyz");
+        EXPECT_EQ(Glob::find(haystack, "xyz"), at);
+        EXPECT_EQ(Glob::find(haystack, "y"), at + 1);
+    }
+    EXPECT_EQ(Glob::find("short", "longer needle"), std::string_view::npos);
+    EXPECT_EQ(Glob::find("abc", ""), 0u);
+}
+
+TEST(GlobTest, CompiledPlansAgreeWithTrie) {
+    // random patterns over a small alphabet reach every plan, and the trie is an independent matcher
+    const std::string atoms[] = {"a", "b", "ab", "*", "?", "[ab]", "[^a]", "\\*"};
+    std::mt19937 rng(7);
+    for (int round = 0; round < 2000; ++round) {
+        std::string pattern;
+        for (size_t n = rng() % 6; n > 0; --n) {
+            pattern += atoms[rng() % std::size(atoms)];
+        }
+        GlobTrie trie;
+        trie.insert(pattern);
+        Glob glob(pattern);
+        for (int t = 0; t < 20; ++t) {
+            std::string text;
+            for (size_t n = rng() % 40; n > 0; --n) {
+                text += "ab*"[rng() % 3];
+            }
+            std::vector<const std::string *> matched;
+            trie.match(text, matched);
+            EXPECT_EQ(glob.matches(text), !matched.empty()) << pattern << " on " << text;
+        }
+    }
+}
+
+TEST(PubSubTest, PublishSharesOneBuffer) {
+    PubSub pubsub;
+    std::vector<std::shared_ptr<RecordingSubscriber>> subscribers;
+    for (int i = 0; i < 100; ++i) {
+        subscribers.push_back(std::make_shared<RecordingSubscriber>());
+        EXPECT_TRUE(pubsub.subscribe(subscribers.back(), "chan"));
+    }
+    EXPECT_FALSE(pubsub.subscribe(subscribers[0], "chan"));
+
+    EXPECT_EQ(pubsub.publish("chan", "hello world"), 100);
+    EXPECT_EQ(pubsub.publish("other", "ignored"), 0);
+
+    for (const auto &subscriber : subscribers) {
+        ASSERT_EQ(subscriber->messages.size(), 1);
+        EXPECT_EQ(subscriber->messages[0].get(), subscribers[0]->messages[0].get());
+    }
+    EXPECT_EQ(*subscribers[0]->messages[0], "message chan hello world\n");
+
+    EXPECT_TRUE(pubsub.unsubscribe(subscribers[0].get(), "chan"));
+    EXPECT_FALSE(pubsub.unsubscribe(subscribers[0].get(), "chan"));
+    EXPECT_EQ(pubsub.numsub("chan"), 99);
+}
+
+TEST(PubSubTest, PatternSubscriptions) {
+    PubSub pubsub;
+    auto subscriber = std::make_shared<RecordingSubscriber>();
+    pubsub.psubscribe(subscriber, "user:*");
+    pubsub.subscribe(subscriber, "user:1");
+
+    EXPECT_EQ(pubsub.publish("user:1", "x"), 2);
+    ASSERT_EQ(subscriber->messages.size(), 2);
+    EXPECT_EQ(*subscriber->messages[0], "message user:1 x\n");
+    EXPECT_EQ(*subscriber->messages[1], "pmessage user:* user:1 x\n");
+
+    EXPECT_TRUE(pubsub.punsubscribe(subscriber.get(), "user:*"));
+    EXPECT_EQ(pubsub.numpat(), 0);
+    EXPECT_EQ(pubsub.publish("user:2", "y"), 0);
+}
+
+TEST(ClientTrackingTest, DefaultModeIsToldOnceBroadcastByPrefix) {
+    ClientTracking tracking;
+    auto reader = std::make_shared<RecordingSubscriber>();
+    auto users = std::make_shared<RecordingSubscriber>();
+    auto idle = std::make_shared<RecordingSubscriber>();
+    auto reader_id = tracking.enable(reader, false, {});
+    tracking.enable(users, true, {"user:"});
+    tracking.enable(idle, false, {});
+
+    tracking.track(reader_id, {"user:1", "page"});
+    tracking.track(reader_id, {"page"});
+    EXPECT_EQ(tracking.tracked_keys(), 2);
+
+    tracking.invalidate({"page", "user:1", "user:2", "user:1"});
+    ASSERT_EQ(reader->messages.size(), 1);
+    EXPECT_EQ(*reader->messages[0], "invalidate 2 page user:1\n");
+    ASSERT_EQ(users->messages.size(), 1);
+    EXPECT_EQ(*users->messages[0], "invalidate 2 user:1 user:2\n");
+    EXPECT_TRUE(idle->messages.empty());
+    EXPECT_EQ(tracking.tracked_keys(), 0);
+
+    // told once: the key has to be read again before the next write is reported
+    tracking.invalidate({"page"});
+    EXPECT_EQ(reader->messages.size(), 1);
+
+    tracking.track(reader_id, {"page"});
+    tracking.disable(reader_id);
+    tracking.invalidate({"page"});
+    EXPECT_EQ(reader->messages.size(), 1);
+
+    tracking.invalidate_all();
+    EXPECT_EQ(*users->messages.back(), "invalidate 0\n");
+    EXPECT_EQ(*idle->messages.back(), "invalidate 0\n");
+    EXPECT_EQ(tracking.clients(), 2);
+}
+
+TEST_F(DataStoreTest, SintercardKeysStopAtNumkeys) {
+    std::vector<std::string> args = {"SINTERCARD", "2", "a", "b", "LIMIT", "1"};
+    std::vector<std::string> keys;
+    CommandKeys::keys(args, *CommandKeys::spec("SINTERCARD"), keys);
+    EXPECT_EQ(keys, (std::vector<std::string>{"a", "b"}));
+
+    std::vector<std::string> none;
+    CommandKeys::keys({"SINTERCARD", "x", "a"}, *CommandKeys::spec("SINTERCARD"), none);
+    CommandKeys::keys({"SINTERCARD"}, *CommandKeys::spec("SINTERCARD"), none);
+    EXPECT_TRUE(none.empty());
+    CommandKeys::keys({"SINTERCARD", "5", "a"}, *CommandKeys::spec("SINTERCARD"), none);
+    EXPECT_EQ(none, std::vector<std::string>{"a"});
+
+    store.sadd("a", "1");
+    store.sadd("a", "2");
+    store.sadd("b", "1");
+    store.sadd("b", "2");
+    size_t count = 0;
+    EXPECT_TRUE(store.exec(keys, false, {}, [&] { count = store.sintercard(keys, 1); }));
+    EXPECT_EQ(count, 1u);
+
+    // neither LIMIT nor its count is remembered as a read key
+    ClientTracking tracking;
+    auto reader = std::make_shared<RecordingSubscriber>();
+    auto id = tracking.enable(reader, false, {});
+    tracking.track(id, keys);
+    tracking.invalidate({"LIMIT", "1"});
+    EXPECT_TRUE(reader->messages.empty());
+    tracking.invalidate({"b"});
+    ASSERT_EQ(reader->messages.size(), 1);
+    EXPECT_EQ(*reader->messages[0], "invalidate 1 b\n");
+}
+
+TEST_F(DataStoreTest, WriteListenerSeesWritesAfterRelease) {
+    std::vector<std::string> written;
+    bool flushed = false;
+    std::optional<std::string> seen;
+    store.set_write_listener([&](std::vector<std::string> keys, bool all) {
+        // called once the locks are released, so the new value is already there
+        seen = store.string_get("a");
+        written.insert(written.end(), keys.begin(), keys.end());
+        flushed |= all;
+    });
+
+    store.string_set("a", "0");
+    EXPECT_TRUE(written.empty());
+
+    store.report_writes(true);
+    store.string_set("a", "1");
+    EXPECT_EQ(seen, "1");
+    EXPECT_EQ(written, std::vector<std::string>{"a"});
+    store.string_get("a");
+    store.hset("h", {{"f", "v"}});
+    store.lpush("l", "x");
+    store.zadd("z", 1, "m");
+    EXPECT_EQ(written, (std::vector<std::string>{"a", "h", "l", "z"}));
+
+    // a batch reports its keys together once EXEC lets go of them
+    written.clear();
+    size_t calls = 0;
+    store.set_write_listener([&](std::vector<std::string> keys, bool) {
+        ++calls;
+        written.insert(written.end(), keys.begin(), keys.end());
+    });
+    store.exec({"a", "b"}, false, {}, [&] {
+        store.string_set("a", "2");
+        store.string_set("b", "2");
+        EXPECT_EQ(calls, 0);
+    });
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(written, (std::vector<std::string>{"a", "b"}));
+
+    store.set_write_listener([&](std::vector<std::string>, bool all) { flushed |= all; });
+    store.flushall(false);
+    EXPECT_TRUE(flushed);
+
+    store.report_writes(false);
+    flushed = false;
+    store.flushall(false);
+    EXPECT_FALSE(flushed);
+}
+
+// feeds lines to a framer until it reports the reply complete, and returns how many it took
+static size_t frame(Reply::Shape shape, const std::vector<std::string> &lines, Reply &reply) {
+    ReplyFramer framer(shape);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (framer.feed(lines[i], reply)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+TEST(ReplyFramerTest, FramesEveryShape) {
+    Reply line;
+    EXPECT_EQ(frame(Reply::Shape::Line, {"OK", "next"}, line), 1);
+    EXPECT_EQ(line.first_, "OK");
+
+    Reply counted;
+    EXPECT_EQ(frame(Reply::Shape::Counted, {"2", "a", "(nil)", "next"}, counted), 3);
+    EXPECT_EQ(counted.items_, (std::vector<std::string>{"a", "(nil)"}));
+
+    Reply empty;
+    EXPECT_EQ(frame(Reply::Shape::Counted, {"0", "next"}, empty), 1);
+    EXPECT_TRUE(empty.items_.empty());
+
+    Reply cursor;
+    EXPECT_EQ(frame(Reply::Shape::Cursor, {"17", "1", "key", "next"}, cursor), 3);
+    EXPECT_EQ(cursor.first_, "17");
+    EXPECT_EQ(cursor.items_, std::vector<std::string>{"key"});
+
+    // ZQUERY ends with a blank line, which is not an item
+    Reply query;
+    EXPECT_EQ(frame(Reply::Shape::Query, {"1", "a 1.5", "", "next"}, query), 3);
+    EXPECT_EQ(query.items_, std::vector<std::string>{"a 1.5"});
+    Reply none;
+    EXPECT_EQ(frame(Reply::Shape::Query, {"0", "", "next"}, none), 2);
+    EXPECT_TRUE(none.items_.empty());
+}
+
+TEST(ReplyFramerTest, ErrorsAreOneLineWhateverTheShape) {
+    for (auto shape: {Reply::Shape::Line, Reply::Shape::Counted, Reply::Shape::Cursor, Reply::Shape::Query}) {
+        Reply reply;
+        EXPECT_EQ(frame(shape, {"error: MGET requires at least one key", "next"}, reply), 1);
+        ASSERT_TRUE(reply.error_);
+        EXPECT_EQ(*reply.error_, "error: MGET requires at least one key");
+        EXPECT_FALSE(reply.lost_);
+
+        Reply unknown;
+        EXPECT_EQ(frame(shape, {"unknown command"}, unknown), 1);
+        EXPECT_TRUE(unknown.error_);
+    }
+
+    // a count that is not a number means the replies are out of step
+    Reply reply;
+    ReplyFramer framer(Reply::Shape::Counted);
+    EXPECT_THROW(framer.feed("OK", reply), std::runtime_error);
+}
+
+TEST(NearCacheTest, InvalidationDropsEveryEntryOfTheKey) {
+    NearCache cache(1000);
+    EXPECT_FALSE(cache.get("k", ""));
+    cache.put("k", "", "v");
+    cache.put("h", "hf", "1");
+    cache.put("h", "hg", std::nullopt);
+    EXPECT_EQ(cache.get("k", ""), std::optional<std::string>("v"));
+    auto nil = cache.get("h", "hg");
+    ASSERT_TRUE(nil);
+    EXPECT_FALSE(*nil);
+    EXPECT_EQ(cache.size(), 3);
+
+    cache.invalidate("h");
+    EXPECT_FALSE(cache.get("h", "hf"));
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(cache.hits_and_misses(), std::make_pair(size_t(2), size_t(2)));
+
+    // broadcast mode: keys outside the prefixes would never be invalidated, so they are not kept
+    NearCache prefixed(1000, {"user:"});
+    prefixed.put("user:1", "", "a");
+    prefixed.put("page:1", "", "b");
+    EXPECT_TRUE(prefixed.get("user:1", ""));
+    EXPECT_FALSE(prefixed.get("page:1", ""));
+
+    // each stripe keeps its share of the capacity
+    NearCache small(16);
+    for (int i = 0; i < 1000; ++i) {
+        small.put("key:" + std::to_string(i), "", "v");
+    }
+    EXPECT_LE(small.size(), 16);
+    small.disable();
+    small.put("key:0", "", "v");
+    EXPECT_EQ(small.size(), 0);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();